@@ -0,0 +1,471 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#include "BusCapture.h"
+#include "../System/lowlev.h"
+#include "../System/lowlib.h"
+#include "../System/ee_sprintf.h"
+#include "../System/logging.h"
+#include "../System/rdutils.h"
+#include "../System/nmalloc.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Variables
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Module name
+static const char FromBusCapture[] = "BusCapture";
+
+// Sockets
+int BusCapture::_busSocketId = -1;
+int BusCapture::_commsSocketId = -1;
+
+// Main comms socket - to wire up command handler
+CommsSocketInfo BusCapture::_commsSocketInfo =
+{
+    true,
+    BusCapture::handleRxMsg,
+    NULL,
+    NULL
+};
+
+// Bus socket - waits on all memory and IO cycles while capturing
+BusSocketInfo BusCapture::_busSocketInfo =
+{
+    false,
+    BusCapture::handleWaitInterruptStatic,
+    NULL,
+    true,
+    true,
+    // Reset
+    false,
+    0,
+    // NMI
+    false,
+    0,
+    // IRQ
+    false,
+    0,
+    false,
+    BR_BUS_ACTION_GENERAL,
+    false,
+    // Bus cycles
+    BR_BUS_CYCLE_ALL_MASK
+};
+
+// Capture buffer and the store in it
+uint8_t* BusCapture::_pCaptureBuf = NULL;
+BusCaptureStore BusCapture::_store;
+
+// Compact encoder for readout
+BusCaptureEncoder BusCapture::_encoder;
+
+// Capture state
+volatile BusCapture::CAPTURE_STATE BusCapture::_state = CAPTURE_STATE_IDLE;
+volatile uint32_t BusCapture::_triggerIdx = 0;
+volatile uint32_t BusCapture::_postRemaining = 0;
+volatile uint32_t BusCapture::_cyclesAtTrigger = 0;
+volatile uint32_t BusCapture::_firstKeptIdx = 0;
+volatile bool BusCapture::_triggered = false;
+
+// Trigger
+BusCaptureTriggerType BusCapture::_triggerType = BUS_CAPTURE_TRIGGER_NONE;
+uint32_t BusCapture::_triggerValue = 0;
+uint32_t BusCapture::_triggerMask = 0xffff;
+uint32_t BusCapture::_preTrigger = 0;
+uint32_t BusCapture::_postTrigger = 0;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Init
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BusCapture::init()
+{
+    // Capture buffer - from the heap directly as new is assumed never to fail so its result can't be checked
+    if (!_pCaptureBuf)
+    {
+        _pCaptureBuf = (uint8_t*)nmalloc_malloc(CAPTURE_BUF_LEN);
+        _store.init(_pCaptureBuf, _pCaptureBuf ? CAPTURE_BUF_LEN : 0);
+        if (!_pCaptureBuf)
+            LogWrite(FromBusCapture, LOG_WARNING, "Can't allocate capture buffer - capture disabled");
+    }
+
+    // Connect to the bus socket (added disabled - only enabled while capturing)
+    if (_busSocketId < 0)
+        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo, "BusCapture");
+
+    // Connect to the comms socket
+    if (_commsSocketId < 0)
+        _commsSocketId = CommandHandler::commsSocketAdd(_commsSocketInfo);
+}
+
+void BusCapture::service()
+{
+    // Stop waiting on bus cycles once capture is complete - this isn't done in the wait handler
+    // as it changes the bus cycle dispatch lists
+    if ((_state == CAPTURE_STATE_COMPLETE) && BusAccess::busSocketIsEnabled(_busSocketId))
+    {
+        BusAccess::busSocketEnable(_busSocketId, false);
+        LogWrite(FromBusCapture, LOG_DEBUG, "Capture complete len %u", getCaptureLen());
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Control
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool BusCapture::arm(BusCaptureTriggerType triggerType, uint32_t triggerValue, uint32_t triggerMask,
+            uint32_t preTrigger, uint32_t postTrigger, uint8_t tsShift)
+{
+    // The socket is never enabled without a buffer
+    if (!_pCaptureBuf || (_store.getNumBlocks() == 0) || (_busSocketId < 0))
+        return false;
+
+    // Stop any existing capture
+    BusAccess::busSocketEnable(_busSocketId, false);
+    _state = CAPTURE_STATE_IDLE;
+
+    // Setup - how many cycles fit depends on how well they compress so the post trigger cycles are
+    // kept until the buffer is full (older cycles than the pre trigger ones are dropped to make space)
+    _triggerType = triggerType;
+    _triggerValue = triggerValue;
+    _triggerMask = triggerMask;
+    _preTrigger = preTrigger;
+    _postTrigger = postTrigger;
+    _triggerIdx = 0;
+    _postRemaining = 0;
+    _cyclesAtTrigger = 0;
+    _firstKeptIdx = 0;
+    _triggered = false;
+    _store.start(tsShift, lowlev_cycleCounterRead());
+
+    // Start
+    _state = CAPTURE_STATE_ARMED;
+    BusAccess::busSocketEnable(_busSocketId, true);
+    LogWrite(FromBusCapture, LOG_DEBUG, "Armed trigger %d value %04x mask %04x pre %u post %u tsShift %u",
+                triggerType, triggerValue, triggerMask, preTrigger, postTrigger, tsShift);
+    return true;
+}
+
+void BusCapture::stop()
+{
+    if (_busSocketId >= 0)
+        BusAccess::busSocketEnable(_busSocketId, false);
+    if (_state != CAPTURE_STATE_COMPLETE)
+        _state = CAPTURE_STATE_IDLE;
+
+    // Complete the block being written so all the records can be read
+    _store.finish();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Wait interrupt handler
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BusCapture::handleWaitInterruptStatic(uint32_t addr, uint32_t data,
+        uint32_t flags, uint32_t& retVal)
+{
+    // Check capturing
+    if ((_state != CAPTURE_STATE_ARMED) && (_state != CAPTURE_STATE_TRIGGERED))
+        return;
+
+    // Data is the value written or, for reads, the value returned by another socket if there is one
+    // (this socket is added after the others so their callbacks have been made)
+    uint32_t busData = data;
+    if (((flags & BR_CTRL_BUS_WR_MASK) == 0) && ((retVal & BR_MEM_ACCESS_RSLT_NOT_DECODED) == 0))
+        busData = retVal;
+
+    // Record - the store is only full once the cycles kept for the trigger would be dropped
+    BusCaptureRecord rec;
+    rec.cycles = lowlev_cycleCounterRead();
+    rec.addr = addr;
+    rec.data = busData;
+    rec.flags = flags;
+    if (!_store.add(rec))
+    {
+        _state = CAPTURE_STATE_COMPLETE;
+        return;
+    }
+
+    // Check trigger
+    if (_state == CAPTURE_STATE_ARMED)
+    {
+        if (!triggerMatch(addr, busData, flags))
+            return;
+        _triggered = true;
+        _triggerIdx = _store.getNumAdded() - 1;
+        _cyclesAtTrigger = rec.cycles;
+
+        // Keep the pre trigger cycles
+        uint32_t firstIdx = _store.getFirstIdx();
+        if (_preTrigger == PRE_TRIGGER_HALF_BUFFER)
+            firstIdx = _store.getFirstIdxOfNewest(_store.getNumBlocks() / 2);
+        else if (_triggerIdx - firstIdx > _preTrigger)
+            firstIdx = _triggerIdx - _preTrigger;
+        _firstKeptIdx = firstIdx;
+        _store.setKeepFrom(firstIdx);
+        _postRemaining = _postTrigger;
+        if (_postRemaining == 0)
+        {
+            _store.finish();
+            _state = CAPTURE_STATE_COMPLETE;
+        }
+        else
+        {
+            _state = CAPTURE_STATE_TRIGGERED;
+        }
+        return;
+    }
+
+    // Post trigger
+    _postRemaining = _postRemaining - 1;
+    if (_postRemaining == 0)
+    {
+        _store.finish();
+        _state = CAPTURE_STATE_COMPLETE;
+    }
+}
+
+bool BusCapture::triggerMatch(uint32_t addr, uint32_t data, uint32_t flags)
+{
+    switch(_triggerType)
+    {
+        case BUS_CAPTURE_TRIGGER_NONE:
+            return true;
+        case BUS_CAPTURE_TRIGGER_ADDR:
+            return (flags & BR_CTRL_BUS_MREQ_MASK) && ((addr & _triggerMask) == _triggerValue);
+        case BUS_CAPTURE_TRIGGER_IO_PORT:
+            return (flags & BR_CTRL_BUS_IORQ_MASK) && ((flags & BR_CTRL_BUS_M1_MASK) == 0) &&
+                        ((addr & 0xff & _triggerMask) == _triggerValue);
+        case BUS_CAPTURE_TRIGGER_DATA:
+            return ((data & 0xff & _triggerMask) == _triggerValue);
+        case BUS_CAPTURE_TRIGGER_M1_PC:
+            return (flags & BR_CTRL_BUS_M1_MASK) && (flags & BR_CTRL_BUS_MREQ_MASK) &&
+                        ((addr & _triggerMask) == _triggerValue);
+    }
+    return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Captured records
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Records are read from the store once their block is complete (which they all are when capture is
+// complete or stopped)
+uint32_t BusCapture::getFirstIdx()
+{
+    uint32_t firstIdx = _store.getFirstIdx();
+    if (_triggered && (_firstKeptIdx > firstIdx))
+        firstIdx = _firstKeptIdx;
+    return firstIdx;
+}
+
+uint32_t BusCapture::getCaptureLen()
+{
+    uint32_t firstIdx = getFirstIdx();
+    uint32_t endIdx = _store.getEndIdx();
+    return (endIdx > firstIdx) ? endIdx - firstIdx : 0;
+}
+
+uint32_t BusCapture::getRecords(uint32_t idx, BusCaptureRecord* pRecs, uint32_t maxRecs)
+{
+    uint32_t captureLen = getCaptureLen();
+    if (idx >= captureLen)
+        return 0;
+    if (maxRecs > captureLen - idx)
+        maxRecs = captureLen - idx;
+    return _store.getRecords(getFirstIdx() + idx, pRecs, maxRecs);
+}
+
+uint32_t BusCapture::sendBin(uint32_t startIdx)
+{
+    // Read records
+    static BusCaptureRecord records[MAX_CAPTURE_MSG_BUF_ELEMS];
+    static CaptureBinElemFormat binElems[MAX_CAPTURE_MSG_BUF_ELEMS];
+    uint32_t count = getRecords(startIdx, records, MAX_CAPTURE_MSG_BUF_ELEMS);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        binElems[i].cycles = records[i].cycles;
+        binElems[i].addr = records[i].addr;
+        binElems[i].data = records[i].data;
+        binElems[i].flags = records[i].flags;
+    }
+
+    // Form JSON message
+    static const int JSON_RESP_MAX_LEN = 200 + MAX_CAPTURE_MSG_BUF_ELEMS * sizeof(CaptureBinElemFormat);
+    static char jsonFrame[JSON_RESP_MAX_LEN];
+    uint32_t binDataLen = count * sizeof(CaptureBinElemFormat);
+    ee_sprintf(jsonFrame, "{\"cmdName\":\"captureGetBinData\",\"start\":%u,\"count\":%u,\"dataLen\":%u}",
+                startIdx, count, binDataLen);
+
+    // Copy binary to end of buffer
+    memcopyfast(jsonFrame+strlen(jsonFrame)+1, (uint8_t*)binElems, binDataLen);
+    CommandHandler::sendWithJSON("rdp", "", 0, (const uint8_t*)jsonFrame, strlen(jsonFrame)+1+binDataLen);
+    return count;
+}
+
+uint32_t BusCapture::sendBinCompact(uint32_t startIdx, uint8_t tsShift)
+{
+    // Timestamps are deltas from the record before the first one sent
+    BusCaptureRecord rec;
+    uint32_t startCycles = 0;
+    if (getRecords(startIdx > 0 ? startIdx - 1 : 0, &rec, 1) == 1)
+        startCycles = rec.cycles;
+
+    // Encode as many records as fit - they are read from the store in batches
+    static const int JSON_HEADER_MAX_LEN = 200;
+    static char jsonFrame[JSON_HEADER_MAX_LEN + MAX_CAPTURE_MSG_COMPACT_LEN];
+    static uint8_t encBuf[MAX_CAPTURE_MSG_COMPACT_LEN];
+    static BusCaptureRecord records[COMPACT_READ_BATCH_LEN];
+    _encoder.start(encBuf, MAX_CAPTURE_MSG_COMPACT_LEN, startIdx, startCycles, tsShift);
+    uint32_t count = 0;
+    bool encoderFull = false;
+    while (!encoderFull)
+    {
+        uint32_t numRead = getRecords(startIdx + count, records, COMPACT_READ_BATCH_LEN);
+        if (numRead == 0)
+            break;
+        for (uint32_t i = 0; (i < numRead) && !encoderFull; i++)
+        {
+            encoderFull = !_encoder.add(records[i]);
+            if (!encoderFull)
+                count++;
+        }
+    }
+    uint32_t binDataLen = _encoder.finish();
+
+    // Form JSON message
+    ee_sprintf(jsonFrame, "{\"cmdName\":\"captureGetBinData\",\"enc\":\"compact\",\"start\":%u,\"count\":%u,\"dataLen\":%u}",
+                startIdx, count, binDataLen);
+
+    // Copy binary to end of buffer
+    memcopyfast(jsonFrame+strlen(jsonFrame)+1, encBuf, binDataLen);
+    CommandHandler::sendWithJSON("rdp", "", 0, (const uint8_t*)jsonFrame, strlen(jsonFrame)+1+binDataLen);
+    return count;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Status
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BusCapture::getStatusJson(char* pBuf, int maxLen)
+{
+    static const char* stateNames[] = { "idle", "armed", "triggered", "complete" };
+    char tmpStr[200];
+    ee_sprintf(tmpStr, "\"err\":\"ok\",\"state\":\"%s\",\"trigger\":%d,\"value\":\"0x%04x\",\"mask\":\"0x%04x\"",
+                stateNames[_state], _triggerType, _triggerValue, _triggerMask);
+    strlcpy(pBuf, tmpStr, maxLen);
+    ee_sprintf(tmpStr, ",\"pre\":%d,\"post\":%d,\"cycles\":%u,\"len\":%u,\"triggerIdx\":%d,\"triggerCycles\":%u",
+                (int)_preTrigger, (int)_postTrigger, _store.getNumAdded(), getCaptureLen(),
+                _triggered ? (int)(_triggerIdx - getFirstIdx()) : -1, _cyclesAtTrigger);
+    strlcat(pBuf, tmpStr, maxLen);
+    ee_sprintf(tmpStr, ",\"bufLen\":%u,\"bufUsed\":%u,\"tsShift\":%d",
+                _store.getBufLen(), _store.getUsedLen(), _store.getTsShift());
+    strlcat(pBuf, tmpStr, maxLen);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Handle CommandInterface message
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool BusCapture::handleRxMsg(const char* pCmdJson, [[maybe_unused]]const uint8_t* pParams, [[maybe_unused]]int paramsLen,
+                char* pRespJson, int maxRespLen)
+{
+    // Get the command string from JSON
+    static const int MAX_CMD_NAME_STR = 100;
+    char cmdName[MAX_CMD_NAME_STR+1];
+    if (!jsonGetValueForKey("cmdName", pCmdJson, cmdName, MAX_CMD_NAME_STR))
+        return false;
+
+    if (strcasecmp(cmdName, "captureArm") == 0)
+    {
+        // Trigger type
+        char argStr[MAX_CMD_NAME_STR+1];
+        BusCaptureTriggerType triggerType = BUS_CAPTURE_TRIGGER_NONE;
+        uint32_t defaultMask = 0xffff;
+        if (jsonGetValueForKey("trigger", pCmdJson, argStr, MAX_CMD_NAME_STR))
+        {
+            if (strcasecmp(argStr, "addr") == 0)
+                triggerType = BUS_CAPTURE_TRIGGER_ADDR;
+            else if (strcasecmp(argStr, "io") == 0)
+                triggerType = BUS_CAPTURE_TRIGGER_IO_PORT;
+            else if (strcasecmp(argStr, "data") == 0)
+                triggerType = BUS_CAPTURE_TRIGGER_DATA;
+            else if (strcasecmp(argStr, "pc") == 0)
+                triggerType = BUS_CAPTURE_TRIGGER_M1_PC;
+        }
+        if ((triggerType == BUS_CAPTURE_TRIGGER_IO_PORT) || (triggerType == BUS_CAPTURE_TRIGGER_DATA))
+            defaultMask = 0xff;
+
+        // Values (decimal or 0x prefixed hex)
+        uint32_t triggerValue = 0;
+        if (jsonGetValueForKey("value", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            triggerValue = strtoul(argStr, NULL, 0);
+        uint32_t triggerMask = defaultMask;
+        if (jsonGetValueForKey("mask", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            triggerMask = strtoul(argStr, NULL, 0);
+        // Without a depth half the buffer is kept before the trigger and the rest filled after it
+        uint32_t preTrigger = PRE_TRIGGER_HALF_BUFFER;
+        if (jsonGetValueForKey("pre", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            preTrigger = strtoul(argStr, NULL, 0);
+        uint32_t postTrigger = 0xffffffff;
+        if (jsonGetValueForKey("post", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            postTrigger = strtoul(argStr, NULL, 0);
+
+        // Timestamps stored in the buffer - a bigger shift is coarser but compresses better
+        uint32_t tsShift = DEFAULT_COMPACT_TS_SHIFT;
+        if (jsonGetValueForKey("tsShift", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            tsShift = strtoul(argStr, NULL, 0);
+        if (tsShift > 31)
+            tsShift = BUS_CAPTURE_CODEC_NO_TIMESTAMPS;
+
+        // Arm
+        if (!arm(triggerType, triggerValue & triggerMask, triggerMask, preTrigger, postTrigger, tsShift))
+        {
+            strlcpy(pRespJson, "\"err\":\"fail\"", maxRespLen);
+            return true;
+        }
+        getStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "captureStop") == 0)
+    {
+        stop();
+        getStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "captureStatus") == 0)
+    {
+        getStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "captureGetBin") == 0)
+    {
+        // Check if we would be able to transmit without issues
+        if (CommandHandler::getTxAvailable() < MIN_TX_AVAILABLE_FOR_BIN_FRAME)
+        {
+            strlcpy(pRespJson, "\"err\":\"busy\"", maxRespLen);
+            return true;
+        }
+        char argStr[MAX_CMD_NAME_STR+1];
+        uint32_t startIdx = 0;
+        if (jsonGetValueForKey("start", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            startIdx = strtoul(argStr, NULL, 0);
+
+        // Encoding - compact gives several times more records per frame (timestamps default to the
+        // resolution they are stored at as they can't be any finer)
+        bool compact = false;
+        uint32_t tsShift = _store.getTsShift();
+        if (jsonGetValueForKey("enc", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            compact = (strcasecmp(argStr, "compact") == 0);
+        if (jsonGetValueForKey("tsShift", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            tsShift = strtoul(argStr, NULL, 0);
+        if (tsShift > 31)
+            tsShift = BUS_CAPTURE_CODEC_NO_TIMESTAMPS;
+        uint32_t count = compact ? sendBinCompact(startIdx, tsShift) : sendBin(startIdx);
+        ee_sprintf(pRespJson, "\"err\":\"ok\",\"start\":%u,\"count\":%u,\"len\":%u",
+                    startIdx, count, getCaptureLen());
+        return true;
+    }
+    return false;
+}
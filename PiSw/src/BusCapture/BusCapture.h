@@ -0,0 +1,135 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include "../TargetBus/BusAccess.h"
+#include "../CommandInterface/CommandHandler.h"
+#include "BusCaptureCodec.h"
+#include "BusCaptureStore.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Triggers
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Trigger types
+enum BusCaptureTriggerType
+{
+    // Trigger on the first cycle
+    BUS_CAPTURE_TRIGGER_NONE,
+    // Memory access at address
+    BUS_CAPTURE_TRIGGER_ADDR,
+    // IO access to port (low 8 bits of address)
+    BUS_CAPTURE_TRIGGER_IO_PORT,
+    // Data value read or written
+    BUS_CAPTURE_TRIGGER_DATA,
+    // Opcode fetch at PC
+    BUS_CAPTURE_TRIGGER_M1_PC
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Bus capture - records every bus cycle into a circular buffer (like a logic analyser) with a trigger
+// and pre/post trigger depth - the buffer holds the records compact encoded (see BusCaptureStore.h) so
+// the depth depends on how well the cycles compress
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BusCapture
+{
+public:
+    // Init
+    static void init();
+    static void service();
+
+    // Arm capture - up to preTrigger cycles before the trigger and postTrigger cycles after it are kept
+    // (PRE_TRIGGER_HALF_BUFFER keeps the cycles in the newest half of the buffer when triggered and a
+    // postTrigger of 0xffffffff fills the buffer) and timestamps are stored >> tsShift
+    // (BUS_CAPTURE_CODEC_NO_TIMESTAMPS for none)
+    static const uint32_t PRE_TRIGGER_HALF_BUFFER = 0xffffffff;
+    static bool arm(BusCaptureTriggerType triggerType, uint32_t triggerValue, uint32_t triggerMask,
+                uint32_t preTrigger, uint32_t postTrigger, uint8_t tsShift);
+    static void stop();
+
+    // Captured records - idx is from the oldest kept record
+    static uint32_t getCaptureLen();
+    static uint32_t getRecords(uint32_t idx, BusCaptureRecord* pRecs, uint32_t maxRecs);
+
+    // Status
+    static void getStatusJson(char* pBuf, int maxLen);
+
+private:
+    // Bus socket we're attached to
+    static int _busSocketId;
+    static BusSocketInfo _busSocketInfo;
+
+    // Comms socket we're attached to
+    static int _commsSocketId;
+    static CommsSocketInfo _commsSocketInfo;
+
+    // Handle messages
+    static bool handleRxMsg(const char* pCmdJson, const uint8_t* pParams, int paramsLen,
+                    char* pRespJson, int maxRespLen);
+
+    // Wait interrupt handler
+    static void handleWaitInterruptStatic(uint32_t addr, uint32_t data,
+            uint32_t flags, uint32_t& retVal);
+
+    // Trigger
+    static bool triggerMatch(uint32_t addr, uint32_t data, uint32_t flags);
+
+    // Send captured records in binary - raw 8 byte records or compact encoded (see BusCaptureCodec.h)
+    static uint32_t sendBin(uint32_t startIdx);
+    static uint32_t sendBinCompact(uint32_t startIdx, uint8_t tsShift);
+
+    // Capture buffer (allocated on init) and the store in it
+    static const uint32_t CAPTURE_BUF_LEN = 256 * BusCaptureStore::BLOCK_LEN;
+    static uint8_t* _pCaptureBuf;
+    static BusCaptureStore _store;
+
+    // Capture state
+    enum CAPTURE_STATE
+    {
+        CAPTURE_STATE_IDLE,
+        CAPTURE_STATE_ARMED,
+        CAPTURE_STATE_TRIGGERED,
+        CAPTURE_STATE_COMPLETE
+    };
+    static volatile CAPTURE_STATE _state;
+    static volatile uint32_t _triggerIdx;
+    static volatile uint32_t _postRemaining;
+    static volatile uint32_t _cyclesAtTrigger;
+    static volatile uint32_t _firstKeptIdx;
+    static volatile bool _triggered;
+
+    // First record of the capture in the store
+    static uint32_t getFirstIdx();
+
+    // Trigger
+    static BusCaptureTriggerType _triggerType;
+    static uint32_t _triggerValue;
+    static uint32_t _triggerMask;
+    static uint32_t _preTrigger;
+    static uint32_t _postTrigger;
+
+    // Binary transfer
+    #pragma pack(push, 1)
+    struct CaptureBinElemFormat
+    {
+        uint32_t cycles;
+        uint16_t addr;
+        uint8_t data;
+        uint8_t flags;
+    };
+    #pragma pack(pop)
+    static const int MAX_CAPTURE_MSG_BUF_ELEMS = 1000;
+    static const int MAX_CAPTURE_MSG_COMPACT_LEN = 8000;
+    static const uint32_t COMPACT_READ_BATCH_LEN = 1000;
+    static const uint8_t DEFAULT_COMPACT_TS_SHIFT = 8;
+    static BusCaptureEncoder _encoder;
+
+    // Tx chars available in tx buffer for bin frame transmission
+    static const int MIN_TX_AVAILABLE_FOR_BIN_FRAME = 16000;
+};
@@ -0,0 +1,338 @@
+// Bus Raider
+// Rob Dobson 2019
+// Compact encoding of bus capture records
+
+#include "BusCaptureCodec.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Flags classes
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Flags for each of the fixed classes - the cycles seen in a wait are almost always one of these
+static const uint8_t BUS_CAPTURE_CODEC_CLASS_FLAGS[] =
+{
+    BR_CTRL_BUS_M1_MASK | BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_RD_MASK | BR_CTRL_BUS_WAIT_MASK,
+    BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_RD_MASK | BR_CTRL_BUS_WAIT_MASK,
+    BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_WR_MASK | BR_CTRL_BUS_WAIT_MASK,
+    BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_RD_MASK | BR_CTRL_BUS_WAIT_MASK,
+    BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_WR_MASK | BR_CTRL_BUS_WAIT_MASK,
+    BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_M1_MASK | BR_CTRL_BUS_WAIT_MASK
+};
+static const int BUS_CAPTURE_CODEC_NUM_FIXED_CLASSES = sizeof(BUS_CAPTURE_CODEC_CLASS_FLAGS) / sizeof(uint8_t);
+
+int BusCaptureDecoder::flagsClass(uint8_t flags, uint8_t prevFlags)
+{
+    for (int i = 0; i < BUS_CAPTURE_CODEC_NUM_FIXED_CLASSES; i++)
+        if (flags == BUS_CAPTURE_CODEC_CLASS_FLAGS[i])
+            return i;
+    if (flags == prevFlags)
+        return BUS_CAPTURE_CODEC_FLAGS_SAME;
+    return BUS_CAPTURE_CODEC_FLAGS_RAW;
+}
+
+uint8_t BusCaptureDecoder::flagsForClass(int flagsClass, uint8_t prevFlags)
+{
+    if (flagsClass < BUS_CAPTURE_CODEC_NUM_FIXED_CLASSES)
+        return BUS_CAPTURE_CODEC_CLASS_FLAGS[flagsClass];
+    return prevFlags;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Encoder
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BusCaptureEncoder::start(uint8_t* pBuf, uint32_t maxLen, uint32_t startIdx, uint32_t startCycles, uint8_t tsShift)
+{
+    _pBuf = pBuf;
+    _maxLen = maxLen;
+    _pos = 0;
+    _numRecords = 0;
+    _tsShift = tsShift;
+    _prevAddr = 0;
+    _prevFlags = 0;
+    _prevTs = (tsShift == BUS_CAPTURE_CODEC_NO_TIMESTAMPS) ? 0 : (startCycles >> tsShift);
+    _histCount = 0;
+    _runPatLen = 0;
+    _runCount = 0;
+    _runLastCycles = 0;
+
+    // Header - counts and length are filled in by finish()
+    if (maxLen < BUS_CAPTURE_CODEC_HEADER_LEN)
+    {
+        _maxLen = 0;
+        return;
+    }
+    putByte('B');
+    putByte('C');
+    putByte(BUS_CAPTURE_CODEC_VERSION);
+    putByte(tsShift);
+    for (int i = 0; i < 4; i++)
+        putByte(startIdx >> (i * 8));
+    _pos += 8;
+    for (int i = 0; i < 4; i++)
+        putByte(startCycles >> (i * 8));
+}
+
+bool BusCaptureEncoder::add(const BusCaptureRecord& rec)
+{
+    // Keep space to flush a pending run, emit this record and flush a run it starts
+    if (_pos + MAX_ELEM_LEN + MAX_REP_LEN * 2 > _maxLen)
+        return false;
+
+    // Extend a pending run
+    if (_runPatLen != 0)
+    {
+        if (rec.sameCycle(histGet(_runPatLen)))
+        {
+            _runCount++;
+            _runLastCycles = rec.cycles;
+            _hist[_histCount++ % BUS_CAPTURE_CODEC_HISTORY_LEN] = rec;
+            _numRecords++;
+            return true;
+        }
+        emitRun();
+    }
+
+    // Check if this record starts a run - shortest pattern first
+    uint32_t maxBack = (_histCount < (uint32_t)BUS_CAPTURE_CODEC_HISTORY_LEN) ? _histCount : BUS_CAPTURE_CODEC_HISTORY_LEN;
+    for (uint32_t back = 1; back <= maxBack; back++)
+    {
+        if (rec.sameCycle(histGet(back)))
+        {
+            _runPatLen = back;
+            _runCount = 1;
+            _runLastCycles = rec.cycles;
+            break;
+        }
+    }
+    if (_runPatLen == 0)
+        emitRecord(rec);
+    _hist[_histCount++ % BUS_CAPTURE_CODEC_HISTORY_LEN] = rec;
+    _numRecords++;
+    return true;
+}
+
+uint32_t BusCaptureEncoder::finish()
+{
+    if (_maxLen == 0)
+        return 0;
+    if (_runPatLen != 0)
+        emitRun();
+
+    // Fill in counts
+    uint32_t bodyLen = _pos - BUS_CAPTURE_CODEC_HEADER_LEN;
+    for (int i = 0; i < 4; i++)
+    {
+        _pBuf[8 + i] = _numRecords >> (i * 8);
+        _pBuf[12 + i] = bodyLen >> (i * 8);
+    }
+    return _pos;
+}
+
+void BusCaptureEncoder::emitRecord(const BusCaptureRecord& rec)
+{
+    // Flags
+    int flagsClass = BusCaptureDecoder::flagsClass(rec.flags, _prevFlags);
+
+    // Address
+    uint16_t seqOffset = rec.addr - _prevAddr - 1;
+    int16_t delta = rec.addr - _prevAddr;
+    if (seqOffset < 8)
+    {
+        putByte(BUS_CAPTURE_CODEC_TAG_SEQ | (flagsClass << 3) | seqOffset);
+        if (flagsClass == BUS_CAPTURE_CODEC_FLAGS_RAW)
+            putByte(rec.flags);
+    }
+    else if ((delta >= -128) && (delta <= 127))
+    {
+        putByte(BUS_CAPTURE_CODEC_TAG_NEAR | (flagsClass << 3));
+        if (flagsClass == BUS_CAPTURE_CODEC_FLAGS_RAW)
+            putByte(rec.flags);
+        putByte((uint8_t)delta);
+    }
+    else
+    {
+        putByte(BUS_CAPTURE_CODEC_TAG_ABS | (flagsClass << 3));
+        if (flagsClass == BUS_CAPTURE_CODEC_FLAGS_RAW)
+            putByte(rec.flags);
+        putByte(rec.addr & 0xff);
+        putByte(rec.addr >> 8);
+    }
+
+    // Data and time
+    putByte(rec.data);
+    putTimestamp(rec.cycles);
+    _prevAddr = rec.addr;
+    _prevFlags = rec.flags;
+}
+
+void BusCaptureEncoder::emitRun()
+{
+    // A single matching record is cheaper as a literal (and keeps its exact timestamp)
+    if (_runCount == 1)
+    {
+        emitRecord(histGet(1));
+    }
+    else
+    {
+        putByte(BUS_CAPTURE_CODEC_TAG_REP | (_runPatLen - 1));
+        putVarint(_runCount);
+        putTimestamp(_runLastCycles);
+        _prevAddr = histGet(1).addr;
+        _prevFlags = histGet(1).flags;
+    }
+    _runPatLen = 0;
+    _runCount = 0;
+}
+
+void BusCaptureEncoder::putVarint(uint32_t val)
+{
+    while (val >= 0x80)
+    {
+        putByte((val & 0x7f) | 0x80);
+        val >>= 7;
+    }
+    putByte(val);
+}
+
+void BusCaptureEncoder::putTimestamp(uint32_t cycles)
+{
+    if (_tsShift == BUS_CAPTURE_CODEC_NO_TIMESTAMPS)
+        return;
+    uint32_t ts = cycles >> _tsShift;
+    putVarint((ts - _prevTs) & (0xffffffff >> _tsShift));
+    _prevTs = ts;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Decoder
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool busCaptureCodecGetVarint(const uint8_t* pData, uint32_t len, uint32_t& pos, uint32_t& val)
+{
+    val = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        if (pos >= len)
+            return false;
+        uint8_t byt = pData[pos++];
+        val |= (uint32_t)(byt & 0x7f) << shift;
+        if ((byt & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+uint32_t BusCaptureDecoder::decode(const uint8_t* pData, uint32_t len, BusCaptureRecordCBFnType* pRecCB, void* pArg)
+{
+    // Header
+    if ((len < BUS_CAPTURE_CODEC_HEADER_LEN) || (pData[0] != 'B') || (pData[1] != 'C') ||
+                (pData[2] != BUS_CAPTURE_CODEC_VERSION))
+        return 0;
+    uint8_t tsShift = pData[3];
+    bool hasTimestamps = tsShift != BUS_CAPTURE_CODEC_NO_TIMESTAMPS;
+    if (hasTimestamps && (tsShift > 31))
+        return 0;
+    uint32_t idx = getU32(pData + 4);
+    uint32_t numRecords = getU32(pData + 8);
+    uint32_t bodyLen = getU32(pData + 12);
+    uint32_t cycles = getU32(pData + 16);
+    if (bodyLen > len - BUS_CAPTURE_CODEC_HEADER_LEN)
+        return 0;
+    uint32_t endPos = BUS_CAPTURE_CODEC_HEADER_LEN + bodyLen;
+    uint32_t tsMask = hasTimestamps ? (0xffffffff >> tsShift) : 0;
+
+    // State
+    BusCaptureRecord hist[BUS_CAPTURE_CODEC_HISTORY_LEN];
+    uint32_t histCount = 0;
+    BusCaptureRecord rec;
+    rec.addr = 0;
+    rec.data = 0;
+    rec.flags = 0;
+    rec.cycles = 0;
+    uint32_t prevTs = hasTimestamps ? (cycles >> tsShift) : 0;
+    uint32_t decoded = 0;
+
+    // Elements
+    uint32_t pos = BUS_CAPTURE_CODEC_HEADER_LEN;
+    while ((pos < endPos) && (decoded < numRecords))
+    {
+        uint8_t tag = pData[pos++];
+        uint8_t kind = tag & BUS_CAPTURE_CODEC_TAG_KIND_MASK;
+
+        // Repeat
+        if (kind == BUS_CAPTURE_CODEC_TAG_REP)
+        {
+            uint32_t patLen = (tag & 0x3f) + 1;
+            uint32_t count = 0, tsDelta = 0;
+            if ((patLen > histCount) || !busCaptureCodecGetVarint(pData, endPos, pos, count))
+                return 0;
+            if (hasTimestamps && !busCaptureCodecGetVarint(pData, endPos, pos, tsDelta))
+                return 0;
+            if (count > numRecords - decoded)
+                return 0;
+            for (uint32_t i = 1; i <= count; i++)
+            {
+                rec = hist[(histCount - patLen) % BUS_CAPTURE_CODEC_HISTORY_LEN];
+                rec.cycles = hasTimestamps ? (((prevTs + (uint32_t)(((uint64_t)tsDelta * i) / count)) & tsMask) << tsShift) : 0;
+                hist[histCount++ % BUS_CAPTURE_CODEC_HISTORY_LEN] = rec;
+                pRecCB(idx++, rec, pArg);
+            }
+            prevTs = (prevTs + tsDelta) & tsMask;
+            decoded += count;
+            continue;
+        }
+
+        // Flags
+        int flagsClass = (tag >> 3) & 0x07;
+        uint8_t prevFlags = rec.flags;
+        if (flagsClass == BUS_CAPTURE_CODEC_FLAGS_RAW)
+        {
+            if (pos >= endPos)
+                return 0;
+            rec.flags = pData[pos++];
+        }
+        else
+        {
+            rec.flags = flagsForClass(flagsClass, prevFlags);
+        }
+
+        // Address
+        if (kind == BUS_CAPTURE_CODEC_TAG_SEQ)
+        {
+            rec.addr = rec.addr + (tag & 0x07) + 1;
+        }
+        else if (kind == BUS_CAPTURE_CODEC_TAG_NEAR)
+        {
+            if (pos >= endPos)
+                return 0;
+            rec.addr = rec.addr + (int8_t)pData[pos++];
+        }
+        else
+        {
+            if (pos + 2 > endPos)
+                return 0;
+            rec.addr = pData[pos] | (pData[pos+1] << 8);
+            pos += 2;
+        }
+
+        // Data and time
+        if (pos >= endPos)
+            return 0;
+        rec.data = pData[pos++];
+        if (hasTimestamps)
+        {
+            uint32_t tsDelta = 0;
+            if (!busCaptureCodecGetVarint(pData, endPos, pos, tsDelta))
+                return 0;
+            prevTs = (prevTs + tsDelta) & tsMask;
+            rec.cycles = prevTs << tsShift;
+        }
+        hist[histCount++ % BUS_CAPTURE_CODEC_HISTORY_LEN] = rec;
+        pRecCB(idx++, rec, pArg);
+        decoded++;
+    }
+    if (decoded != numRecords)
+        return 0;
+    return endPos;
+}
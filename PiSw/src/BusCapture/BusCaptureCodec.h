@@ -0,0 +1,169 @@
+// Bus Raider
+// Rob Dobson 2019
+// Compact encoding of bus capture records - this has no Pi dependencies so it is also built
+// into the host-side decoder (tools/BusCaptureDecode)
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../TargetBus/TargetCPU.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Capture record
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// One bus cycle - cycles is the CPU cycle counter when the cycle was handled and flags are the
+// low 8 bits of the BR_CTRL_BUS_XXX_MASK values (RD, WR, MREQ, IORQ, M1, WAIT, RESET, IRQ)
+class BusCaptureRecord
+{
+public:
+    uint32_t cycles;
+    uint16_t addr;
+    uint8_t data;
+    uint8_t flags;
+
+    bool sameCycle(const BusCaptureRecord& other) const
+    {
+        return (addr == other.addr) && (data == other.data) && (flags == other.flags);
+    }
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Compact stream format
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A stream is a 20 byte header followed by the body - all values little-endian
+//   0  'B' 'C'
+//   2  version
+//   3  timestamp shift (cycles are stored >> shift, BUS_CAPTURE_CODEC_NO_TIMESTAMPS if not stored)
+//   4  index of first record in the capture
+//   8  number of records
+//   12 body length in bytes
+//   16 cycle counter before the first record
+//
+// The body is a sequence of elements each starting with a tag byte - the top two bits are the kind:
+//   00ccc000 ABS  - address low, address high
+//   01cccnnn SEQ  - address is the previous address + nnn + 1 (so sequential fetches need no address)
+//   10ccc000 NEAR - signed 8 bit address delta
+//   11pppppp REP  - repeat: varint count of records each equal to the record (ppppppp + 1) before it,
+//                   which run-length encodes loops such as polling an IO port
+// ccc is the flags class (see BUS_CAPTURE_CODEC_FLAGS_XXX) - for the raw class a flags byte follows the
+// tag. ABS, SEQ and NEAR are then followed by the data byte. If timestamps are stored each element ends
+// with a varint delta of the shifted cycle count (for REP this is to the last repeated record and the
+// timestamps of the repeated records are interpolated)
+static const uint8_t BUS_CAPTURE_CODEC_VERSION = 1;
+static const uint8_t BUS_CAPTURE_CODEC_NO_TIMESTAMPS = 0xff;
+static const uint32_t BUS_CAPTURE_CODEC_HEADER_LEN = 20;
+static const int BUS_CAPTURE_CODEC_HISTORY_LEN = 64;
+
+// Tag kinds
+static const uint8_t BUS_CAPTURE_CODEC_TAG_ABS = 0x00;
+static const uint8_t BUS_CAPTURE_CODEC_TAG_SEQ = 0x40;
+static const uint8_t BUS_CAPTURE_CODEC_TAG_NEAR = 0x80;
+static const uint8_t BUS_CAPTURE_CODEC_TAG_REP = 0xc0;
+static const uint8_t BUS_CAPTURE_CODEC_TAG_KIND_MASK = 0xc0;
+
+// Flags classes
+enum BusCaptureCodecFlagsClass
+{
+    BUS_CAPTURE_CODEC_FLAGS_M1_FETCH,
+    BUS_CAPTURE_CODEC_FLAGS_MEM_RD,
+    BUS_CAPTURE_CODEC_FLAGS_MEM_WR,
+    BUS_CAPTURE_CODEC_FLAGS_IO_RD,
+    BUS_CAPTURE_CODEC_FLAGS_IO_WR,
+    BUS_CAPTURE_CODEC_FLAGS_IRQ_ACK,
+    BUS_CAPTURE_CODEC_FLAGS_SAME,
+    BUS_CAPTURE_CODEC_FLAGS_RAW
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Encoder
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BusCaptureEncoder
+{
+public:
+    // Start a stream in the buffer
+    void start(uint8_t* pBuf, uint32_t maxLen, uint32_t startIdx, uint32_t startCycles, uint8_t tsShift);
+
+    // Add a record - returns false (and the record is not added) if the buffer is full
+    bool add(const BusCaptureRecord& rec);
+
+    // Complete the stream - returns the total length (header and body)
+    uint32_t finish();
+
+    uint32_t getNumRecords()
+    {
+        return _numRecords;
+    }
+
+    // Length so far (header and body)
+    uint32_t getLen()
+    {
+        return _pos;
+    }
+
+private:
+    void emitRecord(const BusCaptureRecord& rec);
+    void emitRun();
+    void putByte(uint8_t val)
+    {
+        _pBuf[_pos++] = val;
+    }
+    void putVarint(uint32_t val);
+    void putTimestamp(uint32_t cycles);
+    const BusCaptureRecord& histGet(int back)
+    {
+        return _hist[(_histCount - back) % BUS_CAPTURE_CODEC_HISTORY_LEN];
+    }
+
+    // Worst case element sizes - space is kept so that a pending run can always be emitted
+    static const uint32_t MAX_ELEM_LEN = 1 + 1 + 2 + 1 + 5;
+    static const uint32_t MAX_REP_LEN = 1 + 5 + 5;
+
+    // Output
+    uint8_t* _pBuf;
+    uint32_t _maxLen;
+    uint32_t _pos;
+    uint32_t _numRecords;
+    uint8_t _tsShift;
+
+    // Previous emitted state
+    uint16_t _prevAddr;
+    uint8_t _prevFlags;
+    uint32_t _prevTs;
+
+    // History of records (emitted or in the pending run)
+    BusCaptureRecord _hist[BUS_CAPTURE_CODEC_HISTORY_LEN];
+    uint32_t _histCount;
+
+    // Pending run - records matching the record runPatLen before them
+    int _runPatLen;
+    uint32_t _runCount;
+    uint32_t _runLastCycles;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Decoder
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef void BusCaptureRecordCBFnType(uint32_t idx, const BusCaptureRecord& rec, void* pArg);
+
+class BusCaptureDecoder
+{
+public:
+    // Decode one stream calling the callback for each record - returns the length of the stream
+    // (header and body) or 0 if it is invalid
+    static uint32_t decode(const uint8_t* pData, uint32_t len, BusCaptureRecordCBFnType* pRecCB, void* pArg);
+
+    // Header field access
+    static uint32_t getU32(const uint8_t* pData)
+    {
+        return pData[0] | (pData[1] << 8) | (pData[2] << 16) | ((uint32_t)pData[3] << 24);
+    }
+
+    // Flags classes
+    static int flagsClass(uint8_t flags, uint8_t prevFlags);
+    static uint8_t flagsForClass(int flagsClass, uint8_t prevFlags);
+};
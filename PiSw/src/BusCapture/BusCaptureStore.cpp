@@ -0,0 +1,170 @@
+// Bus Raider
+// Rob Dobson 2019
+// Capture record store
+
+#include "BusCaptureStore.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Init
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BusCaptureStore::BusCaptureStore()
+{
+    init(NULL, 0);
+}
+
+void BusCaptureStore::init(uint8_t* pBuf, uint32_t bufLen)
+{
+    _pBuf = pBuf;
+    _numBlocks = pBuf ? bufLen / BLOCK_LEN : 0;
+    _oldestBlock = 0;
+    _curBlock = 0;
+    _numBlocksUsed = 0;
+    _curBlockFinished = true;
+    _numAdded = 0;
+    _keepFromIdx = 0xffffffff;
+    _lastCycles = 0;
+    _tsShift = BUS_CAPTURE_CODEC_NO_TIMESTAMPS;
+}
+
+void BusCaptureStore::start(uint8_t tsShift, uint32_t startCycles)
+{
+    _tsShift = tsShift;
+    _numAdded = 0;
+    _keepFromIdx = 0xffffffff;
+    _lastCycles = startCycles;
+    _oldestBlock = 0;
+    _curBlock = 0;
+    _numBlocksUsed = 0;
+    _curBlockFinished = true;
+    if (_numBlocks == 0)
+        return;
+    startBlock(0);
+    _numBlocksUsed = 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Add
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool BusCaptureStore::add(const BusCaptureRecord& rec)
+{
+    if (_numBlocksUsed == 0)
+        return false;
+
+    // Move to the next block if this one is full (or completed)
+    if (_curBlockFinished || !_encoder.add(rec))
+    {
+        if (!nextBlock() || !_encoder.add(rec))
+            return false;
+    }
+    _numAdded++;
+    _lastCycles = rec.cycles;
+    return true;
+}
+
+void BusCaptureStore::finish()
+{
+    if ((_numBlocksUsed == 0) || _curBlockFinished)
+        return;
+    _encoder.finish();
+    _curBlockFinished = true;
+}
+
+void BusCaptureStore::startBlock(uint32_t blockIdx)
+{
+    // Each block is a stream of its own - its timestamps start from the last record of the block before
+    _encoder.start(blockPtr(blockIdx), BLOCK_LEN, _numAdded, _lastCycles, _tsShift);
+    _curBlockFinished = false;
+}
+
+bool BusCaptureStore::nextBlock()
+{
+    // An empty block is used again
+    if (!_curBlockFinished && (_encoder.getNumRecords() == 0))
+    {
+        startBlock(_curBlock);
+        return true;
+    }
+    finish();
+
+    // Drop the oldest block if all its records are before the keep index
+    if (_numBlocksUsed == _numBlocks)
+    {
+        uint32_t oldestEndIdx = (_numBlocks > 1) ? blockStartIdx(_oldestBlock + 1) : _numAdded;
+        if (oldestEndIdx > _keepFromIdx)
+            return false;
+        _oldestBlock = (_oldestBlock + 1) % _numBlocks;
+        _numBlocksUsed--;
+    }
+    _curBlock = (_curBlock + 1) % _numBlocks;
+    _numBlocksUsed++;
+    startBlock(_curBlock);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Read
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t BusCaptureStore::getFirstIdx()
+{
+    if (_numBlocksUsed == 0)
+        return 0;
+    return blockStartIdx(_oldestBlock);
+}
+
+uint32_t BusCaptureStore::getEndIdx()
+{
+    if (_numBlocksUsed == 0)
+        return 0;
+    if (_curBlockFinished)
+        return _numAdded;
+    return blockStartIdx(_curBlock);
+}
+
+uint32_t BusCaptureStore::getFirstIdxOfNewest(uint32_t numBlocks)
+{
+    if (numBlocks == 0)
+        return _numAdded;
+    if (numBlocks >= _numBlocksUsed)
+        return getFirstIdx();
+    return blockStartIdx(_curBlock + _numBlocks - (numBlocks - 1));
+}
+
+uint32_t BusCaptureStore::getUsedLen()
+{
+    if (_numBlocksUsed == 0)
+        return 0;
+    return (_numBlocksUsed - 1) * BLOCK_LEN + _encoder.getLen();
+}
+
+uint32_t BusCaptureStore::getRecords(uint32_t idx, BusCaptureRecord* pRecs, uint32_t maxRecs)
+{
+    if ((idx < getFirstIdx()) || (idx >= getEndIdx()))
+        return 0;
+
+    // Decode the completed blocks holding the records
+    ReadState readState = { idx, maxRecs, 0, pRecs };
+    for (uint32_t i = 0; (i < _numBlocksUsed) && (readState.numRead < maxRecs); i++)
+    {
+        uint32_t blockIdx = (_oldestBlock + i) % _numBlocks;
+        if ((blockIdx == _curBlock) && !_curBlockFinished)
+            break;
+        const uint8_t* pBlock = blockPtr(blockIdx);
+        uint32_t blockEndIdx = blockStartIdx(blockIdx) + BusCaptureDecoder::getU32(pBlock + 8);
+        if (blockEndIdx <= idx + readState.numRead)
+            continue;
+        if (BusCaptureDecoder::decode(pBlock, BLOCK_LEN, readRecordCB, &readState) == 0)
+            break;
+    }
+    return readState.numRead;
+}
+
+void BusCaptureStore::readRecordCB(uint32_t idx, const BusCaptureRecord& rec, void* pArg)
+{
+    ReadState* pReadState = (ReadState*)pArg;
+    if ((pReadState->numRead >= pReadState->maxRecs) || (idx != pReadState->startIdx + pReadState->numRead))
+        return;
+    pReadState->pRecs[pReadState->numRead++] = rec;
+}
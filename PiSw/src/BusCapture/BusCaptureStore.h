@@ -0,0 +1,117 @@
+// Bus Raider
+// Rob Dobson 2019
+// Capture record store - records are kept compact encoded (see BusCaptureCodec.h) in a ring of blocks,
+// this has no Pi dependencies so it is also built into the host-side tests (test/capture)
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "BusCaptureCodec.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Store
+//
+// The buffer is split into fixed size blocks each holding one compact stream (header and body) - when a
+// block is full it is completed and the next one started and once all blocks are used the oldest one is
+// dropped, unless it holds records from the keep index onwards in which case the store is full
+//
+// Record indices count from the first record added since start() - the records of the block being
+// written can only be read once it is completed (by filling it or by calling finish())
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BusCaptureStore
+{
+public:
+    BusCaptureStore();
+
+    // Buffer - split into blocks (any part smaller than a block isn't used)
+    void init(uint8_t* pBuf, uint32_t bufLen);
+
+    // Start storing - timestamps are stored >> tsShift (or not at all if BUS_CAPTURE_CODEC_NO_TIMESTAMPS)
+    void start(uint8_t tsShift, uint32_t startCycles);
+
+    // Add a record - returns false if there is no space
+    bool add(const BusCaptureRecord& rec);
+
+    // Complete the block being written so all the records can be read
+    void finish();
+
+    // Records from idx onwards aren't dropped (records before it can be)
+    void setKeepFrom(uint32_t idx)
+    {
+        _keepFromIdx = idx;
+    }
+
+    // Indices - first stored record, one after the last record which can be read and number added
+    uint32_t getFirstIdx();
+    uint32_t getEndIdx();
+    uint32_t getNumAdded()
+    {
+        return _numAdded;
+    }
+
+    // Index of the first record in the newest numBlocks blocks (including the one being written)
+    uint32_t getFirstIdxOfNewest(uint32_t numBlocks);
+
+    // Read records from idx - returns the number read
+    uint32_t getRecords(uint32_t idx, BusCaptureRecord* pRecs, uint32_t maxRecs);
+
+    // Sizes
+    uint32_t getNumBlocks()
+    {
+        return _numBlocks;
+    }
+    uint32_t getBufLen()
+    {
+        return _numBlocks * BLOCK_LEN;
+    }
+    uint32_t getUsedLen();
+    uint8_t getTsShift()
+    {
+        return _tsShift;
+    }
+
+    // Block size - records are dropped a block at a time
+    static const uint32_t BLOCK_LEN = 8192;
+
+private:
+    // Buffer
+    uint8_t* _pBuf;
+    uint32_t _numBlocks;
+
+    // Blocks in use - the oldest, the one being written and the number (including the one being written)
+    uint32_t _oldestBlock;
+    uint32_t _curBlock;
+    uint32_t _numBlocksUsed;
+    bool _curBlockFinished;
+
+    // Records
+    uint32_t _numAdded;
+    uint32_t _keepFromIdx;
+    uint32_t _lastCycles;
+    uint8_t _tsShift;
+    BusCaptureEncoder _encoder;
+
+    // Blocks
+    uint8_t* blockPtr(uint32_t blockIdx)
+    {
+        return _pBuf + (blockIdx % _numBlocks) * BLOCK_LEN;
+    }
+    uint32_t blockStartIdx(uint32_t blockIdx)
+    {
+        return BusCaptureDecoder::getU32(blockPtr(blockIdx) + 4);
+    }
+    void startBlock(uint32_t blockIdx);
+    bool nextBlock();
+
+    // Decode callback
+    struct ReadState
+    {
+        uint32_t startIdx;
+        uint32_t maxRecs;
+        uint32_t numRead;
+        BusCaptureRecord* pRecs;
+    };
+    static void readRecordCB(uint32_t idx, const BusCaptureRecord& rec, void* pArg);
+};
@@ -3,6 +3,7 @@
 
 #include "BusController.h"
 #include "../System/PiWiring.h"
+#include "../System/lowlev.h"
 #include "../System/lowlib.h"
 #include "../System/ee_sprintf.h"
 #include "../System/logging.h"
@@ -49,19 +50,18 @@ BusSocketInfo BusController::_busSocketInfo =
     0,
     false,
     BR_BUS_ACTION_GENERAL,
-    false
+    false,
+    // Bus cycles
+    BR_BUS_CYCLE_NONE_MASK
 };
 
 // This instance
 BusController* BusController::_pThisInstance = NULL;
 
 // Synchronous memory access
-uint8_t BusController::_memAccessDataBuf[MAX_MEM_BLOCK_READ_WRITE];
+BusAccessTransfer BusController::_memAccessList[MAX_MEM_ACCESS_LIST_LEN];
+int BusController::_memAccessListLen = 0;
 bool BusController::_memAccessPending = false;
-bool BusController::_memAccessWrite = false;
-uint32_t BusController::_memAccessDataLen = 0;
-uint32_t BusController::_memAccessAddr = 0;
-bool BusController::_memAccessIo = false;
 uint32_t BusController::_memAccessRdWrErrCount = 0;
 char BusController::_memAccessRdWrErrStr[MAX_RDWR_ERR_STR_LEN];
 bool BusController::_memAccessRdWrTest = false;
@@ -84,7 +84,7 @@ void BusController::init()
 {
     // Connect to the bus socket
     if (_busSocketId < 0)
-        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo);
+        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo, "BusController");
 
     // Connect to the comms socket
     if (_commsSocketId < 0)
@@ -447,6 +447,54 @@ bool BusController::handleRxMsg(const char* pCmdJson, [[maybe_unused]]const uint
         strlcpy(pRespJson, "\"err\":\"ok\"", maxRespLen);
         return true;
     }
+    else if (strcasecmp(cmdName, "busLatencyClear") == 0)
+    {
+        // Clear bus latency histograms
+        BusAccess::clearLatencyHist();
+        strlcpy(pRespJson, "\"err\":\"ok\"", maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "busSocketCost") == 0)
+    {
+        // Cost of each bus socket's callbacks in CPU cycles
+        BusAccess::getSocketCostJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "busSocketCostClear") == 0)
+    {
+        // Clear callback cost
+        BusAccess::clearSocketCost();
+        strlcpy(pRespJson, "\"err\":\"ok\"", maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "busBlockBench") == 0)
+    {
+        // Block read and write-back of the same data to measure throughput
+        uint32_t addr = 0;
+        uint32_t dataLen = MAX_MEM_BLOCK_READ_WRITE;
+        getArg("addr", 1, pCmdJson, addr);
+        getArg("len", 2, pCmdJson, dataLen);
+        if ((dataLen <= 0) || (dataLen > MAX_MEM_BLOCK_READ_WRITE))
+        {
+            strlcpy(pRespJson, "\"err\":\"LenTooLong\"", maxRespLen);
+            return true;
+        }
+        uint8_t pData[MAX_MEM_BLOCK_READ_WRITE];
+        BusAccessTransfer xfers[] = {
+            { addr, pData, dataLen, false, false },
+            { addr, pData, dataLen, true, false }
+        };
+        if (BusController::blockAccessListSync(xfers, sizeof(xfers)/sizeof(xfers[0])) != BR_OK)
+        {
+            strlcpy(pRespJson, "\"err\":\"fail\"", maxRespLen);
+            return true;
+        }
+        BusAccessStatusInfo statusInfo;
+        BusAccess::getStatus(statusInfo);
+        ee_sprintf(pRespJson, "\"err\":\"ok\",\"len\":%d,\"addr\":\"0x%04x\",\"rdBps\":%u,\"wrBps\":%u",
+                    dataLen, addr, statusInfo.blockRdBytesPerSec, statusInfo.blockWrBytesPerSec);
+        return true;
+    }
     else if (strcasecmp(cmdName, "busInit") == 0)
     {
         // Get bus status
@@ -592,6 +640,38 @@ bool BusController::handleRxMsg(const char* pCmdJson, [[maybe_unused]]const uint
         _stepCompletionPending = true;
         return true;
     }
+    else if (strcasecmp(cmdName, "stepCount") == 0)
+    {
+        // Step a number of instructions - completion is reported once at the end
+        uint32_t numInstrs = 0;
+        if (!getArg("count", 1, pCmdJson, numInstrs, NULL, 0, true))
+            return false;
+        TargetTracker::stepCount(numInstrs);
+        strlcpy(pRespJson, "\"err\":\"ok\"", maxRespLen);
+        _stepCompletionPending = true;
+        return true;
+    }
+    else if (strcasecmp(cmdName, "stepRange") == 0)
+    {
+        // Run until the PC leaves the address range (inclusive)
+        uint32_t startAddr = 0, endAddr = 0;
+        if (!getArg("start", 1, pCmdJson, startAddr))
+            return false;
+        if (!getArg("end", 2, pCmdJson, endAddr))
+            return false;
+        TargetTracker::stepRunInRange(startAddr, endAddr);
+        strlcpy(pRespJson, "\"err\":\"ok\"", maxRespLen);
+        _stepCompletionPending = true;
+        return true;
+    }
+    else if (strcasecmp(cmdName, "stepOut") == 0)
+    {
+        // Run until return from the current subroutine
+        TargetTracker::stepOut();
+        strlcpy(pRespJson, "\"err\":\"ok\"", maxRespLen);
+        _stepCompletionPending = true;
+        return true;
+    }
     else if (strcasecmp(cmdName, "stepRun") == 0)
     {
         // Turn target tracker on
@@ -609,6 +689,115 @@ bool BusController::handleRxMsg(const char* pCmdJson, [[maybe_unused]]const uint
         strlcat(pRespJson, "\"", maxRespLen);
         return true;
     }
+    else if (strcasecmp(cmdName, "tracepointSet") == 0)
+    {
+        // Address and record type (count, time or regs)
+        uint32_t addr = 0;
+        if (!getArg("addr", 1, pCmdJson, addr))
+            return false;
+        static const int MAX_CMD_PARAM_STR = 50;
+        char paramVal[MAX_CMD_PARAM_STR+1];
+        TargetTracepointRecordType recordType = TARGET_TRACEPOINT_RECORD_COUNT;
+        if (jsonGetValueForKey("record", pCmdJson, paramVal, MAX_CMD_PARAM_STR))
+        {
+            if (strcasecmp(paramVal, "time") == 0)
+                recordType = TARGET_TRACEPOINT_RECORD_TIME;
+            else if (strcasecmp(paramVal, "regs") == 0)
+                recordType = TARGET_TRACEPOINT_RECORD_REGS;
+        }
+        if (TargetTracker::setTracepoint(addr, recordType))
+            strlcpy(pRespJson, "\"err\":\"ok\"", maxRespLen);
+        else
+            strlcpy(pRespJson, "\"err\":\"full\"", maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "tracepointClear") == 0)
+    {
+        // Clear the tracepoint at addr or all tracepoints if no address
+        uint32_t addr = 0;
+        if (getArg("addr", 1, pCmdJson, addr))
+            TargetTracker::clearTracepoint(addr);
+        else
+            TargetTracker::clearTracepoints();
+        strlcpy(pRespJson, "\"err\":\"ok\"", maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "tracepointStatus") == 0)
+    {
+        TargetTracker::getTracepointsJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "tracepointGetLog") == 0)
+    {
+        // Log is sent as a binary frame
+        if (CommandHandler::getTxAvailable() < MIN_TX_AVAILABLE_FOR_BIN_FRAME)
+        {
+            strlcpy(pRespJson, "\"err\":\"busy\"", maxRespLen);
+            return true;
+        }
+        uint32_t count = sendTracepointLogBin();
+        ee_sprintf(pRespJson, "\"err\":\"ok\",\"count\":%u", count);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "callStack") == 0)
+    {
+        // Shadow call stack - innermost frame first
+        TargetTracker::getCallStackJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "historyEnable") == 0)
+    {
+        // Ring size in MB - 0 disables
+        uint32_t sizeMB = TargetTracker::HISTORY_DEFAULT_SIZE_MB;
+        getArg("sizeMB", 1, pCmdJson, sizeMB, NULL, 0, true);
+        uint32_t allocatedMB = 0;
+        if (TargetTracker::historyEnable(sizeMB, allocatedMB))
+        {
+            char tmpStr[50];
+            ee_sprintf(tmpStr, "\"err\":\"ok\",\"sizeMB\":%u", allocatedMB);
+            strlcpy(pRespJson, tmpStr, maxRespLen);
+        }
+        else
+            strlcpy(pRespJson, "\"err\":\"nomem\"", maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "historyClear") == 0)
+    {
+        TargetTracker::historyClear();
+        strlcpy(pRespJson, "\"err\":\"ok\"", maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "historyStatus") == 0)
+    {
+        TargetTracker::getHistoryStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "historyGetBin") == 0)
+    {
+        // Records are only stable while the target is held
+        if (TargetTracker::isTrackingActive() && !TargetTracker::isPaused())
+        {
+            strlcpy(pRespJson, "\"err\":\"running\"", maxRespLen);
+            return true;
+        }
+        if (CommandHandler::getTxAvailable() < MIN_TX_AVAILABLE_FOR_BIN_FRAME)
+        {
+            strlcpy(pRespJson, "\"err\":\"busy\"", maxRespLen);
+            return true;
+        }
+        // Count (decimal) and start record index (decimal - 0 is the oldest) which defaults to the newest count
+        uint32_t count = MAX_HISTORY_MSG_RECORDS;
+        getArg("count", 1, pCmdJson, count, NULL, 0, true);
+        if ((count == 0) || (count > MAX_HISTORY_MSG_RECORDS))
+            count = MAX_HISTORY_MSG_RECORDS;
+        uint32_t recordCount = TargetTracker::getHistoryRecordCount();
+        uint32_t startIdx = (recordCount > count) ? recordCount - count : 0;
+        getArg("start", 2, pCmdJson, startIdx, NULL, 0, true);
+        uint32_t numRecords = sendHistoryBin(startIdx, count);
+        ee_sprintf(pRespJson, "\"err\":\"ok\",\"start\":%u,\"count\":%u,\"total\":%u",
+                    startIdx, numRecords, recordCount);
+        return true;
+    }
     else if (strcasecmp(cmdName, "waitCycleUs") == 0)
     {
         // Get params
@@ -690,6 +879,41 @@ bool BusController::getArg(const char* argName, int argNum, const char* pCmdJson
     return false;
 }
 
+uint32_t BusController::sendTracepointLogBin()
+{
+    // Form JSON message
+    static const int JSON_HEADER_MAX_LEN = 200;
+    static char jsonFrame[JSON_HEADER_MAX_LEN + MAX_TRACEPOINT_LOG_MSG_ENTRIES * sizeof(TargetTracepointLogEntry)];
+    static TargetTracepointLogEntry logEntries[MAX_TRACEPOINT_LOG_MSG_ENTRIES];
+    uint32_t count = TargetTracker::getTracepointLog(logEntries, MAX_TRACEPOINT_LOG_MSG_ENTRIES);
+    uint32_t binDataLen = count * sizeof(TargetTracepointLogEntry);
+    ee_sprintf(jsonFrame, "{\"cmdName\":\"tracepointLogData\",\"count\":%u,\"dropped\":%u,\"dataLen\":%u}",
+                count, TargetTracker::getTracepointLogDropped(), binDataLen);
+
+    // Copy binary to end of buffer
+    memcopyfast(jsonFrame+strlen(jsonFrame)+1, (uint8_t*)logEntries, binDataLen);
+    CommandHandler::sendWithJSON("rdp", "", 0, (const uint8_t*)jsonFrame, strlen(jsonFrame)+1+binDataLen);
+    return count;
+}
+
+uint32_t BusController::sendHistoryBin(uint32_t startIdx, uint32_t maxRecords)
+{
+    // Form JSON message
+    static const int JSON_HEADER_MAX_LEN = 200;
+    static char jsonFrame[JSON_HEADER_MAX_LEN + MAX_HISTORY_MSG_BYTES];
+    static uint8_t historyData[MAX_HISTORY_MSG_BYTES];
+    uint32_t numRecords = 0, predictedPC = 0;
+    uint32_t binDataLen = TargetTracker::getHistoryRecords(startIdx, maxRecords, historyData, MAX_HISTORY_MSG_BYTES,
+                numRecords, predictedPC);
+    ee_sprintf(jsonFrame, "{\"cmdName\":\"historyBinData\",\"start\":%u,\"count\":%u,\"pc\":%u,\"dataLen\":%u}",
+                startIdx, numRecords, predictedPC, binDataLen);
+
+    // Copy binary to end of buffer
+    memcopyfast(jsonFrame+strlen(jsonFrame)+1, historyData, binDataLen);
+    CommandHandler::sendWithJSON("rdp", "", 0, (const uint8_t*)jsonFrame, strlen(jsonFrame)+1+binDataLen);
+    return numRecords;
+}
+
 bool BusController::busLineHandler(const char* pCmdJson)
 {
     static const int MAX_CMD_PARAM_STR = 50;
@@ -834,18 +1058,8 @@ void BusController::busActionCompleteStatic([[maybe_unused]]BR_BUS_ACTION action
 {
     if ((actionType == BR_BUS_ACTION_BUSRQ) && _memAccessPending)
     {
-        if (!_memAccessWrite)
-        {
-            // Read
-            HwManager::blockRead(_memAccessAddr, _memAccessDataBuf, 
-                        _memAccessDataLen, false, _memAccessIo, false);
-        }
-        else
-        {
-            // Write
-            HwManager::blockWrite(_memAccessAddr, _memAccessDataBuf, 
-                        _memAccessDataLen, false, _memAccessIo, false);
-        }
+        // Perform all reads/writes in this bus grant
+        HwManager::blockTransferList(_memAccessList, _memAccessListLen, false, false);
         _memAccessPending = false;
     }
 }
@@ -880,16 +1094,24 @@ void BusController::service()
 
 BR_RETURN_TYPE BusController::blockAccessSync(uint32_t addr, uint8_t* pData, uint32_t len, bool iorq, bool write)
 {
+    if (len > MAX_MEM_BLOCK_READ_WRITE)
+        len = MAX_MEM_BLOCK_READ_WRITE;
+    BusAccessTransfer xfer = { addr, pData, len, write, iorq };
+    return blockAccessListSync(&xfer, 1);
+}
+
+// Perform a list of block reads/writes in a single bus grant - data is transferred directly
+// to/from the buffers in the list which must remain valid until this function returns
+BR_RETURN_TYPE BusController::blockAccessListSync(const BusAccessTransfer* pList, int numTransfers)
+{
+    if ((numTransfers <= 0) || (numTransfers > MAX_MEM_ACCESS_LIST_LEN))
+        return BR_ERR;
+
     // Request the bus
+    for (int i = 0; i < numTransfers; i++)
+        _memAccessList[i] = pList[i];
+    _memAccessListLen = numTransfers;
     _memAccessPending = true;
-    _memAccessWrite = write;
-    _memAccessDataLen = len;
-    if (_memAccessDataLen > MAX_MEM_BLOCK_READ_WRITE)
-        _memAccessDataLen = MAX_MEM_BLOCK_READ_WRITE;
-    _memAccessAddr = addr;
-    _memAccessIo = iorq;
-    if (write)
-        memcopyfast(_memAccessDataBuf, pData, len);
     BusAccess::targetReqBus(_busSocketId, BR_BUS_ACTION_GENERAL);
     // Now enter a loop to wait for the bus action to complete
     static const uint32_t MAX_WAIT_FOR_BUS_ACCESS_US = 50000;
@@ -900,7 +1122,7 @@ BR_RETURN_TYPE BusController::blockAccessSync(uint32_t addr, uint8_t* pData, uin
         // Finished?
         if (!_memAccessPending)
             break;
-        // Service the bus access - the actual read/write operation occurs in a
+        // Service the bus access - the actual read/write operations occur in a
         // callback during this function call
         BusAccess::service();
     }
@@ -910,7 +1132,5 @@ BR_RETURN_TYPE BusController::blockAccessSync(uint32_t addr, uint8_t* pData, uin
         _memAccessPending = false;
         return BR_NO_BUS_ACK;
     }
-    if (!write)
-        memcopyfast(pData, _memAccessDataBuf, len);
     return BR_OK;
 }
\ No newline at end of file
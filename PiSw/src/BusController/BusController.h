@@ -15,6 +15,7 @@ class BusController
 {
 public:
     static const int MAX_MEM_BLOCK_READ_WRITE = 1024;
+    static const int MAX_MEM_ACCESS_LIST_LEN = 8;
 
     BusController();
     void init();
@@ -24,6 +25,7 @@ public:
 
     // Bus access to data
     static BR_RETURN_TYPE blockAccessSync(uint32_t addr, uint8_t* pData, uint32_t len, bool iorq, bool write);
+    static BR_RETURN_TYPE blockAccessListSync(const BusAccessTransfer* pList, int numTransfers);
 
 private:
 
@@ -59,13 +61,21 @@ private:
                 uint32_t& value, char* pOutStr = NULL, uint32_t maxOutStrLen = 0,
                 bool forceDecimal = false);
 
+    // Send tracepoint log in binary (TargetTracepointLogEntry records)
+    static uint32_t sendTracepointLogBin();
+    static const int MAX_TRACEPOINT_LOG_MSG_ENTRIES = 400;
+
+    // Send instruction history records in binary (packed as described in TargetHistory.h)
+    static uint32_t sendHistoryBin(uint32_t startIdx, uint32_t maxRecords);
+    static const uint32_t MAX_HISTORY_MSG_RECORDS = 2000;
+    static const uint32_t MAX_HISTORY_MSG_BYTES = 8192;
+
+    static const int MIN_TX_AVAILABLE_FOR_BIN_FRAME = 16000;
+
     // Synchronous bus access
-    static uint8_t _memAccessDataBuf[MAX_MEM_BLOCK_READ_WRITE];
+    static BusAccessTransfer _memAccessList[MAX_MEM_ACCESS_LIST_LEN];
+    static int _memAccessListLen;
     static bool _memAccessPending;
-    static bool _memAccessWrite;
-    static uint32_t _memAccessDataLen;
-    static uint32_t _memAccessAddr;
-    static bool _memAccessIo;
     static uint32_t _memAccessRdWrErrCount;
     static const int MAX_RDWR_ERR_STR_LEN = 200;
     static char _memAccessRdWrErrStr[MAX_RDWR_ERR_STR_LEN];
@@ -120,10 +120,21 @@ void DeZogInterface::service()
             uint32_t curAddr = TargetTracker::getRegs().PC;
             uint8_t* pMirrorMemory = HwManager::getMirrorMemForAddr(0);
             strlcpy(respMsg, "", DEZOG_RESP_MAX_LEN);
+
+            // Watchpoint which caused the break
+            TargetWatchpointHit watchpointHit;
+            if (TargetTracker::getWatchpointHit(watchpointHit))
+            {
+                ee_sprintf(respMsg, "Watchpoint %d (%04X-%04X) fired: %s %04X\n",
+                            watchpointHit.watchpointIdx, watchpointHit.startAddr, watchpointHit.endAddr,
+                            (watchpointHit.accessType == TARGET_WATCHPOINT_WRITE) ? "write" : "read",
+                            watchpointHit.dataAddr);
+            }
             if (pMirrorMemory)
             {
-                disasmZ80(pMirrorMemory, 0, curAddr, respMsg, INTEL, false, true);
-                mungeDisassembly(respMsg);
+                char* pDisassembly = respMsg + strlen(respMsg);
+                disasmZ80(pMirrorMemory, 0, curAddr, pDisassembly, INTEL, false, true);
+                mungeDisassembly(pDisassembly);
             }
             addPromptMsg(respMsg, DEZOG_RESP_MAX_LEN);
             CommandHandler::sendWithJSON("dezog", "", _smartloadMsgIdx, 
@@ -348,9 +359,54 @@ bool DeZogInterface::handleLine(char* pCmd, char* pResponse, int maxResponseLen,
     }
     else if (commandMatch(cmdStr, "set-register"))
     {
+        // Format is name=value - value is decimal or hex with H suffix - only the changed register
+        // is injected when the target is paused
+        char* pEquals = argStr ? strstr(argStr, "=") : NULL;
+        if (pEquals && TargetTracker::isPaused())
+        {
+            *pEquals = 0;
+            const char* pValStr = pEquals + 1;
+            int valLen = strlen(pValStr);
+            bool isHex = (valLen > 0) && ((pValStr[valLen-1] == 'H') || (pValStr[valLen-1] == 'h'));
+            Z80Registers regs = TargetTracker::getRegs();
+            if (regs.setByName(argStr, strtoul(pValStr, NULL, isHex ? 16 : 10)))
+                TargetTracker::startSetRegisterSequence(&regs);
+        }
+        TargetTracker::getRegsFormatted(pResponse, maxResponseLen);
     }
     else if (commandMatch(cmdStr, "get-stack-backtrace"))
     {
+        // Return addresses from the shadow call stack (innermost first) or, if no calls have been seen,
+        // the words on the stack from the mirror
+        static const uint32_t DEFAULT_BACKTRACE_FRAMES = 5;
+        uint32_t numFrames = argStr ? strtoul(argStr, NULL, 10) : 0;
+        if (numFrames == 0)
+            numFrames = DEFAULT_BACKTRACE_FRAMES;
+        if (numFrames > TargetCallStack::MAX_FRAMES)
+            numFrames = TargetCallStack::MAX_FRAMES;
+        uint32_t callDepth = TargetTracker::getCallStackDepth();
+        for (uint32_t i = 0; i < numFrames; i++)
+        {
+            uint32_t wordVal = 0;
+            if (callDepth > 0)
+            {
+                TargetCallFrame frame;
+                if (!TargetTracker::getCallStackFrame(i, frame))
+                    break;
+                wordVal = frame.retAddr;
+            }
+            else
+            {
+                uint32_t stackAddr = TargetTracker::getRegs().SP + i * 2;
+                uint8_t* pMirrorMem = HwManager::getMirrorMemForAddr(0);
+                if (!pMirrorMem || !TargetTracker::isPaused() || (stackAddr + 1 > HwManager::getMaxAddress()))
+                    break;
+                wordVal = pMirrorMem[stackAddr] | (pMirrorMem[stackAddr + 1] << 8);
+            }
+            char chBuf[20];
+            ee_sprintf(chBuf, "%04XH ", wordVal);
+            strlcat(pResponse, chBuf, maxResponseLen);
+        }
     }
     else if (commandMatch(cmdStr, "read-memory"))
     {
@@ -374,8 +430,15 @@ bool DeZogInterface::handleLine(char* pCmd, char* pResponse, int maxResponseLen,
         static const uint32_t MAX_BYTES_TO_RETURN = 1024;
         if ((startAddr <= HwManager::getMaxAddress()) && (blockLength <= MAX_BYTES_TO_RETURN))
         {
+            // A block past the top of memory wraps to address 0 - both parts are read in one bus grant
             uint8_t dataBlock[MAX_BYTES_TO_RETURN];
-            HwManager::blockRead(startAddr, dataBlock, blockLength, false, false, false);
+            uint32_t memLen = HwManager::getMaxAddress() + 1;
+            uint32_t firstPartLen = (startAddr + blockLength > memLen) ? memLen - startAddr : blockLength;
+            BusAccessTransfer transfers[2] = {
+                { startAddr, dataBlock, firstPartLen, false, false },
+                { 0, dataBlock + firstPartLen, blockLength - firstPartLen, false, false }
+            };
+            HwManager::blockTransferList(transfers, (firstPartLen < blockLength) ? 2 : 1, true, false);
             LogWrite(MODULE_PREFIX, LOG_DEBUG, "dataBlock %04x %02x %02x %02x %02x", 
                             startAddr, dataBlock[0], dataBlock[1], dataBlock[2], dataBlock[3]);
             for (uint32_t i = 0; i < blockLength; i++)
@@ -430,8 +493,31 @@ bool DeZogInterface::handleLine(char* pCmd, char* pResponse, int maxResponseLen,
         {
             int addr = strtol(argStr2+3, NULL, 16);
             TargetTracker::setBreakpointPCAddr(breakpointIdx, addr);
+
+            // Any condition follows the PC - e.g. PC=8000h and A=3fh
+            const char* pCondition = argRest ? argRest : "";
+            while (*pCondition == ' ')
+                pCondition++;
+            if (strncasecmp(pCondition, "and ", 4) == 0)
+                pCondition += 4;
+            else if (strncmp(pCondition, "&&", 2) == 0)
+                pCondition += 2;
+            if (!TargetTracker::setBreakpointCondition(breakpointIdx, pCondition))
+            {
+                LogWrite(MODULE_PREFIX, LOG_DEBUG, "breakpoint condition invalid %s", pCondition);
+                strlcat(pResponse, "Error: invalid breakpoint condition, breakpoint disabled\n", maxResponseLen);
+            }
         }        
     }
+    else if (commandMatch(cmdStr, "set-breakpointpasscount"))
+    {
+        // Break on the Nth hit (with the condition true)
+        if (argStr && argStr2)
+        {
+            int breakpointIdx = strtol(argStr, NULL, 10) - 1;
+            TargetTracker::setBreakpointPassCount(breakpointIdx, strtoul(argStr2, NULL, 10));
+        }
+    }
     else if (commandMatch(cmdStr, "set-breakpointaction"))
     {
         LogWrite(MODULE_PREFIX, LOG_DEBUG, "set breakpoint action %s %s %s", argStr, argStr2, argRest);
@@ -453,7 +539,8 @@ bool DeZogInterface::handleLine(char* pCmd, char* pResponse, int maxResponseLen,
 
         // Get breakpoint to enable
         int breakpointIdx = strtol(argStr, NULL, 10) - 1;
-        TargetTracker::enableBreakpoint(breakpointIdx, true);    
+        if (!TargetTracker::enableBreakpoint(breakpointIdx, true))
+            strlcat(pResponse, "Error: breakpoint not enabled - invalid index or condition\n", maxResponseLen);
     }
     else if (commandMatch(cmdStr, "disable-breakpoint"))
     {
@@ -465,13 +552,24 @@ bool DeZogInterface::handleLine(char* pCmd, char* pResponse, int maxResponseLen,
     }
     else if (commandMatch(cmdStr, "clear-membreakpoints"))
     {
-        // TODO
-        // TargetTracker::enableBreakpoints();
+        TargetTracker::clearWatchpoints();
     }
     else if (commandMatch(cmdStr, "set-membreakpoint"))
     {
-        // TODO
-        // TargetTracker::setMemBreakpoint();
+        // Format is address type [items] - address is decimal or hex with H suffix and type is
+        // 0 (disabled), 1 (read), 2 (write) or 3 (read/write)
+        if (argStr && argStr2)
+        {
+            int addrLen = strlen(argStr);
+            bool isHex = (addrLen > 0) && ((argStr[addrLen-1] == 'H') || (argStr[addrLen-1] == 'h'));
+            uint32_t addr = strtoul(argStr, NULL, isHex ? 16 : 10);
+            int watchType = strtol(argStr2, NULL, 10);
+            uint32_t len = argRest ? strtoul(argRest, NULL, 10) : 1;
+            if ((watchType < TARGET_WATCHPOINT_DISABLED) || (watchType > TARGET_WATCHPOINT_ACCESS))
+                watchType = TARGET_WATCHPOINT_DISABLED;
+            LogWrite(MODULE_PREFIX, LOG_DEBUG, "set membreakpoint addr %04x type %d len %d", addr, watchType, len);
+            TargetTracker::setWatchpoint(addr, len, (TargetWatchpointType)watchType);
+        }
     }
     else if (commandMatch(cmdStr, "clear-fast-breakpoint"))
     {
@@ -542,10 +640,37 @@ bool DeZogInterface::handleLine(char* pCmd, char* pResponse, int maxResponseLen,
         // Return immediately (no prompt)
         return true;
     }
+    else if (commandMatch(cmdStr, "cpu-step-out"))
+    {
+        // Run until return from the current subroutine
+        TargetTracker::stepOut();
+        _stepCompletionPending = true;
+        // Return immediately (no prompt)
+        return true;
+    }
+    else if (commandMatch(cmdStr, "cpu-step-range"))
+    {
+        // Run while the PC is in the range (hex start and end addresses inclusive)
+        if (!argStr || !argStr2)
+        {
+            strlcat(pResponse, "Error: start and end address required\n", maxResponseLen);
+        }
+        else
+        {
+            TargetTracker::stepRunInRange(strtoul(argStr, NULL, 16), strtoul(argStr2, NULL, 16));
+            _stepCompletionPending = true;
+            // Return immediately (no prompt)
+            return true;
+        }
+    }
     else if (commandMatch(cmdStr, "cpu-step"))
     {
-        // Step into
-        TargetTracker::stepInto();
+        // Step into - or a number of instructions if a count is given
+        uint32_t numInstrs = argStr ? strtoul(argStr, NULL, 10) : 1;
+        if (numInstrs > 1)
+            TargetTracker::stepCount(numInstrs);
+        else
+            TargetTracker::stepInto();
         _stepCompletionPending = true;
         // Debug
         // LogWrite(MODULE_PREFIX, LOG_DEBUG, "stepInto");
@@ -71,6 +71,17 @@ public:
         return STD_TARGET_MEMORY_LEN;
     }
 
+    // Bus cycle filters - bitmaps of IO ports and memory pages that handleMemOrIOReq uses
+    // Return false if all ports/pages are of interest
+    virtual bool getIOPortFilter([[maybe_unused]] uint32_t* pPortBitmap)
+    {
+        return false;
+    }
+    virtual bool getMemPageFilter([[maybe_unused]] uint32_t* pPageBitmap)
+    {
+        return false;
+    }
+
 protected:
     bool _enabled;
     const char* _pName;
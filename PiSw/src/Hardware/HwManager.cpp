@@ -39,7 +39,9 @@ BusSocketInfo HwManager::_busSocketInfo =
     0,
     false,
     BR_BUS_ACTION_GENERAL,
-    false
+    false,
+    // Bus cycles
+    BR_BUS_CYCLE_ALL_MASK
 };
 
 int HwManager::_commsSocketId = -1;
@@ -94,7 +96,7 @@ void HwManager::init()
 {
     // Connect to the bus socket
     if (_busSocketId < 0)
-        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo);
+        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo, "HwManager");
 
     // Connect to the comms socket
     if (_commsSocketId < 0)
@@ -162,6 +164,7 @@ void HwManager::setMemoryEmulationMode(bool val)
 
     // Set
     _memoryEmulationMode = val;
+    busSocketFiltersUpdate();
 }
 
 // Page out RAM/ROM for opcode injection
@@ -216,6 +219,7 @@ void HwManager::setMirrorMode(bool val)
 
     // Set
     _mirrorMode = val;
+    busSocketFiltersUpdate();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -280,6 +284,40 @@ BR_RETURN_TYPE HwManager::blockRead(uint32_t addr, uint8_t* pBuf, uint32_t len,
     return retVal;
 }
 
+// Perform a list of block reads/writes using a single bus grant
+BR_RETURN_TYPE HwManager::blockTransferList(const BusAccessTransfer* pList, int numTransfers,
+                bool busRqAndRelease, bool forceMirrorAccess)
+{
+    // Check if bus access is available
+    forceMirrorAccess = forceMirrorAccess || (!TargetTracker::busAccessAvailable());
+
+    // Request the bus once for all transfers (not needed if only the mirror is accessed)
+    bool busTaken = false;
+    if (busRqAndRelease && !forceMirrorAccess)
+    {
+        BR_RETURN_TYPE ret = BusAccess::controlRequestAndTake();
+        if (ret != BR_OK)
+            return ret;
+        busTaken = true;
+    }
+
+    // Perform transfers
+    BR_RETURN_TYPE retVal = BR_OK;
+    for (int i = 0; i < numTransfers; i++)
+    {
+        const BusAccessTransfer& xfer = pList[i];
+        BR_RETURN_TYPE newRet = xfer.write ?
+                    blockWrite(xfer.addr, xfer.pData, xfer.len, false, xfer.iorq, forceMirrorAccess) :
+                    blockRead(xfer.addr, xfer.pData, xfer.len, false, xfer.iorq, forceMirrorAccess);
+        retVal = (newRet == BR_OK) ? retVal : newRet;
+    }
+
+    // Release bus
+    if (busTaken)
+        BusAccess::controlRelease();
+    return retVal;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Mirror memory
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -460,6 +498,7 @@ bool HwManager::enableHw(const char* hwName, bool enable)
         if (strcasecmp(_pHw[i]->name(), hwName) == 0)
         {
             _pHw[i]->enable(enable);
+            busSocketFiltersUpdate();
             return true;
         }
     }
@@ -475,6 +514,7 @@ void HwManager::disableAll()
             continue;
         _pHw[i]->enable(false);
     }
+    busSocketFiltersUpdate();
 }
 
 // Configure
@@ -491,6 +531,50 @@ void HwManager::configureHw(const char* hwName, const char* hwDefJson)
             break;
         }
     }
+    busSocketFiltersUpdate();
+}
+
+// Update bus socket filters - union of the ports/pages used by enabled hardware
+void HwManager::busSocketFiltersUpdate()
+{
+    uint32_t portFilter[BR_BUS_FILTER_BITMAP_WORDS];
+    uint32_t pageFilter[BR_BUS_FILTER_BITMAP_WORDS];
+    BusSocketInfo::filterClear(portFilter);
+    BusSocketInfo::filterClear(pageFilter);
+    bool portFilterValid = true;
+    bool pageFilterValid = true;
+    for (int i = 0; i < _numHardware; i++)
+    {
+        if (!_pHw[i] || !_pHw[i]->isEnabled())
+            continue;
+        uint32_t hwFilter[BR_BUS_FILTER_BITMAP_WORDS];
+        if (portFilterValid && _pHw[i]->getIOPortFilter(hwFilter))
+        {
+            for (int j = 0; j < BR_BUS_FILTER_BITMAP_WORDS; j++)
+                portFilter[j] |= hwFilter[j];
+        }
+        else
+        {
+            portFilterValid = false;
+        }
+        if (pageFilterValid && _pHw[i]->getMemPageFilter(hwFilter))
+        {
+            for (int j = 0; j < BR_BUS_FILTER_BITMAP_WORDS; j++)
+                pageFilter[j] |= hwFilter[j];
+        }
+        else
+        {
+            pageFilterValid = false;
+        }
+    }
+
+#ifdef DEBUG_IO_ACCESS
+    // All IO accesses are logged
+    portFilterValid = false;
+#endif
+
+    BusAccess::busSocketSetIOPortFilter(_busSocketId, portFilterValid ? portFilter : NULL);
+    BusAccess::busSocketSetMemPageFilter(_busSocketId, pageFilterValid ? pageFilter : NULL);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -67,6 +67,8 @@ public:
                 bool busRqAndRelease, bool iorq, bool forceMirrorAccess);
     static BR_RETURN_TYPE blockRead(uint32_t addr, uint8_t* pBuf, uint32_t len, 
                 bool busRqAndRelease, bool iorq, bool forceMirrorAccess);
+    static BR_RETURN_TYPE blockTransferList(const BusAccessTransfer* pList, int numTransfers,
+                bool busRqAndRelease, bool forceMirrorAccess);
 
     // Tracer interface to hardware
     static void tracerClone();
@@ -137,4 +139,7 @@ private:
     // Wait interrupt handler
     static void handleWaitInterruptStatic(uint32_t addr, uint32_t data, 
             uint32_t flags, uint32_t& retVal);
+
+    // Update bus socket filters from enabled hardware
+    static void busSocketFiltersUpdate();
 };
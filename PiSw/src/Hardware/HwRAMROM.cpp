@@ -656,3 +656,21 @@ void HwRAMROM::handleMemOrIOReq([[maybe_unused]] uint32_t addr, [[maybe_unused]]
         }
     }
 }
+
+// IO ports used by this card - bank registers and page enable
+bool HwRAMROM::getIOPortFilter(uint32_t* pPortBitmap)
+{
+    BusSocketInfo::filterClear(pPortBitmap);
+    BusSocketInfo::filterSetRange(pPortBitmap, _bankHwBaseIOAddr, _bankHwBaseIOAddr + NUM_BANKS - 1);
+    BusSocketInfo::filterSetRange(pPortBitmap, _bankHwPageEnIOAddr, _bankHwPageEnIOAddr);
+    return true;
+}
+
+// Memory pages used by this card - all pages in emulation or mirror mode, otherwise none
+bool HwRAMROM::getMemPageFilter(uint32_t* pPageBitmap)
+{
+    if (_memoryEmulationMode || _mirrorMode)
+        return false;
+    BusSocketInfo::filterClear(pPageBitmap);
+    return true;
+}
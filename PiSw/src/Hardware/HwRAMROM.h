@@ -53,6 +53,10 @@ public:
         return (_memCardSizeBytes * 1024) - 1;
     }
 
+    // Bus cycle filters
+    virtual bool getIOPortFilter(uint32_t* pPortBitmap);
+    virtual bool getMemPageFilter(uint32_t* pPageBitmap);
+
 private:
     static const char* _logPrefix;
 
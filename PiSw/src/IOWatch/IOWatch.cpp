@@ -0,0 +1,363 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#include "IOWatch.h"
+#include "../TargetBus/TargetTracker.h"
+#include "../System/lowlev.h"
+#include "../System/lowlib.h"
+#include "../System/ee_sprintf.h"
+#include "../System/logging.h"
+#include "../System/rdutils.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Variables
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Module name
+static const char FromIOWatch[] = "IOWatch";
+
+// Sockets
+int IOWatch::_busSocketId = -1;
+int IOWatch::_commsSocketId = -1;
+
+// Main comms socket - to wire up command handler
+CommsSocketInfo IOWatch::_commsSocketInfo =
+{
+    true,
+    IOWatch::handleRxMsg,
+    NULL,
+    NULL
+};
+
+// Bus socket - waits on IO read and write cycles while any watchpoint is set
+BusSocketInfo IOWatch::_busSocketInfo =
+{
+    false,
+    IOWatch::handleWaitInterruptStatic,
+    NULL,
+    false,
+    true,
+    // Reset
+    false,
+    0,
+    // NMI
+    false,
+    0,
+    // IRQ
+    false,
+    0,
+    false,
+    BR_BUS_ACTION_GENERAL,
+    false,
+    // Bus cycles
+    BR_BUS_CYCLE_IORQ_RD_MASK | BR_BUS_CYCLE_IORQ_WR_MASK,
+    // Port filter enabled - the ports are set from the watchpoints (none to start with)
+    true
+};
+
+// Watchpoints
+IOWatchpoint IOWatch::_watchpoints[MAX_IO_WATCHPOINTS];
+
+// Log
+IOWatch::IOWatchLogEntry IOWatch::_ioLog[MAX_IO_LOG_ENTRIES];
+RingBufferPosn IOWatch::_ioLogPosn(MAX_IO_LOG_ENTRIES);
+volatile uint32_t IOWatch::_ioLogCount = 0;
+volatile uint32_t IOWatch::_ioLogDropped = 0;
+uint32_t IOWatch::_ioLogLastDrainUs = 0;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Init
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void IOWatch::init()
+{
+    // Connect to the bus socket (added disabled - only enabled while watchpoints are set)
+    if (_busSocketId < 0)
+        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo, "IOWatch");
+
+    // Connect to the comms socket
+    if (_commsSocketId < 0)
+        _commsSocketId = CommandHandler::commsSocketAdd(_commsSocketInfo);
+}
+
+void IOWatch::service()
+{
+    // Drain log
+    if (!_ioLogPosn.canGet())
+    {
+        _ioLogLastDrainUs = micros();
+        return;
+    }
+    if ((_ioLogPosn.count() < MIN_IO_LOG_MSG_ENTRIES) && !isTimeout(micros(), _ioLogLastDrainUs, MAX_IO_LOG_DRAIN_INTERVAL_US))
+        return;
+    if (CommandHandler::getTxAvailable() < MIN_TX_AVAILABLE_FOR_BIN_FRAME)
+        return;
+    sendLogBin();
+    _ioLogLastDrainUs = micros();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Watchpoints
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int IOWatch::setWatchpoint(uint32_t portStart, uint32_t portEnd, uint32_t portMask,
+            TargetWatchpointType watchType, uint32_t actions)
+{
+    if ((watchType == TARGET_WATCHPOINT_DISABLED) || (actions == 0) || (portEnd < portStart))
+        return -1;
+    for (int i = 0; i < MAX_IO_WATCHPOINTS; i++)
+    {
+        if (_watchpoints[i].inUse)
+            continue;
+        _watchpoints[i].portStart = portStart;
+        _watchpoints[i].portEnd = portEnd;
+        _watchpoints[i].portMask = portMask;
+        _watchpoints[i].watchType = watchType;
+        _watchpoints[i].actions = actions;
+        _watchpoints[i].hitCount = 0;
+        _watchpoints[i].inUse = true;
+        updateBusSocket();
+        LogWrite(FromIOWatch, LOG_DEBUG, "Set %d ports %04x-%04x mask %04x type %d actions %d",
+                    i, portStart, portEnd, portMask, watchType, actions);
+        return i;
+    }
+    return -1;
+}
+
+void IOWatch::clearWatchpoint(int idx)
+{
+    if ((idx < 0) || (idx >= MAX_IO_WATCHPOINTS))
+        return;
+    _watchpoints[idx].inUse = false;
+    updateBusSocket();
+}
+
+void IOWatch::clearAll()
+{
+    for (int i = 0; i < MAX_IO_WATCHPOINTS; i++)
+        _watchpoints[i].inUse = false;
+    updateBusSocket();
+}
+
+void IOWatch::updateBusSocket()
+{
+    if (_busSocketId < 0)
+        return;
+
+    // Port filter on the low 8 bits of the port address - so unwatched ports don't call the handler
+    uint32_t portFilter[BR_BUS_FILTER_BITMAP_WORDS];
+    BusSocketInfo::filterClear(portFilter);
+    bool anyInUse = false;
+    for (int i = 0; i < MAX_IO_WATCHPOINTS; i++)
+    {
+        const IOWatchpoint& watchpoint = _watchpoints[i];
+        if (!watchpoint.inUse)
+            continue;
+        anyInUse = true;
+        uint32_t startLow = watchpoint.portStart & 0xff;
+        uint32_t endLow = watchpoint.portEnd & 0xff;
+        if (((watchpoint.portMask & 0xff) != 0xff) || (watchpoint.portEnd - watchpoint.portStart >= 0xff))
+        {
+            BusSocketInfo::filterSetRange(portFilter, 0, 0xff);
+        }
+        else if (startLow <= endLow)
+        {
+            BusSocketInfo::filterSetRange(portFilter, startLow, endLow);
+        }
+        else
+        {
+            BusSocketInfo::filterSetRange(portFilter, startLow, 0xff);
+            BusSocketInfo::filterSetRange(portFilter, 0, endLow);
+        }
+    }
+    BusAccess::busSocketSetIOPortFilter(_busSocketId, portFilter);
+    BusAccess::busSocketEnable(_busSocketId, anyInUse);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Wait interrupt handler
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void IOWatch::handleWaitInterruptStatic(uint32_t addr, uint32_t data,
+        uint32_t flags, uint32_t& retVal)
+{
+    // Data is the value written or, for reads, the value returned by another socket if there is one
+    // (this socket is added after the others so their callbacks have been made)
+    uint32_t busData = data;
+    if (((flags & BR_CTRL_BUS_WR_MASK) == 0) && ((retVal & BR_MEM_ACCESS_RSLT_NOT_DECODED) == 0))
+        busData = retVal;
+
+    // Check watchpoints
+    uint32_t accessType = (flags & BR_CTRL_BUS_WR_MASK) ? TARGET_WATCHPOINT_WRITE : TARGET_WATCHPOINT_READ;
+    uint32_t actions = 0;
+    for (int i = 0; i < MAX_IO_WATCHPOINTS; i++)
+    {
+        IOWatchpoint& watchpoint = _watchpoints[i];
+        if (!watchpoint.inUse || ((watchpoint.watchType & accessType) == 0))
+            continue;
+        uint32_t port = addr & watchpoint.portMask;
+        if ((port < watchpoint.portStart) || (port > watchpoint.portEnd))
+            continue;
+        watchpoint.hitCount = watchpoint.hitCount + 1;
+        actions |= watchpoint.actions;
+    }
+
+    // Log
+    if (actions & IO_WATCH_ACTION_LOG)
+    {
+        if (_ioLogPosn.canPut())
+        {
+            IOWatchLogEntry& entry = _ioLog[_ioLogPosn.posToPut()];
+            entry.cycles = lowlev_cycleCounterRead();
+            entry.port = addr;
+            entry.data = busData;
+            entry.flags = flags;
+            _ioLogPosn.hasPut();
+            _ioLogCount = _ioLogCount + 1;
+        }
+        else
+        {
+            _ioLogDropped = _ioLogDropped + 1;
+        }
+    }
+
+    // Break (at the start of the next instruction)
+    if ((actions & IO_WATCH_ACTION_BREAK) && TargetTracker::isTrackingActive())
+        TargetTracker::requestBreak();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Log
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t IOWatch::sendLogBin()
+{
+    // Form JSON message - the binary entries are copied straight from the ring
+    static const int JSON_HEADER_MAX_LEN = 200;
+    static char jsonFrame[JSON_HEADER_MAX_LEN + MAX_IO_LOG_MSG_ENTRIES * sizeof(IOWatchLogEntry)];
+    uint32_t count = _ioLogPosn.count();
+    if (count > MAX_IO_LOG_MSG_ENTRIES)
+        count = MAX_IO_LOG_MSG_ENTRIES;
+    uint32_t binDataLen = count * sizeof(IOWatchLogEntry);
+    ee_sprintf(jsonFrame, "{\"cmdName\":\"ioLogBinData\",\"count\":%u,\"total\":%u,\"dropped\":%u,\"dataLen\":%u}",
+                count, _ioLogCount, _ioLogDropped, binDataLen);
+
+    // Copy binary to end of buffer - in up to two parts if the ring wraps
+    uint8_t* pBin = (uint8_t*)(jsonFrame + strlen(jsonFrame) + 1);
+    uint32_t getPos = _ioLogPosn.posToGet();
+    uint32_t firstPart = MAX_IO_LOG_ENTRIES - getPos;
+    if (firstPart > count)
+        firstPart = count;
+    memcopyfast(pBin, (uint8_t*)(_ioLog + getPos), firstPart * sizeof(IOWatchLogEntry));
+    if (count > firstPart)
+        memcopyfast(pBin + firstPart * sizeof(IOWatchLogEntry), (uint8_t*)_ioLog, (count - firstPart) * sizeof(IOWatchLogEntry));
+    for (uint32_t i = 0; i < count; i++)
+        _ioLogPosn.hasGot();
+    CommandHandler::sendWithJSON("rdp", "", 0, (const uint8_t*)jsonFrame, strlen(jsonFrame)+1+binDataLen);
+    return count;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Status
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void IOWatch::getStatusJson(char* pBuf, int maxLen)
+{
+    static const char* typeNames[] = { "none", "rd", "wr", "rdwr" };
+    char tmpStr[200];
+    ee_sprintf(tmpStr, "\"err\":\"ok\",\"logged\":%u,\"dropped\":%u,\"pending\":%u,\"watch\":[",
+                _ioLogCount, _ioLogDropped, _ioLogPosn.count());
+    strlcpy(pBuf, tmpStr, maxLen);
+    bool first = true;
+    for (int i = 0; i < MAX_IO_WATCHPOINTS; i++)
+    {
+        const IOWatchpoint& watchpoint = _watchpoints[i];
+        if (!watchpoint.inUse)
+            continue;
+        ee_sprintf(tmpStr, "%s{\"idx\":%d,\"start\":\"0x%04x\",\"end\":\"0x%04x\",\"mask\":\"0x%04x\",\"type\":\"%s\",\"log\":%d,\"break\":%d,\"hits\":%u}",
+                    first ? "" : ",", i, watchpoint.portStart, watchpoint.portEnd, watchpoint.portMask,
+                    typeNames[watchpoint.watchType & 0x03],
+                    (watchpoint.actions & IO_WATCH_ACTION_LOG) != 0,
+                    (watchpoint.actions & IO_WATCH_ACTION_BREAK) != 0,
+                    watchpoint.hitCount);
+        strlcat(pBuf, tmpStr, maxLen);
+        first = false;
+    }
+    strlcat(pBuf, "]", maxLen);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Handle CommandInterface message
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool IOWatch::handleRxMsg(const char* pCmdJson, [[maybe_unused]]const uint8_t* pParams, [[maybe_unused]]int paramsLen,
+                char* pRespJson, int maxRespLen)
+{
+    // Get the command string from JSON
+    static const int MAX_CMD_NAME_STR = 100;
+    char cmdName[MAX_CMD_NAME_STR+1];
+    if (!jsonGetValueForKey("cmdName", pCmdJson, cmdName, MAX_CMD_NAME_STR))
+        return false;
+
+    if (strcasecmp(cmdName, "ioWatchSet") == 0)
+    {
+        // Ports (decimal or 0x prefixed hex) - end defaults to start
+        char argStr[MAX_CMD_NAME_STR+1];
+        uint32_t portStart = 0;
+        if (jsonGetValueForKey("port", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            portStart = strtoul(argStr, NULL, 0);
+        uint32_t portEnd = portStart;
+        if (jsonGetValueForKey("portEnd", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            portEnd = strtoul(argStr, NULL, 0);
+        uint32_t portMask = 0xff;
+        if (jsonGetValueForKey("mask", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            portMask = strtoul(argStr, NULL, 0);
+
+        // Access type
+        TargetWatchpointType watchType = TARGET_WATCHPOINT_ACCESS;
+        if (jsonGetValueForKey("type", pCmdJson, argStr, MAX_CMD_NAME_STR))
+        {
+            if (strcasecmp(argStr, "rd") == 0)
+                watchType = TARGET_WATCHPOINT_READ;
+            else if (strcasecmp(argStr, "wr") == 0)
+                watchType = TARGET_WATCHPOINT_WRITE;
+        }
+
+        // Actions
+        uint32_t actions = IO_WATCH_ACTION_LOG;
+        if (jsonGetValueForKey("action", pCmdJson, argStr, MAX_CMD_NAME_STR))
+        {
+            if (strcasecmp(argStr, "break") == 0)
+                actions = IO_WATCH_ACTION_BREAK;
+            else if (strcasecmp(argStr, "both") == 0)
+                actions = IO_WATCH_ACTION_LOG | IO_WATCH_ACTION_BREAK;
+        }
+
+        // Set
+        int idx = setWatchpoint(portStart & portMask, portEnd & portMask, portMask, watchType, actions);
+        if (idx < 0)
+        {
+            strlcpy(pRespJson, "\"err\":\"fail\"", maxRespLen);
+            return true;
+        }
+        ee_sprintf(pRespJson, "\"err\":\"ok\",\"idx\":%d", idx);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "ioWatchClear") == 0)
+    {
+        // Clear one or all
+        char argStr[MAX_CMD_NAME_STR+1];
+        if (jsonGetValueForKey("idx", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            clearWatchpoint(strtol(argStr, NULL, 10));
+        else
+            clearAll();
+        getStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "ioWatchStatus") == 0)
+    {
+        getStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,120 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include "../TargetBus/BusAccess.h"
+#include "../TargetBus/TargetBreakpoints.h"
+#include "../CommandInterface/CommandHandler.h"
+#include "../System/RingBufferPosn.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// IO watchpoint
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Actions on a hit
+static const uint32_t IO_WATCH_ACTION_LOG = 0x01;
+static const uint32_t IO_WATCH_ACTION_BREAK = 0x02;
+
+// Watches a range of ports - the port address is masked before comparing with the range so the
+// default mask of 0xff matches on the low 8 bits (as most Z80 hardware decodes)
+class IOWatchpoint
+{
+public:
+    bool inUse;
+    uint32_t portStart;
+    uint32_t portEnd;
+    uint32_t portMask;
+    TargetWatchpointType watchType;
+    uint32_t actions;
+    volatile uint32_t hitCount;
+
+    IOWatchpoint()
+    {
+        inUse = false;
+        portStart = 0;
+        portEnd = 0;
+        portMask = 0xff;
+        watchType = TARGET_WATCHPOINT_DISABLED;
+        actions = 0;
+        hitCount = 0;
+    }
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// IO watch - IORQ watchpoints which can log accesses (with the data value) and/or break the target
+// The log is a ring written in the wait handler and drained in bulk to the ESP32 in service()
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class IOWatch
+{
+public:
+    // Init
+    static void init();
+    static void service();
+
+    // Watchpoints - returns index or -1 if none free
+    static int setWatchpoint(uint32_t portStart, uint32_t portEnd, uint32_t portMask,
+                TargetWatchpointType watchType, uint32_t actions);
+    static void clearWatchpoint(int idx);
+    static void clearAll();
+
+    // Status
+    static void getStatusJson(char* pBuf, int maxLen);
+
+private:
+    // Bus socket we're attached to
+    static int _busSocketId;
+    static BusSocketInfo _busSocketInfo;
+
+    // Comms socket we're attached to
+    static int _commsSocketId;
+    static CommsSocketInfo _commsSocketInfo;
+
+    // Handle messages
+    static bool handleRxMsg(const char* pCmdJson, const uint8_t* pParams, int paramsLen,
+                    char* pRespJson, int maxRespLen);
+
+    // Wait interrupt handler
+    static void handleWaitInterruptStatic(uint32_t addr, uint32_t data,
+            uint32_t flags, uint32_t& retVal);
+
+    // Update bus socket enable and port filter after watchpoints change
+    static void updateBusSocket();
+
+    // Send log entries in binary
+    static uint32_t sendLogBin();
+
+    // Watchpoints
+    static const int MAX_IO_WATCHPOINTS = 16;
+    static IOWatchpoint _watchpoints[MAX_IO_WATCHPOINTS];
+
+    // Log
+    #pragma pack(push, 1)
+    struct IOWatchLogEntry
+    {
+        uint32_t cycles;
+        uint16_t port;
+        uint8_t data;
+        uint8_t flags;
+    };
+    #pragma pack(pop)
+    static const int MAX_IO_LOG_ENTRIES = 8192;
+    static IOWatchLogEntry _ioLog[MAX_IO_LOG_ENTRIES];
+    static RingBufferPosn _ioLogPosn;
+    static volatile uint32_t _ioLogCount;
+    static volatile uint32_t _ioLogDropped;
+
+    // Draining the log - entries are sent when a frame's worth has built up or after a short time
+    static const int MAX_IO_LOG_MSG_ENTRIES = 1000;
+    static const uint32_t MIN_IO_LOG_MSG_ENTRIES = 250;
+    static const uint32_t MAX_IO_LOG_DRAIN_INTERVAL_US = 100000;
+    static uint32_t _ioLogLastDrainUs;
+
+    // Tx chars available in tx buffer for bin frame transmission
+    static const int MIN_TX_AVAILABLE_FOR_BIN_FRAME = 16000;
+};
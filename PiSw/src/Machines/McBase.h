@@ -102,6 +102,13 @@ public:
     // Bus action complete callback
     virtual void busActionCompleteCallback(BR_BUS_ACTION actionType) = 0;
 
+    // Get IO ports (bitmap of low address byte) that busAccessCallback handles
+    // Returns false if all ports are of interest
+    virtual bool getIOPortFilter([[maybe_unused]] uint32_t* pPortBitmap)
+    {
+        return false;
+    }
+
     // Mirror change buffer max length
     static const int MAX_MIRROR_CHANGE_BUF_LEN = 5000;
 
@@ -57,7 +57,9 @@ BusSocketInfo McManager::_busSocketInfo =
     0,
     false,
     BR_BUS_ACTION_DISPLAY,
-    false
+    false,
+    // Bus cycles
+    BR_BUS_CYCLE_NONE_MASK
 };
 
 // Pending actions
@@ -133,7 +135,7 @@ void McManager::init(DisplayBase* pDisplay)
     
     // Connect to the bus socket
     if (_busSocketId < 0)
-        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo);
+        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo, "McManager");
 
     // Connect to the comms socket
     if (_commsSocketId < 0)
@@ -340,9 +342,14 @@ bool McManager::setupMachine(const char* mcJson)
     // Setup display
     pMc->setupDisplay(_pDisplay);
 
-    // Enable wait generation as required
+    // Enable wait generation and bus cycle handling as required
     BusAccess::waitOnIO(_busSocketId, _pCurMachine->getDescriptorTable()->monitorIORQ);
     BusAccess::waitOnMemory(_busSocketId, _pCurMachine->getDescriptorTable()->monitorMREQ);
+    BusAccess::busSocketSetCycles(_busSocketId, 
+                (_pCurMachine->getDescriptorTable()->monitorIORQ ? BR_BUS_CYCLE_IORQ_MASK : 0) |
+                (_pCurMachine->getDescriptorTable()->monitorMREQ ? BR_BUS_CYCLE_MREQ_MASK : 0));
+    uint32_t portFilter[BR_BUS_FILTER_BITMAP_WORDS];
+    BusAccess::busSocketSetIOPortFilter(_busSocketId, _pCurMachine->getIOPortFilter(portFilter) ? portFilter : NULL);
 
     // See if any files to load
     static const int MAX_FILE_NAME_LEN = 100;
@@ -360,6 +360,14 @@ void McTRS80::busAccessCallback([[maybe_unused]] uint32_t addr, [[maybe_unused]]
     }
 }
 
+// Get IO ports that busAccessCallback handles - joystick
+bool McTRS80::getIOPortFilter(uint32_t* pPortBitmap)
+{
+    BusSocketInfo::filterClear(pPortBitmap);
+    BusSocketInfo::filterSetRange(pPortBitmap, 0x13, 0x13);
+    return true;
+}
+
 // Bus action complete callback
 void McTRS80::busActionCompleteCallback(BR_BUS_ACTION actionType)
 {
@@ -47,6 +47,9 @@ public:
     // Bus action complete callback
     virtual void busActionCompleteCallback(BR_BUS_ACTION actionType);
 
+    // Get IO ports that busAccessCallback handles
+    virtual bool getIOPortFilter(uint32_t* pPortBitmap);
+
 private:
     void updateDisplayFromBuffer(uint8_t* pScrnBuffer, uint32_t bufLen);
     void handleWD1771DiskController(uint32_t addr, uint32_t data, uint32_t flags, uint32_t& retVal);
@@ -502,6 +502,15 @@ void McTerminal::busAccessCallback([[maybe_unused]] uint32_t addr, [[maybe_unuse
     }
 }
 
+// Get IO ports that busAccessCallback handles - 6850 UART emulation
+bool McTerminal::getIOPortFilter(uint32_t* pPortBitmap)
+{
+    BusSocketInfo::filterClear(pPortBitmap);
+    if (_emulate6850)
+        BusSocketInfo::filterSetRange(pPortBitmap, 0x80, 0xbf);
+    return true;
+}
+
 // Bus action complete callback
 void McTerminal::busActionCompleteCallback([[maybe_unused]] BR_BUS_ACTION actionType)
 {
@@ -65,6 +65,9 @@ public:
     // Bus action complete callback
     virtual void busActionCompleteCallback(BR_BUS_ACTION actionType);
 
+    // Get IO ports that busAccessCallback handles
+    virtual bool getIOPortFilter(uint32_t* pPortBitmap);
+
     // Convert raw USB code to key string
     static const char* convertRawToKeyString(unsigned char ucModifiers, const unsigned char rawKeys[6]);
 
@@ -552,6 +552,16 @@ void McZXSpectrum::busAccessCallback([[maybe_unused]] uint32_t addr, [[maybe_unu
     #endif
 }
 
+// Get IO ports that busAccessCallback handles - keyboard on even ports and Kempston joystick
+bool McZXSpectrum::getIOPortFilter(uint32_t* pPortBitmap)
+{
+    BusSocketInfo::filterClear(pPortBitmap);
+    for (uint32_t port = 0; port < 0x100; port += 2)
+        BusSocketInfo::filterSetRange(pPortBitmap, port, port);
+    BusSocketInfo::filterSetRange(pPortBitmap, 0x1f, 0x1f);
+    return true;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Bus actions
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -81,6 +81,9 @@ public:
     // Bus action complete callback
     virtual void busActionCompleteCallback(BR_BUS_ACTION actionType);
 
+    // Get IO ports that busAccessCallback handles
+    virtual bool getIOPortFilter(uint32_t* pPortBitmap);
+
 private:
     static uint32_t getKeyBitmap(const int* keyCodes, int keyCodesLen, const uint8_t currentKeyPresses[MAX_KEYS]);
     void updateDisplayFromBuffer(uint8_t* pScrnBuffer, uint32_t bufLen);
@@ -0,0 +1,765 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#include "Profiler.h"
+#include "../System/lowlev.h"
+#include "../System/lowlib.h"
+#include "../System/ee_sprintf.h"
+#include "../System/logging.h"
+#include "../System/rdutils.h"
+#include "../System/nmalloc.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Variables
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Module name
+static const char FromProfiler[] = "Profiler";
+
+// Sockets
+int Profiler::_busSocketId = -1;
+int Profiler::_commsSocketId = -1;
+
+// Main comms socket - to wire up command handler
+CommsSocketInfo Profiler::_commsSocketInfo =
+{
+    true,
+    Profiler::handleRxMsg,
+    NULL,
+    NULL
+};
+
+// Bus socket - waits on opcode fetches while profiling or on coverage (and memory reads and writes
+// for data access coverage)
+BusSocketInfo Profiler::_busSocketInfo =
+{
+    false,
+    Profiler::handleWaitInterruptStatic,
+    Profiler::busActionCompleteStatic,
+    true,
+    false,
+    // Reset
+    false,
+    0,
+    // NMI
+    false,
+    0,
+    // IRQ
+    false,
+    0,
+    false,
+    BR_BUS_ACTION_GENERAL,
+    false,
+    // Bus cycles
+    BR_BUS_CYCLE_M1_MASK
+};
+
+// Counters
+uint32_t* Profiler::_pCounterPages[MAX_PAGES];
+volatile uint32_t Profiler::_numPagesActive = 0;
+volatile bool Profiler::_profileRunning = false;
+volatile uint32_t Profiler::_sampleCount = 0;
+volatile uint32_t Profiler::_outsideCount = 0;
+uint32_t Profiler::_prefixPending = 0;
+
+// Symbols
+Profiler::ProfilerSymbol* Profiler::_pSymbols = NULL;
+int Profiler::_numSymbols = 0;
+
+// Coverage
+uint32_t* Profiler::_pCoverage[PROFILER_COVERAGE_NUM_TYPES];
+volatile bool Profiler::_coverageRunning = false;
+bool Profiler::_coverageDataAccess = false;
+bool Profiler::_coverageClearOnReset = true;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Init
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Profiler::init()
+{
+    // Symbol table - buffers are from the heap directly as new is assumed never to fail so its result
+    // can't be checked
+    if (!_pSymbols)
+        _pSymbols = (ProfilerSymbol*)nmalloc_malloc(MAX_SYMBOLS * sizeof(ProfilerSymbol));
+
+    // Connect to the bus socket (added disabled - only enabled while profiling)
+    if (_busSocketId < 0)
+        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo, "Profiler");
+
+    // Connect to the comms socket
+    if (_commsSocketId < 0)
+        _commsSocketId = CommandHandler::commsSocketAdd(_commsSocketInfo);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Control
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Profiler::start(uint32_t numPages, bool clearCounts)
+{
+    if (_busSocketId < 0)
+        return false;
+
+    // Stop while the counters are changed
+    _profileRunning = false;
+    updateBusSocket();
+
+    // Allocate counter pages (pages stay allocated once used)
+    if (numPages < 1)
+        numPages = 1;
+    if (numPages > MAX_PAGES)
+        numPages = MAX_PAGES;
+    for (uint32_t page = 0; page < numPages; page++)
+    {
+        if (_pCounterPages[page])
+            continue;
+        _pCounterPages[page] = (uint32_t*)nmalloc_malloc(ADDRS_PER_PAGE * sizeof(uint32_t));
+        if (!_pCounterPages[page])
+        {
+            LogWrite(FromProfiler, LOG_WARNING, "Can't allocate counter page %u", page);
+            return false;
+        }
+        memset(_pCounterPages[page], 0, ADDRS_PER_PAGE * sizeof(uint32_t));
+    }
+    _numPagesActive = numPages;
+    if (clearCounts)
+        Profiler::clearCounts();
+
+    // Start
+    _prefixPending = 0;
+    _profileRunning = true;
+    updateBusSocket();
+    LogWrite(FromProfiler, LOG_DEBUG, "Started pages %u", numPages);
+    return true;
+}
+
+void Profiler::stop()
+{
+    _profileRunning = false;
+    updateBusSocket();
+}
+
+void Profiler::clearCounts()
+{
+    for (uint32_t page = 0; page < MAX_PAGES; page++)
+        if (_pCounterPages[page])
+            memset(_pCounterPages[page], 0, ADDRS_PER_PAGE * sizeof(uint32_t));
+    _sampleCount = 0;
+    _outsideCount = 0;
+}
+
+bool Profiler::coverageStart(bool dataAccess, bool clearOnReset)
+{
+    if (_busSocketId < 0)
+        return false;
+
+    // Allocate bitmaps (they stay allocated once used)
+    _coverageRunning = false;
+    for (int i = 0; i < PROFILER_COVERAGE_NUM_TYPES; i++)
+    {
+        if ((i != PROFILER_COVERAGE_EXEC) && !dataAccess)
+            continue;
+        if (_pCoverage[i])
+            continue;
+        _pCoverage[i] = (uint32_t*)nmalloc_malloc(COVERAGE_BITMAP_WORDS * sizeof(uint32_t));
+        if (!_pCoverage[i])
+        {
+            LogWrite(FromProfiler, LOG_WARNING, "Can't allocate coverage bitmap %d", i);
+            return false;
+        }
+        memset(_pCoverage[i], 0, COVERAGE_BITMAP_WORDS * sizeof(uint32_t));
+    }
+    _coverageDataAccess = dataAccess;
+    _coverageClearOnReset = clearOnReset;
+
+    // Start
+    _coverageRunning = true;
+    updateBusSocket();
+    LogWrite(FromProfiler, LOG_DEBUG, "Coverage started data %d clearOnReset %d", dataAccess, clearOnReset);
+    return true;
+}
+
+void Profiler::coverageStop()
+{
+    _coverageRunning = false;
+    updateBusSocket();
+}
+
+void Profiler::coverageClear()
+{
+    for (int i = 0; i < PROFILER_COVERAGE_NUM_TYPES; i++)
+        if (_pCoverage[i])
+            memset(_pCoverage[i], 0, COVERAGE_BITMAP_WORDS * sizeof(uint32_t));
+}
+
+void Profiler::updateBusSocket()
+{
+    if (_busSocketId < 0)
+        return;
+    uint32_t busCycles = BR_BUS_CYCLE_M1_MASK;
+    if (_coverageRunning && _coverageDataAccess)
+        busCycles |= BR_BUS_CYCLE_MREQ_RD_MASK | BR_BUS_CYCLE_MREQ_WR_MASK;
+    BusAccess::busSocketSetCycles(_busSocketId, busCycles);
+    BusAccess::busSocketEnable(_busSocketId, _profileRunning || _coverageRunning);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Wait interrupt handler
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Profiler::handleWaitInterruptStatic(uint32_t addr, uint32_t data,
+        uint32_t flags, uint32_t& retVal)
+{
+    // Coverage
+    if (_coverageRunning)
+    {
+        uint32_t bitIdx = addr % COVERAGE_ADDR_SPACE;
+        ProfilerCoverageType coverageType = PROFILER_COVERAGE_EXEC;
+        if ((flags & BR_CTRL_BUS_M1_MASK) == 0)
+            coverageType = (flags & BR_CTRL_BUS_WR_MASK) ? PROFILER_COVERAGE_WRITE : PROFILER_COVERAGE_READ;
+        _pCoverage[coverageType][bitIdx / 32] |= 1u << (bitIdx % 32);
+    }
+    if (!_profileRunning || ((flags & BR_CTRL_BUS_M1_MASK) == 0))
+        return;
+
+    // Opcode is the value returned by another socket if there is one (this socket is added after
+    // the others so their callbacks have been made)
+    uint32_t opcode = data;
+    if ((retVal & BR_MEM_ACCESS_RSLT_NOT_DECODED) == 0)
+        opcode = retVal;
+    opcode &= 0xff;
+
+    // Only the first fetch of an instruction is counted - a CB or ED prefix is followed by one more
+    // fetch, DD and FD by one more (which may be another prefix - after DD CB the rest are reads)
+    uint32_t prefix = _prefixPending;
+    _prefixPending = 0;
+    bool isPrefix = (opcode == 0xcb) || (opcode == 0xdd) || (opcode == 0xed) || (opcode == 0xfd);
+    if (isPrefix && ((prefix == 0) || (((prefix == 0xdd) || (prefix == 0xfd)) && (opcode != 0xcb))))
+        _prefixPending = opcode;
+    if (prefix != 0)
+        return;
+
+    // Count
+    uint32_t page = addr / ADDRS_PER_PAGE;
+    if (page < _numPagesActive)
+        _pCounterPages[page][addr % ADDRS_PER_PAGE]++;
+    else
+        _outsideCount = _outsideCount + 1;
+    _sampleCount = _sampleCount + 1;
+}
+
+void Profiler::busActionCompleteStatic(BR_BUS_ACTION actionType, [[maybe_unused]] BR_BUS_ACTION_REASON reason)
+{
+    // Coverage is since the target was last reset
+    if ((actionType == BR_BUS_ACTION_RESET) && _coverageRunning && _coverageClearOnReset)
+        coverageClear();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Symbols
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Profiler::clearSymbols()
+{
+    _numSymbols = 0;
+}
+
+uint32_t Profiler::addSymbols(const char* pText, int textLen)
+{
+    uint32_t numAdded = 0;
+    int lineStart = 0;
+    while (lineStart < textLen)
+    {
+        int lineEnd = lineStart;
+        while ((lineEnd < textLen) && (pText[lineEnd] != '\n') && (pText[lineEnd] != '\r') && (pText[lineEnd] != 0))
+            lineEnd++;
+        uint32_t addr = 0;
+        const char* pName = NULL;
+        int nameLen = 0;
+        if (parseSymbolLine(pText + lineStart, lineEnd - lineStart, addr, pName, nameLen))
+        {
+            if (!addSymbol(addr, pName, nameLen))
+                break;
+            numAdded++;
+        }
+        lineStart = lineEnd + 1;
+    }
+    LogWrite(FromProfiler, LOG_DEBUG, "Added %u symbols total %d", numAdded, _numSymbols);
+    return numAdded;
+}
+
+static bool isSymbolNameChar(char c)
+{
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')) ||
+                (c == '_') || (c == '.') || (c == '@') || (c == '?');
+}
+
+static bool isSymbolAddrStart(char c)
+{
+    return ((c >= '0') && (c <= '9')) || (c == '$');
+}
+
+static bool parseSymbolAddr(const char* pStr, int len, uint32_t& addr)
+{
+    // Hex with optional 0x, $ or trailing h
+    if ((len > 0) && (*pStr == '$'))
+    {
+        pStr++;
+        len--;
+    }
+    if ((len > 0) && ((pStr[len-1] == 'h') || (pStr[len-1] == 'H')))
+        len--;
+    if ((len >= 2) && (pStr[0] == '0') && ((pStr[1] == 'x') || (pStr[1] == 'X')))
+    {
+        pStr += 2;
+        len -= 2;
+    }
+    if (len == 0)
+        return false;
+    addr = 0;
+    for (int i = 0; i < len; i++)
+    {
+        char c = rdtoupper(pStr[i]);
+        if ((c >= '0') && (c <= '9'))
+            addr = (addr << 4) + (c - '0');
+        else if ((c >= 'A') && (c <= 'F'))
+            addr = (addr << 4) + (c - 'A' + 10);
+        else
+            return false;
+    }
+    return true;
+}
+
+bool Profiler::parseSymbolLine(const char* pLine, int lineLen, uint32_t& addr, const char*& pName, int& nameLen)
+{
+    // Split into up to three tokens - a colon after a label, = and EQU are separators
+    const char* pTokens[3];
+    int tokenLens[3];
+    int numTokens = 0;
+    int pos = 0;
+    while ((pos < lineLen) && (numTokens < 3))
+    {
+        while ((pos < lineLen) && (rdisspace(pLine[pos]) || (pLine[pos] == ':') || (pLine[pos] == '=')))
+            pos++;
+        if ((pos >= lineLen) || (pLine[pos] == ';'))
+            break;
+        int tokenStart = pos;
+        while ((pos < lineLen) && !rdisspace(pLine[pos]) && (pLine[pos] != ':') && (pLine[pos] != '=') && (pLine[pos] != ';'))
+            pos++;
+        if ((pos - tokenStart == 3) && (strncasecmp(pLine + tokenStart, "equ", 3) == 0))
+            continue;
+        pTokens[numTokens] = pLine + tokenStart;
+        tokenLens[numTokens] = pos - tokenStart;
+        numTokens++;
+    }
+    if (numTokens < 2)
+        return false;
+
+    // Address then name or name then address - a token starting with a digit or $ is taken as the
+    // address first as names like "add" are also valid hex (which is only accepted as an address on
+    // a line of just address and name)
+    int addrIdx = 0;
+    if (!isSymbolAddrStart(pTokens[0][0]))
+    {
+        if (isSymbolAddrStart(pTokens[1][0]))
+            addrIdx = 1;
+        else if (numTokens != 2)
+            return false;
+        else if (!parseSymbolAddr(pTokens[0], tokenLens[0], addr))
+            addrIdx = 1;
+    }
+    if (!parseSymbolAddr(pTokens[addrIdx], tokenLens[addrIdx], addr))
+        return false;
+    int nameIdx = 1 - addrIdx;
+    for (int i = 0; i < tokenLens[nameIdx]; i++)
+        if (!isSymbolNameChar(pTokens[nameIdx][i]))
+            return false;
+    pName = pTokens[nameIdx];
+    nameLen = tokenLens[nameIdx];
+    return true;
+}
+
+bool Profiler::addSymbol(uint32_t addr, const char* pName, int nameLen)
+{
+    if (!_pSymbols || (_numSymbols >= MAX_SYMBOLS))
+        return false;
+
+    // Insert in address order (replacing a symbol at the same address)
+    int insertPos = _numSymbols;
+    while ((insertPos > 0) && (_pSymbols[insertPos-1].addr > addr))
+        insertPos--;
+    if ((insertPos > 0) && (_pSymbols[insertPos-1].addr == addr))
+    {
+        insertPos--;
+    }
+    else
+    {
+        for (int i = _numSymbols; i > insertPos; i--)
+            _pSymbols[i] = _pSymbols[i-1];
+        _numSymbols++;
+    }
+    if (nameLen >= MAX_SYMBOL_NAME_LEN)
+        nameLen = MAX_SYMBOL_NAME_LEN - 1;
+    _pSymbols[insertPos].addr = addr;
+    memcpy(_pSymbols[insertPos].name, pName, nameLen);
+    _pSymbols[insertPos].name[nameLen] = 0;
+    return true;
+}
+
+int Profiler::findSymbol(uint32_t addr)
+{
+    // Index of the symbol at or before the address (-1 if none)
+    int lo = 0;
+    int hi = _numSymbols - 1;
+    int found = -1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (_pSymbols[mid].addr <= addr)
+        {
+            found = mid;
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Results
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t Profiler::topListAdd(ProfilerTopItem* pList, uint32_t listLen, uint32_t maxItems,
+            uint32_t idx, uint32_t count)
+{
+    // Returns the new list length
+    if ((count == 0) || ((listLen == maxItems) && (count <= pList[listLen-1].count)))
+        return listLen;
+    uint32_t pos = (listLen < maxItems) ? listLen++ : listLen - 1;
+    while ((pos > 0) && (pList[pos-1].count < count))
+    {
+        pList[pos] = pList[pos-1];
+        pos--;
+    }
+    pList[pos].idx = idx;
+    pList[pos].count = count;
+    return listLen;
+}
+
+void Profiler::getStatusJson(char* pBuf, int maxLen)
+{
+    char tmpStr[200];
+    ee_sprintf(tmpStr, "\"err\":\"ok\",\"running\":%d,\"pages\":%u,\"samples\":%u,\"outside\":%u,\"symbols\":%d",
+                _profileRunning, _numPagesActive, _sampleCount, _outsideCount, _numSymbols);
+    strlcpy(pBuf, tmpStr, maxLen);
+}
+
+void Profiler::getTopAddrsJson(uint32_t maxItems, char* pBuf, int maxLen)
+{
+    if ((maxItems == 0) || (maxItems > MAX_TOP_ITEMS))
+        maxItems = MAX_TOP_ITEMS;
+
+    // Find hottest addresses
+    ProfilerTopItem topList[MAX_TOP_ITEMS];
+    uint32_t listLen = 0;
+    for (uint32_t page = 0; page < _numPagesActive; page++)
+    {
+        const uint32_t* pCounts = _pCounterPages[page];
+        for (uint32_t i = 0; i < ADDRS_PER_PAGE; i++)
+            if (pCounts[i] != 0)
+                listLen = topListAdd(topList, listLen, maxItems, page * ADDRS_PER_PAGE + i, pCounts[i]);
+    }
+
+    // Format with symbol and offset if known
+    char tmpStr[200];
+    ee_sprintf(tmpStr, "\"err\":\"ok\",\"samples\":%u,\"top\":[", _sampleCount);
+    strlcpy(pBuf, tmpStr, maxLen);
+    for (uint32_t i = 0; i < listLen; i++)
+    {
+        ee_sprintf(tmpStr, "%s{\"addr\":\"0x%04x\",\"count\":%u", (i == 0) ? "" : ",", topList[i].idx, topList[i].count);
+        strlcat(pBuf, tmpStr, maxLen);
+        int symIdx = findSymbol(topList[i].idx);
+        if (symIdx >= 0)
+        {
+            ee_sprintf(tmpStr, ",\"sym\":\"%s\",\"offset\":%u", _pSymbols[symIdx].name,
+                        topList[i].idx - _pSymbols[symIdx].addr);
+            strlcat(pBuf, tmpStr, maxLen);
+        }
+        strlcat(pBuf, "}", maxLen);
+    }
+    strlcat(pBuf, "]", maxLen);
+}
+
+void Profiler::getTopFunctionsJson(uint32_t maxItems, char* pBuf, int maxLen)
+{
+    if ((maxItems == 0) || (maxItems > MAX_TOP_ITEMS))
+        maxItems = MAX_TOP_ITEMS;
+
+    // Each symbol covers the addresses up to the next symbol
+    ProfilerTopItem topList[MAX_TOP_ITEMS];
+    uint32_t listLen = 0;
+    uint32_t addrLimit = _numPagesActive * ADDRS_PER_PAGE;
+    for (int symIdx = 0; symIdx < _numSymbols; symIdx++)
+    {
+        uint32_t endAddr = (symIdx + 1 < _numSymbols) ? _pSymbols[symIdx+1].addr : addrLimit;
+        if (endAddr > addrLimit)
+            endAddr = addrLimit;
+        uint32_t total = 0;
+        for (uint32_t addr = _pSymbols[symIdx].addr; addr < endAddr; addr++)
+            total += getCount(addr);
+        listLen = topListAdd(topList, listLen, maxItems, symIdx, total);
+    }
+
+    // Format
+    char tmpStr[200];
+    ee_sprintf(tmpStr, "\"err\":\"ok\",\"samples\":%u,\"funcs\":[", _sampleCount);
+    strlcpy(pBuf, tmpStr, maxLen);
+    for (uint32_t i = 0; i < listLen; i++)
+    {
+        const ProfilerSymbol& sym = _pSymbols[topList[i].idx];
+        ee_sprintf(tmpStr, "%s{\"sym\":\"%s\",\"addr\":\"0x%04x\",\"count\":%u}", (i == 0) ? "" : ",",
+                    sym.name, sym.addr, topList[i].count);
+        strlcat(pBuf, tmpStr, maxLen);
+    }
+    strlcat(pBuf, "]", maxLen);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Coverage results
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t Profiler::getCoverageAddrCount(ProfilerCoverageType coverageType)
+{
+    const uint32_t* pBitmap = _pCoverage[coverageType];
+    if (!pBitmap)
+        return 0;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < COVERAGE_BITMAP_WORDS; i++)
+        if (pBitmap[i])
+            count += __builtin_popcount(pBitmap[i]);
+    return count;
+}
+
+void Profiler::getCoverageStatusJson(char* pBuf, int maxLen)
+{
+    char tmpStr[200];
+    ee_sprintf(tmpStr, "\"err\":\"ok\",\"running\":%d,\"data\":%d,\"clearOnReset\":%d,\"exec\":%u,\"read\":%u,\"write\":%u",
+                _coverageRunning, _coverageDataAccess, _coverageClearOnReset,
+                getCoverageAddrCount(PROFILER_COVERAGE_EXEC), getCoverageAddrCount(PROFILER_COVERAGE_READ),
+                getCoverageAddrCount(PROFILER_COVERAGE_WRITE));
+    strlcpy(pBuf, tmpStr, maxLen);
+}
+
+uint32_t Profiler::packBits(const uint8_t* pIn, uint32_t inLen, uint8_t* pOut)
+{
+    // PackBits - a header byte of 0..127 is followed by that plus one literal bytes and 129..255 by
+    // one byte repeated 257 minus the header times - returns the encoded length
+    uint32_t inPos = 0;
+    uint32_t outPos = 0;
+    while (inPos < inLen)
+    {
+        // Repeat
+        uint32_t runLen = 1;
+        while ((inPos + runLen < inLen) && (runLen < 128) && (pIn[inPos + runLen] == pIn[inPos]))
+            runLen++;
+        if (runLen > 1)
+        {
+            pOut[outPos++] = 257 - runLen;
+            pOut[outPos++] = pIn[inPos];
+            inPos += runLen;
+            continue;
+        }
+
+        // Literal - up to the start of a run of three or more
+        uint32_t litLen = 1;
+        while ((inPos + litLen < inLen) && (litLen < 128))
+        {
+            if ((inPos + litLen + 2 < inLen) && (pIn[inPos + litLen] == pIn[inPos + litLen + 1]) &&
+                        (pIn[inPos + litLen] == pIn[inPos + litLen + 2]))
+                break;
+            litLen++;
+        }
+        pOut[outPos++] = litLen - 1;
+        memcpy(pOut + outPos, pIn + inPos, litLen);
+        outPos += litLen;
+        inPos += litLen;
+    }
+    return outPos;
+}
+
+uint32_t Profiler::sendCoverageBin(ProfilerCoverageType coverageType, uint32_t startByte, uint32_t endByte)
+{
+    // Bitmap bytes to send (bit 0 of byte 0 is address 0) - start and len in the header are addresses
+    const uint8_t* pBitmap = (const uint8_t*)_pCoverage[coverageType];
+    if (!pBitmap || (startByte >= endByte))
+        return 0;
+    uint32_t bitmapLen = endByte - startByte;
+    if (bitmapLen > MAX_COVERAGE_MSG_BITMAP_BYTES)
+        bitmapLen = MAX_COVERAGE_MSG_BITMAP_BYTES;
+
+    // Compress after the JSON header
+    static const char* typeNames[] = { "exec", "read", "write" };
+    static const int JSON_HEADER_MAX_LEN = 200;
+    static char jsonFrame[JSON_HEADER_MAX_LEN + MAX_COVERAGE_MSG_COMPRESSED_LEN];
+    static uint8_t encBuf[MAX_COVERAGE_MSG_COMPRESSED_LEN];
+    uint32_t binDataLen = packBits(pBitmap + startByte, bitmapLen, encBuf);
+    ee_sprintf(jsonFrame, "{\"cmdName\":\"coverageBinData\",\"type\":\"%s\",\"enc\":\"packbits\",\"start\":%u,\"len\":%u,\"dataLen\":%u}",
+                typeNames[coverageType], startByte * 8, bitmapLen * 8, binDataLen);
+    memcopyfast(jsonFrame+strlen(jsonFrame)+1, encBuf, binDataLen);
+    CommandHandler::sendWithJSON("rdp", "", 0, (const uint8_t*)jsonFrame, strlen(jsonFrame)+1+binDataLen);
+    return bitmapLen;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Handle CommandInterface message
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Profiler::handleRxMsg(const char* pCmdJson, const uint8_t* pParams, int paramsLen,
+                char* pRespJson, int maxRespLen)
+{
+    // Get the command string from JSON
+    static const int MAX_CMD_NAME_STR = 100;
+    char cmdName[MAX_CMD_NAME_STR+1];
+    if (!jsonGetValueForKey("cmdName", pCmdJson, cmdName, MAX_CMD_NAME_STR))
+        return false;
+
+    if (strcasecmp(cmdName, "profileStart") == 0)
+    {
+        // Pages of 64K addresses to count (1 for Z80, up to 16 for Z180) and whether to clear
+        char argStr[MAX_CMD_NAME_STR+1];
+        uint32_t numPages = 1;
+        if (jsonGetValueForKey("pages", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            numPages = strtoul(argStr, NULL, 0);
+        bool clear = true;
+        if (jsonGetValueForKey("clear", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            clear = strtol(argStr, NULL, 10) != 0;
+        if (!start(numPages, clear))
+        {
+            strlcpy(pRespJson, "\"err\":\"fail\"", maxRespLen);
+            return true;
+        }
+        getStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "profileStop") == 0)
+    {
+        stop();
+        getStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "profileClear") == 0)
+    {
+        clearCounts();
+        getStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "profileStatus") == 0)
+    {
+        getStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "profileTop") == 0)
+    {
+        // Hottest addresses
+        char argStr[MAX_CMD_NAME_STR+1];
+        uint32_t maxItems = DEFAULT_TOP_ITEMS;
+        if (jsonGetValueForKey("n", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            maxItems = strtoul(argStr, NULL, 10);
+        getTopAddrsJson(maxItems, pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "profileFuncs") == 0)
+    {
+        // Busiest functions (needs symbols)
+        char argStr[MAX_CMD_NAME_STR+1];
+        uint32_t maxItems = DEFAULT_TOP_ITEMS;
+        if (jsonGetValueForKey("n", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            maxItems = strtoul(argStr, NULL, 10);
+        getTopFunctionsJson(maxItems, pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "profileSymbols") == 0)
+    {
+        // Symbol map text follows the JSON - sent in chunks with clear set on the first
+        char argStr[MAX_CMD_NAME_STR+1];
+        if (jsonGetValueForKey("clear", pCmdJson, argStr, MAX_CMD_NAME_STR) && (strtol(argStr, NULL, 10) != 0))
+            clearSymbols();
+        uint32_t numAdded = 0;
+        if (pParams && (paramsLen > 0))
+            numAdded = addSymbols((const char*)pParams, paramsLen);
+        ee_sprintf(pRespJson, "\"err\":\"ok\",\"added\":%u,\"symbols\":%d", numAdded, _numSymbols);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "coverageStart") == 0)
+    {
+        // Data access (reads and writes) as well as execution and whether cleared on target reset
+        char argStr[MAX_CMD_NAME_STR+1];
+        bool dataAccess = false;
+        if (jsonGetValueForKey("data", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            dataAccess = strtol(argStr, NULL, 10) != 0;
+        bool clearOnReset = true;
+        if (jsonGetValueForKey("clearOnReset", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            clearOnReset = strtol(argStr, NULL, 10) != 0;
+        if (!coverageStart(dataAccess, clearOnReset))
+        {
+            strlcpy(pRespJson, "\"err\":\"fail\"", maxRespLen);
+            return true;
+        }
+        getCoverageStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "coverageStop") == 0)
+    {
+        coverageStop();
+        getCoverageStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "coverageClear") == 0)
+    {
+        coverageClear();
+        getCoverageStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "coverageStatus") == 0)
+    {
+        getCoverageStatusJson(pRespJson, maxRespLen);
+        return true;
+    }
+    else if (strcasecmp(cmdName, "coverageGetBin") == 0)
+    {
+        // Check if we would be able to transmit without issues
+        if (CommandHandler::getTxAvailable() < MIN_TX_AVAILABLE_FOR_BIN_FRAME)
+        {
+            strlcpy(pRespJson, "\"err\":\"busy\"", maxRespLen);
+            return true;
+        }
+
+        // Bitmap type and address range (a frame holds up to 64K addresses - the host asks again
+        // from start plus the len returned)
+        char argStr[MAX_CMD_NAME_STR+1];
+        ProfilerCoverageType coverageType = PROFILER_COVERAGE_EXEC;
+        if (jsonGetValueForKey("type", pCmdJson, argStr, MAX_CMD_NAME_STR))
+        {
+            if (strcasecmp(argStr, "read") == 0)
+                coverageType = PROFILER_COVERAGE_READ;
+            else if (strcasecmp(argStr, "write") == 0)
+                coverageType = PROFILER_COVERAGE_WRITE;
+        }
+        uint32_t startAddr = 0;
+        if (jsonGetValueForKey("start", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            startAddr = strtoul(argStr, NULL, 0);
+        uint32_t endAddr = STD_TARGET_MEMORY_LEN;
+        if (jsonGetValueForKey("end", pCmdJson, argStr, MAX_CMD_NAME_STR))
+            endAddr = strtoul(argStr, NULL, 0);
+        if (endAddr > COVERAGE_ADDR_SPACE)
+            endAddr = COVERAGE_ADDR_SPACE;
+        uint32_t bytesSent = sendCoverageBin(coverageType, startAddr / 8, (endAddr + 7) / 8);
+        ee_sprintf(pRespJson, "\"err\":\"ok\",\"start\":%u,\"len\":%u", startAddr & ~7, bytesSent * 8);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,147 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include "../TargetBus/BusAccess.h"
+#include "../CommandInterface/CommandHandler.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Profiler - counts the address of each instruction fetched (M1 cycles other than those after a prefix)
+// while the target runs, so the hot addresses and (with a symbol map loaded) the busiest functions can be
+// found without stepping
+//
+// Counters are in 64K address pages allocated when profiling starts - one page covers the Z80 and up to
+// 16 pages cover the 1MB address space of the Z180
+//
+// Coverage uses the same bus socket to set a bit for every address fetched under M1 (and optionally read
+// or written) since it was started, cleared or the target reset - the bitmaps are sent to the host
+// PackBits compressed
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Coverage bitmaps
+enum ProfilerCoverageType
+{
+    PROFILER_COVERAGE_EXEC,
+    PROFILER_COVERAGE_READ,
+    PROFILER_COVERAGE_WRITE,
+    PROFILER_COVERAGE_NUM_TYPES
+};
+
+class Profiler
+{
+public:
+    // Init
+    static void init();
+
+    // Start (counting in numPages 64K pages of addresses) and stop
+    static bool start(uint32_t numPages, bool clearCounts);
+    static void stop();
+    static void clearCounts();
+
+    // Coverage - data access coverage (reads and writes) waits on all memory cycles so is optional
+    static bool coverageStart(bool dataAccess, bool clearOnReset);
+    static void coverageStop();
+    static void coverageClear();
+
+    // Symbols - text lines of "addr name" or "name = addr" (or "name equ addr") - addresses are hex
+    // with optional 0x, $ or h
+    static void clearSymbols();
+    static uint32_t addSymbols(const char* pText, int textLen);
+
+    // Results
+    static void getStatusJson(char* pBuf, int maxLen);
+    static void getTopAddrsJson(uint32_t maxItems, char* pBuf, int maxLen);
+    static void getTopFunctionsJson(uint32_t maxItems, char* pBuf, int maxLen);
+    static void getCoverageStatusJson(char* pBuf, int maxLen);
+
+private:
+    // Bus socket we're attached to
+    static int _busSocketId;
+    static BusSocketInfo _busSocketInfo;
+
+    // Comms socket we're attached to
+    static int _commsSocketId;
+    static CommsSocketInfo _commsSocketInfo;
+
+    // Handle messages
+    static bool handleRxMsg(const char* pCmdJson, const uint8_t* pParams, int paramsLen,
+                    char* pRespJson, int maxRespLen);
+
+    // Wait interrupt handler
+    static void handleWaitInterruptStatic(uint32_t addr, uint32_t data,
+            uint32_t flags, uint32_t& retVal);
+
+    // Bus action complete callback
+    static void busActionCompleteStatic(BR_BUS_ACTION actionType, BR_BUS_ACTION_REASON reason);
+
+    // Update bus socket enable and cycles after profiling or coverage starts or stops
+    static void updateBusSocket();
+
+    // Counter pages
+    static const uint32_t ADDRS_PER_PAGE = 0x10000;
+    static const uint32_t MAX_PAGES = 16;
+    static uint32_t* _pCounterPages[MAX_PAGES];
+    static volatile uint32_t _numPagesActive;
+    static volatile bool _profileRunning;
+    static volatile uint32_t _sampleCount;
+    static volatile uint32_t _outsideCount;
+    static uint32_t getCount(uint32_t addr)
+    {
+        uint32_t page = addr / ADDRS_PER_PAGE;
+        if ((page >= _numPagesActive) || !_pCounterPages[page])
+            return 0;
+        return _pCounterPages[page][addr % ADDRS_PER_PAGE];
+    }
+
+    // Prefix of the instruction being fetched (0 if the next M1 is the first byte of an instruction)
+    static uint32_t _prefixPending;
+
+    // Symbols - kept sorted by address
+    static const int MAX_SYMBOLS = 4096;
+    static const int MAX_SYMBOL_NAME_LEN = 32;
+    struct ProfilerSymbol
+    {
+        uint32_t addr;
+        char name[MAX_SYMBOL_NAME_LEN];
+    };
+    static ProfilerSymbol* _pSymbols;
+    static int _numSymbols;
+    static bool addSymbol(uint32_t addr, const char* pName, int nameLen);
+    static bool parseSymbolLine(const char* pLine, int lineLen, uint32_t& addr, const char*& pName, int& nameLen);
+    static int findSymbol(uint32_t addr);
+
+    // Top N list - kept in descending count order
+    static const uint32_t MAX_TOP_ITEMS = 40;
+    static const uint32_t DEFAULT_TOP_ITEMS = 20;
+    struct ProfilerTopItem
+    {
+        uint32_t idx;
+        uint32_t count;
+    };
+    static uint32_t topListAdd(ProfilerTopItem* pList, uint32_t listLen, uint32_t maxItems,
+                uint32_t idx, uint32_t count);
+
+    // Coverage bitmaps (allocated on first use) covering the 1MB address space
+    static const uint32_t COVERAGE_ADDR_SPACE = MAX_PAGES * ADDRS_PER_PAGE;
+    static const uint32_t COVERAGE_BITMAP_WORDS = COVERAGE_ADDR_SPACE / 32;
+    static uint32_t* _pCoverage[PROFILER_COVERAGE_NUM_TYPES];
+    static volatile bool _coverageRunning;
+    static bool _coverageDataAccess;
+    static bool _coverageClearOnReset;
+    static uint32_t getCoverageAddrCount(ProfilerCoverageType coverageType);
+
+    // Send coverage bitmap bytes from startByte in a PackBits compressed binary frame - returns the
+    // number of bitmap bytes sent
+    static const uint32_t MAX_COVERAGE_MSG_BITMAP_BYTES = 8192;
+    static const uint32_t MAX_COVERAGE_MSG_COMPRESSED_LEN = MAX_COVERAGE_MSG_BITMAP_BYTES + MAX_COVERAGE_MSG_BITMAP_BYTES / 128 + 1;
+    static uint32_t sendCoverageBin(ProfilerCoverageType coverageType, uint32_t startByte, uint32_t endByte);
+    static uint32_t packBits(const uint8_t* pIn, uint32_t inLen, uint8_t* pOut);
+
+    // Tx chars available in tx buffer for bin frame transmission
+    static const int MIN_TX_AVAILABLE_FOR_BIN_FRAME = 16000;
+};
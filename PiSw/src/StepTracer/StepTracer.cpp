@@ -7,7 +7,6 @@
 #include "../System/ee_sprintf.h"
 #include "../System/logging.h"
 #include "../System/rdutils.h"
-#include "libz80/z80.h"
 
 // Uncomment the following line to use SPI0 CE0 of the Pi as a debug pin
 // #define USE_PI_SPI0_CE0_AS_DEBUG_PIN 1
@@ -33,7 +32,6 @@ int StepTracer::_busSocketId = -1;
 int StepTracer::_commsSocketId = -1;
 
 // Step tracer
-StepTracerCycle StepTracer::_stepCycles[MAX_STEP_CYCLES_FOR_INSTR];
 int StepTracer::_stepCycleCount = 0;
 int StepTracer::_stepCyclePos = 0;
 BusSocketInfo StepTracer::_busSocketInfo = 
@@ -54,7 +52,9 @@ BusSocketInfo StepTracer::_busSocketInfo =
     0,
     false,
     BR_BUS_ACTION_GENERAL,
-    false
+    false,
+    // Bus cycles
+    BR_BUS_CYCLE_ALL_MASK
 };
 
 // This instance
@@ -86,11 +86,8 @@ StepTracer::StepTracer() :
     _pTracerMemory = NULL;    
 #endif
 
-    // Set Z80 CPU callbacks
-    _cpu_z80.ioRead = io_read;
-	_cpu_z80.ioWrite = io_write;
-	_cpu_z80.memRead = mem_read;
-	_cpu_z80.memWrite = mem_write;
+    // Set Z80 bus cycle generator callbacks
+    _cycleGen.setAccessFns(mem_read, mem_write, io_read, io_write);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -207,7 +204,7 @@ void StepTracer::start(bool logging, bool recordAll, bool compareToEmulated, boo
 
     // Connect to the bus socket
     if (_busSocketId < 0)
-        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo);
+        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo, "StepTracer");
     BusAccess::busSocketEnable(_busSocketId, true);
 
     // Prime from memory if required
@@ -308,7 +305,7 @@ void StepTracer::resetComplete()
     _exceptionsPosn.clear();
 
     // Reset the emulated CPU
-    Z80RESET(&_cpu_z80);
+    _cycleGen.reset();
 
     // Clear stats
     _stats.clear();
@@ -363,16 +360,39 @@ void StepTracer::handleWaitInterrupt([[maybe_unused]] uint32_t addr, [[maybe_unu
         uint32_t expCtrl = 0;
         uint32_t expAddr = 0;
         uint32_t expData = 0;
-        if (_stepCyclePos == _stepCycleCount)
+        if (_stepCyclePos >= _stepCycleCount)
         {
+            // An interrupt acknowledge starts the interrupt response instead of the next instruction
             _stepCyclePos = 0;
-            _stepCycleCount = 0;
-            Z80Execute(&_cpu_z80);
-            _stats.instructionCount++;
+            if ((flags & BR_CTRL_BUS_IORQ_MASK) && (flags & BR_CTRL_BUS_M1_MASK))
+            {
+                _stepCycleCount = _cycleGen.genIntResponse(data);
+            }
+            else
+            {
+                _stepCycleCount = _cycleGen.genInstr();
+                _stats.instructionCount++;
+            }
+
+            // Cycles beyond the max aren't generated so can't be compared
+            if (_cycleGen.cyclesOverflowed())
+                _stats.errors++;
+        }
+        if (_stepCyclePos < _stepCycleCount)
+        {
+            // The value of an IO read is only known from the bus
+            const Z80BusCycle& expCycle = _cycleGen.getCycle(_stepCyclePos);
+            if ((expCycle.flags == (BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_RD_MASK)) &&
+                        (expCycle.addr == addr) && (expCycle.data != data))
+                _stepCycleCount = _cycleGen.genAgainWithIORead(data);
+        }
+        if (_stepCyclePos < _stepCycleCount)
+        {
+            const Z80BusCycle& expCycle = _cycleGen.getCycle(_stepCyclePos);
+            expCtrl = expCycle.flags;
+            expAddr = expCycle.addr;
+            expData = expCycle.data;
         }
-        expCtrl = _stepCycles[_stepCyclePos].flags;
-        expAddr = _stepCycles[_stepCyclePos].addr;
-        expData = _stepCycles[_stepCyclePos].data;
         _stepCyclePos++;
 
         // Check against what we got from the real system
@@ -619,41 +639,22 @@ void StepTracer::getTraceBin()
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 // Memory and IO functions
-byte StepTracer::mem_read([[maybe_unused]] int param, [[maybe_unused]] ushort address)
+uint8_t StepTracer::mem_read(uint32_t address)
 {
-    if (!_pThisInstance)
-        return 0;
-    uint32_t dataVal = 0; 
+    uint32_t dataVal = 0;
 #ifdef STEP_VAL_WITHOUT_HW_MANAGER
-    if (_pThisInstance->_pTracerMemory && (address < _pThisInstance->_tracerMemoryLen))
+    if (_pThisInstance && _pThisInstance->_pTracerMemory && (address < _pThisInstance->_tracerMemoryLen))
         dataVal = _pThisInstance->_pTracerMemory[address];
 #else
     HwManager::tracerHandleAccess(address, 0, BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_RD_MASK, dataVal);
 #endif
-    if (_stepCycleCount < MAX_STEP_CYCLES_FOR_INSTR)
-    {
-        _stepCycles[_stepCycleCount].addr = address;
-        _stepCycles[_stepCycleCount].data = dataVal;
-        _stepCycles[_stepCycleCount].flags = (_pThisInstance->_cpu_z80.M1 ? BR_CTRL_BUS_M1_MASK : 0) |
-                        BR_CTRL_BUS_RD_MASK | BR_CTRL_BUS_MREQ_MASK;
-        _stepCycleCount++;
-    }
     return dataVal;
 }
 
-void StepTracer::mem_write([[maybe_unused]] int param, [[maybe_unused]] ushort address, [[maybe_unused]] byte data)
+void StepTracer::mem_write(uint32_t address, uint8_t data)
 {
-    if (!_pThisInstance)
-        return;
-    if (_stepCycleCount < MAX_STEP_CYCLES_FOR_INSTR)
-    {
-        _stepCycles[_stepCycleCount].addr = address;
-        _stepCycles[_stepCycleCount].data = data;
-        _stepCycles[_stepCycleCount].flags = BR_CTRL_BUS_WR_MASK | BR_CTRL_BUS_MREQ_MASK;
-        _stepCycleCount++;
-    }
 #ifdef STEP_VAL_WITHOUT_HW_MANAGER
-    if (_pThisInstance->_pTracerMemory && (address < _pThisInstance->_tracerMemoryLen))
+    if (_pThisInstance && _pThisInstance->_pTracerMemory && (address < _pThisInstance->_tracerMemoryLen))
         _pThisInstance->_pTracerMemory[address] = data;
 #else
     uint32_t retVal = 0;
@@ -661,35 +662,18 @@ void StepTracer::mem_write([[maybe_unused]] int param, [[maybe_unused]] ushort a
 #endif
 }
 
-byte StepTracer::io_read([[maybe_unused]] int param, [[maybe_unused]] ushort address)
+uint8_t StepTracer::io_read([[maybe_unused]] uint32_t address)
 {
-    if (!_pThisInstance)
-        return 0;
-    uint32_t dataVal = 0x80; // TODO - really need to find a way to make this the value returned on the BUS to keep validity
+    // Only a guess - the instruction is generated again with the value seen on the bus
+    uint32_t dataVal = 0xff;
 #ifndef STEP_VAL_WITHOUT_HW_MANAGER
     HwManager::tracerHandleAccess(address, 0, BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_RD_MASK, dataVal);
 #endif
-    if (_stepCycleCount < MAX_STEP_CYCLES_FOR_INSTR)
-    {
-        _stepCycles[_stepCycleCount].addr = address;
-        _stepCycles[_stepCycleCount].data = dataVal;
-        _stepCycles[_stepCycleCount].flags = BR_CTRL_BUS_RD_MASK | BR_CTRL_BUS_IORQ_MASK;
-        _stepCycleCount++;
-    }
     return dataVal;
 }
 
-void StepTracer::io_write([[maybe_unused]] int param, [[maybe_unused]] ushort address, [[maybe_unused]] byte data)
+void StepTracer::io_write([[maybe_unused]] uint32_t address, [[maybe_unused]] uint8_t data)
 {
-    if (!_pThisInstance)
-        return;
-    if (_stepCycleCount < MAX_STEP_CYCLES_FOR_INSTR)
-    {
-        _stepCycles[_stepCycleCount].addr = address;
-        _stepCycles[_stepCycleCount].data = data;
-        _stepCycles[_stepCycleCount].flags = BR_CTRL_BUS_WR_MASK | BR_CTRL_BUS_IORQ_MASK;
-        _stepCycleCount++;
-    }
 #ifndef STEP_VAL_WITHOUT_HW_MANAGER
     uint32_t retVal = 0;
     HwManager::tracerHandleAccess(address, data, BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_WR_MASK, retVal);
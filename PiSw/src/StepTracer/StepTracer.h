@@ -11,7 +11,7 @@
 #include "../TargetBus/TargetRegisters.h"
 #include "../TargetBus/BusAccess.h"
 #include "../CommandInterface/CommandHandler.h"
-#include "libz80/z80.h"
+#include "Z80BusCycleGen.h"
 
 // #define STEP_VAL_WITHOUT_HW_MANAGER 1
 #ifndef STEP_VAL_WITHOUT_HW_MANAGER
@@ -62,15 +62,6 @@ public:
     uint32_t traceCount;
 };
 
-// Cycle info
-class StepTracerCycle
-{
-public:
-    uint32_t addr;
-    uint32_t data;
-    uint32_t flags;
-};
-
 // Tracer
 class StepTracer
 {
@@ -91,8 +82,8 @@ public:
     
 private:
 
-    // Z80 CPU context
-    Z80Context _cpu_z80;
+    // Z80 bus cycle generator
+    Z80BusCycleGen _cycleGen;
 
     // Flags
     bool _logging;
@@ -139,14 +130,12 @@ private:
             uint32_t flags, uint32_t& retVal);
 
     // Memory and IO functions
-    static byte mem_read(int param, ushort address);
-    static void mem_write(int param, ushort address, byte data);
-    static byte io_read(int param, ushort address);
-    static void io_write(int param, ushort address, byte data);
-
-    // Record step information for instruction
-    static const int MAX_STEP_CYCLES_FOR_INSTR = 10;
-    static StepTracerCycle _stepCycles[MAX_STEP_CYCLES_FOR_INSTR];
+    static uint8_t mem_read(uint32_t address);
+    static void mem_write(uint32_t address, uint8_t data);
+    static uint8_t io_read(uint32_t address);
+    static void io_write(uint32_t address, uint8_t data);
+
+    // Position in the cycles generated for the instruction
     static int _stepCycleCount;
     static int _stepCyclePos;
 
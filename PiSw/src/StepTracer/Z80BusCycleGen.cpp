@@ -0,0 +1,1230 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#include "Z80BusCycleGen.h"
+#include "../TargetBus/TargetCPU.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Defs
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Flags
+static const uint8_t FLAG_C = 0x01;
+static const uint8_t FLAG_N = 0x02;
+static const uint8_t FLAG_PV = 0x04;
+static const uint8_t FLAG_X = 0x08;
+static const uint8_t FLAG_H = 0x10;
+static const uint8_t FLAG_Y = 0x20;
+static const uint8_t FLAG_Z = 0x40;
+static const uint8_t FLAG_S = 0x80;
+
+// Cycle types
+static const uint32_t CYCLE_OPCODE_FETCH = BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_RD_MASK | BR_CTRL_BUS_M1_MASK;
+static const uint32_t CYCLE_MEM_READ = BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_RD_MASK;
+static const uint32_t CYCLE_MEM_WRITE = BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_WR_MASK;
+static const uint32_t CYCLE_IO_READ = BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_RD_MASK;
+static const uint32_t CYCLE_IO_WRITE = BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_WR_MASK;
+static const uint32_t CYCLE_INT_ACK = BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_M1_MASK;
+
+// Interrupt mode set by ED 46 + 8 * y
+static const uint8_t edInterruptModes[8] = { 0, 0, 1, 2, 0, 0, 1, 2 };
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Init
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Z80BusCycleGen::Z80BusCycleGen()
+{
+    _pMemRead = NULL;
+    _pMemWrite = NULL;
+    _pIORead = NULL;
+    _pIOWrite = NULL;
+    _numCycles = 0;
+    _cyclesOverflowed = false;
+    _ioReadDataValid = false;
+    _ioReadData = 0;
+    _pIdx = &_regs.hl;
+    reset();
+}
+
+void Z80BusCycleGen::setAccessFns(Z80BusCycleReadFnType* pMemRead, Z80BusCycleWriteFnType* pMemWrite,
+                Z80BusCycleReadFnType* pIORead, Z80BusCycleWriteFnType* pIOWrite)
+{
+    _pMemRead = pMemRead;
+    _pMemWrite = pMemWrite;
+    _pIORead = pIORead;
+    _pIOWrite = pIOWrite;
+}
+
+void Z80BusCycleGen::reset()
+{
+    // AF and SP are FFFF after reset - other registers are undefined
+    _regs.af.w = 0xffff;
+    _regs.sp.w = 0xffff;
+    _regs.bc.w = _regs.de.w = _regs.hl.w = _regs.ix.w = _regs.iy.w = _regs.wz.w = 0;
+    _regs.afAlt.w = _regs.bcAlt.w = _regs.deAlt.w = _regs.hlAlt.w = 0;
+    _regs.pc = 0;
+    _regs.i = _regs.r = 0;
+    _regs.iff1 = _regs.iff2 = 0;
+    _regs.im = 0;
+    _regs.halted = false;
+    _regsAtInstrStart = _regs;
+    _numCycles = 0;
+    _cyclesOverflowed = false;
+}
+
+void Z80BusCycleGen::setRegs(const Z80Registers& regs)
+{
+    _regs.af.w = regs.AF;
+    _regs.bc.w = regs.BC;
+    _regs.de.w = regs.DE;
+    _regs.hl.w = regs.HL;
+    _regs.ix.w = regs.IX;
+    _regs.iy.w = regs.IY;
+    _regs.sp.w = regs.SP;
+    _regs.wz.w = regs.MEMPTR;
+    _regs.afAlt.w = regs.AFDASH;
+    _regs.bcAlt.w = regs.BCDASH;
+    _regs.deAlt.w = regs.DEDASH;
+    _regs.hlAlt.w = regs.HLDASH;
+    _regs.pc = regs.PC;
+    _regs.i = regs.I;
+    _regs.r = regs.R;
+    _regs.iff1 = _regs.iff2 = regs.INTENABLED ? 1 : 0;
+    _regs.im = regs.INTMODE;
+    _regs.halted = false;
+    _regsAtInstrStart = _regs;
+}
+
+void Z80BusCycleGen::getRegs(Z80Registers& regs)
+{
+    regs.AF = _regs.af.w;
+    regs.BC = _regs.bc.w;
+    regs.DE = _regs.de.w;
+    regs.HL = _regs.hl.w;
+    regs.IX = _regs.ix.w;
+    regs.IY = _regs.iy.w;
+    regs.SP = _regs.sp.w;
+    regs.MEMPTR = _regs.wz.w;
+    regs.AFDASH = _regs.afAlt.w;
+    regs.BCDASH = _regs.bcAlt.w;
+    regs.DEDASH = _regs.deAlt.w;
+    regs.HLDASH = _regs.hlAlt.w;
+    regs.PC = _regs.pc;
+    regs.I = _regs.i;
+    regs.R = _regs.r;
+    regs.INTENABLED = _regs.iff1;
+    regs.INTMODE = _regs.im;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Generate
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int Z80BusCycleGen::genInstr()
+{
+    _regsAtInstrStart = _regs;
+    _ioReadDataValid = false;
+    genNextInstr();
+    return _numCycles;
+}
+
+int Z80BusCycleGen::genAgainWithIORead(uint8_t ioData)
+{
+    _regs = _regsAtInstrStart;
+    _ioReadData = ioData;
+    _ioReadDataValid = true;
+    genNextInstr();
+    return _numCycles;
+}
+
+int Z80BusCycleGen::genIntResponse(uint8_t ackData)
+{
+    _regsAtInstrStart = _regs;
+    _ioReadDataValid = false;
+    _numCycles = 0;
+    _cyclesOverflowed = false;
+
+    // Acknowledge - the address is the PC (which is after the HALT if halted)
+    _regs.halted = false;
+    addCycle(_regs.pc, ackData, CYCLE_INT_ACK);
+    _regs.r = (_regs.r & 0x80) | ((_regs.r + 1) & 0x7f);
+    _regs.iff1 = _regs.iff2 = 0;
+    if (_regs.im == 2)
+    {
+        push(_regs.pc);
+        uint16_t vectorAddr = (_regs.i << 8) | ackData;
+        uint8_t lo = readMem(vectorAddr);
+        uint8_t hi = readMem(vectorAddr + 1);
+        _regs.pc = (hi << 8) | lo;
+    }
+    else if (_regs.im == 1)
+    {
+        push(_regs.pc);
+        _regs.pc = 0x38;
+    }
+    else if ((ackData & 0xc7) == 0xc7)
+    {
+        // IM0 with RST on the bus
+        push(_regs.pc);
+        _regs.pc = ackData & 0x38;
+    }
+    _regs.wz.w = _regs.pc;
+    return _numCycles;
+}
+
+void Z80BusCycleGen::genNextInstr()
+{
+    _numCycles = 0;
+    _cyclesOverflowed = false;
+
+    // While halted the processor fetches (and ignores) the byte after the HALT
+    if (_regs.halted)
+    {
+        addCycle(_regs.pc, _pMemRead ? _pMemRead(_regs.pc) : 0, CYCLE_OPCODE_FETCH);
+        _regs.r = (_regs.r & 0x80) | ((_regs.r + 1) & 0x7f);
+        return;
+    }
+
+    // Index prefixes - only the last of a run of prefixes is used so a prefix followed by another is
+    // generated as an instruction of its own (this keeps memory filled with DD or FD from running on)
+    _pIdx = &_regs.hl;
+    uint8_t opcode = fetchOpcode();
+    if ((opcode == 0xdd) || (opcode == 0xfd))
+    {
+        uint8_t nextOpcode = _pMemRead ? _pMemRead(_regs.pc) : 0;
+        if ((nextOpcode == 0xdd) || (nextOpcode == 0xfd))
+            return;
+        _pIdx = (opcode == 0xdd) ? &_regs.ix : &_regs.iy;
+        opcode = fetchOpcode();
+    }
+
+    // Other prefixes
+    if (opcode == 0xcb)
+    {
+        if (_pIdx == &_regs.hl)
+            execCB(fetchOpcode());
+        else
+            execIndexedCB();
+    }
+    else if (opcode == 0xed)
+    {
+        _pIdx = &_regs.hl;
+        execED(fetchOpcode());
+    }
+    else
+    {
+        execMain(opcode);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Bus cycles
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Z80BusCycleGen::addCycle(uint32_t addr, uint32_t data, uint32_t flags)
+{
+    if (_numCycles >= MAX_CYCLES_PER_INSTR)
+    {
+        _cyclesOverflowed = true;
+        return;
+    }
+    _cycles[_numCycles].addr = addr;
+    _cycles[_numCycles].data = data;
+    _cycles[_numCycles].flags = flags;
+    _numCycles++;
+}
+
+uint8_t Z80BusCycleGen::fetchOpcode()
+{
+    uint8_t opcode = _pMemRead ? _pMemRead(_regs.pc) : 0;
+    addCycle(_regs.pc, opcode, CYCLE_OPCODE_FETCH);
+    _regs.pc++;
+    _regs.r = (_regs.r & 0x80) | ((_regs.r + 1) & 0x7f);
+    return opcode;
+}
+
+uint8_t Z80BusCycleGen::fetchByte()
+{
+    return readMem(_regs.pc++);
+}
+
+uint16_t Z80BusCycleGen::fetchWord()
+{
+    uint8_t lo = fetchByte();
+    uint8_t hi = fetchByte();
+    return (hi << 8) | lo;
+}
+
+uint8_t Z80BusCycleGen::readMem(uint16_t addr)
+{
+    uint8_t data = _pMemRead ? _pMemRead(addr) : 0;
+    addCycle(addr, data, CYCLE_MEM_READ);
+    return data;
+}
+
+void Z80BusCycleGen::writeMem(uint16_t addr, uint8_t data)
+{
+    addCycle(addr, data, CYCLE_MEM_WRITE);
+    if (_pMemWrite)
+        _pMemWrite(addr, data);
+}
+
+uint8_t Z80BusCycleGen::readIO(uint16_t port)
+{
+    uint8_t data = 0xff;
+    if (_ioReadDataValid)
+        data = _ioReadData;
+    else if (_pIORead)
+        data = _pIORead(port);
+    addCycle(port, data, CYCLE_IO_READ);
+    return data;
+}
+
+void Z80BusCycleGen::writeIO(uint16_t port, uint8_t data)
+{
+    addCycle(port, data, CYCLE_IO_WRITE);
+    if (_pIOWrite)
+        _pIOWrite(port, data);
+}
+
+void Z80BusCycleGen::push(uint16_t val)
+{
+    // High byte first
+    writeMem(--_regs.sp.w, val >> 8);
+    writeMem(--_regs.sp.w, val & 0xff);
+}
+
+uint16_t Z80BusCycleGen::pop()
+{
+    uint8_t lo = readMem(_regs.sp.w++);
+    uint8_t hi = readMem(_regs.sp.w++);
+    return (hi << 8) | lo;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Registers by opcode field
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// B, C, D, E, H, L, -, A with H and L replaced by the index register halves
+uint8_t Z80BusCycleGen::getReg8(int idx)
+{
+    if (idx == 4)
+        return _pIdx->b.h;
+    if (idx == 5)
+        return _pIdx->b.l;
+    return getReg8NoIdx(idx);
+}
+
+void Z80BusCycleGen::setReg8(int idx, uint8_t val)
+{
+    if (idx == 4)
+        _pIdx->b.h = val;
+    else if (idx == 5)
+        _pIdx->b.l = val;
+    else
+        setReg8NoIdx(idx, val);
+}
+
+// B, C, D, E, H, L, -, A - used with an (IX+d) operand
+uint8_t Z80BusCycleGen::getReg8NoIdx(int idx)
+{
+    switch (idx)
+    {
+        case 0: return _regs.bc.b.h;
+        case 1: return _regs.bc.b.l;
+        case 2: return _regs.de.b.h;
+        case 3: return _regs.de.b.l;
+        case 4: return _regs.hl.b.h;
+        case 5: return _regs.hl.b.l;
+        case 7: return _regs.af.b.h;
+    }
+    return 0;
+}
+
+void Z80BusCycleGen::setReg8NoIdx(int idx, uint8_t val)
+{
+    switch (idx)
+    {
+        case 0: _regs.bc.b.h = val; break;
+        case 1: _regs.bc.b.l = val; break;
+        case 2: _regs.de.b.h = val; break;
+        case 3: _regs.de.b.l = val; break;
+        case 4: _regs.hl.b.h = val; break;
+        case 5: _regs.hl.b.l = val; break;
+        case 7: _regs.af.b.h = val; break;
+    }
+}
+
+// BC, DE, HL, SP
+Z80BusCycleGen::RegPair& Z80BusCycleGen::regPairSP(int idx)
+{
+    switch (idx)
+    {
+        case 0: return _regs.bc;
+        case 1: return _regs.de;
+        case 2: return *_pIdx;
+    }
+    return _regs.sp;
+}
+
+// BC, DE, HL, AF
+Z80BusCycleGen::RegPair& Z80BusCycleGen::regPairAF(int idx)
+{
+    switch (idx)
+    {
+        case 0: return _regs.bc;
+        case 1: return _regs.de;
+        case 2: return *_pIdx;
+    }
+    return _regs.af;
+}
+
+// NZ, Z, NC, C, PO, PE, P, M
+bool Z80BusCycleGen::testCond(int cond)
+{
+    static const uint8_t condFlags[4] = { FLAG_Z, FLAG_C, FLAG_PV, FLAG_S };
+    bool isSet = (_regs.af.b.l & condFlags[cond >> 1]) != 0;
+    return (cond & 1) ? isSet : !isSet;
+}
+
+// Address of (HL) or (IX+d) - the displacement is read here
+uint16_t Z80BusCycleGen::memOperandAddr()
+{
+    if (_pIdx == &_regs.hl)
+        return _regs.hl.w;
+    int8_t disp = (int8_t)fetchByte();
+    _regs.wz.w = _pIdx->w + disp;
+    return _regs.wz.w;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Execute unprefixed (and DD / FD prefixed)
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Z80BusCycleGen::execMain(uint8_t opcode)
+{
+    int x = opcode >> 6;
+    int y = (opcode >> 3) & 0x07;
+    int z = opcode & 0x07;
+    switch (x)
+    {
+        case 0:
+            execMainX0(y, z, y >> 1, y & 1);
+            break;
+        case 1:
+            if (opcode == 0x76)
+            {
+                // HALT - the PC is left at the next byte
+                _regs.halted = true;
+            }
+            else if (y == 6)
+            {
+                uint16_t addr = memOperandAddr();
+                writeMem(addr, (_pIdx == &_regs.hl) ? getReg8(z) : getReg8NoIdx(z));
+            }
+            else if (z == 6)
+            {
+                uint16_t addr = memOperandAddr();
+                uint8_t val = readMem(addr);
+                if (_pIdx == &_regs.hl)
+                    setReg8(y, val);
+                else
+                    setReg8NoIdx(y, val);
+            }
+            else
+            {
+                setReg8(y, getReg8(z));
+            }
+            break;
+        case 2:
+            alu8(y, (z == 6) ? readMem(memOperandAddr()) : getReg8(z));
+            break;
+        case 3:
+            execMainX3(y, z, y >> 1, y & 1);
+            break;
+    }
+}
+
+void Z80BusCycleGen::execMainX0(int y, int z, int p, int q)
+{
+    switch (z)
+    {
+        case 0:
+        {
+            if (y == 0)
+            {
+                // NOP
+            }
+            else if (y == 1)
+            {
+                // EX AF,AF'
+                uint16_t tmp = _regs.af.w;
+                _regs.af.w = _regs.afAlt.w;
+                _regs.afAlt.w = tmp;
+            }
+            else
+            {
+                // DJNZ, JR, JR cc
+                int8_t disp = (int8_t)fetchByte();
+                bool jump = true;
+                if (y == 2)
+                    jump = (--_regs.bc.b.h != 0);
+                else if (y >= 4)
+                    jump = testCond(y - 4);
+                if (jump)
+                {
+                    _regs.pc += disp;
+                    _regs.wz.w = _regs.pc;
+                }
+            }
+            break;
+        }
+        case 1:
+        {
+            // LD rr,nn / ADD HL,rr
+            if (q == 0)
+                regPairSP(p).w = fetchWord();
+            else
+                _pIdx->w = add16(_pIdx->w, regPairSP(p).w);
+            break;
+        }
+        case 2:
+        {
+            // Indirect loads
+            uint16_t addr = 0;
+            switch (p)
+            {
+                case 0:
+                case 1:
+                    addr = (p == 0) ? _regs.bc.w : _regs.de.w;
+                    if (q == 0)
+                    {
+                        writeMem(addr, _regs.af.b.h);
+                        _regs.wz.w = (_regs.af.b.h << 8) | ((addr + 1) & 0xff);
+                    }
+                    else
+                    {
+                        _regs.af.b.h = readMem(addr);
+                        _regs.wz.w = addr + 1;
+                    }
+                    break;
+                case 2:
+                    addr = fetchWord();
+                    if (q == 0)
+                    {
+                        writeMem(addr, _pIdx->b.l);
+                        writeMem(addr + 1, _pIdx->b.h);
+                    }
+                    else
+                    {
+                        _pIdx->b.l = readMem(addr);
+                        _pIdx->b.h = readMem(addr + 1);
+                    }
+                    _regs.wz.w = addr + 1;
+                    break;
+                case 3:
+                    addr = fetchWord();
+                    if (q == 0)
+                    {
+                        writeMem(addr, _regs.af.b.h);
+                        _regs.wz.w = (_regs.af.b.h << 8) | ((addr + 1) & 0xff);
+                    }
+                    else
+                    {
+                        _regs.af.b.h = readMem(addr);
+                        _regs.wz.w = addr + 1;
+                    }
+                    break;
+            }
+            break;
+        }
+        case 3:
+        {
+            // INC rr / DEC rr
+            if (q == 0)
+                regPairSP(p).w++;
+            else
+                regPairSP(p).w--;
+            break;
+        }
+        case 4:
+        case 5:
+        {
+            // INC r / DEC r
+            if (y == 6)
+            {
+                uint16_t addr = memOperandAddr();
+                uint8_t val = readMem(addr);
+                writeMem(addr, (z == 4) ? inc8(val) : dec8(val));
+            }
+            else
+            {
+                setReg8(y, (z == 4) ? inc8(getReg8(y)) : dec8(getReg8(y)));
+            }
+            break;
+        }
+        case 6:
+        {
+            // LD r,n - the displacement of (IX+d) comes before n
+            if (y == 6)
+            {
+                uint16_t addr = memOperandAddr();
+                writeMem(addr, fetchByte());
+            }
+            else
+            {
+                setReg8(y, fetchByte());
+            }
+            break;
+        }
+        case 7:
+        {
+            uint8_t a = _regs.af.b.h;
+            uint8_t f = _regs.af.b.l;
+            uint8_t carry = 0;
+            switch (y)
+            {
+                case 0:
+                    // RLCA
+                    carry = a >> 7;
+                    a = (a << 1) | carry;
+                    break;
+                case 1:
+                    // RRCA
+                    carry = a & 0x01;
+                    a = (a >> 1) | (carry << 7);
+                    break;
+                case 2:
+                    // RLA
+                    carry = a >> 7;
+                    a = (a << 1) | (f & FLAG_C);
+                    break;
+                case 3:
+                    // RRA
+                    carry = a & 0x01;
+                    a = (a >> 1) | ((f & FLAG_C) << 7);
+                    break;
+                case 4:
+                    daa();
+                    return;
+                case 5:
+                    // CPL
+                    a = ~a;
+                    _regs.af.b.h = a;
+                    _regs.af.b.l = (f & (FLAG_S | FLAG_Z | FLAG_PV | FLAG_C)) | FLAG_H | FLAG_N | (a & (FLAG_Y | FLAG_X));
+                    return;
+                case 6:
+                    // SCF
+                    _regs.af.b.l = (f & (FLAG_S | FLAG_Z | FLAG_PV)) | (a & (FLAG_Y | FLAG_X)) | FLAG_C;
+                    return;
+                case 7:
+                    // CCF
+                    _regs.af.b.l = (f & (FLAG_S | FLAG_Z | FLAG_PV)) | (a & (FLAG_Y | FLAG_X)) |
+                                ((f & FLAG_C) ? FLAG_H : FLAG_C);
+                    return;
+            }
+            _regs.af.b.h = a;
+            _regs.af.b.l = (f & (FLAG_S | FLAG_Z | FLAG_PV)) | (a & (FLAG_Y | FLAG_X)) | carry;
+            break;
+        }
+    }
+}
+
+void Z80BusCycleGen::execMainX3(int y, int z, int p, int q)
+{
+    switch (z)
+    {
+        case 0:
+        {
+            // RET cc
+            if (testCond(y))
+            {
+                _regs.pc = pop();
+                _regs.wz.w = _regs.pc;
+            }
+            break;
+        }
+        case 1:
+        {
+            if (q == 0)
+            {
+                // POP
+                regPairAF(p).w = pop();
+                break;
+            }
+            switch (p)
+            {
+                case 0:
+                    // RET
+                    _regs.pc = pop();
+                    _regs.wz.w = _regs.pc;
+                    break;
+                case 1:
+                {
+                    // EXX
+                    uint16_t tmp = _regs.bc.w;
+                    _regs.bc.w = _regs.bcAlt.w;
+                    _regs.bcAlt.w = tmp;
+                    tmp = _regs.de.w;
+                    _regs.de.w = _regs.deAlt.w;
+                    _regs.deAlt.w = tmp;
+                    tmp = _regs.hl.w;
+                    _regs.hl.w = _regs.hlAlt.w;
+                    _regs.hlAlt.w = tmp;
+                    break;
+                }
+                case 2:
+                    // JP (HL)
+                    _regs.pc = _pIdx->w;
+                    break;
+                case 3:
+                    // LD SP,HL
+                    _regs.sp.w = _pIdx->w;
+                    break;
+            }
+            break;
+        }
+        case 2:
+        {
+            // JP cc,nn
+            _regs.wz.w = fetchWord();
+            if (testCond(y))
+                _regs.pc = _regs.wz.w;
+            break;
+        }
+        case 3:
+        {
+            switch (y)
+            {
+                case 0:
+                    // JP nn
+                    _regs.wz.w = fetchWord();
+                    _regs.pc = _regs.wz.w;
+                    break;
+                case 2:
+                {
+                    // OUT (n),A
+                    uint8_t n = fetchByte();
+                    writeIO((_regs.af.b.h << 8) | n, _regs.af.b.h);
+                    _regs.wz.w = (_regs.af.b.h << 8) | ((n + 1) & 0xff);
+                    break;
+                }
+                case 3:
+                {
+                    // IN A,(n)
+                    uint16_t port = (_regs.af.b.h << 8) | fetchByte();
+                    _regs.af.b.h = readIO(port);
+                    _regs.wz.w = port + 1;
+                    break;
+                }
+                case 4:
+                {
+                    // EX (SP),HL - read low then high and write high then low
+                    uint8_t lo = readMem(_regs.sp.w);
+                    uint8_t hi = readMem(_regs.sp.w + 1);
+                    writeMem(_regs.sp.w + 1, _pIdx->b.h);
+                    writeMem(_regs.sp.w, _pIdx->b.l);
+                    _pIdx->w = (hi << 8) | lo;
+                    _regs.wz.w = _pIdx->w;
+                    break;
+                }
+                case 5:
+                {
+                    // EX DE,HL (not affected by index prefixes)
+                    uint16_t tmp = _regs.de.w;
+                    _regs.de.w = _regs.hl.w;
+                    _regs.hl.w = tmp;
+                    break;
+                }
+                case 6:
+                    // DI
+                    _regs.iff1 = _regs.iff2 = 0;
+                    break;
+                case 7:
+                    // EI
+                    _regs.iff1 = _regs.iff2 = 1;
+                    break;
+            }
+            break;
+        }
+        case 4:
+        {
+            // CALL cc,nn
+            _regs.wz.w = fetchWord();
+            if (testCond(y))
+            {
+                push(_regs.pc);
+                _regs.pc = _regs.wz.w;
+            }
+            break;
+        }
+        case 5:
+        {
+            if (q == 0)
+            {
+                // PUSH
+                push(regPairAF(p).w);
+            }
+            else if (p == 0)
+            {
+                // CALL nn
+                _regs.wz.w = fetchWord();
+                push(_regs.pc);
+                _regs.pc = _regs.wz.w;
+            }
+            break;
+        }
+        case 6:
+        {
+            // ALU A,n
+            alu8(y, fetchByte());
+            break;
+        }
+        case 7:
+        {
+            // RST
+            push(_regs.pc);
+            _regs.pc = y * 8;
+            _regs.wz.w = _regs.pc;
+            break;
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Execute CB prefixed
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Z80BusCycleGen::execCB(uint8_t opcode)
+{
+    int x = opcode >> 6;
+    int y = (opcode >> 3) & 0x07;
+    int z = opcode & 0x07;
+    uint8_t val = (z == 6) ? readMem(_regs.hl.w) : getReg8NoIdx(z);
+    uint8_t result = val;
+    switch (x)
+    {
+        case 0:
+            result = rotShift(y, val);
+            break;
+        case 1:
+            // BIT - X and Y of BIT n,(HL) come from the internal address register
+            bitTest(y, val, (z == 6) ? _regs.wz.b.h : val);
+            return;
+        case 2:
+            result = val & ~(1 << y);
+            break;
+        case 3:
+            result = val | (1 << y);
+            break;
+    }
+    if (z == 6)
+        writeMem(_regs.hl.w, result);
+    else
+        setReg8NoIdx(z, result);
+}
+
+void Z80BusCycleGen::execIndexedCB()
+{
+    // DD CB d op - the displacement and opcode are memory reads (not M1)
+    int8_t disp = (int8_t)fetchByte();
+    uint8_t opcode = fetchByte();
+    uint16_t addr = _pIdx->w + disp;
+    _regs.wz.w = addr;
+    int x = opcode >> 6;
+    int y = (opcode >> 3) & 0x07;
+    int z = opcode & 0x07;
+    uint8_t val = readMem(addr);
+    uint8_t result = val;
+    switch (x)
+    {
+        case 0:
+            result = rotShift(y, val);
+            break;
+        case 1:
+            bitTest(y, val, addr >> 8);
+            return;
+        case 2:
+            result = val & ~(1 << y);
+            break;
+        case 3:
+            result = val | (1 << y);
+            break;
+    }
+    writeMem(addr, result);
+
+    // The result is also copied to a register unless the register field is (HL)
+    if (z != 6)
+        setReg8NoIdx(z, result);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Execute ED prefixed
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Z80BusCycleGen::execED(uint8_t opcode)
+{
+    int x = opcode >> 6;
+    int y = (opcode >> 3) & 0x07;
+    int z = opcode & 0x07;
+    int p = y >> 1;
+    int q = y & 1;
+    if (x == 2)
+    {
+        if ((z <= 3) && (y >= 4))
+            execBlock(y, z);
+        return;
+    }
+    if (x != 1)
+        return;
+
+    switch (z)
+    {
+        case 0:
+        {
+            // IN r,(C) - (HL) sets flags only
+            uint8_t val = readIO(_regs.bc.w);
+            _regs.wz.w = _regs.bc.w + 1;
+            _regs.af.b.l = (_regs.af.b.l & FLAG_C) | flagsSZP(val);
+            if (y != 6)
+                setReg8NoIdx(y, val);
+            break;
+        }
+        case 1:
+        {
+            // OUT (C),r - (HL) outputs 0
+            writeIO(_regs.bc.w, (y == 6) ? 0 : getReg8NoIdx(y));
+            _regs.wz.w = _regs.bc.w + 1;
+            break;
+        }
+        case 2:
+        {
+            // SBC HL,rr / ADC HL,rr
+            if (q == 0)
+                _regs.hl.w = sbc16(_regs.hl.w, regPairSP(p).w);
+            else
+                _regs.hl.w = adc16(_regs.hl.w, regPairSP(p).w);
+            break;
+        }
+        case 3:
+        {
+            // LD (nn),rr / LD rr,(nn)
+            uint16_t addr = fetchWord();
+            RegPair& regPair = regPairSP(p);
+            if (q == 0)
+            {
+                writeMem(addr, regPair.b.l);
+                writeMem(addr + 1, regPair.b.h);
+            }
+            else
+            {
+                regPair.b.l = readMem(addr);
+                regPair.b.h = readMem(addr + 1);
+            }
+            _regs.wz.w = addr + 1;
+            break;
+        }
+        case 4:
+        {
+            // NEG
+            uint8_t val = _regs.af.b.h;
+            _regs.af.b.h = 0;
+            alu8(2, val);
+            break;
+        }
+        case 5:
+        {
+            // RETN / RETI
+            _regs.pc = pop();
+            _regs.wz.w = _regs.pc;
+            _regs.iff1 = _regs.iff2;
+            break;
+        }
+        case 6:
+        {
+            // IM
+            _regs.im = edInterruptModes[y];
+            break;
+        }
+        case 7:
+        {
+            switch (y)
+            {
+                case 0:
+                    // LD I,A
+                    _regs.i = _regs.af.b.h;
+                    break;
+                case 1:
+                    // LD R,A
+                    _regs.r = _regs.af.b.h;
+                    break;
+                case 2:
+                case 3:
+                {
+                    // LD A,I / LD A,R
+                    uint8_t val = (y == 2) ? _regs.i : _regs.r;
+                    _regs.af.b.h = val;
+                    _regs.af.b.l = (_regs.af.b.l & FLAG_C) | (val & (FLAG_S | FLAG_Y | FLAG_X)) |
+                                (val ? 0 : FLAG_Z) | (_regs.iff2 ? FLAG_PV : 0);
+                    break;
+                }
+                case 4:
+                case 5:
+                {
+                    // RRD / RLD
+                    uint8_t val = readMem(_regs.hl.w);
+                    uint8_t a = _regs.af.b.h;
+                    if (y == 4)
+                    {
+                        writeMem(_regs.hl.w, (a << 4) | (val >> 4));
+                        a = (a & 0xf0) | (val & 0x0f);
+                    }
+                    else
+                    {
+                        writeMem(_regs.hl.w, (val << 4) | (a & 0x0f));
+                        a = (a & 0xf0) | (val >> 4);
+                    }
+                    _regs.af.b.h = a;
+                    _regs.af.b.l = (_regs.af.b.l & FLAG_C) | flagsSZP(a);
+                    _regs.wz.w = _regs.hl.w + 1;
+                    break;
+                }
+            }
+            break;
+        }
+    }
+}
+
+void Z80BusCycleGen::execBlock(int y, int z)
+{
+    // y is 4 (increment), 5 (decrement), 6 (increment repeat) or 7 (decrement repeat)
+    int dir = (y & 1) ? -1 : 1;
+    bool repeat = y >= 6;
+    uint8_t a = _regs.af.b.h;
+    uint8_t f = _regs.af.b.l;
+    switch (z)
+    {
+        case 0:
+        {
+            // LDI / LDD / LDIR / LDDR
+            uint8_t val = readMem(_regs.hl.w);
+            writeMem(_regs.de.w, val);
+            _regs.hl.w += dir;
+            _regs.de.w += dir;
+            _regs.bc.w--;
+            uint8_t n = val + a;
+            _regs.af.b.l = (f & (FLAG_S | FLAG_Z | FLAG_C)) | (n & FLAG_X) | ((n << 4) & FLAG_Y) |
+                        (_regs.bc.w ? FLAG_PV : 0);
+            if (repeat && _regs.bc.w)
+            {
+                _regs.pc -= 2;
+                _regs.wz.w = _regs.pc + 1;
+            }
+            break;
+        }
+        case 1:
+        {
+            // CPI / CPD / CPIR / CPDR
+            uint8_t val = readMem(_regs.hl.w);
+            uint8_t result = a - val;
+            _regs.hl.w += dir;
+            _regs.bc.w--;
+            _regs.wz.w += dir;
+            uint8_t halfCarry = (a ^ val ^ result) & FLAG_H;
+            uint8_t n = result - (halfCarry ? 1 : 0);
+            _regs.af.b.l = (f & FLAG_C) | FLAG_N | (result & FLAG_S) | (result ? 0 : FLAG_Z) | halfCarry |
+                        (n & FLAG_X) | ((n << 4) & FLAG_Y) | (_regs.bc.w ? FLAG_PV : 0);
+            if (repeat && _regs.bc.w && result)
+            {
+                _regs.pc -= 2;
+                _regs.wz.w = _regs.pc + 1;
+            }
+            break;
+        }
+        case 2:
+        {
+            // INI / IND / INIR / INDR - input (with B before decrementing) then write
+            uint8_t val = readIO(_regs.bc.w);
+            _regs.wz.w = _regs.bc.w + dir;
+            writeMem(_regs.hl.w, val);
+            _regs.bc.b.h--;
+            _regs.hl.w += dir;
+            uint16_t k = val + ((_regs.bc.b.l + dir) & 0xff);
+            uint8_t b = _regs.bc.b.h;
+            _regs.af.b.l = (b & (FLAG_S | FLAG_Y | FLAG_X)) | (b ? 0 : FLAG_Z) | ((val & 0x80) ? FLAG_N : 0) |
+                        ((k > 0xff) ? (FLAG_H | FLAG_C) : 0) | (flagsSZP((k & 0x07) ^ b) & FLAG_PV);
+            if (repeat && b)
+                _regs.pc -= 2;
+            break;
+        }
+        case 3:
+        {
+            // OUTI / OUTD / OTIR / OTDR - read then output (with B after decrementing)
+            uint8_t val = readMem(_regs.hl.w);
+            _regs.bc.b.h--;
+            writeIO(_regs.bc.w, val);
+            _regs.wz.w = _regs.bc.w + dir;
+            _regs.hl.w += dir;
+            uint16_t k = val + _regs.hl.b.l;
+            uint8_t b = _regs.bc.b.h;
+            _regs.af.b.l = (b & (FLAG_S | FLAG_Y | FLAG_X)) | (b ? 0 : FLAG_Z) | ((val & 0x80) ? FLAG_N : 0) |
+                        ((k > 0xff) ? (FLAG_H | FLAG_C) : 0) | (flagsSZP((k & 0x07) ^ b) & FLAG_PV);
+            if (repeat && b)
+                _regs.pc -= 2;
+            break;
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ALU
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// ADD, ADC, SUB, SBC, AND, XOR, OR, CP
+void Z80BusCycleGen::alu8(int op, uint8_t val)
+{
+    uint8_t a = _regs.af.b.h;
+    uint8_t carry = _regs.af.b.l & FLAG_C;
+    switch (op)
+    {
+        case 0:
+        case 1:
+        {
+            uint16_t result = a + val + ((op == 1) ? carry : 0);
+            uint8_t res8 = result;
+            _regs.af.b.h = res8;
+            _regs.af.b.l = (res8 & (FLAG_S | FLAG_Y | FLAG_X)) | (res8 ? 0 : FLAG_Z) | ((a ^ val ^ res8) & FLAG_H) |
+                        (((a ^ ~val) & (a ^ res8) & 0x80) ? FLAG_PV : 0) | ((result > 0xff) ? FLAG_C : 0);
+            break;
+        }
+        case 2:
+        case 3:
+        case 7:
+        {
+            uint16_t result = a - val - ((op == 3) ? carry : 0);
+            uint8_t res8 = result;
+            // CP takes X and Y from the operand
+            uint8_t xyVal = (op == 7) ? val : res8;
+            if (op != 7)
+                _regs.af.b.h = res8;
+            _regs.af.b.l = (res8 & FLAG_S) | (xyVal & (FLAG_Y | FLAG_X)) | (res8 ? 0 : FLAG_Z) |
+                        ((a ^ val ^ res8) & FLAG_H) | (((a ^ val) & (a ^ res8) & 0x80) ? FLAG_PV : 0) |
+                        FLAG_N | ((result & 0x100) ? FLAG_C : 0);
+            break;
+        }
+        case 4:
+            _regs.af.b.h = a & val;
+            _regs.af.b.l = flagsSZP(_regs.af.b.h) | FLAG_H;
+            break;
+        case 5:
+            _regs.af.b.h = a ^ val;
+            _regs.af.b.l = flagsSZP(_regs.af.b.h);
+            break;
+        case 6:
+            _regs.af.b.h = a | val;
+            _regs.af.b.l = flagsSZP(_regs.af.b.h);
+            break;
+    }
+}
+
+uint8_t Z80BusCycleGen::inc8(uint8_t val)
+{
+    uint8_t result = val + 1;
+    _regs.af.b.l = (_regs.af.b.l & FLAG_C) | (result & (FLAG_S | FLAG_Y | FLAG_X)) | (result ? 0 : FLAG_Z) |
+                (((result & 0x0f) == 0) ? FLAG_H : 0) | ((val == 0x7f) ? FLAG_PV : 0);
+    return result;
+}
+
+uint8_t Z80BusCycleGen::dec8(uint8_t val)
+{
+    uint8_t result = val - 1;
+    _regs.af.b.l = (_regs.af.b.l & FLAG_C) | FLAG_N | (result & (FLAG_S | FLAG_Y | FLAG_X)) | (result ? 0 : FLAG_Z) |
+                (((val & 0x0f) == 0) ? FLAG_H : 0) | ((val == 0x80) ? FLAG_PV : 0);
+    return result;
+}
+
+uint16_t Z80BusCycleGen::add16(uint16_t val1, uint16_t val2)
+{
+    uint32_t result = val1 + val2;
+    _regs.wz.w = val1 + 1;
+    _regs.af.b.l = (_regs.af.b.l & (FLAG_S | FLAG_Z | FLAG_PV)) | ((result >> 8) & (FLAG_Y | FLAG_X)) |
+                (((val1 ^ val2 ^ result) >> 8) & FLAG_H) | ((result > 0xffff) ? FLAG_C : 0);
+    return result;
+}
+
+uint16_t Z80BusCycleGen::adc16(uint16_t val1, uint16_t val2)
+{
+    uint32_t result = val1 + val2 + (_regs.af.b.l & FLAG_C);
+    uint16_t res16 = result;
+    _regs.wz.w = val1 + 1;
+    _regs.af.b.l = ((res16 >> 8) & (FLAG_S | FLAG_Y | FLAG_X)) | (res16 ? 0 : FLAG_Z) |
+                (((val1 ^ val2 ^ res16) >> 8) & FLAG_H) | (((val1 ^ ~val2) & (val1 ^ res16) & 0x8000) ? FLAG_PV : 0) |
+                ((result > 0xffff) ? FLAG_C : 0);
+    return res16;
+}
+
+uint16_t Z80BusCycleGen::sbc16(uint16_t val1, uint16_t val2)
+{
+    uint32_t result = (uint32_t)val1 - val2 - (_regs.af.b.l & FLAG_C);
+    uint16_t res16 = result;
+    _regs.wz.w = val1 + 1;
+    _regs.af.b.l = ((res16 >> 8) & (FLAG_S | FLAG_Y | FLAG_X)) | (res16 ? 0 : FLAG_Z) |
+                (((val1 ^ val2 ^ res16) >> 8) & FLAG_H) | (((val1 ^ val2) & (val1 ^ res16) & 0x8000) ? FLAG_PV : 0) |
+                FLAG_N | ((result & 0x10000) ? FLAG_C : 0);
+    return res16;
+}
+
+// RLC, RRC, RL, RR, SLA, SRA, SLL, SRL
+uint8_t Z80BusCycleGen::rotShift(int op, uint8_t val)
+{
+    uint8_t carryIn = _regs.af.b.l & FLAG_C;
+    uint8_t carryOut = (op & 1) ? (val & 0x01) : (val >> 7);
+    uint8_t result = 0;
+    switch (op)
+    {
+        case 0: result = (val << 1) | carryOut; break;
+        case 1: result = (val >> 1) | (carryOut << 7); break;
+        case 2: result = (val << 1) | carryIn; break;
+        case 3: result = (val >> 1) | (carryIn << 7); break;
+        case 4: result = val << 1; break;
+        case 5: result = (val >> 1) | (val & 0x80); break;
+        case 6: result = (val << 1) | 0x01; break;
+        case 7: result = val >> 1; break;
+    }
+    _regs.af.b.l = flagsSZP(result) | carryOut;
+    return result;
+}
+
+void Z80BusCycleGen::bitTest(int bit, uint8_t val, uint8_t xyVal)
+{
+    uint8_t bitVal = val & (1 << bit);
+    _regs.af.b.l = (_regs.af.b.l & FLAG_C) | FLAG_H | (xyVal & (FLAG_Y | FLAG_X)) |
+                (bitVal ? 0 : (FLAG_Z | FLAG_PV)) | (bitVal & FLAG_S);
+}
+
+void Z80BusCycleGen::daa()
+{
+    uint8_t a = _regs.af.b.h;
+    uint8_t f = _regs.af.b.l;
+    uint8_t correction = 0;
+    bool carry = (f & FLAG_C) != 0;
+    if ((f & FLAG_H) || ((a & 0x0f) > 9))
+        correction |= 0x06;
+    if (carry || (a > 0x99))
+    {
+        correction |= 0x60;
+        carry = true;
+    }
+    uint8_t result = (f & FLAG_N) ? a - correction : a + correction;
+    _regs.af.b.h = result;
+    _regs.af.b.l = flagsSZP(result) | (f & FLAG_N) | (carry ? FLAG_C : 0) | ((a ^ result) & FLAG_H);
+}
+
+uint8_t Z80BusCycleGen::flagsSZP(uint8_t val)
+{
+    uint8_t parity = val ^ (val >> 4);
+    parity ^= parity >> 2;
+    parity ^= parity >> 1;
+    return (val & (FLAG_S | FLAG_Y | FLAG_X)) | (val ? 0 : FLAG_Z) | ((parity & 1) ? 0 : FLAG_PV);
+}
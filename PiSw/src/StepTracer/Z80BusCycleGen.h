@@ -0,0 +1,161 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "../TargetBus/TargetRegisters.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Z80 bus cycle generator - a Z80 core which produces the bus cycles (address, data and control lines) a real
+// Z80 puts on the bus for each instruction in the order it does them
+//
+// Only cycles which can be waited are produced - refresh cycles (and the internal cycles of instructions
+// like LDIR or EX (SP),HL) don't have a wait state so aren't seen by the wait handler
+// An instruction includes its prefixes (each fetched with M1), the displacement and opcode of DD CB / FD CB
+// instructions are ordinary memory reads (no M1) and while halted each instruction is a single M1 fetch
+// at the address after the HALT
+// A DD or FD followed by another DD or FD has no effect so it is generated as a one cycle instruction
+// An interrupt response starts with the acknowledge cycle (IORQ and M1) whose data is the vector (IM2)
+// or opcode (IM0 - only RST is supported) - NMI isn't followed as it has no cycle of its own to detect it
+//
+// The value of an IO read isn't known until the real cycle is seen so an instruction can be generated again
+// with the value (the cycles before the read don't depend on it)
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Bus cycle
+struct Z80BusCycle
+{
+    uint32_t addr;
+    uint32_t data;
+    uint32_t flags;
+};
+
+// Memory and IO access for generated cycles
+typedef uint8_t Z80BusCycleReadFnType(uint32_t addr);
+typedef void Z80BusCycleWriteFnType(uint32_t addr, uint8_t data);
+
+class Z80BusCycleGen
+{
+public:
+    Z80BusCycleGen();
+    void setAccessFns(Z80BusCycleReadFnType* pMemRead, Z80BusCycleWriteFnType* pMemWrite,
+                Z80BusCycleReadFnType* pIORead, Z80BusCycleWriteFnType* pIOWrite);
+
+    // Processor reset
+    void reset();
+
+    // Registers - set to generate from a known processor state (clears halted)
+    void setRegs(const Z80Registers& regs);
+    void getRegs(Z80Registers& regs);
+
+    // Generate the cycles of the next instruction or of the response to an acknowledged interrupt
+    // - return the number of cycles
+    int genInstr();
+    int genIntResponse(uint8_t ackData);
+
+    // Generate the last instruction again with the value of its IO read
+    int genAgainWithIORead(uint8_t ioData);
+
+    // Cycles generated
+    const Z80BusCycle& getCycle(int idx)
+    {
+        return _cycles[idx];
+    }
+
+    // Max cycles generated for one instruction (or interrupt response)
+    static const int MAX_CYCLES_PER_INSTR = 10;
+
+    // True if the last instruction generated had more cycles than the max (those after the max are lost)
+    bool cyclesOverflowed()
+    {
+        return _cyclesOverflowed;
+    }
+
+private:
+    // Registers
+    union RegPair
+    {
+        uint16_t w;
+        struct
+        {
+            uint8_t l;
+            uint8_t h;
+        } b;
+    };
+    struct Regs
+    {
+        RegPair af, bc, de, hl, ix, iy, sp, wz;
+        RegPair afAlt, bcAlt, deAlt, hlAlt;
+        uint16_t pc;
+        uint8_t i, r;
+        uint8_t iff1, iff2, im;
+        bool halted;
+    };
+    Regs _regs;
+
+    // Registers at the start of the last instruction and the IO value to use when generating again
+    Regs _regsAtInstrStart;
+    bool _ioReadDataValid;
+    uint8_t _ioReadData;
+
+    // Memory and IO
+    Z80BusCycleReadFnType* _pMemRead;
+    Z80BusCycleWriteFnType* _pMemWrite;
+    Z80BusCycleReadFnType* _pIORead;
+    Z80BusCycleWriteFnType* _pIOWrite;
+
+    // Cycles of the instruction
+    Z80BusCycle _cycles[MAX_CYCLES_PER_INSTR];
+    int _numCycles;
+    bool _cyclesOverflowed;
+
+    // HL or the index register in use for this instruction
+    RegPair* _pIdx;
+
+    // Bus cycles
+    void addCycle(uint32_t addr, uint32_t data, uint32_t flags);
+    uint8_t fetchOpcode();
+    uint8_t fetchByte();
+    uint16_t fetchWord();
+    uint8_t readMem(uint16_t addr);
+    void writeMem(uint16_t addr, uint8_t data);
+    uint8_t readIO(uint16_t port);
+    void writeIO(uint16_t port, uint8_t data);
+    void push(uint16_t val);
+    uint16_t pop();
+
+    // Registers by opcode field
+    uint8_t getReg8(int idx);
+    void setReg8(int idx, uint8_t val);
+    uint8_t getReg8NoIdx(int idx);
+    void setReg8NoIdx(int idx, uint8_t val);
+    RegPair& regPairSP(int idx);
+    RegPair& regPairAF(int idx);
+    bool testCond(int cond);
+    uint16_t memOperandAddr();
+
+    // Execute
+    void genNextInstr();
+    void execMain(uint8_t opcode);
+    void execMainX0(int y, int z, int p, int q);
+    void execMainX3(int y, int z, int p, int q);
+    void execCB(uint8_t opcode);
+    void execIndexedCB();
+    void execED(uint8_t opcode);
+    void execBlock(int y, int z);
+
+    // ALU
+    void alu8(int op, uint8_t val);
+    uint8_t inc8(uint8_t val);
+    uint8_t dec8(uint8_t val);
+    uint16_t add16(uint16_t val1, uint16_t val2);
+    uint16_t adc16(uint16_t val1, uint16_t val2);
+    uint16_t sbc16(uint16_t val1, uint16_t val2);
+    uint8_t rotShift(int op, uint8_t val);
+    void bitTest(int bit, uint8_t val, uint8_t xyVal);
+    void daa();
+    static uint8_t flagsSZP(uint8_t val);
+};
@@ -35,6 +35,17 @@ extern void blinkLEDForever();
 
 extern void disable_mmu_and_cache();
 
+#ifdef BUSACCESS_SIM
+// Host-side simulation - no caches or barriers to manage
+#define InvalidateInstructionCache()
+#define FlushPrefetchBuffer()
+#define FlushBranchTargetCache()
+#define lowlev_dmb()
+#define lowlev_dsb()
+#define lowlev_flushcache()
+#define lowlev_cycleCounterEnable()
+extern uint32_t lowlev_cycleCounterRead();
+#else
 #define InvalidateInstructionCache()	\
 				asm volatile ("mcr p15, 0, %0, c7, c5,  0" : : "r" (0) : "memory")
 #define FlushPrefetchBuffer()	asm volatile ("mcr p15, 0, %0, c7, c5,  4" : : "r" (0) : "memory")
@@ -58,6 +69,20 @@ extern void disable_mmu_and_cache();
                                   :                                   \
                                   : [zero] "r"(0))
 
+// Enable the ARM1176 performance monitor - the cycle counter (CCNT) then counts CPU clock cycles
+#define lowlev_cycleCounterEnable() asm volatile("mcr p15, #0, %[en], c15, c12, #0" \
+                                  :                                   \
+                                  : [en] "r"(1))
+
+// Read the cycle counter - this wraps so only differences are meaningful
+static inline uint32_t lowlev_cycleCounterRead()
+{
+    uint32_t cycles;
+    asm volatile("mrc p15, #0, %[cycles], c15, c12, #1" : [cycles] "=r"(cycles));
+    return cycles;
+}
+#endif
+
 #define lowlev_mem_p2v(X) (X)
 #define lowlev_mem_v2p(X) (X)
 #define lowlev_mem_2uncached(X) ((((unsigned int)X) & 0x0FFFFFFF) | 0x40000000)
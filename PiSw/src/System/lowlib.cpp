@@ -15,14 +15,12 @@ extern "C" {
 
 uint32_t micros()
 {
-    static const uint32_t volatile* pTimerLower32Bits = (uint32_t*)ARM_SYSTIMER_CLO;
-    return *pTimerLower32Bits;
+    return RD32(ARM_SYSTIMER_CLO);
 }
 
 uint32_t millis()
 {
-    static const uint32_t volatile* pTimerLower32Bits = (uint32_t*)ARM_SYSTIMER_CLO;
-    return (*pTimerLower32Bits) / 1000;
+    return RD32(ARM_SYSTIMER_CLO) / 1000;
 }
 
 void microsDelay(uint32_t us)
@@ -58,6 +56,33 @@ uint32_t timeToTimeout(unsigned long curTime, unsigned long lastTime, unsigned l
     return maxDuration - (ULONG_MAX - (lastTime - curTime));
 }
 
+#ifdef BUSACCESS_SIM
+
+// Host C libraries before glibc 2.38 don't have these
+#if defined(__GLIBC__) && ((__GLIBC__ < 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ < 38)))
+size_t strlcpy(char * dst, const char * src, size_t dsize)
+{
+    size_t srcLen = strlen(src);
+    if (dsize != 0)
+    {
+        size_t copyLen = (srcLen < dsize - 1) ? srcLen : dsize - 1;
+        memcpy(dst, src, copyLen);
+        dst[copyLen] = 0;
+    }
+    return srcLen;
+}
+
+size_t strlcat(char * dst, const char * src, size_t maxlen)
+{
+    size_t dstLen = strnlen(dst, maxlen);
+    if (dstLen == maxlen)
+        return maxlen + strlen(src);
+    return dstLen + strlcpy(dst + dstLen, src, maxlen - dstLen);
+}
+#endif
+
+#else
+
 // Startup code
 extern "C" void entry_point()
 {
@@ -122,6 +147,8 @@ extern "C" int __aeabi_atexit(
 
 void* __dso_handle = nullptr;
 
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,8 +12,16 @@
 extern "C" {
 #endif
 
+#ifdef BUSACCESS_SIM
+// Host-side simulation - register accesses go to a virtual register file (see TargetBus/BusAccessSim.h)
+extern uint32_t busAccessSimRd32(uint32_t addr);
+extern void busAccessSimWr32(uint32_t addr, uint32_t val);
+#define WR32(addr, val) busAccessSimWr32((uint32_t)(addr), (uint32_t)(val))
+#define RD32(addr) busAccessSimRd32((uint32_t)(addr))
+#else
 #define WR32(addr, val) (*(volatile unsigned *)(addr)) = (val)
 #define RD32(addr) (*(volatile unsigned *)(addr))
+#endif
 
 extern uint32_t micros();
 extern uint32_t millis();
@@ -32,10 +40,20 @@ extern void heapInit();
 #define MAXOPT		__attribute__ ((optimize (3)))
 #define WEAK		__attribute__ ((weak))
 
+#ifdef BUSACCESS_SIM
+// Host C library provides string functions - strlcpy/strlcat are in lowlib.cpp for glibc before 2.38
+#include <string.h>
+#include <strings.h>
+#if defined(__GLIBC__) && ((__GLIBC__ < 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ < 38)))
+extern size_t strlcpy(char * dst, const char * src, size_t dsize);
+extern size_t strlcat(char * dst, const char * src, size_t maxlen);
+#endif
+#else
 extern size_t strlcpy(char * dst, const char * src, size_t dsize);
 extern size_t strlcat(char * dst, const char * src, size_t maxlen);
 extern int strcasecmp (const char *s1, const char *s2);
 extern int strncasecmp (const char *s1, const char *s2, size_t maxlen);
+#endif
 
 #ifdef __cplusplus
 }
@@ -209,6 +209,28 @@ void nmalloc_free(void** pptr)
     merge_adjacent_free_blocks();
 }
 
+size_T nmalloc_free_space(void)
+{
+    size_T freespace = 0;
+    block* cfree = _nmalloc_data.first_free;
+    while (cfree) {
+        freespace += cfree->size;
+        cfree = cfree->next;
+    }
+    return freespace;
+}
+
+size_T nmalloc_num_free_blocks(void)
+{
+    size_T freeblocks = 0;
+    block* cfree = _nmalloc_data.first_free;
+    while (cfree) {
+        freeblocks++;
+        cfree = cfree->next;
+    }
+    return freeblocks;
+}
+
 #ifdef NMALLOC_DEBUG
 
 void nmalloc_print_blocks(void)
@@ -235,26 +257,4 @@ void nmalloc_print_blocks(void)
     printf("\n");
 }
 
-size_T nmalloc_free_space(void)
-{
-    size_T freespace = 0;
-    block* cfree = _nmalloc_data.first_free;
-    while (cfree) {
-        freespace += cfree->size;
-        cfree = cfree->next;
-    }
-    return freespace;
-}
-
-size_T nmalloc_num_free_blocks(void)
-{
-    size_T freeblocks = 0;
-    block* cfree = _nmalloc_data.first_free;
-    while (cfree) {
-        freeblocks++;
-        cfree = cfree->next;
-    }
-    return freeblocks;
-}
-
 #endif
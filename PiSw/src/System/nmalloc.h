@@ -54,13 +54,13 @@ typedef unsigned int size_T;
 extern void nmalloc_set_memory_area(void* pBuff, size_T max_size);
 extern void* nmalloc_malloc(size_T size);
 extern void nmalloc_free(void** ptr);
+extern size_T nmalloc_free_space(void);
+extern size_T nmalloc_num_free_blocks(void);
 
 /* The following functions are available only in debug mode */
 #ifdef NMALLOC_DEBUG
 
 extern void nmalloc_print_blocks(void);
-extern size_T nmalloc_free_space(void);
-extern size_T nmalloc_num_free_blocks(void);
 
 #endif
 
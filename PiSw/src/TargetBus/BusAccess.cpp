@@ -29,6 +29,19 @@ int BusAccess::_hwVersionNumber = HW_VERSION_DEFAULT;
 // Bus sockets
 BusSocketInfo BusAccess::_busSockets[MAX_BUS_SOCKETS];
 int BusAccess::_busSocketCount = 0;
+const char* BusAccess::_busSocketNames[MAX_BUS_SOCKETS];
+
+// Callback cost
+BusSocketCallbackCost BusAccess::_busSocketAccessCost[MAX_BUS_SOCKETS][BR_BUS_CYCLE_NUM_CLASSES];
+BusSocketCallbackCost BusAccess::_busSocketActionCost[MAX_BUS_SOCKETS];
+
+// Bus access callbacks for each class of bus cycle
+BusAccess::BusCycleDispatch BusAccess::_busCycleDispatch[BR_BUS_CYCLE_NUM_CLASSES][MAX_BUS_SOCKETS];
+volatile int BusAccess::_busCycleDispatchCount[BR_BUS_CYCLE_NUM_CLASSES];
+
+// IO ports of interest to any socket - used for fast release of other IORQ waits
+volatile bool BusAccess::_ioFastReleaseEnabled = false;
+uint32_t BusAccess::_ioFastReleasePorts[BR_BUS_FILTER_BITMAP_WORDS];
 
 // Bus service enabled - can be disabled to allow external API to completely control bus
 bool BusAccess::_busServiceEnabled = true;
@@ -59,6 +72,15 @@ volatile uint32_t BusAccess::_busActionAssertedMaxUs = 0;
 volatile BusAccess::BUS_ACTION_STATE BusAccess::_busActionState = BUS_ACTION_STATE_NONE;
 volatile bool BusAccess::_busActionSyncWithWait = false;
 
+// Bus action queue - types in priority order and the max time each may wait before it is
+// started ahead of higher priority actions
+const BR_BUS_ACTION BusAccess::_busActionPriority[BUS_ACTION_NUM_QUEUED_TYPES] = 
+        { BR_BUS_ACTION_BUSRQ, BR_BUS_ACTION_RESET, BR_BUS_ACTION_NMI, BR_BUS_ACTION_IRQ };
+const uint32_t BusAccess::_busActionDeadlineUs[BUS_ACTION_NUM_QUEUED_TYPES] = 
+        { 20000, 20000, 2000, 2000 };
+volatile uint32_t BusAccess::_busActionReqUs[MAX_BUS_SOCKETS][BUS_ACTION_NUM_QUEUED_TYPES];
+volatile int BusAccess::_busActionLastServedSocket = -1;
+
 // Status
 BusAccessStatusInfo BusAccess::_statusInfo;
 
@@ -78,6 +100,12 @@ bool volatile BusAccess::_targetReadInProgress = false;
 // Initialise the bus raider
 void BusAccess::init()
 {
+    // Bus access functions for hardware version
+    hwVersionSelect();
+
+    // Cycle counter used to measure callback cost
+    lowlev_cycleCounterEnable();
+
     // Clock
     clockSetup();
     clockSetFreqHz(1000000);
@@ -222,6 +250,8 @@ void BusAccess::waitSetCycleUs(uint32_t cycleUs)
 void BusAccess::waitRelease()
 {
     // LogWrite("BusAccess", LOG_DEBUG, "waitRelease");
+    if (_waitAsserted)
+        _statusInfo.waitLatencyHist.add(micros() - _waitAssertedStartUs);
     waitResetFlipFlops();
     // Handle release after a read
     waitHandleReadRelease();
@@ -264,6 +294,7 @@ void BusAccess::targetReqReset(int busSocket, int durationTStates)
     if ((busSocket < 0) || (busSocket >= _busSocketCount))
         return;
     _busSockets[busSocket].resetDurationTStates = (durationTStates <= 0) ? BR_RESET_PULSE_T_STATES : durationTStates;
+    busActionRequested(busSocket, BR_BUS_ACTION_RESET, _busSockets[busSocket].resetPending);
     _busSockets[busSocket].resetPending = true;
     LogWrite("BusAccess", LOG_DEBUG, "targetReqReset");
 }
@@ -276,6 +307,7 @@ void BusAccess::targetReqNMI(int busSocket, int durationTStates)
         return;
     // Request NMI
     _busSockets[busSocket].nmiDurationTStates = (durationTStates <= 0) ? BR_NMI_PULSE_T_STATES : durationTStates;
+    busActionRequested(busSocket, BR_BUS_ACTION_NMI, _busSockets[busSocket].nmiPending);
     _busSockets[busSocket].nmiPending = true;
 }
 
@@ -288,6 +320,7 @@ void BusAccess::targetReqIRQ(int busSocket, int durationTStates)
         return;
     // Request NMI
     _busSockets[busSocket].irqDurationTStates = (durationTStates <= 0) ? BR_IRQ_PULSE_T_STATES : durationTStates;
+    busActionRequested(busSocket, BR_BUS_ACTION_IRQ, _busSockets[busSocket].irqPending);
     _busSockets[busSocket].irqPending = true;
 }
 
@@ -300,6 +333,7 @@ void BusAccess::targetReqBus(int busSocket, BR_BUS_ACTION_REASON busMasterReason
         LogWrite("BA", LOG_DEBUG, "targetReqBus sock %d invalid count = %d", busSocket, _busSocketCount);
         return;
     }
+    busActionRequested(busSocket, BR_BUS_ACTION_BUSRQ, _busSockets[busSocket].busMasterRequest);
     _busSockets[busSocket].busMasterRequest = true;
     _busSockets[busSocket].busMasterReason = busMasterReason;
 
@@ -384,24 +418,68 @@ void BusAccess::busActionCheck()
     if (_busActionState != BUS_ACTION_STATE_NONE)
         return;
 
-    // See if anything to do
+    // Choose from the pending actions - scanning in priority order and round-robin from the socket
+    // after the one last served means the first action found is the one to start unless another
+    // has passed its deadline
+    uint32_t nowUs = micros();
     int busSocket = -1;
-    for (int i = 0; i < _busSocketCount; i++)
+    int busActionIdx = 0;
+    uint32_t overdueUs = 0;
+    uint32_t queueLen = 0;
+    for (int prioIdx = 0; prioIdx < BUS_ACTION_NUM_QUEUED_TYPES; prioIdx++)
     {
-        if (_busSockets[i].enabled && (_busSockets[i].getType() != BR_BUS_ACTION_NONE))
+        BR_BUS_ACTION type = _busActionPriority[prioIdx];
+        for (int j = 0; j < _busSocketCount; j++)
         {
-            busSocket = i;
-            break;
+            int sockIdx = (_busActionLastServedSocket + 1 + j) % _busSocketCount;
+            if (!_busSockets[sockIdx].enabled || !_busSockets[sockIdx].isPending(type))
+                continue;
+            queueLen++;
+
+            // Check deadline
+            uint32_t waitUs = nowUs - _busActionReqUs[sockIdx][prioIdx];
+            uint32_t pastDeadlineUs = (waitUs > _busActionDeadlineUs[prioIdx]) ? 
+                        waitUs - _busActionDeadlineUs[prioIdx] : 0;
+            if ((busSocket < 0) || (pastDeadlineUs > overdueUs))
+            {
+                busSocket = sockIdx;
+                busActionIdx = prioIdx;
+                overdueUs = pastDeadlineUs;
+            }
         }
     }
     if (busSocket < 0)
         return;
 
+    // Stats
+    _statusInfo.busActionCount++;
+    if (_statusInfo.busActionQueueMax < queueLen)
+        _statusInfo.busActionQueueMax = queueLen;
+    if (overdueUs > 0)
+        _statusInfo.busActionOverdue++;
+
     // Set this new action as in progress
     _busActionSocket = busSocket;
-    _busActionType = _busSockets[busSocket].getType();
+    _busActionType = _busActionPriority[busActionIdx];
+    _busActionLastServedSocket = busSocket;
     _busActionState = BUS_ACTION_STATE_PENDING;
-    _busActionInProgressStartUs = micros();
+    _busActionInProgressStartUs = nowUs;
+}
+
+// Index of a bus action type in the queue
+int BusAccess::busActionQueueIdx(BR_BUS_ACTION type)
+{
+    for (int i = 0; i < BUS_ACTION_NUM_QUEUED_TYPES; i++)
+        if (_busActionPriority[i] == type)
+            return i;
+    return 0;
+}
+
+// Record the time of a new request - a repeated request keeps its original place in the queue
+void BusAccess::busActionRequested(int busSocket, BR_BUS_ACTION type, bool alreadyPending)
+{
+    if (!alreadyPending)
+        _busActionReqUs[busSocket][busActionQueueIdx(type)] = micros();
 }
 
 bool BusAccess::busActionHandleStart()
@@ -419,6 +497,8 @@ bool BusAccess::busActionHandleStart()
 
     // Set start timer
     _busActionAssertedStartUs = micros();
+    _statusInfo.busActionWaitHist.add(_busActionAssertedStartUs - 
+                _busActionReqUs[_busActionSocket][busActionQueueIdx(_busActionType)]);
     _busActionAssertedMaxUs = _busSockets[_busActionSocket].getAssertUs(_busActionType, clockCurFreqHz());
     _busActionState = BUS_ACTION_STATE_ASSERTED;
 
@@ -534,12 +614,25 @@ void BusAccess::busActionHandleActive()
             // Take control of bus
             controlTake();
 
+            // Coalesce BUSRQs from other sockets into this grant - every socket's callback is made
+            // so they are all served - if any is programming then use that reason as it also
+            // results in a mirror callback
+            BR_BUS_ACTION_REASON reason = _busSockets[_busActionSocket].busMasterReason;
+            for (int i = 0; i < _busSocketCount; i++)
+            {
+                if ((i == _busActionSocket) || !_busSockets[i].enabled || !_busSockets[i].busMasterRequest)
+                    continue;
+                _statusInfo.busActionCoalesced++;
+                if (_busSockets[i].busMasterReason == BR_BUS_ACTION_PROGRAMMING)
+                    reason = BR_BUS_ACTION_PROGRAMMING;
+            }
+
             // Clear the action now so that any new action raised by the callback
             // such as a reset, etc can be asserted before BUSRQ is released
             busActionClearFlags();
 
             // Callback
-            busActionCallback(BR_BUS_ACTION_BUSRQ, _busSockets[_busActionSocket].busMasterReason);
+            busActionCallback(BR_BUS_ACTION_BUSRQ, reason);
 
             // Release bus
             controlRelease();
@@ -592,7 +685,11 @@ void BusAccess::busActionCallback(BR_BUS_ACTION busActionType, BR_BUS_ACTION_REA
             continue;
         // Inform all active sockets of the bus action completion
         if (_busSockets[i].busActionCallback)
+        {
+            uint32_t cbStartCycles = lowlev_cycleCounterRead();
             _busSockets[i].busActionCallback(busActionType, reason);
+            _busSocketActionCost[i].add(lowlev_cycleCounterRead() - cbStartCycles);
+        }
     }
 
     // If we just programmed then call again for mirroring
@@ -603,7 +700,11 @@ void BusAccess::busActionCallback(BR_BUS_ACTION busActionType, BR_BUS_ACTION_REA
             if (!_busSockets[i].enabled)
                 continue;
             if (_busSockets[i].busActionCallback)
+            {
+                uint32_t cbStartCycles = lowlev_cycleCounterRead();
                 _busSockets[i].busActionCallback(busActionType, BR_BUS_ACTION_MIRROR);
+                _busSocketActionCost[i].add(lowlev_cycleCounterRead() - cbStartCycles);
+            }
         }
     }
 }
@@ -649,6 +750,10 @@ void BusAccess::serviceWaitActivity()
         // Check if we have a new wait (and we're not in BUSACK)
         if (((busVals & BR_WAIT_BAR_MASK) == 0) && ((busVals & BR_BUSACK_BAR_MASK) != 0))
         {
+            // Release IORQ waits on ports no socket is interested in
+            if (waitHandleFastRelease(busVals))
+                return;
+
             // Record the time of the wait start
             _waitAssertedStartUs = micros();
             _waitAsserted = true;
@@ -698,6 +803,34 @@ void BusAccess::serviceWaitActivity()
     }
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Fast release
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Release an IORQ wait immediately if no socket handles the port - only the low address is read
+// Returns true if the wait was released
+bool BusAccess::waitHandleFastRelease(uint32_t busVals)
+{
+    // Only IORQ read/write (not interrupt acknowledge) with no paging pending and on hardware
+    // where the low address can be read on its own
+    if (!_ioFastReleaseEnabled || _targetPageInOnReadComplete || !_hwFns.addrLowRead)
+        return false;
+    if (((busVals & BR_IORQ_BAR_MASK) != 0) || ((busVals & BR_V20_M1_BAR_MASK) == 0) ||
+                (((busVals & BR_RD_BAR_MASK) != 0) && ((busVals & BR_WR_BAR_MASK) != 0)))
+        return false;
+
+    // Read the low address (port)
+    uint32_t port = _hwFns.addrLowRead();
+    if (BusSocketInfo::filterMatch(_ioFastReleasePorts, port))
+        return false;
+
+    // Check if we need to assert any new bus requests and release
+    busActionHandleStart();
+    waitResetFlipFlops();
+    _statusInfo.isrIORQFastRelease++;
+    return true;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Read release
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -742,6 +875,7 @@ void BusAccess::waitHandleNew()
 {
     // Time at start of ISR
     uint32_t isrStartUs = micros();
+    uint32_t isrStartCycles = lowlev_cycleCounterRead();
 
     uint32_t addr = 0;
     uint32_t dataBusVals = 0;
@@ -776,20 +910,25 @@ void BusAccess::waitHandleNew()
         addrAndDataBusRead(addr, dataBusVals);
     }
 
-    // Send this to all bus sockets
+    // Send this to the bus sockets which handle this class of cycle (and whose filter matches)
     uint32_t retVal = BR_MEM_ACCESS_RSLT_NOT_DECODED;
-    for (int sockIdx = 0; sockIdx < _busSocketCount; sockIdx++)
+    int cycleClass = busCycleClass(ctrlBusVals);
+    uint32_t filterIdx = (ctrlBusVals & BR_CTRL_BUS_IORQ_MASK) ? (addr & 0xff) : ((addr >> 8) & 0xff);
+    BusCycleDispatch* pDispatch = _busCycleDispatch[cycleClass];
+    int dispatchCount = _busCycleDispatchCount[cycleClass];
+    for (int cbIdx = 0; cbIdx < dispatchCount; cbIdx++)
     {
-        if (_busSockets[sockIdx].enabled && _busSockets[sockIdx].busAccessCallback)
-        {
-            _busSockets[sockIdx].busAccessCallback(addr, dataBusVals, ctrlBusVals, retVal);
-            // TODO
-            // if (ctrlBusVals & BR_CTRL_BUS_IORQ_MASK)
-            //     LogWrite("BA", LOG_DEBUG, "%d IORQ %s from %04x %02x", sockIdx,
-            //             (ctrlBusVals & BR_CTRL_BUS_RD_MASK) ? "RD" : ((ctrlBusVals & BR_CTRL_BUS_WR_MASK) ? "WR" : "??"),
-            //             addr, 
-            //             (ctrlBusVals & BR_CTRL_BUS_WR_MASK) ? dataBusVals : retVal);
-        }
+        if (pDispatch[cbIdx].pFilter && !BusSocketInfo::filterMatch(pDispatch[cbIdx].pFilter, filterIdx))
+            continue;
+        uint32_t cbStartCycles = lowlev_cycleCounterRead();
+        pDispatch[cbIdx].busAccessCallback(addr, dataBusVals, ctrlBusVals, retVal);
+        _busSocketAccessCost[pDispatch[cbIdx].busSocket][cycleClass].add(lowlev_cycleCounterRead() - cbStartCycles);
+        // TODO
+        // if (ctrlBusVals & BR_CTRL_BUS_IORQ_MASK)
+        //     LogWrite("BA", LOG_DEBUG, "%d IORQ %s from %04x %02x", cbIdx,
+        //             (ctrlBusVals & BR_CTRL_BUS_RD_MASK) ? "RD" : ((ctrlBusVals & BR_CTRL_BUS_WR_MASK) ? "WR" : "??"),
+        //             addr, 
+        //             (ctrlBusVals & BR_CTRL_BUS_WR_MASK) ? dataBusVals : retVal);
     }
 
 #ifdef DEBUG_IORQ_PROCESSING
@@ -923,6 +1062,7 @@ void BusAccess::waitHandleNew()
     }
 
     // Elapsed and count
+    uint32_t isrElapsedCycles = lowlev_cycleCounterRead() - isrStartCycles;
     uint32_t isrElapsedUs = micros() - isrStartUs;
     _statusInfo.isrCount++;
 
@@ -963,6 +1103,30 @@ void BusAccess::waitHandleNew()
     if (_statusInfo.isrMaxUs < isrElapsedUs)
         _statusInfo.isrMaxUs = isrElapsedUs;
 
+    // Histogram
+    _statusInfo.isrLatencyHist[cycleClass].add(isrElapsedCycles);
+
+}
+
+void BusAccessLatencyHist::appendJson(char* pBuf, int maxLen)
+{
+    strlcat(pBuf, "[", maxLen);
+    for (int i = 0; i < NUM_BUCKETS; i++)
+    {
+        char tmpResp[20];
+        ee_sprintf(tmpResp, "%s%u", (i != 0) ? "," : "", buckets[i]);
+        strlcat(pBuf, tmpResp, maxLen);
+    }
+    strlcat(pBuf, "]", maxLen);
+}
+
+void BusSocketCallbackCost::appendJson(char* pBuf, int maxLen)
+{
+    char tmpResp[100];
+    ee_sprintf(tmpResp, "{\"n\":%u,\"totK\":%u,\"mean\":%u,\"max\":%u}", 
+                count, (uint32_t)(totalCycles / 1000), 
+                (count == 0) ? 0 : (uint32_t)(totalCycles / count), maxCycles);
+    strlcat(pBuf, tmpResp, maxLen);
 }
 
 char BusAccessStatusInfo::_jsonBuf[MAX_JSON_LEN];
@@ -974,6 +1138,27 @@ const char* BusAccessStatusInfo::getJson()
     ee_sprintf(tmpResp, ",\"mreqRd\":%u,\"mreqWr\":%u,\"iorqRd\":%u,\"iorqWr\":%u,\"irqAck\":%u,\"isrBadBusrq\":%u,\"irqDuringBusAck\":%u,\"irqNoWait\":%u",
                 isrMREQRD, isrMREQWR, isrIORQRD, isrIORQWR, isrIRQACK, isrSpuriousBUSRQ, isrDuringBUSACK, isrWithoutWAIT);
     strlcat(_jsonBuf, tmpResp, MAX_JSON_LEN);
+    ee_sprintf(tmpResp, ",\"iorqFast\":%u,\"blkRdBps\":%u,\"blkWrBps\":%u", 
+                isrIORQFastRelease, blockRdBytesPerSec, blockWrBytesPerSec);
+    strlcat(_jsonBuf, tmpResp, MAX_JSON_LEN);
+    ee_sprintf(tmpResp, ",\"actCount\":%u,\"actQMax\":%u,\"actOverdue\":%u,\"actCoalesced\":%u", 
+                busActionCount, busActionQueueMax, busActionOverdue, busActionCoalesced);
+    strlcat(_jsonBuf, tmpResp, MAX_JSON_LEN);
+
+    // Latency histograms
+    static const char* histNames[BR_BUS_CYCLE_NUM_CLASSES] = 
+            { "m1", "mreqRd", "mreqWr", "iorqRd", "iorqWr", "irqAck", "other" };
+    strlcat(_jsonBuf, ",\"isrHistCycles\":{", MAX_JSON_LEN);
+    for (int i = 0; i < BR_BUS_CYCLE_NUM_CLASSES; i++)
+    {
+        ee_sprintf(tmpResp, "%s\"%s\":", (i != 0) ? "," : "", histNames[i]);
+        strlcat(_jsonBuf, tmpResp, MAX_JSON_LEN);
+        isrLatencyHist[i].appendJson(_jsonBuf, MAX_JSON_LEN);
+    }
+    strlcat(_jsonBuf, "},\"waitHistUs\":", MAX_JSON_LEN);
+    waitLatencyHist.appendJson(_jsonBuf, MAX_JSON_LEN);
+    strlcat(_jsonBuf, ",\"actWaitHistUs\":", MAX_JSON_LEN);
+    busActionWaitHist.appendJson(_jsonBuf, MAX_JSON_LEN);
 
 #ifdef DEBUG_IORQ_PROCESSING
     ee_sprintf(_jsonBuf, "");
@@ -131,6 +131,39 @@
 // Clock frequency for debug
 #define BR_TARGET_DEBUG_CLOCK_HZ 500000
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Bus cycle classes
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Classes of bus cycle - sockets select the classes their busAccessCallback is called for
+enum BR_BUS_CYCLE_CLASS
+{
+    BR_BUS_CYCLE_M1,
+    BR_BUS_CYCLE_MREQ_RD,
+    BR_BUS_CYCLE_MREQ_WR,
+    BR_BUS_CYCLE_IORQ_RD,
+    BR_BUS_CYCLE_IORQ_WR,
+    BR_BUS_CYCLE_IRQ_ACK,
+    BR_BUS_CYCLE_OTHER,
+    BR_BUS_CYCLE_NUM_CLASSES
+};
+
+// Masks for above
+#define BR_BUS_CYCLE_M1_MASK (1 << BR_BUS_CYCLE_M1)
+#define BR_BUS_CYCLE_MREQ_RD_MASK (1 << BR_BUS_CYCLE_MREQ_RD)
+#define BR_BUS_CYCLE_MREQ_WR_MASK (1 << BR_BUS_CYCLE_MREQ_WR)
+#define BR_BUS_CYCLE_IORQ_RD_MASK (1 << BR_BUS_CYCLE_IORQ_RD)
+#define BR_BUS_CYCLE_IORQ_WR_MASK (1 << BR_BUS_CYCLE_IORQ_WR)
+#define BR_BUS_CYCLE_IRQ_ACK_MASK (1 << BR_BUS_CYCLE_IRQ_ACK)
+#define BR_BUS_CYCLE_OTHER_MASK (1 << BR_BUS_CYCLE_OTHER)
+#define BR_BUS_CYCLE_MREQ_MASK (BR_BUS_CYCLE_M1_MASK | BR_BUS_CYCLE_MREQ_RD_MASK | BR_BUS_CYCLE_MREQ_WR_MASK)
+#define BR_BUS_CYCLE_IORQ_MASK (BR_BUS_CYCLE_IORQ_RD_MASK | BR_BUS_CYCLE_IORQ_WR_MASK | BR_BUS_CYCLE_IRQ_ACK_MASK)
+#define BR_BUS_CYCLE_ALL_MASK ((1 << BR_BUS_CYCLE_NUM_CLASSES) - 1)
+#define BR_BUS_CYCLE_NONE_MASK 0
+
+// Bus cycle filters - bitmaps of 256 IO ports (low address byte) or 256 memory pages (high address byte)
+#define BR_BUS_FILTER_BITMAP_WORDS (256 / 32)
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Callback types
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -146,31 +179,59 @@ typedef void BusActionCBFnType(BR_BUS_ACTION actionType, BR_BUS_ACTION_REASON re
 class BusSocketInfo
 {
 public:
+    // Sockets are initialised in field order - fields left out of an initialiser get these defaults
+
     // Socket enablement
-    bool enabled;
+    bool enabled = false;
 
     // Callbacks
-    BusAccessCBFnType* busAccessCallback;
-    BusActionCBFnType* busActionCallback;
+    BusAccessCBFnType* busAccessCallback = NULL;
+    BusActionCBFnType* busActionCallback = NULL;
 
     // Flags
-    bool waitOnMemory;
-    bool waitOnIO;
+    bool waitOnMemory = false;
+    bool waitOnIO = false;
 
     // Bus actions and duration
-    volatile bool resetPending;
-    volatile uint32_t resetDurationTStates;
-    volatile bool nmiPending;
-    volatile uint32_t nmiDurationTStates;
-    volatile bool irqPending;
-    volatile uint32_t irqDurationTStates;
+    volatile bool resetPending = false;
+    volatile uint32_t resetDurationTStates = 0;
+    volatile bool nmiPending = false;
+    volatile uint32_t nmiDurationTStates = 0;
+    volatile bool irqPending = false;
+    volatile uint32_t irqDurationTStates = 0;
 
     // Bus master request and reason
-    volatile bool busMasterRequest;
-    volatile BR_BUS_ACTION_REASON busMasterReason;
+    volatile bool busMasterRequest = false;
+    volatile BR_BUS_ACTION_REASON busMasterReason = BR_BUS_ACTION_GENERAL;
 
     // Bus hold in wait
-    volatile bool holdInWaitReq;
+    volatile bool holdInWaitReq = false;
+
+    // Classes of bus cycle (BR_BUS_CYCLE_XXX_MASK) that busAccessCallback is called for
+    uint32_t busAccessCycles = BR_BUS_CYCLE_ALL_MASK;
+
+    // Filters - when enabled busAccessCallback is only called for IORQ cycles on ports (or MREQ cycles 
+    // on 256 byte memory pages) which are set in the bitmap
+    bool ioPortFilterEnabled = false;
+    bool memPageFilterEnabled = false;
+    uint32_t ioPortFilter[BR_BUS_FILTER_BITMAP_WORDS] = {};
+    uint32_t memPageFilter[BR_BUS_FILTER_BITMAP_WORDS] = {};
+
+    // Filter bitmap helpers
+    static void filterClear(uint32_t* pBitmap)
+    {
+        for (int i = 0; i < BR_BUS_FILTER_BITMAP_WORDS; i++)
+            pBitmap[i] = 0;
+    }
+    static void filterSetRange(uint32_t* pBitmap, uint32_t first, uint32_t last)
+    {
+        for (uint32_t idx = first; (idx <= last) && (idx < 256); idx++)
+            pBitmap[idx / 32] |= (1u << (idx % 32));
+    }
+    static inline bool filterMatch(const uint32_t* pBitmap, uint32_t idx)
+    {
+        return (pBitmap[idx / 32] & (1u << (idx % 32))) != 0;
+    }
 
     // Get type of bus action
     BR_BUS_ACTION getType()
@@ -186,6 +247,19 @@ public:
         return BR_BUS_ACTION_NONE;
     }
 
+    bool isPending(BR_BUS_ACTION type)
+    {
+        if (type == BR_BUS_ACTION_BUSRQ)
+            return busMasterRequest;
+        else if (type == BR_BUS_ACTION_RESET)
+            return resetPending;
+        else if (type == BR_BUS_ACTION_NMI)
+            return nmiPending;
+        else if (type == BR_BUS_ACTION_IRQ)
+            return irqPending;
+        return false;
+    }
+
     void clearDown(BR_BUS_ACTION type)
     {
         if (type == BR_BUS_ACTION_BUSRQ)
@@ -222,6 +296,69 @@ public:
     }
 };
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Latency histogram
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Log2 bucketed latency - bucket 0 is 0, bucket N is 2^(N-1) to 2^N - 1 and the last bucket also counts
+// anything longer - the units are CPU cycles (cycle counter) for ISR durations as they are usually
+// well under 1us and us for waits and bus actions which can be held for much longer
+class BusAccessLatencyHist
+{
+public:
+    static const int NUM_BUCKETS = 20;
+
+    void clear()
+    {
+        for (int i = 0; i < NUM_BUCKETS; i++)
+            buckets[i] = 0;
+    }
+
+    void add(uint32_t elapsed)
+    {
+        int bucketIdx = (elapsed == 0) ? 0 : 32 - __builtin_clz(elapsed);
+        if (bucketIdx >= NUM_BUCKETS)
+            bucketIdx = NUM_BUCKETS - 1;
+        buckets[bucketIdx]++;
+    }
+
+    // Append as a JSON array
+    void appendJson(char* pBuf, int maxLen);
+
+    uint32_t buckets[NUM_BUCKETS];
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Callback cost
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// CPU cycles spent in a bus socket's callbacks
+class BusSocketCallbackCost
+{
+public:
+    void clear()
+    {
+        count = 0;
+        totalCycles = 0;
+        maxCycles = 0;
+    }
+
+    void add(uint32_t cycles)
+    {
+        count++;
+        totalCycles += cycles;
+        if (maxCycles < cycles)
+            maxCycles = cycles;
+    }
+
+    // Append as a JSON object
+    void appendJson(char* pBuf, int maxLen);
+
+    uint32_t count;
+    uint64_t totalCycles;
+    uint32_t maxCycles;
+};
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Status Info
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -234,8 +371,17 @@ public:
         clear();
     }
     
+    void clearLatencyHist()
+    {
+        for (int i = 0; i < BR_BUS_CYCLE_NUM_CLASSES; i++)
+            isrLatencyHist[i].clear();
+        waitLatencyHist.clear();
+        busActionWaitHist.clear();
+    }
+
     void clear()
     {
+        clearLatencyHist();
         isrCount = 0;
         isrAccumUs = 0;
         isrAvgingCount = 0;
@@ -250,11 +396,18 @@ public:
         clrMaxUs = 0;
         busrqFailCount = 0;
         busActionFailedDueToWait = 0;
+        busActionCount = 0;
+        busActionQueueMax = 0;
+        busActionOverdue = 0;
+        busActionCoalesced = 0;
         isrMREQRD = 0;
         isrMREQWR = 0;
         isrIORQRD = 0;
         isrIORQWR = 0;
         isrIRQACK = 0;
+        isrIORQFastRelease = 0;
+        blockRdBytesPerSec = 0;
+        blockWrBytesPerSec = 0;
 #ifdef DEBUG_IORQ_PROCESSING
         _debugIORQNum = 0;
         _debugIORQClrMicros = 0;
@@ -265,7 +418,7 @@ public:
 #endif
     }
 
-    static const int MAX_JSON_LEN = 30 * 20;
+    static const int MAX_JSON_LEN = 34 * 20 + (BR_BUS_CYCLE_NUM_CLASSES + 2) * 260;
     static char _jsonBuf[MAX_JSON_LEN];
     const char* getJson();
 
@@ -287,6 +440,16 @@ public:
     uint32_t isrIORQRD;
     uint32_t isrIORQWR;
     uint32_t isrIRQACK;
+    uint32_t isrIORQFastRelease;
+
+    // Throughput of the last block read/write (excluding BUSRQ)
+    uint32_t blockRdBytesPerSec;
+    uint32_t blockWrBytesPerSec;
+
+    // Latency histograms - ISR duration (CPU cycles) for each class of bus cycle and time (us)
+    // from wait asserted to wait released
+    BusAccessLatencyHist isrLatencyHist[BR_BUS_CYCLE_NUM_CLASSES];
+    BusAccessLatencyHist waitLatencyHist;
 
     // Clear pulse edge width
     uint32_t clrAccumUs;
@@ -300,6 +463,14 @@ public:
     // Bus actions
     uint32_t busActionFailedDueToWait;
 
+    // Bus action queue - actions started, max number pending at once, actions started after their
+    // deadline, BUSRQ requests served by another socket's grant and time from request to assert
+    uint32_t busActionCount;
+    uint32_t busActionQueueMax;
+    uint32_t busActionOverdue;
+    uint32_t busActionCoalesced;
+    BusAccessLatencyHist busActionWaitHist;
+
 #ifdef DEBUG_IORQ_PROCESSING
     class DebugIORQ
     {
@@ -338,6 +509,20 @@ public:
 // Bus Access
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Block transfer descriptor - used to perform several block reads/writes in a single bus grant
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BusAccessTransfer
+{
+public:
+    uint32_t addr;
+    uint8_t* pData;
+    uint32_t len;
+    bool write;
+    bool iorq;
+};
+
 class TargetClockGenerator;
 
 class BusAccess
@@ -348,8 +533,11 @@ public:
     static void busAccessReset();
 
     // Bus Sockets - used to hook things like waitInterrupts, busControl, etc
-    static int busSocketAdd(BusSocketInfo& busSocketInfo);
+    static int busSocketAdd(BusSocketInfo& busSocketInfo, const char* pName = NULL);
     static void busSocketEnable(int busSocket, bool enable);
+    static void busSocketSetCycles(int busSocket, uint32_t busAccessCycles);
+    static void busSocketSetIOPortFilter(int busSocket, const uint32_t* pPortBitmap);
+    static void busSocketSetMemPageFilter(int busSocket, const uint32_t* pPageBitmap);
     static bool busSocketIsEnabled(int busSocket);
 
     // Wait state enablement
@@ -373,6 +561,7 @@ public:
     // Read and write blocks
     static BR_RETURN_TYPE blockWrite(uint32_t addr, const uint8_t* pData, uint32_t len, bool busRqAndRelease, bool iorq);
     static BR_RETURN_TYPE blockRead(uint32_t addr, uint8_t* pData, uint32_t len, bool busRqAndRelease, bool iorq);
+    static BR_RETURN_TYPE blockTransferList(const BusAccessTransfer* pList, int numTransfers, bool busRqAndRelease);
 
     // Wait hold and release
     static void waitRelease();
@@ -380,7 +569,10 @@ public:
     static void waitHold(int busSocket, bool hold);
 
     // Suspend bus detail for one cycle - used to fix a PIB contention issue
-    static void waitSuspendBusDetailOneCycle();
+    static void waitSuspendBusDetailOneCycle()
+    {
+        _hwFns.waitSuspendBusDetailOneCycle();
+    }
 
     // Service
     static void service();
@@ -409,6 +601,11 @@ public:
     // Status
     static void getStatus(BusAccessStatusInfo& statusInfo);
     static void clearStatus();
+    static void clearLatencyHist();
+
+    // Callback cost per socket (in CPU cycles)
+    static void getSocketCostJson(char* pBuf, int maxLen);
+    static void clearSocketCost();
 
     // External API low-level bus control
     static void rawBusControlEnable(bool en);
@@ -438,10 +635,14 @@ public:
     static void setHwVersion(int hwVersion)
     {
         _hwVersionNumber = hwVersion;
+        hwVersionSelect();
     }
 
     // Control of bus paging pin
-    static void busPagePinSetActive(bool active);
+    static void busPagePinSetActive(bool active)
+    {
+        _hwFns.busPagePinSetActive(active);
+    }
 
     // Debug
     static void isrAssert(int code);
@@ -453,8 +654,14 @@ public:
     // Bus request/ack
     static void controlRequest();
     static BR_RETURN_TYPE controlRequestAndTake();
-    static void controlRelease();
-    static void controlTake();
+    static void controlRelease()
+    {
+        _hwFns.controlRelease();
+    }
+    static void controlTake()
+    {
+        _hwFns.controlTake();
+    }
     static bool waitForBusAck(bool ack);
 
 private:
@@ -466,6 +673,27 @@ private:
     static const int MAX_BUS_SOCKETS = 10;
     static BusSocketInfo _busSockets[MAX_BUS_SOCKETS];
     static int _busSocketCount;
+    static const char* _busSocketNames[MAX_BUS_SOCKETS];
+
+    // Cycles spent in each socket's bus access callback (per class of bus cycle) and bus action callback
+    static BusSocketCallbackCost _busSocketAccessCost[MAX_BUS_SOCKETS][BR_BUS_CYCLE_NUM_CLASSES];
+    static BusSocketCallbackCost _busSocketActionCost[MAX_BUS_SOCKETS];
+
+    // Bus access callbacks for each class of bus cycle - rebuilt when sockets change
+    // The filter is the socket's port/page bitmap (or NULL if the socket has no filter for the cycle class)
+    struct BusCycleDispatch
+    {
+        BusAccessCBFnType* busAccessCallback;
+        const uint32_t* pFilter;
+        int busSocket;
+    };
+    static BusCycleDispatch _busCycleDispatch[BR_BUS_CYCLE_NUM_CLASSES][MAX_BUS_SOCKETS];
+    static volatile int _busCycleDispatchCount[BR_BUS_CYCLE_NUM_CLASSES];
+
+    // IO ports that any socket handles - IORQ waits on other ports are released without
+    // full bus cycle handling (only enabled when all IORQ sockets have a port filter)
+    static volatile bool _ioFastReleaseEnabled;
+    static uint32_t _ioFastReleasePorts[BR_BUS_FILTER_BITMAP_WORDS];
 
     // Bus service active
     static bool _busServiceEnabled;
@@ -511,6 +739,15 @@ private:
     };
     static volatile BUS_ACTION_STATE _busActionState;
 
+    // Bus action queue - pending actions are the per-socket request flags, each with the time it was
+    // requested - the next action is the most overdue one or, if none is overdue, the highest priority
+    // type with sockets served round-robin
+    static const int BUS_ACTION_NUM_QUEUED_TYPES = 4;
+    static const BR_BUS_ACTION _busActionPriority[BUS_ACTION_NUM_QUEUED_TYPES];
+    static const uint32_t _busActionDeadlineUs[BUS_ACTION_NUM_QUEUED_TYPES];
+    static volatile uint32_t _busActionReqUs[MAX_BUS_SOCKETS][BUS_ACTION_NUM_QUEUED_TYPES];
+    static volatile int _busActionLastServedSocket;
+
     // Bus currently under BusRaider control
     static volatile bool _busIsUnderControl;
 
@@ -526,21 +763,111 @@ private:
 private:
     // Bus actions
     static void busActionCheck();
+    static int busActionQueueIdx(BR_BUS_ACTION type);
+    static void busActionRequested(int busSocket, BR_BUS_ACTION type, bool alreadyPending);
     static bool busActionHandleStart();
     static void busActionHandleActive();
     static void busActionClearFlags();
     static void busActionCallback(BR_BUS_ACTION busActionType, BR_BUS_ACTION_REASON reason);
     static bool busAccessHandleIrqAck();
 
+    // Bus access functions specialised for each hardware version - the set used is selected
+    // by hwVersionSelect() so the wait handler, bus actions and block transfers have no runtime
+    // version checks
+    struct BusAccessHwFns
+    {
+        void (*controlTake)();
+        void (*controlRelease)();
+        void (*muxSet)(int muxVal);
+        void (*muxClear)();
+        void (*muxDataBusOutputEnable)();
+        void (*muxClearLowAddr)();
+        void (*waitSuspendBusDetailOneCycle)();
+        void (*busPagePinSetActive)(bool active);
+        uint32_t (*controlBusRead)();
+        void (*addrAndDataBusRead)(uint32_t& addr, uint32_t& dataBusVals);
+        // NULL if the hardware can't read the low address without full cycle handling
+        uint8_t (*addrLowRead)();
+        void (*addrLowSet)(uint32_t lowAddrByte);
+        void (*addrLowInc)();
+        void (*addrHighSet)(uint32_t highAddrByte);
+        void (*byteWrite)(uint32_t byte, int iorq);
+        uint8_t (*byteRead)(int iorq);
+        void (*blockWrite)(uint32_t addr, const uint8_t* pData, uint32_t len, bool iorq);
+        void (*blockRead)(uint32_t addr, uint8_t* pData, uint32_t len, bool iorq);
+    };
+    static BusAccessHwFns _hwFns;
+    static void hwVersionSelect();
+    template<int HW_VERSION>
+    static void hwFnsGet(BusAccessHwFns& hwFns);
+    template<int HW_VERSION>
+    static void controlTakeHw();
+    template<int HW_VERSION>
+    static void controlReleaseHw();
+    template<int HW_VERSION>
+    static void waitSuspendBusDetailOneCycleHw();
+    template<int HW_VERSION>
+    static void busPagePinSetActiveHw(bool active);
+
     // Set address
-    static void addrLowSet(uint32_t lowAddrByte);
-    static void addrLowInc();
-    static void addrHighSet(uint32_t highAddrByte);
+    static inline void addrLowSet(uint32_t lowAddrByte)
+    {
+        _hwFns.addrLowSet(lowAddrByte);
+    }
+    static inline void addrLowInc()
+    {
+        _hwFns.addrLowInc();
+    }
+    static inline void addrHighSet(uint32_t highAddrByte)
+    {
+        _hwFns.addrHighSet(highAddrByte);
+    }
     static void addrSet(unsigned int addr);
+    template<int HW_VERSION>
+    static void addrLowSetHw(uint32_t lowAddrByte);
+    template<int HW_VERSION>
+    static void addrLowIncHw();
+    template<int HW_VERSION>
+    static void addrHighSetHw(uint32_t highAddrByte);
+
+    // Bus cycle dispatch
+    static void busCycleDispatchUpdate();
+    static inline int busCycleClass(uint32_t ctrlBusVals)
+    {
+        if (ctrlBusVals & BR_CTRL_BUS_MREQ_MASK)
+        {
+            if (ctrlBusVals & BR_CTRL_BUS_RD_MASK)
+                return (ctrlBusVals & BR_CTRL_BUS_M1_MASK) ? BR_BUS_CYCLE_M1 : BR_BUS_CYCLE_MREQ_RD;
+            if (ctrlBusVals & BR_CTRL_BUS_WR_MASK)
+                return BR_BUS_CYCLE_MREQ_WR;
+        }
+        else if (ctrlBusVals & BR_CTRL_BUS_IORQ_MASK)
+        {
+            if (ctrlBusVals & BR_CTRL_BUS_M1_MASK)
+                return BR_BUS_CYCLE_IRQ_ACK;
+            if (ctrlBusVals & BR_CTRL_BUS_RD_MASK)
+                return BR_BUS_CYCLE_IORQ_RD;
+            if (ctrlBusVals & BR_CTRL_BUS_WR_MASK)
+                return BR_BUS_CYCLE_IORQ_WR;
+        }
+        return BR_BUS_CYCLE_OTHER;
+    }
 
     // Control bus read
-    static uint32_t controlBusRead();
-    static void addrAndDataBusRead(uint32_t& addr, uint32_t& dataBusVals);
+    static inline uint32_t controlBusRead()
+    {
+        return _hwFns.controlBusRead();
+    }
+    static inline void addrAndDataBusRead(uint32_t& addr, uint32_t& dataBusVals)
+    {
+        _hwFns.addrAndDataBusRead(addr, dataBusVals);
+    }
+    template<int HW_VERSION>
+    static uint32_t controlBusReadHw();
+    template<int HW_VERSION>
+    static void addrAndDataBusReadHw(uint32_t& addr, uint32_t& dataBusVals);
+    template<int HW_VERSION>
+    static uint8_t addrLowReadHw();
 
     // Control the PIB (bus used to transfer data to/from Pi)
     static inline void pibSetOut()
@@ -587,10 +914,12 @@ private:
     static void setPinOut(int pinNumber, bool val);
     static void setPinIn(int pinNumber);
 
+    // Mux control specialised for each hardware version (no runtime version checks)
     // Set the MUX
-    static inline void muxSet(int muxVal)
+    template<int HW_VERSION>
+    static inline void muxSetHw(int muxVal)
     {
-        if (_hwVersionNumber == 17)
+        if constexpr (HW_VERSION == 17)
         {
             // Clear first as this is a safe setting - sets HADDR_SER low
             WR32(ARM_GPIO_GPCLR0, BR_MUX_CTRL_BIT_MASK);
@@ -618,9 +947,10 @@ private:
     }
 
     // Clear the MUX
-    static inline void muxClear()
+    template<int HW_VERSION>
+    static inline void muxClearHw()
     {
-        if (_hwVersionNumber == 17)
+        if constexpr (HW_VERSION == 17)
         {
             // Clear to a safe setting - sets HADDR_SER low
             WR32(ARM_GPIO_GPCLR0, BR_MUX_CTRL_BIT_MASK);
@@ -640,9 +970,10 @@ private:
     }
 
     // Mux set data bus driver output enable
-    static inline void muxDataBusOutputEnable()
+    template<int HW_VERSION>
+    static inline void muxDataBusOutputEnableHw()
     {
-        if (_hwVersionNumber == 17)
+        if constexpr (HW_VERSION == 17)
         {
             // Clear first as this is a safe setting - sets HADDR_SER low
             WR32(ARM_GPIO_GPCLR0, BR_MUX_CTRL_BIT_MASK);
@@ -674,9 +1005,10 @@ private:
     }
 
     // Mux clear low address
-    static inline void muxClearLowAddr()
+    template<int HW_VERSION>
+    static inline void muxClearLowAddrHw()
     {
-        if (_hwVersionNumber == 17)
+        if constexpr (HW_VERSION == 17)
         {
             WR32(ARM_GPIO_GPCLR0, BR_MUX_CTRL_BIT_MASK);
             WR32(ARM_GPIO_GPSET0, BR_MUX_LADDR_CLR_BAR_LOW << BR_MUX_LOW_BIT_POS);
@@ -706,6 +1038,24 @@ private:
         
     }
 
+    // Mux control for the current hardware version
+    static inline void muxSet(int muxVal)
+    {
+        _hwFns.muxSet(muxVal);
+    }
+    static inline void muxClear()
+    {
+        _hwFns.muxClear();
+    }
+    static inline void muxDataBusOutputEnable()
+    {
+        _hwFns.muxDataBusOutputEnable();
+    }
+    static inline void muxClearLowAddr()
+    {
+        _hwFns.muxClearLowAddr();
+    }
+
     // Set signal (RESET/IRQ/NMI)
     static void setSignal(BR_BUS_ACTION busAction, bool assert);
 
@@ -714,6 +1064,7 @@ private:
     static void waitResetFlipFlops(bool forceClear = false);
     static void waitClearDetected();
     static void waitHandleNew();
+    static bool waitHandleFastRelease(uint32_t busVals);
     static void waitEnablementUpdate();
     static void waitGenerationDisable();
     static void waitHandleReadRelease();
@@ -722,8 +1073,27 @@ private:
     static void busAccessCallbackPageIn();
 
     // Read and write bytes
-    static void byteWrite(uint32_t byte, int iorq);
-    static uint8_t byteRead(int iorq);
+    static inline void byteWrite(uint32_t byte, int iorq)
+    {
+        _hwFns.byteWrite(byte, iorq);
+    }
+    static inline uint8_t byteRead(int iorq)
+    {
+        return _hwFns.byteRead(iorq);
+    }
+    template<int HW_VERSION>
+    static void byteWriteHw(uint32_t byte, int iorq);
+    template<int HW_VERSION>
+    static uint8_t byteReadHw(int iorq);
+
+    // Block transfers
+    template<int HW_VERSION>
+    static void blockWriteHw(uint32_t addr, const uint8_t* pData, uint32_t len, bool iorq);
+    template<int HW_VERSION>
+    static void blockReadHw(uint32_t addr, uint8_t* pData, uint32_t len, bool iorq);
+    static void blockWritePipelined(uint32_t addr, const uint8_t* pData, uint32_t len, bool iorq);
+    static void blockReadPipelined(uint32_t addr, uint8_t* pData, uint32_t len, bool iorq);
+    static uint32_t blockBytesPerSec(uint32_t len, uint32_t elapsedUs);
 
 private:
     // Timeouts
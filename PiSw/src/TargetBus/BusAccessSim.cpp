@@ -0,0 +1,530 @@
+// Bus Raider
+// Rob Dobson 2019
+// Host-side simulation of the BCM2835 GPIO/PWM registers and the target Z80 bus
+
+#ifdef BUSACCESS_SIM
+
+#include "BusAccessSim.h"
+#include "BusAccess.h"
+#include "../System/BCM2835.h"
+#include "../System/ee_sprintf.h"
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Variables
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Register file
+uint32_t BusAccessSim::_gpfSel[6];
+uint32_t BusAccessSim::_gpioOutLatch = 0;
+uint32_t BusAccessSim::_pwmCtl = 0;
+int BusAccessSim::_pwmFifoChan = 0;
+uint32_t BusAccessSim::_cmPwmCtl = 0;
+uint32_t BusAccessSim::_cmPwmDiv = 0;
+uint32_t BusAccessSim::_otherRegAddrs[MAX_OTHER_REGS];
+uint32_t BusAccessSim::_otherRegVals[MAX_OTHER_REGS];
+int BusAccessSim::_otherRegCount = 0;
+
+// Address latches
+uint32_t BusAccessSim::_lowAddrCounter = 0;
+uint32_t BusAccessSim::_lowAddrOut = 0;
+uint32_t BusAccessSim::_highAddrShift = 0;
+uint32_t BusAccessSim::_highAddrOut = 0;
+bool BusAccessSim::_dataOEFlipFlop = false;
+
+// Target state
+const BusAccessSimCycle* BusAccessSim::_pScript = NULL;
+int BusAccessSim::_scriptLen = 0;
+int BusAccessSim::_scriptPos = 0;
+bool BusAccessSim::_scriptLoop = false;
+bool BusAccessSim::_cycleActive = false;
+bool BusAccessSim::_waitAsserted = false;
+bool BusAccessSim::_busAck = false;
+uint64_t BusAccessSim::_cycleStartNs = 0;
+uint64_t BusAccessSim::_cycleEndNs = 0;
+uint64_t BusAccessSim::_nextCycleNs = 0;
+uint32_t BusAccessSim::_waitStartRegAccesses = 0;
+uint8_t BusAccessSim::_targetMemory[0x10000];
+uint8_t BusAccessSim::_targetIO[0x100];
+
+// Timing - defaults approximate a Pi Zero (1GHz ARM, slow peripheral bus) and a 4MHz Z80
+uint64_t BusAccessSim::_simTimePs = 0;
+uint32_t BusAccessSim::_nsPerRegAccess = 40;
+uint32_t BusAccessSim::_psPerDelayCycle = 1000;
+uint32_t BusAccessSim::_nsPerBusCycle = 750;
+uint32_t BusAccessSim::_nsBetweenBusCycles = 250;
+
+// Callback
+BusAccessSimCycleCBFnType* BusAccessSim::_pCycleCB = NULL;
+
+// Stats
+BusAccessSimStats BusAccessSim::_stats;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Hooks for RD32/WR32 and low-level functions
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+extern "C" uint32_t busAccessSimRd32(uint32_t addr)
+{
+    return BusAccessSim::rd32(addr);
+}
+
+extern "C" void busAccessSimWr32(uint32_t addr, uint32_t val)
+{
+    BusAccessSim::wr32(addr, val);
+}
+
+extern "C" void lowlev_cycleDelay(unsigned int cycles)
+{
+    BusAccessSim::cycleDelay(cycles);
+}
+
+// Cycle counter - the simulated CPU runs at 1GHz
+extern "C" uint32_t lowlev_cycleCounterRead()
+{
+    return (uint32_t)BusAccessSim::getTimeNs();
+}
+
+extern "C" void lowlev_enable_irq()
+{
+}
+
+extern "C" void lowlev_disable_irq()
+{
+}
+
+extern "C" void lowlev_enable_fiq()
+{
+}
+
+extern "C" void lowlev_disable_fiq()
+{
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Setup
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BusAccessSim::reset()
+{
+    memset(_gpfSel, 0, sizeof(_gpfSel));
+    _gpioOutLatch = 0;
+    _pwmCtl = 0;
+    _pwmFifoChan = 0;
+    _cmPwmCtl = 0;
+    _cmPwmDiv = 0;
+    _otherRegCount = 0;
+    _lowAddrCounter = 0;
+    _lowAddrOut = 0;
+    _highAddrShift = 0;
+    _highAddrOut = 0;
+    _dataOEFlipFlop = false;
+    _pScript = NULL;
+    _scriptLen = 0;
+    _scriptPos = 0;
+    _scriptLoop = false;
+    _cycleActive = false;
+    _waitAsserted = false;
+    _busAck = false;
+    _nextCycleNs = 0;
+    memset(_targetMemory, 0, sizeof(_targetMemory));
+    memset(_targetIO, 0xff, sizeof(_targetIO));
+    _stats.clear();
+}
+
+void BusAccessSim::setTiming(uint32_t nsPerRegAccess, uint32_t psPerDelayCycle,
+            uint32_t nsPerBusCycle, uint32_t nsBetweenBusCycles)
+{
+    _nsPerRegAccess = nsPerRegAccess;
+    _psPerDelayCycle = psPerDelayCycle;
+    _nsPerBusCycle = nsPerBusCycle;
+    _nsBetweenBusCycles = nsBetweenBusCycles;
+}
+
+void BusAccessSim::setScript(const BusAccessSimCycle* pCycles, int numCycles, bool loop)
+{
+    _pScript = pCycles;
+    _scriptLen = numCycles;
+    _scriptPos = 0;
+    _scriptLoop = loop;
+    _nextCycleNs = getTimeNs() + _nsBetweenBusCycles;
+}
+
+bool BusAccessSim::isScriptComplete()
+{
+    return !_scriptLoop && !_cycleActive && (_scriptPos >= _scriptLen);
+}
+
+uint32_t BusAccessSim::runScript(uint32_t maxServiceCalls)
+{
+    uint32_t serviceCalls = 0;
+    while ((serviceCalls < maxServiceCalls) && !isScriptComplete())
+    {
+        BusAccess::service();
+        serviceCalls++;
+    }
+    return serviceCalls;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Register access
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t BusAccessSim::rd32(uint32_t addr)
+{
+    _stats.regReads++;
+    _simTimePs += (uint64_t)_nsPerRegAccess * 1000;
+    busUpdate();
+
+    if ((addr >= ARM_GPIO_GPFSEL0) && (addr <= ARM_GPIO_GPFSEL5))
+        return _gpfSel[(addr - ARM_GPIO_GPFSEL0) / 4];
+    switch (addr)
+    {
+        case ARM_GPIO_GPLEV0: return gpioLevels();
+        case ARM_GPIO_GPLEV1: return 0xffffffff;
+        case ARM_PWM_CTL: return _pwmCtl;
+        case ARM_PWM_STA: return 0;
+        case ARM_CM_PWMCTL: return _cmPwmCtl & ~ARM_CM_CTL_BUSY;
+        case ARM_CM_PWMDIV: return _cmPwmDiv;
+        case ARM_SYSTIMER_CLO: return (uint32_t)(getTimeNs() / 1000);
+        case ARM_SYSTIMER_CHI: return (uint32_t)((getTimeNs() / 1000) >> 32);
+    }
+    for (int i = 0; i < _otherRegCount; i++)
+        if (_otherRegAddrs[i] == addr)
+            return _otherRegVals[i];
+    return 0;
+}
+
+void BusAccessSim::wr32(uint32_t addr, uint32_t val)
+{
+    _stats.regWrites++;
+    _simTimePs += (uint64_t)_nsPerRegAccess * 1000;
+
+    if ((addr >= ARM_GPIO_GPFSEL0) && (addr <= ARM_GPIO_GPFSEL5))
+    {
+        _gpfSel[(addr - ARM_GPIO_GPFSEL0) / 4] = val;
+    }
+    else if (addr == ARM_GPIO_GPSET0)
+    {
+        uint32_t prevLatch = _gpioOutLatch;
+        _gpioOutLatch |= val;
+        gpioOutputsChanged(prevLatch);
+    }
+    else if (addr == ARM_GPIO_GPCLR0)
+    {
+        uint32_t prevLatch = _gpioOutLatch;
+        _gpioOutLatch &= ~val;
+        gpioOutputsChanged(prevLatch);
+    }
+    else if (addr == ARM_PWM_CTL)
+    {
+        if (val & ARM_PWM_CTL_CLRF1)
+            _pwmFifoChan = 0;
+        _pwmCtl = val & ~ARM_PWM_CTL_CLRF1;
+    }
+    else if (addr == ARM_PWM_FIF1)
+    {
+        // FIFO is shared so entries alternate between channel 1 (IORQ) and channel 2 (MREQ)
+        int pwmChan = _pwmFifoChan;
+        _pwmFifoChan = 1 - _pwmFifoChan;
+        if (val != 0)
+            waitReleaseFromPWM(pwmChan);
+    }
+    else if (addr == ARM_CM_PWMCTL)
+    {
+        _cmPwmCtl = val & ~ARM_CM_PASSWD;
+    }
+    else if (addr == ARM_CM_PWMDIV)
+    {
+        _cmPwmDiv = val & ~ARM_CM_PASSWD;
+    }
+    else
+    {
+        int i = 0;
+        for (; i < _otherRegCount; i++)
+            if (_otherRegAddrs[i] == addr)
+                break;
+        if (i < MAX_OTHER_REGS)
+        {
+            _otherRegAddrs[i] = addr;
+            _otherRegVals[i] = val;
+            if (i == _otherRegCount)
+                _otherRegCount++;
+        }
+    }
+    busUpdate();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// GPIO pin model
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t BusAccessSim::outputPinMask()
+{
+    uint32_t outMask = 0;
+    for (int pin = 0; pin < 32; pin++)
+        if (((_gpfSel[pin / 10] >> ((pin % 10) * 3)) & 0x07) == 1)
+            outMask |= (1 << pin);
+    return outMask;
+}
+
+int BusAccessSim::muxSelected(uint32_t latch)
+{
+    // Decoder outputs are only active when the mux is enabled
+    if (latch & BR_MUX_EN_BAR_MASK)
+        return -1;
+    return (latch & BR_MUX_CTRL_BIT_MASK) >> BR_MUX_LOW_BIT_POS;
+}
+
+uint32_t BusAccessSim::gpioLevels()
+{
+    // Inputs float high (pull-ups on the board) unless driven
+    uint32_t extLevels = 0xffffffff;
+    if (_cycleActive && !_busAck)
+    {
+        const BusAccessSimCycle& cycle = _pScript[_scriptPos];
+        if (cycle.flags & BR_CTRL_BUS_MREQ_MASK)
+            extLevels &= ~BR_MREQ_BAR_MASK;
+        if (cycle.flags & BR_CTRL_BUS_IORQ_MASK)
+            extLevels &= ~BR_IORQ_BAR_MASK;
+        if (cycle.flags & BR_CTRL_BUS_RD_MASK)
+            extLevels &= ~BR_RD_BAR_MASK;
+        if (cycle.flags & BR_CTRL_BUS_WR_MASK)
+            extLevels &= ~BR_WR_BAR_MASK;
+        if (cycle.flags & BR_CTRL_BUS_M1_MASK)
+            extLevels &= ~BR_V20_M1_BAR_MASK;
+    }
+    if (_waitAsserted)
+        extLevels &= ~BR_WAIT_BAR_MASK;
+    if (_busAck)
+        extLevels &= ~BR_BUSACK_BAR_MASK;
+    extLevels = (extLevels & BR_PIB_MASK) | (pibInputValue() << BR_DATA_BUS);
+
+    // Pins configured as outputs read back the output latch
+    uint32_t outMask = outputPinMask();
+    return (_gpioOutLatch & outMask) | (extLevels & ~outMask);
+}
+
+uint32_t BusAccessSim::pibInputValue()
+{
+    // Address buffers enabled onto the PIB by the mux - the address bus is driven
+    // by the target during its cycles and by the Bus Raider latches when BUSACK
+    int muxSel = muxSelected(_gpioOutLatch);
+    uint32_t busAddr = (_cycleActive && !_busAck) ? _pScript[_scriptPos].addr : targetAddr();
+    if (muxSel == BR_MUX_HADDR_OE_BAR)
+        return (busAddr >> 8) & 0xff;
+    if (muxSel == BR_MUX_LADDR_OE_BAR)
+        return busAddr & 0xff;
+
+    // Pi is bus master and reading
+    if (_busAck)
+    {
+        if (outLatchLow(BR_RD_BAR_MASK) && !outLatchLow(BR_DATA_DIR_IN_MASK))
+        {
+            if (outLatchLow(BR_MREQ_BAR_MASK))
+                return _targetMemory[targetAddr()];
+            if (outLatchLow(BR_IORQ_BAR_MASK))
+                return _targetIO[targetAddr() & 0xff];
+        }
+        return 0xff;
+    }
+
+    // Target data bus latched through the data bus buffer
+    if (_cycleActive && _dataOEFlipFlop && !outLatchLow(BR_DATA_DIR_IN_MASK))
+    {
+        const BusAccessSimCycle& cycle = _pScript[_scriptPos];
+        if (cycle.flags & BR_CTRL_BUS_WR_MASK)
+            return cycle.data;
+        if ((cycle.flags & BR_CTRL_BUS_RD_MASK) && (cycle.flags & BR_CTRL_BUS_MREQ_MASK))
+            return _targetMemory[cycle.addr & 0xffff];
+        if (cycle.flags & BR_CTRL_BUS_RD_MASK)
+            return _targetIO[cycle.addr & 0xff];
+    }
+    return 0xff;
+}
+
+void BusAccessSim::gpioOutputsChanged(uint32_t prevLatch)
+{
+    // Mux decoder output which has just become active
+    int prevSel = muxSelected(prevLatch);
+    int newSel = muxSelected(_gpioOutLatch);
+    if ((newSel != prevSel) && (newSel >= 0))
+    {
+        switch (newSel)
+        {
+            case BR_MUX_LADDR_CLK:
+                // Output register is one clock behind the counter
+                _lowAddrOut = _lowAddrCounter;
+                _lowAddrCounter = (_lowAddrCounter + 1) & 0xff;
+                break;
+            case BR_MUX_LADDR_CLR_BAR_LOW:
+                _lowAddrCounter = 0;
+                _lowAddrOut = 0;
+                break;
+            case BR_MUX_DATA_OE_BAR_LOW:
+                _dataOEFlipFlop = true;
+                break;
+        }
+    }
+
+    // High address shift register clocked on rising edge - serial in is the LADDR_CLR decoder output
+    if (((prevLatch & (1 << BR_HADDR_CK)) == 0) && (_gpioOutLatch & (1 << BR_HADDR_CK)))
+    {
+        uint32_t serialIn = (newSel == BR_MUX_LADDR_CLR_BAR_LOW) ? 0 : 1;
+        _highAddrOut = _highAddrShift;
+        _highAddrShift = ((_highAddrShift << 1) | serialIn) & 0xff;
+    }
+
+    // Writes and reads when the Pi is bus master
+    if (_busAck && ((prevLatch & BR_WR_BAR_MASK) != 0) && outLatchLow(BR_WR_BAR_MASK))
+    {
+        uint8_t data = (_gpioOutLatch >> BR_DATA_BUS) & 0xff;
+        if (outLatchLow(BR_MREQ_BAR_MASK))
+            _targetMemory[targetAddr()] = data;
+        else if (outLatchLow(BR_IORQ_BAR_MASK))
+            _targetIO[targetAddr() & 0xff] = data;
+        _stats.targetMemWrites++;
+    }
+    if (_busAck && ((prevLatch & BR_RD_BAR_MASK) != 0) && outLatchLow(BR_RD_BAR_MASK))
+        _stats.targetMemReads++;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Bus model
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BusAccessSim::busUpdate()
+{
+    uint64_t nowNs = getTimeNs();
+
+    // Complete current cycle if not held in WAIT
+    if (_cycleActive && !_waitAsserted && (nowNs >= _cycleEndNs))
+        cycleComplete();
+    if (_cycleActive)
+        return;
+
+    // Bus request is only granted between cycles
+    bool busRqAsserted = ((outputPinMask() & BR_BUSRQ_BAR_MASK) != 0) && outLatchLow(BR_BUSRQ_BAR_MASK);
+    if (busRqAsserted && !_busAck)
+    {
+        _busAck = true;
+        _stats.busAckCount++;
+    }
+    else if (!busRqAsserted && _busAck)
+    {
+        _busAck = false;
+        _nextCycleNs = nowNs + _nsBetweenBusCycles;
+    }
+
+    // Start next scripted cycle
+    if (!_busAck && _pScript && (_scriptPos < _scriptLen) && (nowNs >= _nextCycleNs))
+        cycleStart();
+}
+
+void BusAccessSim::cycleStart()
+{
+    const BusAccessSimCycle& cycle = _pScript[_scriptPos];
+    _cycleActive = true;
+    _cycleStartNs = getTimeNs();
+
+    // WAIT generated if the PWM idle state enables it for this cycle type
+    bool waitEnabled = ((cycle.flags & BR_CTRL_BUS_IORQ_MASK) && (_pwmCtl & ARM_PWM_CTL_SBIT1)) ||
+                       ((cycle.flags & BR_CTRL_BUS_MREQ_MASK) && (_pwmCtl & ARM_PWM_CTL_SBIT2));
+    if (waitEnabled)
+    {
+        _waitAsserted = true;
+        _waitStartRegAccesses = (uint32_t)(_stats.regReads + _stats.regWrites);
+        _stats.waitCount++;
+    }
+    else
+    {
+        _cycleEndNs = _cycleStartNs + _nsPerBusCycle;
+    }
+}
+
+void BusAccessSim::waitReleaseFromPWM(int pwmChan)
+{
+    if (!_cycleActive || !_waitAsserted)
+        return;
+    const BusAccessSimCycle& cycle = _pScript[_scriptPos];
+    uint32_t cycleMask = (pwmChan == 0) ? BR_CTRL_BUS_IORQ_MASK : BR_CTRL_BUS_MREQ_MASK;
+    if ((cycle.flags & cycleMask) == 0)
+        return;
+
+    // Release and record time/cost of the wait
+    _waitAsserted = false;
+    uint64_t nowNs = getTimeNs();
+    uint32_t waitNs = (uint32_t)(nowNs - _cycleStartNs);
+    _stats.waitNsTotal += waitNs;
+    if (_stats.waitNsMax < waitNs)
+        _stats.waitNsMax = waitNs;
+    uint32_t regAccesses = (uint32_t)(_stats.regReads + _stats.regWrites) - _waitStartRegAccesses;
+    _stats.waitRegAccessTotal += regAccesses;
+    if (_stats.waitRegAccessMax < regAccesses)
+        _stats.waitRegAccessMax = regAccesses;
+
+    // Remainder of the bus cycle
+    _cycleEndNs = nowNs + _nsPerBusCycle;
+}
+
+void BusAccessSim::cycleComplete()
+{
+    const BusAccessSimCycle& cycle = _pScript[_scriptPos];
+
+    // Determine what was on the data bus at the end of the cycle
+    bool piDriven = false;
+    uint32_t busData = 0xff;
+    uint32_t outMask = outputPinMask();
+    if (cycle.flags & BR_CTRL_BUS_WR_MASK)
+    {
+        busData = cycle.data;
+        if (cycle.flags & BR_CTRL_BUS_MREQ_MASK)
+            _targetMemory[cycle.addr & 0xffff] = cycle.data;
+        else
+            _targetIO[cycle.addr & 0xff] = cycle.data;
+    }
+    else if (_dataOEFlipFlop && outLatchLow(BR_DATA_DIR_IN_MASK) && ((outMask & ~BR_PIB_MASK) == ~BR_PIB_MASK))
+    {
+        piDriven = true;
+        busData = (_gpioOutLatch >> BR_DATA_BUS) & 0xff;
+    }
+    else if (cycle.flags & BR_CTRL_BUS_MREQ_MASK)
+    {
+        busData = _targetMemory[cycle.addr & 0xffff];
+    }
+    else if (cycle.flags & BR_CTRL_BUS_RD_MASK)
+    {
+        busData = _targetIO[cycle.addr & 0xff];
+    }
+
+    // End of MREQ/IORQ resets the data bus OE flip-flop
+    _dataOEFlipFlop = false;
+    _cycleActive = false;
+    _stats.cyclesCompleted++;
+    if (_pCycleCB)
+        _pCycleCB(cycle, busData, piDriven);
+
+    // Next cycle
+    _scriptPos++;
+    if (_scriptLoop && (_scriptPos >= _scriptLen))
+        _scriptPos = 0;
+    _nextCycleNs = getTimeNs() + _nsBetweenBusCycles;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Stats
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+char BusAccessSimStats::_jsonBuf[MAX_JSON_LEN];
+const char* BusAccessSimStats::getJson()
+{
+    uint32_t waitAvgNs = waitCount ? (uint32_t)(waitNsTotal / waitCount) : 0;
+    uint32_t waitRegAvg = waitCount ? (uint32_t)(waitRegAccessTotal / waitCount) : 0;
+    ee_sprintf(_jsonBuf, "\"err\":\"ok\",\"cycles\":%u,\"waits\":%u,\"waitAvgNs\":%u,\"waitMaxNs\":%u,"
+                "\"waitRegAvg\":%u,\"waitRegMax\":%u,\"regRd\":%u,\"regWr\":%u,\"busAck\":%u,\"mcWr\":%u,\"mcRd\":%u",
+                cyclesCompleted, waitCount, waitAvgNs, waitNsMax, waitRegAvg, waitRegAccessMax,
+                (uint32_t)regReads, (uint32_t)regWrites, busAckCount, targetMemWrites, targetMemReads);
+    return _jsonBuf;
+}
+
+#endif
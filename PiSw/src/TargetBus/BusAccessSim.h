@@ -0,0 +1,215 @@
+// Bus Raider
+// Rob Dobson 2019
+// Host-side simulation of the BCM2835 GPIO/PWM registers and the target Z80 bus
+// Enabled by building with BUSACCESS_SIM defined - RD32/WR32 are then routed here
+// so that BusAccess.cpp and BusAccess_Control.cpp can run unmodified on a host
+// Models V2.0 hardware (with V2_PROTO_USING_MUX_EN) - the mux, low address counter,
+// high address shift register, data bus OE flip-flop and PWM driven WAIT flip-flops
+
+#pragma once
+
+#ifdef BUSACCESS_SIM
+
+#include <stdint.h>
+#include <stddef.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scripted bus cycle
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A single target bus cycle - flags use the BR_CTRL_BUS_XXX_MASK values (e.g. MREQ|RD|M1 for an opcode fetch
+// or IORQ|M1 for an interrupt acknowledge) and data is only used for writes
+class BusAccessSimCycle
+{
+public:
+    uint32_t flags;
+    uint32_t addr;
+    uint8_t data;
+};
+
+// Callback when a scripted cycle completes - busData is the value the target saw (read) or wrote (write)
+// and piDriven indicates whether the Pi placed the value on the bus
+typedef void BusAccessSimCycleCBFnType(const BusAccessSimCycle& cycle, uint32_t busData, bool piDriven);
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Simulation statistics
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BusAccessSimStats
+{
+public:
+    BusAccessSimStats()
+    {
+        clear();
+    }
+    void clear()
+    {
+        cyclesCompleted = 0;
+        waitCount = 0;
+        waitNsTotal = 0;
+        waitNsMax = 0;
+        waitRegAccessTotal = 0;
+        waitRegAccessMax = 0;
+        regReads = 0;
+        regWrites = 0;
+        busAckCount = 0;
+        targetMemWrites = 0;
+        targetMemReads = 0;
+    }
+
+    // Cycles and waits
+    uint32_t cyclesCompleted;
+    uint32_t waitCount;
+    uint64_t waitNsTotal;
+    uint32_t waitNsMax;
+
+    // Register accesses made while WAIT was asserted (a deterministic measure of hot-path cost)
+    uint64_t waitRegAccessTotal;
+    uint32_t waitRegAccessMax;
+
+    // All register accesses
+    uint64_t regReads;
+    uint64_t regWrites;
+
+    // Bus mastering by the Pi
+    uint32_t busAckCount;
+    uint32_t targetMemWrites;
+    uint32_t targetMemReads;
+
+    static const int MAX_JSON_LEN = 400;
+    static char _jsonBuf[MAX_JSON_LEN];
+    const char* getJson();
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Simulated bus
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class BusAccessSim
+{
+public:
+    // Reset register file, address latches, target memory and script
+    static void reset();
+
+    // Timing model - cost of a peripheral register access and of one lowlev_cycleDelay() cycle,
+    // target bus cycle length when not held in WAIT and gap between bus cycles
+    static void setTiming(uint32_t nsPerRegAccess, uint32_t psPerDelayCycle,
+                uint32_t nsPerBusCycle, uint32_t nsBetweenBusCycles);
+
+    // Script of bus cycles the target will run (optionally looped)
+    static void setScript(const BusAccessSimCycle* pCycles, int numCycles, bool loop);
+    static bool isScriptComplete();
+    static void setCycleCallback(BusAccessSimCycleCBFnType* pCycleCB)
+    {
+        _pCycleCB = pCycleCB;
+    }
+
+    // Run BusAccess::service() until the script completes (or maxServiceCalls reached)
+    // Returns the number of service calls made
+    static uint32_t runScript(uint32_t maxServiceCalls);
+
+    // Target memory and IO space used when the Pi doesn't drive the data bus
+    static uint8_t* getTargetMemory()
+    {
+        return _targetMemory;
+    }
+    static uint8_t* getTargetIO()
+    {
+        return _targetIO;
+    }
+
+    // Simulated time
+    static uint64_t getTimeNs()
+    {
+        return _simTimePs / 1000;
+    }
+    static void cycleDelay(uint32_t cycles)
+    {
+        _simTimePs += (uint64_t)cycles * _psPerDelayCycle;
+    }
+
+    // Stats
+    static void getStats(BusAccessSimStats& stats)
+    {
+        stats = _stats;
+    }
+    static void clearStats()
+    {
+        _stats.clear();
+    }
+
+    // Register access (called through RD32/WR32)
+    static uint32_t rd32(uint32_t addr);
+    static void wr32(uint32_t addr, uint32_t val);
+
+private:
+    // Pin helpers
+    static uint32_t outputPinMask();
+    static bool outLatchLow(uint32_t mask)
+    {
+        return (_gpioOutLatch & mask) == 0;
+    }
+    static uint32_t gpioLevels();
+    static uint32_t pibInputValue();
+    static int muxSelected(uint32_t latch);
+    static uint32_t targetAddr()
+    {
+        return (_highAddrOut << 8) | _lowAddrOut;
+    }
+    static void gpioOutputsChanged(uint32_t prevLatch);
+
+    // Bus model
+    static void busUpdate();
+    static void cycleStart();
+    static void cycleComplete();
+    static void waitReleaseFromPWM(int pwmChan);
+
+    // Register file
+    static uint32_t _gpfSel[6];
+    static uint32_t _gpioOutLatch;
+    static uint32_t _pwmCtl;
+    static int _pwmFifoChan;
+    static uint32_t _cmPwmCtl;
+    static uint32_t _cmPwmDiv;
+    static const int MAX_OTHER_REGS = 64;
+    static uint32_t _otherRegAddrs[MAX_OTHER_REGS];
+    static uint32_t _otherRegVals[MAX_OTHER_REGS];
+    static int _otherRegCount;
+
+    // Address latches on the Bus Raider board
+    static uint32_t _lowAddrCounter;
+    static uint32_t _lowAddrOut;
+    static uint32_t _highAddrShift;
+    static uint32_t _highAddrOut;
+    static bool _dataOEFlipFlop;
+
+    // Target state
+    static const BusAccessSimCycle* _pScript;
+    static int _scriptLen;
+    static int _scriptPos;
+    static bool _scriptLoop;
+    static bool _cycleActive;
+    static bool _waitAsserted;
+    static bool _busAck;
+    static uint64_t _cycleStartNs;
+    static uint64_t _cycleEndNs;
+    static uint64_t _nextCycleNs;
+    static uint32_t _waitStartRegAccesses;
+    static uint8_t _targetMemory[0x10000];
+    static uint8_t _targetIO[0x100];
+
+    // Timing
+    static uint64_t _simTimePs;
+    static uint32_t _nsPerRegAccess;
+    static uint32_t _psPerDelayCycle;
+    static uint32_t _nsPerBusCycle;
+    static uint32_t _nsBetweenBusCycles;
+
+    // Callback
+    static BusAccessSimCycleCBFnType* _pCycleCB;
+
+    // Stats
+    static BusAccessSimStats _stats;
+};
+
+#endif
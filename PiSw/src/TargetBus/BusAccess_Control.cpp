@@ -25,7 +25,7 @@ TargetClockGenerator BusAccess::_clockGenerator;
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 // Add a bus socket
-int BusAccess::busSocketAdd(BusSocketInfo& busSocketInfo)
+int BusAccess::busSocketAdd(BusSocketInfo& busSocketInfo, const char* pName)
 {
     // Check if all used
     if (_busSocketCount >= MAX_BUS_SOCKETS)
@@ -33,12 +33,16 @@ int BusAccess::busSocketAdd(BusSocketInfo& busSocketInfo)
 
     // Add in available space
     _busSockets[_busSocketCount] = busSocketInfo;
+    _busSocketNames[_busSocketCount] = pName;
     int tmpCount = _busSocketCount++;
 
     // Update wait state generation
     // LogWrite("BusAccess", LOG_DEBUG, "busSocketAdd");
     waitEnablementUpdate();
 
+    // Update bus cycle dispatch
+    busCycleDispatchUpdate();
+
     return tmpCount;
 }
 
@@ -54,6 +58,56 @@ void BusAccess::busSocketEnable(int busSocket, bool enable)
     // Update wait state generation
     // LogWrite("BusAccess", LOG_DEBUG, "busSocketEnable");
     waitEnablementUpdate();
+
+    // Update bus cycle dispatch
+    busCycleDispatchUpdate();
+}
+
+void BusAccess::busSocketSetCycles(int busSocket, uint32_t busAccessCycles)
+{
+    // Check validity
+    if ((busSocket < 0) || (busSocket >= _busSocketCount))
+        return;
+
+    // Set cycles and update dispatch
+    _busSockets[busSocket].busAccessCycles = busAccessCycles;
+    busCycleDispatchUpdate();
+}
+
+// Set IO port filter (NULL to remove filter)
+void BusAccess::busSocketSetIOPortFilter(int busSocket, const uint32_t* pPortBitmap)
+{
+    // Check validity
+    if ((busSocket < 0) || (busSocket >= _busSocketCount))
+        return;
+
+    // Disable filter while it is changed
+    _busSockets[busSocket].ioPortFilterEnabled = false;
+    busCycleDispatchUpdate();
+    if (!pPortBitmap)
+        return;
+    for (int i = 0; i < BR_BUS_FILTER_BITMAP_WORDS; i++)
+        _busSockets[busSocket].ioPortFilter[i] = pPortBitmap[i];
+    _busSockets[busSocket].ioPortFilterEnabled = true;
+    busCycleDispatchUpdate();
+}
+
+// Set memory page filter (NULL to remove filter)
+void BusAccess::busSocketSetMemPageFilter(int busSocket, const uint32_t* pPageBitmap)
+{
+    // Check validity
+    if ((busSocket < 0) || (busSocket >= _busSocketCount))
+        return;
+
+    // Disable filter while it is changed
+    _busSockets[busSocket].memPageFilterEnabled = false;
+    busCycleDispatchUpdate();
+    if (!pPageBitmap)
+        return;
+    for (int i = 0; i < BR_BUS_FILTER_BITMAP_WORDS; i++)
+        _busSockets[busSocket].memPageFilter[i] = pPageBitmap[i];
+    _busSockets[busSocket].memPageFilterEnabled = true;
+    busCycleDispatchUpdate();
 }
 
 bool BusAccess::busSocketIsEnabled(int busSocket)
@@ -64,6 +118,57 @@ bool BusAccess::busSocketIsEnabled(int busSocket)
     return _busSockets[busSocket].enabled;
 }
 
+// Build the list of bus access callbacks for each class of bus cycle
+void BusAccess::busCycleDispatchUpdate()
+{
+    for (int cycleClass = 0; cycleClass < BR_BUS_CYCLE_NUM_CLASSES; cycleClass++)
+    {
+        // Filters which apply to this class of cycle
+        bool isIORQ = (cycleClass == BR_BUS_CYCLE_IORQ_RD) || (cycleClass == BR_BUS_CYCLE_IORQ_WR);
+        bool isMREQ = (cycleClass == BR_BUS_CYCLE_M1) || (cycleClass == BR_BUS_CYCLE_MREQ_RD) ||
+                    (cycleClass == BR_BUS_CYCLE_MREQ_WR);
+
+        // Empty the list while it is rebuilt so the wait handler never sees a partial list
+        _busCycleDispatchCount[cycleClass] = 0;
+        int dispatchCount = 0;
+        for (int i = 0; i < _busSocketCount; i++)
+        {
+            if (!_busSockets[i].enabled || !_busSockets[i].busAccessCallback || 
+                        ((_busSockets[i].busAccessCycles & (1 << cycleClass)) == 0))
+                continue;
+            BusCycleDispatch& dispatch = _busCycleDispatch[cycleClass][dispatchCount++];
+            dispatch.busAccessCallback = _busSockets[i].busAccessCallback;
+            dispatch.pFilter = NULL;
+            dispatch.busSocket = i;
+            if (isIORQ && _busSockets[i].ioPortFilterEnabled)
+                dispatch.pFilter = _busSockets[i].ioPortFilter;
+            else if (isMREQ && _busSockets[i].memPageFilterEnabled)
+                dispatch.pFilter = _busSockets[i].memPageFilter;
+        }
+        _busCycleDispatchCount[cycleClass] = dispatchCount;
+    }
+
+    // Ports of interest for IORQ fast release - disabled while rebuilt and if any socket has no port filter
+    _ioFastReleaseEnabled = false;
+    bool fastReleaseValid = true;
+    BusSocketInfo::filterClear(_ioFastReleasePorts);
+    for (int cycleClass = BR_BUS_CYCLE_IORQ_RD; cycleClass <= BR_BUS_CYCLE_IORQ_WR; cycleClass++)
+    {
+        for (int i = 0; i < _busCycleDispatchCount[cycleClass]; i++)
+        {
+            const uint32_t* pFilter = _busCycleDispatch[cycleClass][i].pFilter;
+            if (!pFilter)
+            {
+                fastReleaseValid = false;
+                break;
+            }
+            for (int j = 0; j < BR_BUS_FILTER_BITMAP_WORDS; j++)
+                _ioFastReleasePorts[j] |= pFilter[j];
+        }
+    }
+    _ioFastReleaseEnabled = fastReleaseValid;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Status
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -78,6 +183,51 @@ void BusAccess::clearStatus()
     _statusInfo.clear();
 }
 
+void BusAccess::clearLatencyHist()
+{
+    _statusInfo.clearLatencyHist();
+}
+
+// Callback cost table - for each socket the cost of its bus access callback for each class of bus
+// cycle it has handled and of its bus action callback
+void BusAccess::getSocketCostJson(char* pBuf, int maxLen)
+{
+    static const char* cycleClassNames[BR_BUS_CYCLE_NUM_CLASSES] = 
+            { "m1", "mreqRd", "mreqWr", "iorqRd", "iorqWr", "irqAck", "other" };
+    char tmpResp[100];
+    strlcpy(pBuf, "\"err\":\"ok\",\"sockets\":[", maxLen);
+    for (int i = 0; i < _busSocketCount; i++)
+    {
+        ee_sprintf(tmpResp, "%s{\"idx\":%d,\"name\":\"%s\",\"en\":%d,\"access\":{", (i != 0) ? "," : "", 
+                    i, _busSocketNames[i] ? _busSocketNames[i] : "", _busSockets[i].enabled ? 1 : 0);
+        strlcat(pBuf, tmpResp, maxLen);
+        bool firstClass = true;
+        for (int cycleClass = 0; cycleClass < BR_BUS_CYCLE_NUM_CLASSES; cycleClass++)
+        {
+            if (_busSocketAccessCost[i][cycleClass].count == 0)
+                continue;
+            ee_sprintf(tmpResp, "%s\"%s\":", firstClass ? "" : ",", cycleClassNames[cycleClass]);
+            strlcat(pBuf, tmpResp, maxLen);
+            _busSocketAccessCost[i][cycleClass].appendJson(pBuf, maxLen);
+            firstClass = false;
+        }
+        strlcat(pBuf, "},\"action\":", maxLen);
+        _busSocketActionCost[i].appendJson(pBuf, maxLen);
+        strlcat(pBuf, "}", maxLen);
+    }
+    strlcat(pBuf, "]", maxLen);
+}
+
+void BusAccess::clearSocketCost()
+{
+    for (int i = 0; i < MAX_BUS_SOCKETS; i++)
+    {
+        for (int cycleClass = 0; cycleClass < BR_BUS_CYCLE_NUM_CLASSES; cycleClass++)
+            _busSocketAccessCost[i][cycleClass].clear();
+        _busSocketActionCost[i].clear();
+    }
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Bus Request / Acknowledge
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -100,7 +250,8 @@ void BusAccess::controlRequest()
 }
 
 // Take control of bus
-void BusAccess::controlTake()
+template<int HW_VERSION>
+void BusAccess::controlTakeHw()
 {
     // Bus is under BusRaider control
     _busIsUnderControl = true;
@@ -126,20 +277,21 @@ void BusAccess::controlTake()
 
     // Address bus enabled (note this is using GPIO3 mentioned above in the V1.7 case)
     // On V2.0 hardware address push is done automatically
-    if (_hwVersionNumber == 17)
+    if constexpr (HW_VERSION == 17)
     {
         digitalWrite(BR_V17_PUSH_ADDR_BAR, 0);
     }
 }
 
 // Release control of bus
-void BusAccess::controlRelease()
+template<int HW_VERSION>
+void BusAccess::controlReleaseHw()
 {
     // Prime flip-flop that skips refresh cycles
     // So that the very first MREQ cycle after a BUSRQ/BUSACK causes a WAIT to be generated
     // (if memory waits are enabled)
 
-    if (_hwVersionNumber == 17)
+    if constexpr (HW_VERSION == 17)
     {
         // Set M1 high via the PIB
         // Need to make data direction out in case FF OE is active
@@ -186,10 +338,10 @@ void BusAccess::controlRelease()
     WR32(ARM_GPIO_GPSET0, 1 << BR_DATA_DIR_IN);
 
     // Clear the mux to deactivate all signals
-    muxClear();
+    muxClearHw<HW_VERSION>();
 
     // Address bus disabled
-    if (_hwVersionNumber == 17)
+    if constexpr (HW_VERSION == 17)
         digitalWrite(BR_V17_PUSH_ADDR_BAR, 1);
 
     // Clear wait detected in case we created some MREQ or IORQ cycles that
@@ -211,7 +363,7 @@ void BusAccess::controlRelease()
 
     // No longer request bus & set all control lines high (inactive)
     uint32_t setMask = BR_BUSRQ_BAR_MASK | BR_WR_BAR_MASK | BR_RD_BAR_MASK | BR_IORQ_BAR_MASK | BR_MREQ_BAR_MASK | BR_WAIT_BAR_MASK;
-    if (_hwVersionNumber != 17)
+    if constexpr (HW_VERSION != 17)
         setMask = setMask | BR_V20_M1_BAR_MASK;
     WR32(ARM_GPIO_GPSET0, setMask);
 
@@ -222,7 +374,7 @@ void BusAccess::controlRelease()
     pinMode(BR_IORQ_BAR, INPUT);
     pinMode(BR_WAIT_BAR_PIN, INPUT);
 
-    if (_hwVersionNumber != 17)
+    if constexpr (HW_VERSION != 17)
     {
         // For V2.0 set GPIO3 which is M1 to an input
         pinMode(BR_V20_M1_BAR, INPUT);
@@ -284,7 +436,8 @@ bool BusAccess::waitForBusAck(bool ack)
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 // Control bus read
-uint32_t BusAccess::controlBusRead()
+template<int HW_VERSION>
+uint32_t BusAccess::controlBusReadHw()
 {
     uint32_t startGetCtrlBusUs = micros();
     int loopCount = 0;
@@ -294,7 +447,7 @@ uint32_t BusAccess::controlBusRead()
         uint32_t busVals = RD32(ARM_GPIO_GPLEV0);
 
         // Handle slower M1 signal on V1.7 hardware
-        if (_hwVersionNumber == 17)
+        if constexpr (HW_VERSION == 17)
         {
             // Check if we're in a wait - in which case FF OE will be active
             // So we must set the data bus direction outward even if this causes a temporary
@@ -322,7 +475,7 @@ uint32_t BusAccess::controlBusRead()
                 (((busVals & BR_BUSACK_BAR_MASK) == 0) ? BR_CTRL_BUS_BUSACK_MASK : 0);
 
         // Handle slower M1 signal on V1.7 hardware
-        if (_hwVersionNumber == 17)
+        if constexpr (HW_VERSION == 17)
         {
             // Clear M1 in case set above
             ctrlBusVals = ctrlBusVals & (~BR_CTRL_BUS_M1_MASK);
@@ -375,9 +528,10 @@ uint32_t BusAccess::controlBusRead()
 // Address & Data Bus Functions
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void BusAccess::addrAndDataBusRead(uint32_t& addr, uint32_t& dataBusVals)
+template<int HW_VERSION>
+void BusAccess::addrAndDataBusReadHw(uint32_t& addr, uint32_t& dataBusVals)
 {
-    if (_hwVersionNumber == 17)
+    if constexpr (HW_VERSION == 17)
     {
         // Set data bus driver direction outward - so it doesn't conflict with the PIB
         // if FF OE is set
@@ -388,7 +542,7 @@ void BusAccess::addrAndDataBusRead(uint32_t& addr, uint32_t& dataBusVals)
     pibSetIn();
 
     // Enable the high address onto the PIB
-    muxSet(BR_MUX_HADDR_OE_BAR);
+    muxSetHw<HW_VERSION>(BR_MUX_HADDR_OE_BAR);
 
     // Delay to allow data to settle
     lowlev_cycleDelay(CYCLES_DELAY_FOR_HIGH_ADDR_READ);
@@ -397,7 +551,7 @@ void BusAccess::addrAndDataBusRead(uint32_t& addr, uint32_t& dataBusVals)
     addr = (pibGetValue() & 0xff) << 8;
 
     // Enable the low address onto the PIB
-    muxSet(BR_MUX_LADDR_OE_BAR);
+    muxSetHw<HW_VERSION>(BR_MUX_LADDR_OE_BAR);
 
     // Delay to allow data to settle
     lowlev_cycleDelay(CYCLES_DELAY_FOR_READ_FROM_PIB);
@@ -406,7 +560,7 @@ void BusAccess::addrAndDataBusRead(uint32_t& addr, uint32_t& dataBusVals)
     addr |= pibGetValue() & 0xff;
 
     // Clear the mux to deactivate output enables
-    muxClear();
+    muxClearHw<HW_VERSION>();
 
     // Delay to allow data to settle
     lowlev_cycleDelay(CYCLES_DELAY_FOR_READ_FROM_PIB);
@@ -426,7 +580,7 @@ void BusAccess::addrAndDataBusRead(uint32_t& addr, uint32_t& dataBusVals)
     // Note that the outputs of the data bus buffer are enabled from this point until
     // a rising edge of IORQ or MREQ
     // This can cause a bus conflict if BR_DATA_DIR_IN is set low before this happens
-    muxDataBusOutputEnable();
+    muxDataBusOutputEnableHw<HW_VERSION>();
 
     // Delay to allow data to settle
     lowlev_cycleDelay(CYCLES_DELAY_FOR_READ_FROM_PIB);
@@ -435,18 +589,31 @@ void BusAccess::addrAndDataBusRead(uint32_t& addr, uint32_t& dataBusVals)
     dataBusVals = pibGetValue() & 0xff;
 }
 
+// Read only the low address (e.g. IO port) - data bus output enable is left untouched
+template<int HW_VERSION>
+uint8_t BusAccess::addrLowReadHw()
+{
+    pibSetIn();
+    muxSetHw<HW_VERSION>(BR_MUX_LADDR_OE_BAR);
+    lowlev_cycleDelay(CYCLES_DELAY_FOR_READ_FROM_PIB);
+    uint8_t lowAddr = pibGetValue();
+    muxClearHw<HW_VERSION>();
+    return lowAddr;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Address Bus Functions
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 // Set low address value by clearing and counting
-void BusAccess::addrLowSet(uint32_t lowAddrByte)
+template<int HW_VERSION>
+void BusAccess::addrLowSetHw(uint32_t lowAddrByte)
 {
     // Clear initially
-    muxClearLowAddr();
+    muxClearLowAddrHw<HW_VERSION>();
     // Clock the required value in - requires one more count than
     // expected as the output register is one clock pulse behind the counter
-    if (_hwVersionNumber == 17)
+    if constexpr (HW_VERSION == 17)
     {
         for (uint32_t i = 0; i < (lowAddrByte & 0xff) + 1; i++) {
             WR32(ARM_GPIO_GPSET0, BR_V17_LADDR_CK_MASK);
@@ -479,9 +646,10 @@ void BusAccess::addrLowSet(uint32_t lowAddrByte)
 }
 
 // Increment low address value by clocking the counter
-void BusAccess::addrLowInc()
+template<int HW_VERSION>
+void BusAccess::addrLowIncHw()
 {
-    if (_hwVersionNumber == 17)
+    if constexpr (HW_VERSION == 17)
     {
         WR32(ARM_GPIO_GPSET0, BR_V17_LADDR_CK_MASK);
         lowlev_cycleDelay(CYCLES_DELAY_FOR_LOW_ADDR_SET);
@@ -509,18 +677,19 @@ void BusAccess::addrLowInc()
 }
 
 // Set the high address value
-void BusAccess::addrHighSet(uint32_t highAddrByte)
+template<int HW_VERSION>
+void BusAccess::addrHighSetHw(uint32_t highAddrByte)
 {
-    if (_hwVersionNumber == 17)
+    if constexpr (HW_VERSION == 17)
     {
         // Shift the value into the register
         // Takes one more shift than expected as output reg is one pulse behind shift
         for (uint32_t i = 0; i < 9; i++) {
             // Set or clear serial pin to shift register
             if (highAddrByte & 0x80)
-                muxSet(BR_V17_MUX_HADDR_SER_HIGH);
+                muxSetHw<HW_VERSION>(BR_V17_MUX_HADDR_SER_HIGH);
             else
-                muxSet(BR_V17_MUX_HADDR_SER_LOW);
+                muxSetHw<HW_VERSION>(BR_V17_MUX_HADDR_SER_LOW);
             // Delay to allow settling
             lowlev_cycleDelay(CYCLES_DELAY_FOR_HIGH_ADDR_SET);
             // Shift the address value for next bit
@@ -538,10 +707,10 @@ void BusAccess::addrHighSet(uint32_t highAddrByte)
         for (uint32_t i = 0; i < 9; i++) {
             // Set or clear serial pin to shift register
             if (highAddrByte & 0x80)
-                muxClear();
+                muxClearHw<HW_VERSION>();
             else
                 // Mux low address clear doubles as high address serial in 
-                muxSet(BR_MUX_LADDR_CLR_BAR_LOW);
+                muxSetHw<HW_VERSION>(BR_MUX_LADDR_CLR_BAR_LOW);
             // Delay to allow settling
             lowlev_cycleDelay(CYCLES_DELAY_FOR_HIGH_ADDR_SET);
             // Shift the address value for next bit
@@ -555,7 +724,7 @@ void BusAccess::addrHighSet(uint32_t highAddrByte)
 
     // Clear multiplexer
     lowlev_cycleDelay(CYCLES_DELAY_FOR_HIGH_ADDR_SET);
-    muxClear();
+    muxClearHw<HW_VERSION>();
 }
 
 // Set the full address
@@ -574,7 +743,8 @@ void BusAccess::addrSet(unsigned int addr)
 // - control of host bus has been requested and acknowledged
 // - address bus is already set and output enabled to host bus
 // - PIB is already set to output
-void BusAccess::byteWrite(uint32_t data, int iorq)
+template<int HW_VERSION>
+void BusAccess::byteWriteHw(uint32_t data, int iorq)
 {
     // Set the data onto the PIB
     pibSetValue(data);
@@ -583,7 +753,7 @@ void BusAccess::byteWrite(uint32_t data, int iorq)
     WR32(ARM_GPIO_GPCLR0, BR_DATA_DIR_IN_MASK | BR_MUX_CTRL_BIT_MASK | (iorq ? BR_IORQ_BAR_MASK : BR_MREQ_BAR_MASK));
     WR32(ARM_GPIO_GPSET0, BR_MUX_DATA_OE_BAR_LOW << BR_MUX_LOW_BIT_POS);
     // Write the data by setting WR_BAR active
-    if (_hwVersionNumber == 17)
+    if constexpr (HW_VERSION == 17)
     {
         WR32(ARM_GPIO_GPCLR0, BR_WR_BAR_MASK);
     }
@@ -598,10 +768,10 @@ void BusAccess::byteWrite(uint32_t data, int iorq)
     // Target write delay
     lowlev_cycleDelay(CYCLES_DELAY_FOR_WRITE_TO_TARGET);
     // Deactivate and leave data direction set to inwards
-    if (_hwVersionNumber == 17)
+    if constexpr (HW_VERSION == 17)
     {
         WR32(ARM_GPIO_GPSET0, BR_DATA_DIR_IN_MASK | (iorq ? BR_IORQ_BAR_MASK : BR_MREQ_BAR_MASK) | BR_WR_BAR_MASK);
-        muxClear();
+        muxClearHw<HW_VERSION>();
     }
     else
     {
@@ -619,12 +789,13 @@ void BusAccess::byteWrite(uint32_t data, int iorq)
 // - control of host bus has been requested and acknowledged
 // - address bus is already set and output enabled to host bus
 // - PIB is already set to input
-uint8_t BusAccess::byteRead(int iorq)
+template<int HW_VERSION>
+uint8_t BusAccess::byteReadHw(int iorq)
 {
     // Enable data output onto PIB, MREQ_BAR and RD_BAR both active
     WR32(ARM_GPIO_GPCLR0, BR_MUX_CTRL_BIT_MASK | (iorq ? BR_IORQ_BAR_MASK : BR_MREQ_BAR_MASK) | BR_RD_BAR_MASK);
     WR32(ARM_GPIO_GPSET0, BR_DATA_DIR_IN_MASK | (BR_MUX_DATA_OE_BAR_LOW << BR_MUX_LOW_BIT_POS));
-    if (_hwVersionNumber != 17)
+    if constexpr (HW_VERSION != 17)
     {
 #ifdef V2_PROTO_USING_MUX_EN
         WR32(ARM_GPIO_GPCLR0, BR_MUX_EN_BAR_MASK);
@@ -635,7 +806,7 @@ uint8_t BusAccess::byteRead(int iorq)
     // Get the data
     uint8_t val = pibGetValue();
     // Deactivate leaving data-dir inwards
-    if (_hwVersionNumber == 17)
+    if constexpr (HW_VERSION == 17)
     {
         WR32(ARM_GPIO_GPCLR0, BR_MUX_CTRL_BIT_MASK);
         WR32(ARM_GPIO_GPSET0, (iorq ? BR_IORQ_BAR_MASK : BR_MREQ_BAR_MASK) | BR_RD_BAR_MASK);
@@ -652,6 +823,67 @@ uint8_t BusAccess::byteRead(int iorq)
     return val;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Hardware version specialisation
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<int HW_VERSION>
+void BusAccess::hwFnsGet(BusAccessHwFns& hwFns)
+{
+    hwFns.controlTake = controlTakeHw<HW_VERSION>;
+    hwFns.controlRelease = controlReleaseHw<HW_VERSION>;
+    hwFns.muxSet = muxSetHw<HW_VERSION>;
+    hwFns.muxClear = muxClearHw<HW_VERSION>;
+    hwFns.muxDataBusOutputEnable = muxDataBusOutputEnableHw<HW_VERSION>;
+    hwFns.muxClearLowAddr = muxClearLowAddrHw<HW_VERSION>;
+    hwFns.waitSuspendBusDetailOneCycle = waitSuspendBusDetailOneCycleHw<HW_VERSION>;
+    hwFns.busPagePinSetActive = busPagePinSetActiveHw<HW_VERSION>;
+    hwFns.controlBusRead = controlBusReadHw<HW_VERSION>;
+    hwFns.addrAndDataBusRead = addrAndDataBusReadHw<HW_VERSION>;
+    // V1.7 hardware can only distinguish IORQ from interrupt acknowledge after M1 settling
+    // so the low address is only read on its own for later hardware
+    hwFns.addrLowRead = (HW_VERSION == 17) ? NULL : addrLowReadHw<HW_VERSION>;
+    hwFns.addrLowSet = addrLowSetHw<HW_VERSION>;
+    hwFns.addrLowInc = addrLowIncHw<HW_VERSION>;
+    hwFns.addrHighSet = addrHighSetHw<HW_VERSION>;
+    hwFns.byteWrite = byteWriteHw<HW_VERSION>;
+    hwFns.byteRead = byteReadHw<HW_VERSION>;
+    hwFns.blockWrite = blockWriteHw<HW_VERSION>;
+    hwFns.blockRead = blockReadHw<HW_VERSION>;
+}
+
+// Select bus access functions for the hardware version
+void BusAccess::hwVersionSelect()
+{
+    if (_hwVersionNumber == 17)
+        hwFnsGet<17>(_hwFns);
+    else
+        hwFnsGet<20>(_hwFns);
+}
+
+// Bus access functions - default hardware version until hwVersionSelect() is called
+BusAccess::BusAccessHwFns BusAccess::_hwFns = 
+{
+    BusAccess::controlTakeHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::controlReleaseHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::muxSetHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::muxClearHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::muxDataBusOutputEnableHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::muxClearLowAddrHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::waitSuspendBusDetailOneCycleHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::busPagePinSetActiveHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::controlBusReadHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::addrAndDataBusReadHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::addrLowReadHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::addrLowSetHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::addrLowIncHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::addrHighSetHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::byteWriteHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::byteReadHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::blockWriteHw<BusAccess::HW_VERSION_DEFAULT>,
+    BusAccess::blockReadHw<BusAccess::HW_VERSION_DEFAULT>
+};
+
 // Write a consecutive block of memory to host
 BR_RETURN_TYPE BusAccess::blockWrite(uint32_t addr, const uint8_t* pData, uint32_t len, bool busRqAndRelease, bool iorq)
 {
@@ -663,11 +895,109 @@ BR_RETURN_TYPE BusAccess::blockWrite(uint32_t addr, const uint8_t* pData, uint32
             return ret;
     }
 
+    // Write the block
+    uint32_t startUs = micros();
+    _hwFns.blockWrite(addr, pData, len, iorq);
+    _statusInfo.blockWrBytesPerSec = blockBytesPerSec(len, micros() - startUs);
+
+    // Check if we need to release bus
+    if (busRqAndRelease) {
+        // release bus
+        controlRelease();
+    }
+    return BR_OK;
+}
+
+// Read a consecutive block of memory from host
+// Assumes:
+// - control of host bus has been requested and acknowledged
+BR_RETURN_TYPE BusAccess::blockRead(uint32_t addr, uint8_t* pData, uint32_t len, bool busRqAndRelease, bool iorq)
+{
+    // Check if we need to request bus
+    if (busRqAndRelease) {
+        // Request bus and take control after ack
+        BR_RETURN_TYPE ret = controlRequestAndTake();
+        if (ret != BR_OK)
+            return ret;
+    }
+
+    // Read the block
+    uint32_t startUs = micros();
+    _hwFns.blockRead(addr, pData, len, iorq);
+    _statusInfo.blockRdBytesPerSec = blockBytesPerSec(len, micros() - startUs);
+
+    // Check if we need to release bus
+    if (busRqAndRelease) {
+        // release bus
+        controlRelease();
+    }
+    return BR_OK;
+}
+
+// Perform a list of block reads/writes - when busRqAndRelease is set the bus is only requested
+// once for the whole list rather than once per block
+BR_RETURN_TYPE BusAccess::blockTransferList(const BusAccessTransfer* pList, int numTransfers, bool busRqAndRelease)
+{
+    // Check if we need to request bus
+    if (busRqAndRelease) {
+        // Request bus and take control after ack
+        BR_RETURN_TYPE ret = controlRequestAndTake();
+        if (ret != BR_OK)
+            return ret;
+    }
+
+    // Perform the transfers
+    for (int i = 0; i < numTransfers; i++)
+    {
+        const BusAccessTransfer& xfer = pList[i];
+        uint32_t startUs = micros();
+        if (xfer.write)
+        {
+            _hwFns.blockWrite(xfer.addr, xfer.pData, xfer.len, xfer.iorq);
+            _statusInfo.blockWrBytesPerSec = blockBytesPerSec(xfer.len, micros() - startUs);
+        }
+        else
+        {
+            _hwFns.blockRead(xfer.addr, xfer.pData, xfer.len, xfer.iorq);
+            _statusInfo.blockRdBytesPerSec = blockBytesPerSec(xfer.len, micros() - startUs);
+        }
+    }
+
+    // Check if we need to release bus
+    if (busRqAndRelease) {
+        // release bus
+        controlRelease();
+    }
+    return BR_OK;
+}
+
+// Throughput of a block transfer
+uint32_t BusAccess::blockBytesPerSec(uint32_t len, uint32_t elapsedUs)
+{
+    if (elapsedUs == 0)
+        elapsedUs = 1;
+    return (uint32_t)(((uint64_t)len * 1000000) / elapsedUs);
+}
+
+// Write block - the low address counter is incremented for each byte and the high address is only
+// reloaded on 256 byte boundaries
+template<int HW_VERSION>
+void BusAccess::blockWriteHw(uint32_t addr, const uint8_t* pData, uint32_t len, bool iorq)
+{
+#ifdef V2_PROTO_USING_MUX_EN
+    if constexpr (HW_VERSION != 17)
+    {
+        blockWritePipelined(addr, pData, len, iorq);
+        return;
+    }
+#endif
+
     // Set PIB to input
     pibSetIn();
 
     // Set the address to initial value
-    addrSet(addr);
+    addrHighSetHw<HW_VERSION>(addr >> 8);
+    addrLowSetHw<HW_VERSION>(addr & 0xff);
 
     // Set the PIB to output
     pibSetOut();
@@ -676,10 +1006,10 @@ BR_RETURN_TYPE BusAccess::blockWrite(uint32_t addr, const uint8_t* pData, uint32
     for (uint32_t i = 0; i < len; i++)
     {
         // Write byte
-        byteWrite(*pData, iorq);
+        byteWriteHw<HW_VERSION>(*pData, iorq);
 
         // Increment the lower address counter
-        addrLowInc();
+        addrLowIncHw<HW_VERSION>();
 
         // Increment addresses
         pData++;
@@ -687,34 +1017,28 @@ BR_RETURN_TYPE BusAccess::blockWrite(uint32_t addr, const uint8_t* pData, uint32
 
         // Check if we've rolled over the lowest 8 bits
         if ((addr & 0xff) == 0) {
-            // Set the address again
-            addrSet(addr);
+            // Set the high address again (low address counter is cleared by this)
+            addrHighSetHw<HW_VERSION>(addr >> 8);
+            addrLowSetHw<HW_VERSION>(0);
         }
     }
 
     // Set the PIB back to INPUT
     pibSetIn();
-
-    // Check if we need to release bus
-    if (busRqAndRelease) {
-        // release bus
-        controlRelease();
-    }
-    return BR_OK;
 }
 
-// Read a consecutive block of memory from host
-// Assumes:
-// - control of host bus has been requested and acknowledged
-BR_RETURN_TYPE BusAccess::blockRead(uint32_t addr, uint8_t* pData, uint32_t len, bool busRqAndRelease, bool iorq)
+// Read block - the low address counter is incremented for each byte and the high address is only
+// reloaded on 256 byte boundaries
+template<int HW_VERSION>
+void BusAccess::blockReadHw(uint32_t addr, uint8_t* pData, uint32_t len, bool iorq)
 {
-    // Check if we need to request bus
-    if (busRqAndRelease) {
-        // Request bus and take control after ack
-        BR_RETURN_TYPE ret = controlRequestAndTake();
-        if (ret != BR_OK)
-            return ret;
+#ifdef V2_PROTO_USING_MUX_EN
+    if constexpr (HW_VERSION != 17)
+    {
+        blockReadPipelined(addr, pData, len, iorq);
+        return;
     }
+#endif
 
     // Set PIB to input
     pibSetIn();
@@ -723,7 +1047,8 @@ BR_RETURN_TYPE BusAccess::blockRead(uint32_t addr, uint8_t* pData, uint32_t len,
     WR32(ARM_GPIO_GPSET0, BR_DATA_DIR_IN_MASK);
 
     // Set the address to initial value
-    addrSet(addr);
+    addrHighSetHw<HW_VERSION>(addr >> 8);
+    addrLowSetHw<HW_VERSION>(addr & 0xff);
 
     // Calculate bit patterns outside loop
     uint32_t reqLinePlusRead = (iorq ? BR_IORQ_BAR_MASK : BR_MREQ_BAR_MASK) | (1 << BR_RD_BAR);
@@ -734,7 +1059,7 @@ BR_RETURN_TYPE BusAccess::blockRead(uint32_t addr, uint8_t* pData, uint32_t len,
 
         // Enable data bus driver output - must be done each time round the loop as it is
         // cleared by IORQ or MREQ rising edge
-        muxDataBusOutputEnable();
+        muxDataBusOutputEnableHw<HW_VERSION>();
 
         // IORQ_BAR / MREQ_BAR and RD_BAR both active
         WR32(ARM_GPIO_GPCLR0, reqLinePlusRead);
@@ -749,7 +1074,7 @@ BR_RETURN_TYPE BusAccess::blockRead(uint32_t addr, uint8_t* pData, uint32_t len,
         WR32(ARM_GPIO_GPSET0, reqLinePlusRead);
 
         // Inc low address
-        addrLowInc();
+        addrLowIncHw<HW_VERSION>();
 
         // Increment addresses
         pData++;
@@ -757,20 +1082,121 @@ BR_RETURN_TYPE BusAccess::blockRead(uint32_t addr, uint8_t* pData, uint32_t len,
 
         // Check if we've rolled over the lowest 8 bits
         if ((addr & 0xff) == 0) {
+            // Set the high address again (low address counter is cleared by this)
+            addrHighSetHw<HW_VERSION>(addr >> 8);
+            addrLowSetHw<HW_VERSION>(0);
+        }
+    }
+}
+
+#ifdef V2_PROTO_USING_MUX_EN
+
+// Pipelined block write for V2.0 hardware - the mux is left selecting the low address clock between
+// bytes and the next byte is placed on the PIB while the low address clock pulse is active
+void BusAccess::blockWritePipelined(uint32_t addr, const uint8_t* pData, uint32_t len, bool iorq)
+{
+    // Set the address to initial value
+    pibSetIn();
+    addrHighSetHw<20>(addr >> 8);
+    addrLowSetHw<20>(addr & 0xff);
+
+    // First byte onto the PIB
+    pibSetOut();
+    if (len > 0)
+        pibSetValue(*pData);
 
-            // Set the address again
-            addrSet(addr);
+    // Calculate bit patterns outside loop
+    uint32_t reqLine = iorq ? BR_IORQ_BAR_MASK : BR_MREQ_BAR_MASK;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        // Data direction out, select the data bus output enable, then enable it along with WR
+        WR32(ARM_GPIO_GPCLR0, BR_DATA_DIR_IN_MASK | BR_MUX_CTRL_BIT_MASK | reqLine);
+        WR32(ARM_GPIO_GPSET0, BR_MUX_DATA_OE_BAR_LOW << BR_MUX_LOW_BIT_POS);
+        WR32(ARM_GPIO_GPCLR0, BR_WR_BAR_MASK | BR_MUX_EN_BAR_MASK);
+
+        // Target write delay
+        lowlev_cycleDelay(CYCLES_DELAY_FOR_WRITE_TO_TARGET);
+
+        // Deactivate leaving data direction inwards
+        WR32(ARM_GPIO_GPSET0, BR_DATA_DIR_IN_MASK | BR_MUX_EN_BAR_MASK | reqLine | BR_WR_BAR_MASK);
+        addr++;
+        bool moreData = (i + 1 < len);
+
+        // Reload high address on a 256 byte boundary (low address counter is cleared by this)
+        if ((addr & 0xff) == 0)
+        {
+            addrHighSetHw<20>(addr >> 8);
+            addrLowSetHw<20>(0);
+            if (moreData)
+                pibSetValue(pData[i + 1]);
+            continue;
         }
+
+        // Clock the low address counter with the next data setup in the pulse
+        WR32(ARM_GPIO_GPCLR0, BR_MUX_CTRL_BIT_MASK);
+        WR32(ARM_GPIO_GPCLR0, BR_MUX_EN_BAR_MASK);
+        if (moreData)
+            pibSetValue(pData[i + 1]);
+        else
+            lowlev_cycleDelay(CYCLES_DELAY_FOR_CLOCK_LOW_ADDR);
+        WR32(ARM_GPIO_GPSET0, BR_MUX_EN_BAR_MASK);
     }
 
-    // Check if we need to release bus
-    if (busRqAndRelease) {
-        // release bus
-        controlRelease();
+    // Set the PIB back to INPUT
+    pibSetIn();
+}
+
+// Pipelined block read for V2.0 hardware - the mux is left selecting the low address clock between
+// bytes so selecting the data bus output enable needs no separate clear
+void BusAccess::blockReadPipelined(uint32_t addr, uint8_t* pData, uint32_t len, bool iorq)
+{
+    // Set PIB to input and data direction for data bus drivers inward
+    pibSetIn();
+    WR32(ARM_GPIO_GPSET0, BR_DATA_DIR_IN_MASK);
+
+    // Set the address to initial value
+    addrHighSetHw<20>(addr >> 8);
+    addrLowSetHw<20>(addr & 0xff);
+    WR32(ARM_GPIO_GPCLR0, BR_MUX_CTRL_BIT_MASK);
+
+    // Calculate bit patterns outside loop
+    uint32_t reqLinePlusRead = (iorq ? BR_IORQ_BAR_MASK : BR_MREQ_BAR_MASK) | (1 << BR_RD_BAR);
+    for (uint32_t i = 0; i < len; i++)
+    {
+        // Enable data bus driver output - cleared by IORQ or MREQ rising edge
+        WR32(ARM_GPIO_GPSET0, BR_MUX_DATA_OE_BAR_LOW << BR_MUX_LOW_BIT_POS);
+        WR32(ARM_GPIO_GPCLR0, BR_MUX_EN_BAR_MASK);
+        lowlev_cycleDelay(CYCLES_DELAY_FOR_OUT_FF_SET);
+        WR32(ARM_GPIO_GPSET0, BR_MUX_EN_BAR_MASK);
+
+        // IORQ_BAR / MREQ_BAR and RD_BAR both active, delay for data to settle then read
+        WR32(ARM_GPIO_GPCLR0, reqLinePlusRead);
+        lowlev_cycleDelay(CYCLES_DELAY_FOR_READ_FROM_PIB);
+        *pData++ = pibGetValue();
+
+        // Deactivate IORQ/MREQ and RD and select the low address clock
+        WR32(ARM_GPIO_GPSET0, reqLinePlusRead);
+        WR32(ARM_GPIO_GPCLR0, BR_MUX_CTRL_BIT_MASK);
+        addr++;
+
+        // Reload high address on a 256 byte boundary (low address counter is cleared by this)
+        if ((addr & 0xff) == 0)
+        {
+            addrHighSetHw<20>(addr >> 8);
+            addrLowSetHw<20>(0);
+            WR32(ARM_GPIO_GPCLR0, BR_MUX_CTRL_BIT_MASK);
+            continue;
+        }
+
+        // Clock the low address counter
+        WR32(ARM_GPIO_GPCLR0, BR_MUX_EN_BAR_MASK);
+        lowlev_cycleDelay(CYCLES_DELAY_FOR_CLOCK_LOW_ADDR);
+        WR32(ARM_GPIO_GPSET0, BR_MUX_EN_BAR_MASK);
     }
-    return BR_OK;
 }
 
+#endif
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Clock Generator
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -964,9 +1390,10 @@ void BusAccess::waitClearDetected()
     // WR32(ARM_GPIO_GPEDS0, BR_ANY_EDGE_MASK);
 }
 
-void BusAccess::waitSuspendBusDetailOneCycle()
+template<int HW_VERSION>
+void BusAccess::waitSuspendBusDetailOneCycleHw()
 {
-    if (_hwVersionNumber == 17)
+    if constexpr (HW_VERSION == 17)
         _waitSuspendBusDetailOneCycle = true;
 }
 
@@ -1046,10 +1473,11 @@ void BusAccess::busAccessCallbackPageIn()
 }
 
 // Paging pin on the bus
-void BusAccess::busPagePinSetActive(bool active)
+template<int HW_VERSION>
+void BusAccess::busPagePinSetActiveHw(bool active)
 {
-    // LogWrite("BA", LOG_DEBUG, "pagePin = %d", (_hwVersionNumber == 17) ? active : !active);
-    digitalWrite(BR_PAGING_RAM_PIN, (_hwVersionNumber == 17) ? active : !active);
+    // LogWrite("BA", LOG_DEBUG, "pagePin = %d", (HW_VERSION == 17) ? active : !active);
+    digitalWrite(BR_PAGING_RAM_PIN, (HW_VERSION == 17) ? active : !active);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,451 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#include "TargetBreakpointCond.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Compile
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TargetBreakpointCond::compile(const char* pExpr)
+{
+    clear();
+    if (!pExpr)
+        return true;
+
+    // Empty expression
+    Compiler compiler(pExpr, _code);
+    if (compiler.atEnd())
+        return true;
+
+    // Compile
+    bool isBool = false;
+    if (!compiler.parseOr(isBool) || !compiler.atEnd() || !compiler.isOk())
+        return false;
+    _codeLen = compiler.getCodeLen();
+    _usesRegisters = compiler.usesRegisters();
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Evaluate
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TargetBreakpointCondResult TargetBreakpointCond::evaluate(const Z80Registers& regs, bool regsValid,
+                TargetBreakpointMemReadFnType* pMemRead) const
+{
+    if (_codeLen == 0)
+        return BREAKPOINT_COND_TRUE;
+    if (_usesRegisters && !regsValid)
+        return BREAKPOINT_COND_UNKNOWN;
+
+    // Run the code
+    int32_t stack[MAX_STACK_DEPTH];
+    int sp = 0;
+    int pc = 0;
+    while (pc < _codeLen)
+    {
+        uint8_t op = _code[pc++];
+        switch(op)
+        {
+            case OP_CONST:
+                stack[sp++] = _code[pc] | (_code[pc+1] << 8) | (_code[pc+2] << 16) | ((uint32_t)_code[pc+3] << 24);
+                pc += 4;
+                continue;
+            case OP_REG:
+                stack[sp++] = getRegValue(regs, _code[pc++]);
+                continue;
+            case OP_MEM8:
+            {
+                uint8_t memVal = 0;
+                if (!pMemRead || !pMemRead(stack[sp-1], memVal))
+                    return BREAKPOINT_COND_UNKNOWN;
+                stack[sp-1] = memVal;
+                continue;
+            }
+            case OP_LOGICAL_NOT:
+                stack[sp-1] = !stack[sp-1];
+                continue;
+        }
+
+        // Binary operators
+        int32_t rhs = stack[--sp];
+        int32_t lhs = stack[sp-1];
+        int32_t result = 0;
+        switch(op)
+        {
+            case OP_ADD: result = lhs + rhs; break;
+            case OP_SUB: result = lhs - rhs; break;
+            case OP_AND: result = lhs & rhs; break;
+            case OP_OR: result = lhs | rhs; break;
+            case OP_XOR: result = lhs ^ rhs; break;
+            case OP_EQ: result = lhs == rhs; break;
+            case OP_NE: result = lhs != rhs; break;
+            case OP_LT: result = lhs < rhs; break;
+            case OP_GT: result = lhs > rhs; break;
+            case OP_LE: result = lhs <= rhs; break;
+            case OP_GE: result = lhs >= rhs; break;
+            case OP_LOGICAL_AND: result = lhs && rhs; break;
+            case OP_LOGICAL_OR: result = lhs || rhs; break;
+        }
+        stack[sp-1] = result;
+    }
+    return (sp > 0) && stack[sp-1] ? BREAKPOINT_COND_TRUE : BREAKPOINT_COND_FALSE;
+}
+
+int TargetBreakpointCond::getRegValue(const Z80Registers& regs, int regId)
+{
+    switch(regId)
+    {
+        case REG_A: return (regs.AF >> 8) & 0xff;
+        case REG_F: return regs.AF & 0xff;
+        case REG_B: return (regs.BC >> 8) & 0xff;
+        case REG_C: return regs.BC & 0xff;
+        case REG_D: return (regs.DE >> 8) & 0xff;
+        case REG_E: return regs.DE & 0xff;
+        case REG_H: return (regs.HL >> 8) & 0xff;
+        case REG_L: return regs.HL & 0xff;
+        case REG_I: return regs.I & 0xff;
+        case REG_R: return regs.R & 0xff;
+        case REG_AF: return regs.AF & 0xffff;
+        case REG_BC: return regs.BC & 0xffff;
+        case REG_DE: return regs.DE & 0xffff;
+        case REG_HL: return regs.HL & 0xffff;
+        case REG_IX: return regs.IX & 0xffff;
+        case REG_IY: return regs.IY & 0xffff;
+        case REG_SP: return regs.SP & 0xffff;
+        case REG_PC: return regs.PC;
+        case REG_AF_DASH: return regs.AFDASH & 0xffff;
+        case REG_BC_DASH: return regs.BCDASH & 0xffff;
+        case REG_DE_DASH: return regs.DEDASH & 0xffff;
+        case REG_HL_DASH: return regs.HLDASH & 0xffff;
+    }
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Recursive descent compiler
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TargetBreakpointCond::Compiler::parseOr(bool& isBool)
+{
+    if (!parseAnd(isBool))
+        return false;
+    while (matchOp("||") || matchWord("or"))
+    {
+        if (!parseAnd(isBool))
+            return false;
+        emit(OP_LOGICAL_OR, -1);
+        isBool = true;
+    }
+    return true;
+}
+
+bool TargetBreakpointCond::Compiler::parseAnd(bool& isBool)
+{
+    if (!parseCompare(isBool))
+        return false;
+    while (matchOp("&&") || matchWord("and"))
+    {
+        if (!parseCompare(isBool))
+            return false;
+        emit(OP_LOGICAL_AND, -1);
+        isBool = true;
+    }
+    return true;
+}
+
+bool TargetBreakpointCond::Compiler::parseCompare(bool& isBool)
+{
+    if (!parseBitwise(isBool))
+        return false;
+
+    // Longer operators first
+    static const struct { const char* pOp; uint8_t opcode; } compareOps[] =
+    {
+        { "==", OP_EQ }, { "!=", OP_NE }, { "<>", OP_NE }, { "<=", OP_LE }, { ">=", OP_GE },
+        { "=", OP_EQ }, { "<", OP_LT }, { ">", OP_GT }
+    };
+    for (unsigned int i = 0; i < sizeof(compareOps) / sizeof(compareOps[0]); i++)
+    {
+        if (matchOp(compareOps[i].pOp))
+        {
+            if (!parseBitwise(isBool))
+                return false;
+            emit(compareOps[i].opcode, -1);
+            isBool = true;
+            return true;
+        }
+    }
+    return true;
+}
+
+bool TargetBreakpointCond::Compiler::parseBitwise(bool& isBool)
+{
+    if (!parseAdd(isBool))
+        return false;
+    while (true)
+    {
+        uint8_t opcode = 0;
+        skipSpace();
+        if ((_pExpr[0] == '&') && (_pExpr[1] != '&'))
+            opcode = OP_AND;
+        else if ((_pExpr[0] == '|') && (_pExpr[1] != '|'))
+            opcode = OP_OR;
+        else if (_pExpr[0] == '^')
+            opcode = OP_XOR;
+        else
+            return true;
+        _pExpr++;
+        if (!parseAdd(isBool))
+            return false;
+        emit(opcode, -1);
+        isBool = false;
+    }
+}
+
+bool TargetBreakpointCond::Compiler::parseAdd(bool& isBool)
+{
+    if (!parseUnary(isBool))
+        return false;
+    while (true)
+    {
+        uint8_t opcode = 0;
+        if (matchOp("+"))
+            opcode = OP_ADD;
+        else if (matchOp("-"))
+            opcode = OP_SUB;
+        else
+            return true;
+        if (!parseUnary(isBool))
+            return false;
+        emit(opcode, -1);
+        isBool = false;
+    }
+}
+
+bool TargetBreakpointCond::Compiler::parseUnary(bool& isBool)
+{
+    skipSpace();
+    if ((_pExpr[0] == '!') && (_pExpr[1] != '='))
+    {
+        _pExpr++;
+        if (_nesting >= MAX_NESTING)
+            return false;
+        _nesting++;
+        bool unaryOk = parseUnary(isBool);
+        _nesting--;
+        if (!unaryOk)
+            return false;
+        emit(OP_LOGICAL_NOT, 0);
+        isBool = true;
+        return true;
+    }
+    return parsePrimary(isBool);
+}
+
+bool TargetBreakpointCond::Compiler::parsePrimary(bool& isBool)
+{
+    // Brackets - memory read unless they hold a comparison or logical expression
+    if (matchOp("("))
+    {
+        if (_nesting >= MAX_NESTING)
+            return false;
+        _nesting++;
+        bool innerIsBool = false;
+        bool innerOk = parseOr(innerIsBool);
+        _nesting--;
+        if (!innerOk || !matchOp(")"))
+            return false;
+        if (!innerIsBool)
+            emit(OP_MEM8, 0);
+        isBool = innerIsBool;
+        return true;
+    }
+
+    // Register
+    isBool = false;
+    int regId = 0;
+    if (parseRegister(regId))
+    {
+        emit(OP_REG, 1);
+        emit(regId, 0);
+        if (regId != REG_PC)
+            _usesRegisters = true;
+        return true;
+    }
+
+    // Number
+    uint32_t val = 0;
+    if (!parseNumber(val))
+        return false;
+    emitConst(val);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Tokens
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool isIdentChar(char ch)
+{
+    return ((ch >= '0') && (ch <= '9')) || ((ch >= 'a') && (ch <= 'z')) || ((ch >= 'A') && (ch <= 'Z')) ||
+                (ch == '_') || (ch == '\'');
+}
+
+static int hexDigitVal(char ch)
+{
+    if ((ch >= '0') && (ch <= '9'))
+        return ch - '0';
+    if ((ch >= 'a') && (ch <= 'f'))
+        return ch - 'a' + 10;
+    if ((ch >= 'A') && (ch <= 'F'))
+        return ch - 'A' + 10;
+    return -1;
+}
+
+void TargetBreakpointCond::Compiler::skipSpace()
+{
+    while ((*_pExpr == ' ') || (*_pExpr == '\t'))
+        _pExpr++;
+}
+
+bool TargetBreakpointCond::Compiler::atEnd()
+{
+    skipSpace();
+    return (*_pExpr == 0) || (*_pExpr == '\r') || (*_pExpr == '\n');
+}
+
+bool TargetBreakpointCond::Compiler::matchOp(const char* pOp)
+{
+    skipSpace();
+    int opLen = strlen(pOp);
+    if (strncmp(_pExpr, pOp, opLen) != 0)
+        return false;
+    _pExpr += opLen;
+    return true;
+}
+
+bool TargetBreakpointCond::Compiler::matchWord(const char* pWord)
+{
+    skipSpace();
+    int wordLen = strlen(pWord);
+    if ((strncasecmp(_pExpr, pWord, wordLen) != 0) || isIdentChar(_pExpr[wordLen]))
+        return false;
+    _pExpr += wordLen;
+    return true;
+}
+
+bool TargetBreakpointCond::Compiler::parseRegister(int& regId)
+{
+    // Longer names first
+    static const struct { const char* pName; int regId; } regNames[] =
+    {
+        { "AF'", REG_AF_DASH }, { "BC'", REG_BC_DASH }, { "DE'", REG_DE_DASH }, { "HL'", REG_HL_DASH },
+        { "AF", REG_AF }, { "BC", REG_BC }, { "DE", REG_DE }, { "HL", REG_HL },
+        { "IX", REG_IX }, { "IY", REG_IY }, { "SP", REG_SP }, { "PC", REG_PC },
+        { "A", REG_A }, { "F", REG_F }, { "B", REG_B }, { "C", REG_C }, { "D", REG_D },
+        { "E", REG_E }, { "H", REG_H }, { "L", REG_L }, { "I", REG_I }, { "R", REG_R }
+    };
+    skipSpace();
+    for (unsigned int i = 0; i < sizeof(regNames) / sizeof(regNames[0]); i++)
+    {
+        int nameLen = strlen(regNames[i].pName);
+        if ((strncasecmp(_pExpr, regNames[i].pName, nameLen) == 0) && !isIdentChar(_pExpr[nameLen]))
+        {
+            _pExpr += nameLen;
+            regId = regNames[i].regId;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Numbers which don't fit in 32 bits are an error
+bool TargetBreakpointCond::Compiler::parseNumber(uint32_t& val)
+{
+    skipSpace();
+    val = 0;
+
+    // $1f
+    if (*_pExpr == '$')
+    {
+        _pExpr++;
+        if (hexDigitVal(*_pExpr) < 0)
+            return false;
+        while (hexDigitVal(*_pExpr) >= 0)
+        {
+            if (val > 0x0fffffff)
+                return false;
+            val = (val << 4) | hexDigitVal(*_pExpr++);
+        }
+        return !isIdentChar(*_pExpr);
+    }
+    if ((*_pExpr < '0') || (*_pExpr > '9'))
+        return false;
+
+    // 0x1f
+    if ((_pExpr[0] == '0') && ((_pExpr[1] == 'x') || (_pExpr[1] == 'X')))
+    {
+        _pExpr += 2;
+        if (hexDigitVal(*_pExpr) < 0)
+            return false;
+        while (hexDigitVal(*_pExpr) >= 0)
+        {
+            if (val > 0x0fffffff)
+                return false;
+            val = (val << 4) | hexDigitVal(*_pExpr++);
+        }
+        return !isIdentChar(*_pExpr);
+    }
+
+    // 1fh or decimal
+    const char* pEnd = _pExpr;
+    while (hexDigitVal(*pEnd) >= 0)
+        pEnd++;
+    if ((*pEnd == 'h') || (*pEnd == 'H'))
+    {
+        while (_pExpr < pEnd)
+        {
+            if (val > 0x0fffffff)
+                return false;
+            val = (val << 4) | hexDigitVal(*_pExpr++);
+        }
+        _pExpr++;
+        return !isIdentChar(*_pExpr);
+    }
+    while ((*_pExpr >= '0') && (*_pExpr <= '9'))
+    {
+        uint32_t digit = *_pExpr++ - '0';
+        if (val > (0xffffffff - digit) / 10)
+            return false;
+        val = val * 10 + digit;
+    }
+    return !isIdentChar(*_pExpr);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Code generation
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TargetBreakpointCond::Compiler::emit(uint8_t op, int stackChange)
+{
+    if (_codeLen >= MAX_CODE_LEN)
+    {
+        _ok = false;
+        return;
+    }
+    _pCode[_codeLen++] = op;
+    _depth += stackChange;
+    if (_depth > _maxDepth)
+        _maxDepth = _depth;
+}
+
+void TargetBreakpointCond::Compiler::emitConst(uint32_t val)
+{
+    emit(OP_CONST, 1);
+    emit(val & 0xff, 0);
+    emit((val >> 8) & 0xff, 0);
+    emit((val >> 16) & 0xff, 0);
+    emit((val >> 24) & 0xff, 0);
+}
@@ -0,0 +1,148 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "../System/lowlib.h"
+#include "TargetRegisters.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Breakpoint condition - an expression like A==0x3F && (HL)>0x80 compiled when the breakpoint is set into
+// bytecode for a small stack machine, so evaluating it on a breakpoint hit is cheap
+//
+// Operands are numbers (decimal, 0x1f, $1f or 1fh), registers (A F B C D E H L I R AF BC DE HL IX IY SP PC
+// and AF' BC' DE' HL') and (expr) which reads the byte at address expr - brackets around a comparison
+// or logical expression just group it
+// Operators are (lowest precedence first) || or, && and, == = != <> < > <= >=, & | ^, + -, !
+// Numbers are up to 32 bits and values are signed 32 bit (so 0xffffffff == 0-1)
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Memory read used when evaluating - returns false if the memory value isn't available
+typedef bool TargetBreakpointMemReadFnType(uint32_t addr, uint8_t& val);
+
+enum TargetBreakpointCondResult
+{
+    BREAKPOINT_COND_FALSE,
+    BREAKPOINT_COND_TRUE,
+    BREAKPOINT_COND_UNKNOWN
+};
+
+class TargetBreakpointCond
+{
+public:
+    TargetBreakpointCond()
+    {
+        clear();
+    }
+    void clear()
+    {
+        _codeLen = 0;
+        _usesRegisters = false;
+    }
+
+    // Compile - an empty expression is always true - returns false on a syntax error
+    bool compile(const char* pExpr);
+
+    // Evaluate - registers are only used if the expression refers to them (other than PC)
+    TargetBreakpointCondResult evaluate(const Z80Registers& regs, bool regsValid,
+                    TargetBreakpointMemReadFnType* pMemRead) const;
+
+    bool isEmpty() const
+    {
+        return _codeLen == 0;
+    }
+    bool usesRegisters() const
+    {
+        return _usesRegisters;
+    }
+
+private:
+    // Opcodes
+    enum
+    {
+        OP_CONST,
+        OP_REG,
+        OP_MEM8,
+        OP_ADD,
+        OP_SUB,
+        OP_AND,
+        OP_OR,
+        OP_XOR,
+        OP_EQ,
+        OP_NE,
+        OP_LT,
+        OP_GT,
+        OP_LE,
+        OP_GE,
+        OP_LOGICAL_AND,
+        OP_LOGICAL_OR,
+        OP_LOGICAL_NOT
+    };
+
+    // Registers
+    enum
+    {
+        REG_A, REG_F, REG_B, REG_C, REG_D, REG_E, REG_H, REG_L, REG_I, REG_R,
+        REG_AF, REG_BC, REG_DE, REG_HL, REG_IX, REG_IY, REG_SP, REG_PC,
+        REG_AF_DASH, REG_BC_DASH, REG_DE_DASH, REG_HL_DASH
+    };
+    static int getRegValue(const Z80Registers& regs, int regId);
+
+    // Code
+    static const int MAX_CODE_LEN = 64;
+    static const int MAX_STACK_DEPTH = 16;
+    uint8_t _code[MAX_CODE_LEN];
+    int _codeLen;
+    bool _usesRegisters;
+
+    // Compiler
+    class Compiler
+    {
+    public:
+        Compiler(const char* pExpr, uint8_t* pCode) : _pExpr(pExpr), _pCode(pCode) {}
+        bool parseOr(bool& isBool);
+        bool atEnd();
+        int getCodeLen()
+        {
+            return _codeLen;
+        }
+        bool usesRegisters()
+        {
+            return _usesRegisters;
+        }
+        bool isOk()
+        {
+            return _ok && (_maxDepth <= MAX_STACK_DEPTH);
+        }
+
+    private:
+        bool parseAnd(bool& isBool);
+        bool parseCompare(bool& isBool);
+        bool parseBitwise(bool& isBool);
+        bool parseAdd(bool& isBool);
+        bool parseUnary(bool& isBool);
+        bool parsePrimary(bool& isBool);
+        void skipSpace();
+        bool matchOp(const char* pOp);
+        bool matchWord(const char* pWord);
+        bool parseNumber(uint32_t& val);
+        bool parseRegister(int& regId);
+        void emit(uint8_t op, int stackChange);
+        void emitConst(uint32_t val);
+        const char* _pExpr;
+        uint8_t* _pCode;
+        int _codeLen = 0;
+        int _depth = 0;
+        int _maxDepth = 0;
+
+        // Brackets and ! are parsed recursively so their nesting is limited (to the evaluation
+        // stack depth) to bound the recursion
+        static const int MAX_NESTING = MAX_STACK_DEPTH;
+        int _nesting = 0;
+        bool _usesRegisters = false;
+        bool _ok = true;
+    };
+};
@@ -5,6 +5,7 @@
 #include "../System/lowlib.h"
 #include "../System/ee_sprintf.h"
 #include "../System/logging.h"
+#include "../System/lowlev.h"
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Variables
@@ -13,8 +14,11 @@
 // Module name
 static const char FromTargetBreakpoints[] = "TargetBreakpoints";
 
-TargetBreakpoints::TargetBreakpoints()
+TargetBreakpoints::TargetBreakpoints() :
+        _tracepointLogPosn(MAX_TRACEPOINT_LOG_ENTRIES)
 {
+    _pCondRegsGet = NULL;
+    _pCondMemRead = NULL;
     clear();
 }
 
@@ -31,6 +35,31 @@ void TargetBreakpoints::clear()
     _breakpointHitIndex = 0;
     _fastBreakpointsNumEnabled = 0;
     _fastBreakpointHitIdx = 0;
+    memset(_breakpointAddrBitmap, 0, sizeof(_breakpointAddrBitmap));
+    clearWatchpoints();
+    _tracepointsNum = 0;
+    _tracepointLogPosn.clear();
+    _tracepointLogDropped = 0;
+    _tracepointLogDroppedAtClear = 0;
+}
+
+void TargetBreakpoints::updateBitmapForAddr(uint32_t addr)
+{
+    if (addr >= BREAKPOINT_ADDR_SPACE)
+        return;
+
+    // Set if any enabled breakpoint (fast or normal) or tracepoint is at this address
+    bool isSet = false;
+    for (int i = 0; (i < _tracepointsNum) && !isSet; i++)
+        isSet = _tracepoints[i].pcValue == addr;
+    for (int i = 0; (i < _fastBreakpointsNumEnabled) && !isSet; i++)
+        isSet = _fastBreakpoints[i].enabled && (_fastBreakpoints[i].pcValue == addr);
+    for (int i = 0; (i < _breakpointNumEnabled) && !isSet; i++)
+        isSet = _breakpoints[_breakpointIdxsToCheck[i]].pcValue == addr;
+    if (isSet)
+        _breakpointAddrBitmap[addr >> 5] |= (1u << (addr & 0x1f));
+    else
+        _breakpointAddrBitmap[addr >> 5] &= ~(1u << (addr & 0x1f));
 }
 
 
@@ -38,17 +67,24 @@ void TargetBreakpoints::clear()
 // Breakpoints
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void TargetBreakpoints::enableBreakpoint(int idx, bool enabled)
+bool TargetBreakpoints::enableBreakpoint(int idx, bool enabled)
 {
     if ((idx < 0) || (idx >= MAX_BREAKPOINTS))
-        return;
+        return false;
+
+    // A breakpoint with an invalid condition would break unconditionally
+    if (enabled && !_breakpoints[idx].conditionValid)
+        enabled = false;
     _breakpoints[idx].enabled = enabled;
+    _breakpoints[idx].hitCount = 0;
     _breakpointNumEnabled = 0;
     int numBreakpointsEnabled = 0;
     for (int i = 0; i < MAX_BREAKPOINTS; i++)
         if (_breakpoints[i].enabled)
             _breakpointIdxsToCheck[numBreakpointsEnabled++] = i;
     _breakpointNumEnabled = numBreakpointsEnabled;
+    updateBitmapForAddr(_breakpoints[idx].pcValue);
+    return _breakpoints[idx].conditionValid;
 }
 
 void TargetBreakpoints::setBreakpointMessage(int idx, const char* hitMessage)
@@ -63,7 +99,52 @@ void TargetBreakpoints::setBreakpointPCAddr(int idx, uint32_t pcVal)
 {
     if ((idx < 0) || (idx >= MAX_BREAKPOINTS))
         return;
+    uint32_t oldPCVal = _breakpoints[idx].pcValue;
     _breakpoints[idx].pcValue = pcVal;
+    _breakpoints[idx].hitCount = 0;
+    updateBitmapForAddr(oldPCVal);
+    updateBitmapForAddr(pcVal);
+}
+
+bool TargetBreakpoints::setBreakpointCondition(int idx, const char* pCondition)
+{
+    if ((idx < 0) || (idx >= MAX_BREAKPOINTS))
+        return false;
+    _breakpoints[idx].hitCount = 0;
+    _breakpoints[idx].conditionValid = _breakpoints[idx].condition.compile(pCondition);
+    if (_breakpoints[idx].conditionValid)
+        return true;
+
+    // Disable the breakpoint rather than leave it unconditional
+    LogWrite(FromTargetBreakpoints, LOG_DEBUG, "Breakpoint %d condition invalid %s", idx, pCondition);
+    if (_breakpoints[idx].enabled)
+        enableBreakpoint(idx, false);
+    return false;
+}
+
+void TargetBreakpoints::setBreakpointPassCount(int idx, uint32_t passCount)
+{
+    if ((idx < 0) || (idx >= MAX_BREAKPOINTS))
+        return;
+    _breakpoints[idx].passCount = passCount;
+    _breakpoints[idx].hitCount = 0;
+}
+
+bool TargetBreakpoints::isConditionMet(SimpleBreakpoint& breakpoint, uint32_t addr)
+{
+    // Condition
+    if (!breakpoint.condition.isEmpty())
+    {
+        Z80Registers regs;
+        bool regsValid = breakpoint.condition.usesRegisters() && _pCondRegsGet && _pCondRegsGet(regs);
+        regs.PC = addr;
+        if (breakpoint.condition.evaluate(regs, regsValid, _pCondMemRead) == BREAKPOINT_COND_FALSE)
+            return false;
+    }
+
+    // Pass count
+    breakpoint.hitCount++;
+    return breakpoint.hitCount >= breakpoint.passCount;
 }
 
 bool TargetBreakpoints::checkForBreak([[maybe_unused]] uint32_t addr, [[maybe_unused]] uint32_t data, 
@@ -71,6 +152,33 @@ bool TargetBreakpoints::checkForBreak([[maybe_unused]] uint32_t addr, [[maybe_un
 {
     // LogWrite(FromTargetBreakpoints, LOG_DEBUG, "checkForBreak %04x, fast %d", 
     //         addr, _fastBreakpointsNumEnabled);
+    // Memory read/write cycles are only checked against watchpoints
+    if ((flags & BR_CTRL_BUS_M1_MASK) == 0)
+    {
+        if ((_watchpointsNum > 0) && isPageInBitmap(addr) && checkWatchpoints(addr, flags))
+            _watchpointBreakPending = true;
+        return false;
+    }
+    if ((flags & BR_CTRL_BUS_RD_MASK) == 0)
+        return false;
+
+    // Break at the first instruction after a watchpoint hit
+    if (_watchpointBreakPending)
+    {
+        _watchpointBreakPending = false;
+        _watchpointHitValid = _watchpointHitPending;
+        _watchpointHitPending = false;
+        return true;
+    }
+
+    // Only M1 cycles at an address with a breakpoint or tracepoint need the lists to be checked
+    if (!isAddrInBitmap(addr))
+        return false;
+
+    // Tracepoints never break
+    if (_tracepointsNum > 0)
+        handleTracepoints(addr);
+
     // See if fast-breakpoints enabled and M1 cycle
     if ((_fastBreakpointsNumEnabled > 0) && (flags & BR_CTRL_BUS_M1_MASK) && (flags & BR_CTRL_BUS_RD_MASK))
     {
@@ -80,6 +188,7 @@ bool TargetBreakpoints::checkForBreak([[maybe_unused]] uint32_t addr, [[maybe_un
             if (_fastBreakpoints[i].enabled && (_fastBreakpoints[i].pcValue == addr))
             {
                 _fastBreakpointHitIdx = i;
+                _watchpointHitValid = false;
                 return true;
             }
         }
@@ -91,9 +200,10 @@ bool TargetBreakpoints::checkForBreak([[maybe_unused]] uint32_t addr, [[maybe_un
         for (int i = 0; i < _breakpointNumEnabled; i++)
         {
             int bpIdx = _breakpointIdxsToCheck[i];
-            if (_breakpoints[bpIdx].pcValue == addr)
+            if ((_breakpoints[bpIdx].pcValue == addr) && isConditionMet(_breakpoints[bpIdx], addr))
             {
                 _breakpointHitIndex = bpIdx;
+                _watchpointHitValid = false;
                 return true;
             }
         }
@@ -110,6 +220,7 @@ void TargetBreakpoints::setFastBreakpoint(uint32_t addr, bool en)
         {
             // LogWrite(FromTargetBreakpoints, LOG_DEBUG, "Fast breakpoint addr %04x now %d", addr, en);
             _fastBreakpoints[i].enabled = en;
+            updateBitmapForAddr(addr);
             return;
         }
     }
@@ -118,5 +229,227 @@ void TargetBreakpoints::setFastBreakpoint(uint32_t addr, bool en)
         _fastBreakpoints[_fastBreakpointsNumEnabled].enabled = true;
         _fastBreakpoints[_fastBreakpointsNumEnabled].pcValue = addr;
         _fastBreakpointsNumEnabled++;
+        updateBitmapForAddr(addr);
+    }
+}
+
+void TargetBreakpoints::clearFastBreakpoints()
+{
+    int numToClear = _fastBreakpointsNumEnabled;
+    _fastBreakpointsNumEnabled = 0;
+    for (int i = 0; i < numToClear; i++)
+        updateBitmapForAddr(_fastBreakpoints[i].pcValue);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Watchpoints
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TargetBreakpoints::setWatchpoint(uint32_t addr, uint32_t len, TargetWatchpointType watchType)
+{
+    // Remove any existing watchpoint at this address
+    for (int i = 0; i < _watchpointsNum; i++)
+    {
+        if (_watchpoints[i].startAddr == addr)
+        {
+            _watchpoints[i] = _watchpoints[_watchpointsNum - 1];
+            _watchpointsNum--;
+            break;
+        }
+    }
+
+    // Add
+    if ((watchType != TARGET_WATCHPOINT_DISABLED) && (len > 0) && (_watchpointsNum < MAX_WATCHPOINTS))
+    {
+        SimpleWatchpoint& watchpoint = _watchpoints[_watchpointsNum];
+        watchpoint.startAddr = addr;
+        watchpoint.endAddr = addr + len - 1;
+        watchpoint.watchType = watchType;
+        _watchpointsNum++;
+    }
+    updateWatchpointPageBitmap();
+}
+
+void TargetBreakpoints::clearWatchpoints()
+{
+    _watchpointsNum = 0;
+    _watchpointHitPending = false;
+    _watchpointHitValid = false;
+    _watchpointBreakPending = false;
+    updateWatchpointPageBitmap();
+}
+
+void TargetBreakpoints::updateWatchpointPageBitmap()
+{
+    memset(_watchpointPageBitmap, 0, sizeof(_watchpointPageBitmap));
+    for (int i = 0; i < _watchpointsNum; i++)
+    {
+        uint32_t endPage = _watchpoints[i].endAddr >> WATCHPOINT_PAGE_SHIFT;
+        if (endPage >= WATCHPOINT_NUM_PAGES)
+            endPage = WATCHPOINT_NUM_PAGES - 1;
+        for (uint32_t page = _watchpoints[i].startAddr >> WATCHPOINT_PAGE_SHIFT; page <= endPage; page++)
+            _watchpointPageBitmap[page >> 5] |= (1u << (page & 0x1f));
+    }
+}
+
+bool TargetBreakpoints::checkWatchpoints(uint32_t addr, uint32_t flags)
+{
+    if (!_breakpointsEnabled)
+        return false;
+    uint32_t accessType = 0;
+    if (flags & BR_CTRL_BUS_RD_MASK)
+        accessType = TARGET_WATCHPOINT_READ;
+    else if (flags & BR_CTRL_BUS_WR_MASK)
+        accessType = TARGET_WATCHPOINT_WRITE;
+    for (int i = 0; i < _watchpointsNum; i++)
+    {
+        if ((addr >= _watchpoints[i].startAddr) && (addr <= _watchpoints[i].endAddr) &&
+                    (_watchpoints[i].watchType & accessType))
+        {
+            // Keep the first hit until the break
+            if (!_watchpointHitPending)
+            {
+                _watchpointHit.watchpointIdx = i;
+                _watchpointHit.startAddr = _watchpoints[i].startAddr;
+                _watchpointHit.endAddr = _watchpoints[i].endAddr;
+                _watchpointHit.dataAddr = addr;
+                _watchpointHit.accessType = (TargetWatchpointType)accessType;
+                _watchpointHitPending = true;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Tracepoints
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TargetBreakpoints::setTracepoint(uint32_t addr, TargetTracepointRecordType recordType)
+{
+    // Check for change to existing
+    for (int i = 0; i < _tracepointsNum; i++)
+    {
+        if (_tracepoints[i].pcValue == addr)
+        {
+            _tracepoints[i].recordType = recordType;
+            _tracepoints[i].hitCount = 0;
+            return true;
+        }
+    }
+    if (_tracepointsNum >= MAX_TRACEPOINTS)
+        return false;
+
+    // Add - the bitmap is updated after the tracepoint is complete as the ISR may see it at any time
+    SimpleTracepoint& tracepoint = _tracepoints[_tracepointsNum];
+    tracepoint.pcValue = addr;
+    tracepoint.recordType = recordType;
+    tracepoint.hitCount = 0;
+    _tracepointsNum++;
+    updateBitmapForAddr(addr);
+    return true;
+}
+
+void TargetBreakpoints::clearTracepoint(uint32_t addr)
+{
+    for (int i = 0; i < _tracepointsNum; i++)
+    {
+        if (_tracepoints[i].pcValue == addr)
+        {
+            _tracepoints[i] = _tracepoints[_tracepointsNum - 1];
+            _tracepointsNum--;
+            updateBitmapForAddr(addr);
+            return;
+        }
+    }
+}
+
+void TargetBreakpoints::clearTracepoints()
+{
+    int numToClear = _tracepointsNum;
+    _tracepointsNum = 0;
+    for (int i = 0; i < numToClear; i++)
+        updateBitmapForAddr(_tracepoints[i].pcValue);
+
+    // The log is emptied by getting everything that has been put as the put position belongs
+    // to the ISR - the dropped count is also the ISR's so the count at the clear is remembered
+    while (_tracepointLogPosn.canGet())
+        _tracepointLogPosn.hasGot();
+    _tracepointLogDroppedAtClear = _tracepointLogDropped;
+}
+
+void TargetBreakpoints::handleTracepoints(uint32_t addr)
+{
+    for (int i = 0; i < _tracepointsNum; i++)
+    {
+        if (_tracepoints[i].pcValue == addr)
+        {
+            _tracepoints[i].hitCount++;
+            if (_tracepoints[i].recordType != TARGET_TRACEPOINT_RECORD_COUNT)
+                logTracepoint(i, addr);
+            return;
+        }
+    }
+}
+
+void TargetBreakpoints::logTracepoint(int idx, uint32_t addr)
+{
+    if (!_tracepointLogPosn.canPut())
+    {
+        _tracepointLogDropped++;
+        return;
+    }
+    TargetTracepointLogEntry& entry = _tracepointLog[_tracepointLogPosn.posToPut()];
+    entry.cycles = lowlev_cycleCounterRead();
+    entry.pc = addr;
+    entry.tracepointIdx = idx;
+    entry.flags = 0;
+
+    // Register snapshot if there is a source of valid registers
+    Z80Registers regs;
+    if ((_tracepoints[idx].recordType == TARGET_TRACEPOINT_RECORD_REGS) && _pCondRegsGet && _pCondRegsGet(regs))
+    {
+        entry.flags |= TARGET_TRACEPOINT_LOG_REGS_VALID;
+        entry.AF = regs.AF;
+        entry.BC = regs.BC;
+        entry.DE = regs.DE;
+        entry.HL = regs.HL;
+        entry.IX = regs.IX;
+        entry.IY = regs.IY;
+        entry.SP = regs.SP;
+    }
+    else
+    {
+        entry.AF = entry.BC = entry.DE = entry.HL = entry.IX = entry.IY = entry.SP = 0;
+    }
+    _tracepointLogPosn.hasPut();
+}
+
+uint32_t TargetBreakpoints::getTracepointLog(TargetTracepointLogEntry* pEntries, uint32_t maxEntries)
+{
+    uint32_t count = 0;
+    while ((count < maxEntries) && _tracepointLogPosn.canGet())
+    {
+        pEntries[count++] = _tracepointLog[_tracepointLogPosn.posToGet()];
+        _tracepointLogPosn.hasGot();
+    }
+    return count;
+}
+
+void TargetBreakpoints::getTracepointsJson(char* pBuf, int maxLen)
+{
+    static const char* recordTypeNames[] = { "count", "time", "regs" };
+    char tmpStr[100];
+    ee_sprintf(tmpStr, "\"err\":\"ok\",\"logCount\":%u,\"logDropped\":%u,\"tracepoints\":[",
+                getTracepointLogCount(), getTracepointLogDropped());
+    strlcpy(pBuf, tmpStr, maxLen);
+    for (int i = 0; i < _tracepointsNum; i++)
+    {
+        ee_sprintf(tmpStr, "%s{\"addr\":\"0x%04x\",\"record\":\"%s\",\"hits\":%u}",
+                    (i == 0) ? "" : ",", _tracepoints[i].pcValue,
+                    recordTypeNames[_tracepoints[i].recordType], _tracepoints[i].hitCount);
+        strlcat(pBuf, tmpStr, maxLen);
     }
+    strlcat(pBuf, "]", maxLen);
 }
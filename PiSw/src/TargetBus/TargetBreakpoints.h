@@ -7,6 +7,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "TargetCPU.h"
+#include "TargetBreakpointCond.h"
+#include "../System/RingBufferPosn.h"
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Defs
@@ -20,14 +22,100 @@ public:
     char hitMessage[MAX_HIT_MSG_LEN];
     uint32_t pcValue;
 
+    // Condition and pass count - the breakpoint only breaks when the condition is true and
+    // it has been hit (with the condition true) passCount times - a breakpoint whose condition
+    // failed to compile can't be enabled
+    TargetBreakpointCond condition;
+    bool conditionValid;
+    uint32_t passCount;
+    uint32_t hitCount;
+
     SimpleBreakpoint()
     {
         enabled = false;
         hitMessage[0] = 0;
         pcValue = 0;
+        conditionValid = true;
+        passCount = 0;
+        hitCount = 0;
+    }
+};
+
+// Register values used by breakpoint conditions - returns false if there is no valid register state
+typedef bool TargetBreakpointRegsGetFnType(Z80Registers& regs);
+
+// Watchpoint types (match the ZEsarUX membreakpoint types)
+enum TargetWatchpointType
+{
+    TARGET_WATCHPOINT_DISABLED = 0,
+    TARGET_WATCHPOINT_READ = 1,
+    TARGET_WATCHPOINT_WRITE = 2,
+    TARGET_WATCHPOINT_ACCESS = 3
+};
+
+class SimpleWatchpoint
+{
+public:
+    uint32_t startAddr;
+    uint32_t endAddr;
+    TargetWatchpointType watchType;
+
+    SimpleWatchpoint()
+    {
+        startAddr = 0;
+        endAddr = 0;
+        watchType = TARGET_WATCHPOINT_DISABLED;
+    }
+};
+
+// Watchpoint which caused a break - the index and range of the watchpoint and the address and type
+// (read or write) of the memory access which hit it
+struct TargetWatchpointHit
+{
+    int watchpointIdx;
+    uint32_t startAddr;
+    uint32_t endAddr;
+    uint32_t dataAddr;
+    TargetWatchpointType accessType;
+};
+
+// Tracepoint record types - what is logged each time a tracepoint is hit (the hit count is always kept)
+enum TargetTracepointRecordType
+{
+    TARGET_TRACEPOINT_RECORD_COUNT = 0,
+    TARGET_TRACEPOINT_RECORD_TIME = 1,
+    TARGET_TRACEPOINT_RECORD_REGS = 2
+};
+
+class SimpleTracepoint
+{
+public:
+    uint32_t pcValue;
+    TargetTracepointRecordType recordType;
+    volatile uint32_t hitCount;
+
+    SimpleTracepoint()
+    {
+        pcValue = 0;
+        recordType = TARGET_TRACEPOINT_RECORD_COUNT;
+        hitCount = 0;
     }
 };
 
+// Tracepoint log entry - cycles is the CPU cycle counter when the tracepoint was hit and the
+// registers are only valid if TARGET_TRACEPOINT_LOG_REGS_VALID is set in flags
+static const uint8_t TARGET_TRACEPOINT_LOG_REGS_VALID = 0x01;
+#pragma pack(push, 1)
+struct TargetTracepointLogEntry
+{
+    uint32_t cycles;
+    uint16_t pc;
+    uint8_t tracepointIdx;
+    uint8_t flags;
+    uint16_t AF, BC, DE, HL, IX, IY, SP;
+};
+#pragma pack(pop)
+
 class TargetBreakpoints
 {
 public:
@@ -40,9 +128,19 @@ public:
     {
         _breakpointsEnabled = en;
     }
-    void enableBreakpoint(int idx, bool enabled);
+    bool enableBreakpoint(int idx, bool enabled);
     void setBreakpointMessage(int idx, const char* hitMessage);
     void setBreakpointPCAddr(int idx, uint32_t pcVal);
+    bool setBreakpointCondition(int idx, const char* pCondition);
+    void setBreakpointPassCount(int idx, uint32_t passCount);
+
+    // Sources of register and memory values for conditions - if the value needed by a condition
+    // isn't available then the breakpoint breaks - registers are also used for tracepoint logging
+    void setConditionSources(TargetBreakpointRegsGetFnType* pRegsGet, TargetBreakpointMemReadFnType* pMemRead)
+    {
+        _pCondRegsGet = pRegsGet;
+        _pCondMemRead = pMemRead;
+    }
     bool checkForBreak(uint32_t addr, uint32_t data, uint32_t flags, uint32_t& retVal);
     int getNumEnabled()
     {
@@ -53,13 +151,106 @@ public:
         return _breakpointsEnabled;
     }
     void setFastBreakpoint(uint32_t addr, bool en);
-    void clearFastBreakpoints()
+    void clearFastBreakpoints();
+
+    // Watchpoints - a range of addresses (len bytes from addr) checked on memory read and/or
+    // write cycles - setting the type to disabled removes the watchpoint at addr
+    void setWatchpoint(uint32_t addr, uint32_t len, TargetWatchpointType watchType);
+    void clearWatchpoints();
+
+    // Watchpoint which caused the last break - returns false if the last break wasn't a watchpoint
+    bool getWatchpointHit(TargetWatchpointHit& hit)
+    {
+        if (!_watchpointHitValid)
+            return false;
+        hit = _watchpointHit;
+        return true;
+    }
+    void clearWatchpointHit()
+    {
+        _watchpointHitValid = false;
+    }
+
+    // Break at the start of the next instruction - for watchpoints checked outside this class
+    void requestBreak()
     {
-        _fastBreakpointsNumEnabled = 0;
+        if (_breakpointsEnabled)
+            _watchpointBreakPending = true;
+    }
+
+    // Tracepoints - counted (and optionally logged) each time the PC value is fetched but never
+    // stop the target - setting a tracepoint at an address which has one changes its record type
+    // and clears its count
+    // They are checked by the target tracker so are only seen while tracking, which waits on every
+    // memory cycle, so the target runs slower than full speed
+    static const int MAX_TRACEPOINTS = 32;
+    bool setTracepoint(uint32_t addr, TargetTracepointRecordType recordType);
+    void clearTracepoint(uint32_t addr);
+    void clearTracepoints();
+    int getNumTracepoints()
+    {
+        return _tracepointsNum;
+    }
+    const SimpleTracepoint* getTracepoint(int idx)
+    {
+        if ((idx < 0) || (idx >= _tracepointsNum))
+            return NULL;
+        return &_tracepoints[idx];
+    }
+    void getTracepointsJson(char* pBuf, int maxLen);
+
+    // Tracepoint log - returns the number of entries copied (oldest first) and removed from the log
+    uint32_t getTracepointLog(TargetTracepointLogEntry* pEntries, uint32_t maxEntries);
+    uint32_t getTracepointLogCount()
+    {
+        return _tracepointLogPosn.count();
+    }
+    uint32_t getTracepointLogDropped()
+    {
+        return _tracepointLogDropped - _tracepointLogDroppedAtClear;
     }
 
 private:
     void clear();
+
+    // Bitmap with a bit set for each address that has an enabled breakpoint - this is the only
+    // check made on most M1 cycles and the breakpoint lists are only scanned on a hit
+    // Covers the 1MB address range of the Z180 (64K for the Z80 is the first 8KB of it)
+    static const uint32_t BREAKPOINT_ADDR_SPACE = 1024 * 1024;
+    uint32_t _breakpointAddrBitmap[BREAKPOINT_ADDR_SPACE / 32];
+    bool isAddrInBitmap(uint32_t addr)
+    {
+        return (addr < BREAKPOINT_ADDR_SPACE) && (_breakpointAddrBitmap[addr >> 5] & (1u << (addr & 0x1f)));
+    }
+    void updateBitmapForAddr(uint32_t addr);
+
+    // Watchpoints
+    static const int MAX_WATCHPOINTS = 100;
+    SimpleWatchpoint _watchpoints[MAX_WATCHPOINTS];
+    int _watchpointsNum;
+
+    // First watchpoint hit since the last break (pending) and the one which caused the last break (valid)
+    TargetWatchpointHit _watchpointHit;
+    volatile bool _watchpointHitPending;
+    volatile bool _watchpointHitValid;
+
+    // A watchpoint hit breaks at the start of the next instruction as the accessing instruction is
+    // part way through when the memory cycle is seen
+    volatile bool _watchpointBreakPending;
+
+    // Bitmap with a bit set for each page that has a watchpoint in it - memory cycles to other pages
+    // cost one lookup
+    static const uint32_t WATCHPOINT_PAGE_SHIFT = 8;
+    static const uint32_t WATCHPOINT_NUM_PAGES = BREAKPOINT_ADDR_SPACE >> WATCHPOINT_PAGE_SHIFT;
+    uint32_t _watchpointPageBitmap[WATCHPOINT_NUM_PAGES / 32];
+    bool isPageInBitmap(uint32_t addr)
+    {
+        uint32_t page = addr >> WATCHPOINT_PAGE_SHIFT;
+        return (page < WATCHPOINT_NUM_PAGES) && (_watchpointPageBitmap[page >> 5] & (1u << (page & 0x1f)));
+    }
+    void updateWatchpointPageBitmap();
+    bool checkWatchpoints(uint32_t addr, uint32_t flags);
+
     bool _breakpointsEnabled;
     int _breakpointNumEnabled;
     static const int MAX_BREAKPOINTS = 100;
@@ -69,4 +260,22 @@ private:
     int _fastBreakpointsNumEnabled;
     SimpleBreakpoint _fastBreakpoints[MAX_BREAKPOINTS];
     int _fastBreakpointHitIdx;
+
+    // Tracepoints
+    SimpleTracepoint _tracepoints[MAX_TRACEPOINTS];
+    int _tracepointsNum;
+    void handleTracepoints(uint32_t addr);
+    void logTracepoint(int idx, uint32_t addr);
+
+    // Tracepoint log
+    static const uint32_t MAX_TRACEPOINT_LOG_ENTRIES = 2048;
+    TargetTracepointLogEntry _tracepointLog[MAX_TRACEPOINT_LOG_ENTRIES];
+    RingBufferPosn _tracepointLogPosn;
+    volatile uint32_t _tracepointLogDropped;
+    uint32_t _tracepointLogDroppedAtClear;
+
+    // Conditions
+    TargetBreakpointRegsGetFnType* _pCondRegsGet;
+    TargetBreakpointMemReadFnType* _pCondMemRead;
+    bool isConditionMet(SimpleBreakpoint& breakpoint, uint32_t addr);
 };
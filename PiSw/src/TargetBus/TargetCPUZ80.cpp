@@ -4,11 +4,16 @@
 #include "TargetCPUZ80.h"
 #include <string.h>
 #include <stdlib.h>
-#include "../system/lowlev.h"
+#include "../System/lowlev.h"
 
 // Module name
 static const char FromTargetCPUZ80[] = "TargetCPUZ80";
 
+// Changed-register injection layouts
+TargetCPUZ80::SetRegsLayout TargetCPUZ80::_setRegsLayoutCache[SET_REGS_LAYOUT_CACHE_SIZE];
+int TargetCPUZ80::_setRegsLayoutCacheCount = 0;
+int TargetCPUZ80::_setRegsLayoutCacheNextIdx = 0;
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Utils
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -178,3 +183,217 @@ int TargetCPUZ80::getSnippetToSetRegs(uint32_t codeLocation, Z80Registers& regs,
     }
     return 0;
 }
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Handle setting only changed registers when injecting opcodes
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int TargetCPUZ80::getInjectToSetChangedRegs(const Z80Registers& regs, const Z80Registers& curRegs, 
+            uint8_t* pCodeBuffer, uint32_t codeMaxlen)
+{
+    // Work out which registers need setting
+    uint32_t key = 0;
+    if (regs.IX != curRegs.IX)
+        key |= SET_REGS_IX;
+    if (regs.IY != curRegs.IY)
+        key |= SET_REGS_IY;
+    if (regs.HL != curRegs.HL)
+        key |= SET_REGS_HL;
+    if (regs.DE != curRegs.DE)
+        key |= SET_REGS_DE;
+    if (regs.BC != curRegs.BC)
+        key |= SET_REGS_BC;
+    if (regs.HLDASH != curRegs.HLDASH)
+        key |= SET_REGS_HLDASH;
+    if (regs.DEDASH != curRegs.DEDASH)
+        key |= SET_REGS_DEDASH;
+    if (regs.BCDASH != curRegs.BCDASH)
+        key |= SET_REGS_BCDASH;
+    if (regs.AFDASH != curRegs.AFDASH)
+        key |= SET_REGS_AFDASH;
+    // Flags can only be set with pop af but A alone can be loaded
+    if ((regs.AF & 0xff) != (curRegs.AF & 0xff))
+        key |= SET_REGS_AF;
+    else if (regs.AF != curRegs.AF)
+        key |= SET_REGS_A;
+    if (regs.SP != curRegs.SP)
+        key |= SET_REGS_SP;
+    if (regs.I != curRegs.I)
+        key |= SET_REGS_I;
+    if (regs.R != curRegs.R)
+        key |= SET_REGS_R;
+    if (regs.INTMODE != curRegs.INTMODE)
+        key |= SET_REGS_IM | ((regs.INTMODE & 0x03) << SET_REGS_IM_VAL_SHIFT);
+    if ((regs.INTENABLED != 0) != (curRegs.INTENABLED != 0))
+        key |= SET_REGS_INTEN | (regs.INTENABLED ? SET_REGS_INTEN_VAL : 0);
+
+    // Get layout and fill in the values
+    const SetRegsLayout& layout = getSetRegsLayout(key);
+    if (codeMaxlen < (uint32_t)layout.codeLen)
+        return 0;
+    memcpy(pCodeBuffer, layout.code, layout.codeLen);
+    for (int i = 0; i < layout.numFields; i++)
+    {
+        int pos = layout.fieldPos[i];
+        switch(layout.fieldId[i])
+        {
+            case SET_REGS_FIELD_IX: store16BitVal(pCodeBuffer, pos, regs.IX); break;
+            case SET_REGS_FIELD_IY: store16BitVal(pCodeBuffer, pos, regs.IY); break;
+            case SET_REGS_FIELD_HL: store16BitVal(pCodeBuffer, pos, regs.HL); break;
+            case SET_REGS_FIELD_DE: store16BitVal(pCodeBuffer, pos, regs.DE); break;
+            case SET_REGS_FIELD_BC: store16BitVal(pCodeBuffer, pos, regs.BC); break;
+            case SET_REGS_FIELD_HLDASH: store16BitVal(pCodeBuffer, pos, regs.HLDASH); break;
+            case SET_REGS_FIELD_DEDASH: store16BitVal(pCodeBuffer, pos, regs.DEDASH); break;
+            case SET_REGS_FIELD_BCDASH: store16BitVal(pCodeBuffer, pos, regs.BCDASH); break;
+            case SET_REGS_FIELD_AFDASH: store16BitVal(pCodeBuffer, pos, regs.AFDASH); break;
+            case SET_REGS_FIELD_AF: store16BitVal(pCodeBuffer, pos, regs.AF); break;
+            case SET_REGS_FIELD_SP: store16BitVal(pCodeBuffer, pos, regs.SP); break;
+            case SET_REGS_FIELD_PC: store16BitVal(pCodeBuffer, pos, regs.PC); break;
+            case SET_REGS_FIELD_A: pCodeBuffer[pos] = regs.AF >> 8; break;
+            case SET_REGS_FIELD_I: pCodeBuffer[pos] = regs.I; break;
+            // Opcode fetches only count in the low 7 bits of R - bit 7 is kept
+            case SET_REGS_FIELD_R: pCodeBuffer[pos] = (regs.R & 0x80) | ((regs.R - layout.rFetchesAfterSet) & 0x7f); break;
+        }
+    }
+    return layout.codeLen;
+}
+
+void TargetCPUZ80::addSetRegsInstr(SetRegsLayout& layout, const uint8_t* pOps, int numOps, int fieldId, int fieldLen)
+{
+    // Opcodes then an optional value field (filled in when the layout is used)
+    for (int i = 0; i < numOps; i++)
+        layout.code[layout.codeLen++] = pOps[i];
+    if (fieldLen > 0)
+    {
+        layout.fieldPos[layout.numFields] = layout.codeLen;
+        layout.fieldId[layout.numFields++] = fieldId;
+        for (int i = 0; i < fieldLen; i++)
+            layout.code[layout.codeLen++] = 0;
+    }
+}
+
+const TargetCPUZ80::SetRegsLayout& TargetCPUZ80::getSetRegsLayout(uint32_t key)
+{
+    // Check cache
+    for (int i = 0; i < _setRegsLayoutCacheCount; i++)
+        if (_setRegsLayoutCache[i].key == key)
+            return _setRegsLayoutCache[i];
+
+    // Build into the next slot (replacing the oldest when full)
+    SetRegsLayout& layout = _setRegsLayoutCache[_setRegsLayoutCacheNextIdx];
+    buildSetRegsLayout(key, layout);
+    _setRegsLayoutCacheNextIdx = (_setRegsLayoutCacheNextIdx + 1) % SET_REGS_LAYOUT_CACHE_SIZE;
+    if (_setRegsLayoutCacheCount < SET_REGS_LAYOUT_CACHE_SIZE)
+        _setRegsLayoutCacheCount++;
+    return layout;
+}
+
+void TargetCPUZ80::buildSetRegsLayout(uint32_t key, SetRegsLayout& layout)
+{
+    layout.key = key;
+    layout.codeLen = 0;
+    layout.numFields = 0;
+
+    // Opcodes
+    static const uint8_t opNop[] = { 0x00 };
+    static const uint8_t opLdIX[] = { 0xdd, 0x21 };
+    static const uint8_t opLdIY[] = { 0xfd, 0x21 };
+    static const uint8_t opLdHL[] = { 0x21 };
+    static const uint8_t opLdDE[] = { 0x11 };
+    static const uint8_t opLdBC[] = { 0x01 };
+    static const uint8_t opExx[] = { 0xd9 };
+    static const uint8_t opExAF[] = { 0x08 };
+    static const uint8_t opPopAF[] = { 0xf1 };
+    static const uint8_t opLdSP[] = { 0x31 };
+    static const uint8_t opLdA[] = { 0x3e };
+    static const uint8_t opLdIA[] = { 0xed, 0x47 };
+    static const uint8_t opLdRA[] = { 0xed, 0x4f };
+    static const uint8_t opJp[] = { 0xc3 };
+
+    // Nop in case previous instruction was prefixed
+    addSetRegsInstr(layout, opNop, 1, 0, 0);
+
+    // Register pairs
+    if (key & SET_REGS_IX)
+        addSetRegsInstr(layout, opLdIX, 2, SET_REGS_FIELD_IX, 2);
+    if (key & SET_REGS_IY)
+        addSetRegsInstr(layout, opLdIY, 2, SET_REGS_FIELD_IY, 2);
+    if (key & SET_REGS_HL)
+        addSetRegsInstr(layout, opLdHL, 1, SET_REGS_FIELD_HL, 2);
+    if (key & SET_REGS_DE)
+        addSetRegsInstr(layout, opLdDE, 1, SET_REGS_FIELD_DE, 2);
+    if (key & SET_REGS_BC)
+        addSetRegsInstr(layout, opLdBC, 1, SET_REGS_FIELD_BC, 2);
+
+    // Alternate register pairs - exx twice so the register banks are left as they were
+    if (key & (SET_REGS_HLDASH | SET_REGS_DEDASH | SET_REGS_BCDASH))
+    {
+        addSetRegsInstr(layout, opExx, 1, 0, 0);
+        if (key & SET_REGS_HLDASH)
+            addSetRegsInstr(layout, opLdHL, 1, SET_REGS_FIELD_HLDASH, 2);
+        if (key & SET_REGS_DEDASH)
+            addSetRegsInstr(layout, opLdDE, 1, SET_REGS_FIELD_DEDASH, 2);
+        if (key & SET_REGS_BCDASH)
+            addSetRegsInstr(layout, opLdBC, 1, SET_REGS_FIELD_BCDASH, 2);
+        addSetRegsInstr(layout, opExx, 1, 0, 0);
+    }
+
+    // AF' and AF are popped (the two bytes that follow are read as if from the stack) so SP must
+    // be set afterwards
+    bool spNeeded = (key & SET_REGS_SP) != 0;
+    if (key & SET_REGS_AFDASH)
+    {
+        addSetRegsInstr(layout, opExAF, 1, 0, 0);
+        addSetRegsInstr(layout, opPopAF, 1, SET_REGS_FIELD_AFDASH, 2);
+        addSetRegsInstr(layout, opExAF, 1, 0, 0);
+        spNeeded = true;
+    }
+    if (key & SET_REGS_AF)
+    {
+        addSetRegsInstr(layout, opPopAF, 1, SET_REGS_FIELD_AF, 2);
+        spNeeded = true;
+    }
+    if (spNeeded)
+        addSetRegsInstr(layout, opLdSP, 1, SET_REGS_FIELD_SP, 2);
+
+    // I and R are set through A so A is restored afterwards
+    bool loadA = (key & SET_REGS_A) != 0;
+    if (key & SET_REGS_I)
+    {
+        addSetRegsInstr(layout, opLdA, 1, SET_REGS_FIELD_I, 1);
+        addSetRegsInstr(layout, opLdIA, 2, 0, 0);
+        loadA = true;
+    }
+    if (key & SET_REGS_R)
+    {
+        addSetRegsInstr(layout, opLdA, 1, SET_REGS_FIELD_R, 1);
+        addSetRegsInstr(layout, opLdRA, 2, 0, 0);
+        loadA = true;
+    }
+
+    // R is incremented by each opcode fetch after it is set
+    layout.rFetchesAfterSet = 1;
+    if (loadA)
+    {
+        addSetRegsInstr(layout, opLdA, 1, SET_REGS_FIELD_A, 1);
+        layout.rFetchesAfterSet++;
+    }
+
+    // Interrupt mode and enable
+    if (key & SET_REGS_IM)
+    {
+        uint32_t intMode = (key >> SET_REGS_IM_VAL_SHIFT) & 0x03;
+        uint8_t opIm[] = { 0xed, (uint8_t)((intMode == 0) ? 0x46 : ((intMode == 1) ? 0x56 : 0x5e)) };
+        addSetRegsInstr(layout, opIm, 2, 0, 0);
+        layout.rFetchesAfterSet += 2;
+    }
+    if (key & SET_REGS_INTEN)
+    {
+        uint8_t opIntEn[] = { (uint8_t)((key & SET_REGS_INTEN_VAL) ? 0xfb : 0xf3) };
+        addSetRegsInstr(layout, opIntEn, 1, 0, 0);
+        layout.rFetchesAfterSet++;
+    }
+
+    // Jump to PC
+    addSetRegsInstr(layout, opJp, 1, SET_REGS_FIELD_PC, 2);
+}
@@ -18,4 +18,65 @@ public:
     static int getSnippetToSetRegs(uint32_t codeLocation, Z80Registers& regs, uint8_t* pCodeBuffer, uint32_t codeMaxlen);
     static void store16BitVal(uint8_t arry[], int offset, uint16_t val);
 
+    // Injection which only sets the registers that differ between regs and curRegs (the values
+    // known to be in the processor) - R is only set if it differs so otherwise it advances by the
+    // number of injected fetches
+    static int getInjectToSetChangedRegs(const Z80Registers& regs, const Z80Registers& curRegs, 
+                uint8_t* pCodeBuffer, uint32_t codeMaxlen);
+
+private:
+    // Items in a changed-register injection
+    enum
+    {
+        SET_REGS_IX = 0x0001,
+        SET_REGS_IY = 0x0002,
+        SET_REGS_HL = 0x0004,
+        SET_REGS_DE = 0x0008,
+        SET_REGS_BC = 0x0010,
+        SET_REGS_HLDASH = 0x0020,
+        SET_REGS_DEDASH = 0x0040,
+        SET_REGS_BCDASH = 0x0080,
+        SET_REGS_AFDASH = 0x0100,
+        SET_REGS_AF = 0x0200,
+        SET_REGS_A = 0x0400,
+        SET_REGS_SP = 0x0800,
+        SET_REGS_I = 0x1000,
+        SET_REGS_R = 0x2000,
+        SET_REGS_IM = 0x4000,
+        SET_REGS_INTEN = 0x8000,
+        // Values of IM and interrupt enable are part of the layout as they change the opcodes
+        SET_REGS_IM_VAL_SHIFT = 16,
+        SET_REGS_INTEN_VAL = 0x40000
+    };
+
+    // Register values patched into an injection layout
+    enum SET_REGS_FIELD
+    {
+        SET_REGS_FIELD_IX, SET_REGS_FIELD_IY, SET_REGS_FIELD_HL, SET_REGS_FIELD_DE, SET_REGS_FIELD_BC,
+        SET_REGS_FIELD_HLDASH, SET_REGS_FIELD_DEDASH, SET_REGS_FIELD_BCDASH, SET_REGS_FIELD_AFDASH,
+        SET_REGS_FIELD_AF, SET_REGS_FIELD_SP, SET_REGS_FIELD_PC, SET_REGS_FIELD_A, SET_REGS_FIELD_I,
+        SET_REGS_FIELD_R
+    };
+
+    // Injection layout - the code for a set of changed registers with the positions of the values
+    // to fill in - layouts are cached as the same few (PC only, PC and one register) are used repeatedly
+    static const int MAX_SET_REGS_LAYOUT_LEN = 64;
+    static const int MAX_SET_REGS_LAYOUT_FIELDS = 16;
+    struct SetRegsLayout
+    {
+        uint32_t key;
+        uint8_t code[MAX_SET_REGS_LAYOUT_LEN];
+        int codeLen;
+        uint8_t fieldPos[MAX_SET_REGS_LAYOUT_FIELDS];
+        uint8_t fieldId[MAX_SET_REGS_LAYOUT_FIELDS];
+        int numFields;
+        int rFetchesAfterSet;
+    };
+    static const int SET_REGS_LAYOUT_CACHE_SIZE = 8;
+    static SetRegsLayout _setRegsLayoutCache[SET_REGS_LAYOUT_CACHE_SIZE];
+    static int _setRegsLayoutCacheCount;
+    static int _setRegsLayoutCacheNextIdx;
+    static const SetRegsLayout& getSetRegsLayout(uint32_t key);
+    static void buildSetRegsLayout(uint32_t key, SetRegsLayout& layout);
+    static void addSetRegsInstr(SetRegsLayout& layout, const uint8_t* pOps, int numOps, int fieldId, int fieldLen);
 };
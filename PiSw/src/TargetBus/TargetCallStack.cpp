@@ -0,0 +1,248 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#include "TargetCallStack.h"
+#include "TargetCPU.h"
+#include "../System/lowlib.h"
+#include "../System/ee_sprintf.h"
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Init
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TargetCallStack::TargetCallStack()
+{
+    clear();
+}
+
+void TargetCallStack::clear()
+{
+    _depth = 0;
+    _pendValid = false;
+    _returnCount = 0;
+    _lastReturnStackAddr = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Handle bus cycles
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TargetCallStack::handleCycle(uint32_t addr, uint32_t data, uint32_t flags, bool firstByteOfInstr)
+{
+    // Start of an instruction completes the previous one
+    if (firstByteOfInstr)
+    {
+        if (_pendValid)
+            completeInstr(addr);
+        _pendValid = true;
+        _pendPC = addr;
+        _pendNumOpcodes = 0;
+        _pendNumReads = 0;
+        _pendNumWrites = 0;
+    }
+    if (!_pendValid)
+        return;
+
+    // Collect opcodes (including prefixes), data reads and writes
+    if (flags & BR_CTRL_BUS_WR_MASK)
+    {
+        if (_pendNumWrites < MAX_INSTR_ACCESSES)
+        {
+            _pendWrites[_pendNumWrites].addr = addr;
+            _pendWrites[_pendNumWrites].data = data;
+            _pendNumWrites++;
+        }
+    }
+    else if (flags & BR_CTRL_BUS_M1_MASK)
+    {
+        if (_pendNumOpcodes < MAX_INSTR_OPCODES)
+            _pendOpcodes[_pendNumOpcodes++] = data;
+    }
+    else if (flags & BR_CTRL_BUS_RD_MASK)
+    {
+        if (_pendNumReads < MAX_INSTR_ACCESSES)
+        {
+            _pendReads[_pendNumReads].addr = addr;
+            _pendReads[_pendNumReads].data = data;
+            _pendNumReads++;
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Infer calls and returns
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TargetCallStack::completeInstr(uint32_t nextInstrAddr)
+{
+    if (_pendNumOpcodes == 0)
+        return;
+
+    // Decode what matters - an index prefix is followed by a second opcode
+    uint8_t opcode = _pendOpcodes[0];
+    uint8_t opcode2 = (_pendNumOpcodes > 1) ? _pendOpcodes[1] : 0;
+    bool isIndexed = (opcode == 0xdd) || (opcode == 0xfd);
+    bool isCall = (opcode == 0xcd) || ((opcode & 0xc7) == 0xc4);
+    bool isRst = (opcode & 0xc7) == 0xc7;
+    bool isRet = (opcode == 0xc9) || ((opcode & 0xc7) == 0xc0) || ((opcode == 0xed) && ((opcode2 & 0xc7) == 0x45));
+    bool isPop = ((opcode & 0xcf) == 0xc1) || (isIndexed && (opcode2 == 0xe1));
+    bool isPush = ((opcode & 0xcf) == 0xc5) || (isIndexed && (opcode2 == 0xe5));
+    bool isExSP = (opcode == 0xe3) || (isIndexed && (opcode2 == 0xe3));
+    uint32_t instrLen = isCall ? 3 : (isIndexed ? 2 : 1);
+    uint32_t val = 0, stackAddr = 0;
+
+    // Return or pop removes the frame it reads - a return is only counted when the next instruction is
+    // at the address popped (if interrupted straight after, the interrupt's return is counted instead)
+    if ((isRet || isPop) && findPopPair(val, stackAddr))
+    {
+        dropFramesAtOrBelow(stackAddr);
+        if (isRet && (val == nextInstrAddr))
+        {
+            _lastReturnStackAddr = stackAddr;
+            _returnCount++;
+        }
+    }
+
+    // Call or restart - a not-taken conditional call followed by an interrupt pushes the same address
+    // but doesn't jump to the operand
+    uint32_t ownWrites = 0;
+    if ((isCall || isRst) && isPushPair(0, val, stackAddr) && (val == _pendPC + instrLen))
+    {
+        uint32_t entryAddr = nextInstrAddr;
+        bool isCallTaken = true;
+        if (isRst)
+        {
+            entryAddr = opcode & 0x38;
+        }
+        else if ((_pendNumReads >= 2) && (_pendReads[0].addr == _pendPC + 1) && (_pendReads[1].addr == _pendPC + 2))
+        {
+            entryAddr = _pendReads[0].data | (_pendReads[1].data << 8);
+            isCallTaken = (_pendNumWrites >= 4) || (entryAddr == nextInstrAddr);
+        }
+        if (isCallTaken)
+        {
+            pushFrame(val, entryAddr, stackAddr, isRst ? TARGET_CALL_FRAME_RST : TARGET_CALL_FRAME_CALL);
+            ownWrites = 2;
+        }
+    }
+    else if ((isPush || isExSP) && (_pendNumWrites >= 2) &&
+                ((_pendNumWrites >= 4) || (nextInstrAddr == _pendPC + instrLen)))
+    {
+        // A push unwinds frames at or below it - an exchange with the top of stack changes a return address
+        ownWrites = 2;
+        if (isPush && isPushPair(0, val, stackAddr))
+            dropFramesAtOrBelow(stackAddr);
+        else
+            for (uint32_t i = 0; i < ownWrites; i++)
+                updateFramesForWrite(_pendWrites[i].addr, _pendWrites[i].data);
+    }
+
+    // Interrupt (or NMI) - a return address pushed after the instruction's own writes with no fetch
+    uint32_t intWrites = 0;
+    uint32_t intRetAddr = 0, intStackAddr = 0;
+    if ((_pendNumWrites >= ownWrites + 2) && isPushPair(_pendNumWrites - 2, intRetAddr, intStackAddr) &&
+                (intRetAddr != nextInstrAddr))
+        intWrites = 2;
+
+    // Other writes may be over a frame
+    for (uint32_t i = ownWrites; i < _pendNumWrites - intWrites; i++)
+        updateFramesForWrite(_pendWrites[i].addr, _pendWrites[i].data);
+    if (intWrites)
+        pushFrame(intRetAddr, nextInstrAddr, intStackAddr,
+                    (nextInstrAddr == 0x66) ? TARGET_CALL_FRAME_NMI : TARGET_CALL_FRAME_INT);
+}
+
+bool TargetCallStack::isPushPair(uint32_t writeIdx, uint32_t& val, uint32_t& stackAddr)
+{
+    // High byte then low byte at the address below
+    if (writeIdx + 1 >= _pendNumWrites)
+        return false;
+    if (_pendWrites[writeIdx + 1].addr != ((_pendWrites[writeIdx].addr - 1) & 0xffff))
+        return false;
+    val = _pendWrites[writeIdx + 1].data | (_pendWrites[writeIdx].data << 8);
+    stackAddr = _pendWrites[writeIdx + 1].addr;
+    return true;
+}
+
+bool TargetCallStack::findPopPair(uint32_t& val, uint32_t& stackAddr)
+{
+    // Low byte then high byte at the address above
+    for (uint32_t i = 0; i + 1 < _pendNumReads; i++)
+    {
+        if (_pendReads[i + 1].addr == ((_pendReads[i].addr + 1) & 0xffff))
+        {
+            val = _pendReads[i].data | (_pendReads[i + 1].data << 8);
+            stackAddr = _pendReads[i].addr;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TargetCallStack::pushFrame(uint32_t retAddr, uint32_t entryAddr, uint32_t stackAddr, TargetCallFrameType frameType)
+{
+    dropFramesAtOrBelow(stackAddr);
+
+    // Lose the outermost frame if full
+    if (_depth >= MAX_FRAMES)
+    {
+        memmove(_frames, _frames + 1, (MAX_FRAMES - 1) * sizeof(TargetCallFrame));
+        _depth = MAX_FRAMES - 1;
+    }
+    _frames[_depth].retAddr = retAddr;
+    _frames[_depth].entryAddr = entryAddr;
+    _frames[_depth].stackAddr = stackAddr;
+    _frames[_depth].frameType = frameType;
+    _depth++;
+}
+
+void TargetCallStack::dropFramesAtOrBelow(uint32_t stackAddr)
+{
+    while ((_depth > 0) && (_frames[_depth - 1].stackAddr <= stackAddr))
+        _depth--;
+}
+
+void TargetCallStack::updateFramesForWrite(uint32_t addr, uint8_t data)
+{
+    for (uint32_t i = 0; i < _depth; i++)
+    {
+        if (_frames[i].stackAddr == addr)
+            _frames[i].retAddr = (_frames[i].retAddr & 0xff00) | data;
+        else if (_frames[i].stackAddr + 1 == addr)
+            _frames[i].retAddr = (_frames[i].retAddr & 0x00ff) | (data << 8);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Get frames
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TargetCallStack::getFrame(uint32_t idx, TargetCallFrame& frame)
+{
+    uint32_t depth = _depth;
+    if (idx >= depth)
+        return false;
+    frame = _frames[depth - 1 - idx];
+    return true;
+}
+
+void TargetCallStack::getJson(char* pBuf, int maxLen)
+{
+    static const char* frameTypeNames[] = { "call", "rst", "int", "nmi" };
+    char tmpStr[120];
+    uint32_t depth = _depth;
+    ee_sprintf(tmpStr, "\"err\":\"ok\",\"depth\":%u,\"frames\":[", depth);
+    strlcpy(pBuf, tmpStr, maxLen);
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        TargetCallFrame frame;
+        if (!getFrame(i, frame))
+            break;
+        ee_sprintf(tmpStr, "%s{\"ret\":\"0x%04x\",\"entry\":\"0x%04x\",\"sp\":\"0x%04x\",\"type\":\"%s\"}",
+                    (i == 0) ? "" : ",", frame.retAddr, frame.entryAddr, frame.stackAddr,
+                    frameTypeNames[frame.frameType]);
+        strlcat(pBuf, tmpStr, maxLen);
+    }
+    strlcat(pBuf, "]", maxLen);
+}
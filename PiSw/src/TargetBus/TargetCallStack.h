@@ -0,0 +1,108 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shadow call stack - the return addresses of calls, restarts and interrupts inferred from the bus cycles of
+// the target so a backtrace (or step out) doesn't need the registers or a read of the stack
+//
+// A frame is added when an instruction pushes the address execution continues at after it (CALL and RST)
+// or when a return address is pushed after an instruction with no instruction fetch (an interrupt or NMI)
+// A frame is removed when a return pops it, a POP reads it or a push is made at or below it (the stack was
+// unwound without a return). Writes over a frame (e.g. EX (SP),HL) change its return address
+// Only calls made since tracking started (or the target reset) are known
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum TargetCallFrameType
+{
+    TARGET_CALL_FRAME_CALL,
+    TARGET_CALL_FRAME_RST,
+    TARGET_CALL_FRAME_INT,
+    TARGET_CALL_FRAME_NMI
+};
+
+struct TargetCallFrame
+{
+    uint32_t retAddr;
+    uint32_t entryAddr;
+    uint32_t stackAddr;
+    TargetCallFrameType frameType;
+};
+
+class TargetCallStack
+{
+public:
+    TargetCallStack();
+
+    void clear();
+
+    // Bus cycle (not injected) - firstByteOfInstr is set for the opcode fetch which starts an instruction
+    // and data is the value read or written
+    void handleCycle(uint32_t addr, uint32_t data, uint32_t flags, bool firstByteOfInstr);
+
+    // Discard the instruction being collected - used when injection takes over before it executes
+    void discardPending()
+    {
+        _pendValid = false;
+    }
+
+    // Frames - 0 is the innermost
+    uint32_t getDepth()
+    {
+        return _depth;
+    }
+    bool getFrame(uint32_t idx, TargetCallFrame& frame);
+    void getJson(char* pBuf, int maxLen);
+
+    // Returns taken (including those of frames that aren't known) - a count so a new one can be seen
+    // and the stack address the last one popped its return address from
+    uint32_t getReturnCount()
+    {
+        return _returnCount;
+    }
+    uint32_t getLastReturnStackAddr()
+    {
+        return _lastReturnStackAddr;
+    }
+
+    static const uint32_t MAX_FRAMES = 64;
+
+private:
+    // Frames - 0 is the outermost
+    TargetCallFrame _frames[MAX_FRAMES];
+    volatile uint32_t _depth;
+
+    // Returns
+    volatile uint32_t _returnCount;
+    volatile uint32_t _lastReturnStackAddr;
+
+    // Instruction being collected
+    static const uint32_t MAX_INSTR_OPCODES = 2;
+    static const uint32_t MAX_INSTR_ACCESSES = 8;
+    struct CallStackAccess
+    {
+        uint32_t addr;
+        uint8_t data;
+    };
+    bool _pendValid;
+    uint32_t _pendPC;
+    uint8_t _pendOpcodes[MAX_INSTR_OPCODES];
+    uint32_t _pendNumOpcodes;
+    CallStackAccess _pendReads[MAX_INSTR_ACCESSES];
+    uint32_t _pendNumReads;
+    CallStackAccess _pendWrites[MAX_INSTR_ACCESSES];
+    uint32_t _pendNumWrites;
+
+    // Process the collected instruction when the next starts
+    void completeInstr(uint32_t nextInstrAddr);
+    bool isPushPair(uint32_t writeIdx, uint32_t& val, uint32_t& stackAddr);
+    bool findPopPair(uint32_t& val, uint32_t& stackAddr);
+    void pushFrame(uint32_t retAddr, uint32_t entryAddr, uint32_t stackAddr, TargetCallFrameType frameType);
+    void dropFramesAtOrBelow(uint32_t stackAddr);
+    void updateFramesForWrite(uint32_t addr, uint8_t data);
+};
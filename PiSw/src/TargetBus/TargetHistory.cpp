@@ -0,0 +1,295 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#include "TargetHistory.h"
+#include "TargetCPU.h"
+#include "../System/nmalloc.h"
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Init
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TargetHistory::TargetHistory()
+{
+    _pRing = NULL;
+    _ringSize = 0;
+    _pMem = NULL;
+    _memLen = 0;
+    clear();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Enable and clear
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TargetHistory::enable(uint32_t ringSize, uint32_t memLen)
+{
+    // Stop recording while the buffers are changed
+    uint8_t* pRing = _pRing;
+    _pRing = NULL;
+    if (pRing && (ringSize != _ringSize))
+        nmalloc_free((void**)&pRing);
+    if (_pMem && (memLen != _memLen))
+        nmalloc_free((void**)&_pMem);
+    if (ringSize == 0)
+    {
+        if (pRing)
+            nmalloc_free((void**)&pRing);
+        if (_pMem)
+            nmalloc_free((void**)&_pMem);
+        _ringSize = 0;
+        _memLen = 0;
+        return true;
+    }
+
+    // Allocate - from the heap directly as new is assumed never to fail so its result can't be checked
+    if (!_pMem)
+    {
+        _pMem = (uint8_t*)nmalloc_malloc(memLen);
+        if (!_pMem)
+            return false;
+        memset(_pMem, 0, memLen);
+    }
+    _memLen = memLen;
+    if (!pRing)
+    {
+        pRing = (uint8_t*)nmalloc_malloc(ringSize);
+        if (!pRing)
+            return false;
+    }
+    _ringSize = ringSize;
+    clear();
+    _pRing = pRing;
+    return true;
+}
+
+void TargetHistory::clear()
+{
+    _pendValid = false;
+    _lastValid = false;
+    _readCursorValid = false;
+    _head = 0;
+    _tail = 0;
+    _usedBytes = 0;
+    _recordCount = 0;
+    _tailPredictedPC = 0;
+    _droppedCount = 0;
+    _repeatCount = 0;
+}
+
+void TargetHistory::syncMemory(const uint8_t* pMem, uint32_t len)
+{
+    if (!_pMem || !pMem)
+        return;
+    memcpy(_pMem, pMem, (len < _memLen) ? len : _memLen);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Handle bus cycles
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TargetHistory::handleCycle(uint32_t addr, uint32_t data, uint32_t flags, bool firstByteOfInstr)
+{
+    if (!_pRing)
+        return;
+    bool isWrite = (flags & BR_CTRL_BUS_WR_MASK) != 0;
+    if (!isWrite && ((flags & BR_CTRL_BUS_RD_MASK) == 0))
+        return;
+    data &= 0xff;
+
+    // Start of an instruction completes the previous one
+    if (firstByteOfInstr)
+    {
+        commitPending();
+        _pendValid = true;
+        _pendBytesDone = false;
+        _pendPC = addr;
+        _pendNumBytes = 0;
+        _pendNumWrites = 0;
+    }
+
+    if (isWrite)
+    {
+        // Record old value from the memory copy
+        _pendBytesDone = true;
+        uint8_t oldVal = (addr < _memLen) ? _pMem[addr] : data;
+        if (addr < _memLen)
+            _pMem[addr] = data;
+        if (_pendValid && (_pendNumWrites < MAX_WRITES))
+        {
+            _pendWrites[_pendNumWrites].addr = addr;
+            _pendWrites[_pendNumWrites].oldVal = oldVal;
+            _pendWrites[_pendNumWrites].newVal = data;
+            _pendNumWrites++;
+        }
+        return;
+    }
+
+    // Reads keep the memory copy in step with the target
+    if (addr < _memLen)
+        _pMem[addr] = data;
+
+    // Instruction bytes are read at consecutive addresses from the PC
+    if (!_pendValid || _pendBytesDone)
+        return;
+    if ((addr == _pendPC + _pendNumBytes) && (_pendNumBytes < MAX_INSTR_BYTES))
+        _pendBytes[_pendNumBytes++] = data;
+    else
+        _pendBytesDone = true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Add records to the ring
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TargetHistory::commitPending()
+{
+    if (!_pendValid || (_pendNumBytes == 0))
+        return;
+    _pendValid = false;
+
+    // Repeats are only counted
+    if (pendingIsRepeat())
+    {
+        _repeatCount++;
+        return;
+    }
+
+    // Address size
+    bool wideAddrs = _pendPC > 0xffff;
+    for (uint32_t i = 0; i < _pendNumWrites; i++)
+        if (_pendWrites[i].addr > 0xffff)
+            wideAddrs = true;
+    bool pcPresent = !_lastValid || (_pendPC != _lastPC + _lastNumBytes);
+
+    // Pack
+    uint8_t record[MAX_RECORD_LEN];
+    uint32_t recLen = 0;
+    record[recLen++] = (_pendNumBytes - 1) | (pcPresent ? HDR_PC_PRESENT : 0) |
+                (wideAddrs ? HDR_WIDE_ADDRS : 0) | (_pendNumWrites << HDR_NUM_WRITES_POS);
+    for (uint32_t i = 0; i < _pendNumBytes; i++)
+        record[recLen++] = _pendBytes[i];
+    if (pcPresent)
+    {
+        record[recLen++] = _pendPC & 0xff;
+        record[recLen++] = (_pendPC >> 8) & 0xff;
+        if (wideAddrs)
+            record[recLen++] = (_pendPC >> 16) & 0xff;
+    }
+    for (uint32_t i = 0; i < _pendNumWrites; i++)
+    {
+        record[recLen++] = _pendWrites[i].addr & 0xff;
+        record[recLen++] = (_pendWrites[i].addr >> 8) & 0xff;
+        if (wideAddrs)
+            record[recLen++] = (_pendWrites[i].addr >> 16) & 0xff;
+        record[recLen++] = _pendWrites[i].oldVal;
+        record[recLen++] = _pendWrites[i].newVal;
+    }
+
+    // Make space
+    while ((_recordCount > 0) && (_ringSize - _usedBytes < recLen))
+        dropOldest();
+    if (_ringSize < recLen)
+        return;
+
+    // Add
+    for (uint32_t i = 0; i < recLen; i++)
+        _pRing[ringPos(_head + i)] = record[i];
+    _head = ringPos(_head + recLen);
+    _usedBytes += recLen;
+    _recordCount++;
+    _readCursorValid = false;
+
+    // Remember for PC prediction and repeats
+    _lastValid = true;
+    _lastPC = _pendPC;
+    _lastNumBytes = _pendNumBytes;
+    memcpy(_lastBytes, _pendBytes, _pendNumBytes);
+    _lastNumWrites = _pendNumWrites;
+}
+
+bool TargetHistory::pendingIsRepeat()
+{
+    if (!_lastValid || (_pendPC != _lastPC) || (_pendNumBytes != _lastNumBytes))
+        return false;
+    if ((_pendNumWrites != 0) || (_lastNumWrites != 0))
+        return false;
+    return memcmp(_pendBytes, _lastBytes, _pendNumBytes) == 0;
+}
+
+void TargetHistory::dropOldest()
+{
+    uint32_t pc = 0, numInstrBytes = 0;
+    uint32_t recLen = parseRecord(_tail, _tailPredictedPC, pc, numInstrBytes);
+    _tailPredictedPC = pc + numInstrBytes;
+    _tail = ringPos(_tail + recLen);
+    _usedBytes -= recLen;
+    _recordCount--;
+    _droppedCount++;
+}
+
+uint32_t TargetHistory::parseRecord(uint32_t pos, uint32_t predictedPC, uint32_t& pc, uint32_t& numInstrBytes)
+{
+    uint8_t header = ringByte(pos);
+    uint32_t addrLen = (header & HDR_WIDE_ADDRS) ? 3 : 2;
+    uint32_t numWrites = (header & HDR_NUM_WRITES_MASK) >> HDR_NUM_WRITES_POS;
+    numInstrBytes = (header & HDR_NUM_BYTES_MASK) + 1;
+    uint32_t recLen = 1 + numInstrBytes;
+    pc = predictedPC;
+    if (header & HDR_PC_PRESENT)
+    {
+        pc = ringByte(ringPos(pos + recLen)) | (ringByte(ringPos(pos + recLen + 1)) << 8);
+        if (addrLen == 3)
+            pc |= ringByte(ringPos(pos + recLen + 2)) << 16;
+        recLen += addrLen;
+    }
+    return recLen + numWrites * (addrLen + 2);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Get records
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t TargetHistory::getRecords(uint32_t startIdx, uint32_t maxRecords, uint8_t* pBuf, uint32_t maxLen,
+                uint32_t& numRecords, uint32_t& predictedPC)
+{
+    numRecords = 0;
+    predictedPC = 0;
+    if (!_pRing)
+        return 0;
+
+    // Walk from the read cursor if it is at or before the start (otherwise from the oldest)
+    if (!_readCursorValid || (_readIdx > startIdx))
+    {
+        _readIdx = 0;
+        _readPos = _tail;
+        _readPredictedPC = _tailPredictedPC;
+        _readCursorValid = true;
+    }
+    uint32_t pc = 0, numInstrBytes = 0;
+    while ((_readIdx < startIdx) && (_readIdx < _recordCount))
+    {
+        uint32_t recLen = parseRecord(_readPos, _readPredictedPC, pc, numInstrBytes);
+        _readPos = ringPos(_readPos + recLen);
+        _readPredictedPC = pc + numInstrBytes;
+        _readIdx++;
+    }
+
+    // Copy whole records
+    predictedPC = _readPredictedPC;
+    uint32_t bufPos = 0;
+    while ((numRecords < maxRecords) && (_readIdx < _recordCount))
+    {
+        uint32_t recLen = parseRecord(_readPos, _readPredictedPC, pc, numInstrBytes);
+        if (bufPos + recLen > maxLen)
+            break;
+        for (uint32_t i = 0; i < recLen; i++)
+            pBuf[bufPos++] = ringByte(ringPos(_readPos + i));
+        _readPos = ringPos(_readPos + recLen);
+        _readPredictedPC = pc + numInstrBytes;
+        _readIdx++;
+        numRecords++;
+    }
+    return bufPos;
+}
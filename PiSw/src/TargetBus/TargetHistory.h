@@ -0,0 +1,149 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Instruction history - a ring of the most recently executed instructions recorded from the bus cycles of the
+// target so a debugger can step back through them without re-running the target
+//
+// Each instruction is a packed record:
+//   header   - bits 0..1 number of instruction bytes - 1, bit 2 PC present, bit 3 addresses are 3 bytes
+//              (otherwise 2), bits 4..6 number of memory writes
+//   bytes    - the instruction bytes (reads at consecutive addresses from the PC - up to 4)
+//   pc       - only present if the PC isn't the PC of the previous record plus its number of bytes
+//   writes   - address, old value and new value of each memory write (including stacking by an interrupt)
+// Addresses are little-endian. A typical record is 2 to 4 bytes so a few MB holds seconds of execution
+//
+// Old values come from a copy of the target memory seeded from the mirror and kept up to date with the reads
+// and writes seen. Repeats of an instruction with no writes (HALT or a jump to itself) are recorded once
+// When the ring is full the oldest records are dropped
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class TargetHistory
+{
+public:
+    TargetHistory();
+
+    // Enable with a ring of ringSize bytes (0 to disable and free memory) - memLen is the size of the
+    // target memory to copy for old values
+    bool enable(uint32_t ringSize, uint32_t memLen);
+    bool isEnabled()
+    {
+        return _pRing != NULL;
+    }
+    void clear();
+
+    // Copy the target memory (from the mirror) for old values of writes
+    void syncMemory(const uint8_t* pMem, uint32_t len);
+
+    // Bus cycle (not injected) - firstByteOfInstr is set for the opcode fetch which starts an instruction
+    // and data is the value read or written
+    void handleCycle(uint32_t addr, uint32_t data, uint32_t flags, bool firstByteOfInstr);
+
+    // Discard the instruction being collected - used when injection takes over before it executes
+    void discardPending()
+    {
+        _pendValid = false;
+    }
+
+    // Stats
+    uint32_t getRingSize()
+    {
+        return _ringSize;
+    }
+    uint32_t getUsedBytes()
+    {
+        return _usedBytes;
+    }
+    uint32_t getRecordCount()
+    {
+        return _recordCount;
+    }
+    uint32_t getDroppedCount()
+    {
+        return _droppedCount;
+    }
+    uint32_t getRepeatCount()
+    {
+        return _repeatCount;
+    }
+
+    // Get packed records starting at record startIdx (0 is the oldest held) - only valid while the target
+    // isn't running - returns the number of bytes copied and sets the number of records and the PC of the
+    // previous record plus its number of bytes (the PC of the first record if it has none)
+    uint32_t getRecords(uint32_t startIdx, uint32_t maxRecords, uint8_t* pBuf, uint32_t maxLen,
+                uint32_t& numRecords, uint32_t& predictedPC);
+
+    // Record format
+    static const uint32_t HDR_NUM_BYTES_MASK = 0x03;
+    static const uint32_t HDR_PC_PRESENT = 0x04;
+    static const uint32_t HDR_WIDE_ADDRS = 0x08;
+    static const uint32_t HDR_NUM_WRITES_POS = 4;
+    static const uint32_t HDR_NUM_WRITES_MASK = 0x70;
+    static const uint32_t MAX_INSTR_BYTES = 4;
+    static const uint32_t MAX_WRITES = 7;
+    static const uint32_t MAX_RECORD_LEN = 1 + MAX_INSTR_BYTES + 3 + MAX_WRITES * (3 + 2);
+
+private:
+    // Ring of packed records
+    uint8_t* _pRing;
+    uint32_t _ringSize;
+    volatile uint32_t _head;
+    volatile uint32_t _tail;
+    volatile uint32_t _usedBytes;
+    volatile uint32_t _recordCount;
+    uint32_t _tailPredictedPC;
+    uint32_t _droppedCount;
+    uint32_t _repeatCount;
+
+    // Copy of target memory
+    uint8_t* _pMem;
+    uint32_t _memLen;
+
+    // Instruction being collected
+    bool _pendValid;
+    bool _pendBytesDone;
+    uint32_t _pendPC;
+    uint32_t _pendNumBytes;
+    uint8_t _pendBytes[MAX_INSTR_BYTES];
+    uint32_t _pendNumWrites;
+    struct HistoryWrite
+    {
+        uint32_t addr;
+        uint8_t oldVal;
+        uint8_t newVal;
+    };
+    HistoryWrite _pendWrites[MAX_WRITES];
+
+    // Last record added
+    bool _lastValid;
+    uint32_t _lastPC;
+    uint32_t _lastNumBytes;
+    uint8_t _lastBytes[MAX_INSTR_BYTES];
+    uint32_t _lastNumWrites;
+
+    // Read cursor - saves walking the ring from the oldest record on each read
+    volatile bool _readCursorValid;
+    uint32_t _readIdx;
+    uint32_t _readPos;
+    uint32_t _readPredictedPC;
+
+    // Record handling
+    void commitPending();
+    bool pendingIsRepeat();
+    void dropOldest();
+    uint32_t parseRecord(uint32_t pos, uint32_t predictedPC, uint32_t& pc, uint32_t& numInstrBytes);
+    uint8_t ringByte(uint32_t pos)
+    {
+        return _pRing[(pos < _ringSize) ? pos : pos - _ringSize];
+    }
+    uint32_t ringPos(uint32_t pos)
+    {
+        return (pos < _ringSize) ? pos : pos - _ringSize;
+    }
+};
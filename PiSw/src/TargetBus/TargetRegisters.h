@@ -8,6 +8,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "../System/ee_sprintf.h"
+#include "../System/lowlib.h"
 
 class Z80Registers
 {
@@ -42,6 +43,43 @@ public:
         HLDASH = DEDASH = BCDASH = AFDASH = MEMPTR = 0;
         I = R = INTMODE = INTENABLED = VPS = 0;
     }
+    // Set a register by name (e.g. HL, HL', A) - returns false if the name isn't recognised
+    bool setByName(const char* pName, int val)
+    {
+        static const char* pairNames[] = { "PC", "SP", "AF", "BC", "DE", "HL", "IX", "IY", "AF'", "BC'", "DE'", "HL'" };
+        int* pairRegs[] = { &PC, &SP, &AF, &BC, &DE, &HL, &IX, &IY, &AFDASH, &BCDASH, &DEDASH, &HLDASH };
+        for (uint32_t i = 0; i < sizeof(pairNames)/sizeof(pairNames[0]); i++)
+        {
+            if (strcasecmp(pName, pairNames[i]) == 0)
+            {
+                *pairRegs[i] = val & 0xffff;
+                return true;
+            }
+        }
+        static const char* byteNames[] = { "A", "F", "B", "C", "D", "E", "H", "L" };
+        int* byteRegs[] = { &AF, &AF, &BC, &BC, &DE, &DE, &HL, &HL };
+        for (uint32_t i = 0; i < sizeof(byteNames)/sizeof(byteNames[0]); i++)
+        {
+            if (strcasecmp(pName, byteNames[i]) == 0)
+            {
+                if (i & 1)
+                    *byteRegs[i] = (*byteRegs[i] & 0xff00) | (val & 0xff);
+                else
+                    *byteRegs[i] = (*byteRegs[i] & 0xff) | ((val & 0xff) << 8);
+                return true;
+            }
+        }
+        if (strcasecmp(pName, "I") == 0)
+            I = val & 0xff;
+        else if (strcasecmp(pName, "R") == 0)
+            R = val & 0xff;
+        else if (strcasecmp(pName, "IM") == 0)
+            INTMODE = val & 0x03;
+        else
+            return false;
+        return true;
+    }
+
     void format(char* pResponse, int maxLen)
     {
         char tmpStr[200];
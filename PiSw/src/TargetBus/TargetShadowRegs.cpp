@@ -0,0 +1,301 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#include "TargetShadowRegs.h"
+#include "TargetCPU.h"
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Variables
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Instance used by the emulator callbacks
+TargetShadowRegs* TargetShadowRegs::_pThisInstance = NULL;
+
+TargetShadowRegs::TargetShadowRegs()
+{
+    _pThisInstance = this;
+    memset(&_z80, 0, sizeof(_z80));
+    _isValid = false;
+    _iffKnown = false;
+    _imKnown = false;
+    _cycleCount = 0;
+    _cyclesUsed = 0;
+    _cycleMismatch = false;
+    _instrCount = 0;
+    _divergeCount = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sync and get
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TargetShadowRegs::sync(const Z80Registers& regs)
+{
+    _isValid = false;
+    memset(&_z80, 0, sizeof(_z80));
+    _z80.memRead = memRead;
+    _z80.memWrite = memWrite;
+    _z80.ioRead = ioRead;
+    _z80.ioWrite = ioWrite;
+    _z80.PC = regs.PC;
+    _z80.R1.wr.SP = regs.SP;
+    _z80.R1.wr.AF = regs.AF;
+    _z80.R1.wr.BC = regs.BC;
+    _z80.R1.wr.DE = regs.DE;
+    _z80.R1.wr.HL = regs.HL;
+    _z80.R1.wr.IX = regs.IX;
+    _z80.R1.wr.IY = regs.IY;
+    _z80.R2.wr.AF = regs.AFDASH;
+    _z80.R2.wr.BC = regs.BCDASH;
+    _z80.R2.wr.DE = regs.DEDASH;
+    _z80.R2.wr.HL = regs.HLDASH;
+    _z80.I = regs.I;
+    _z80.R = regs.R;
+
+    // Interrupt state isn't got by injection
+    _z80.IM = regs.INTMODE;
+    _z80.IFF1 = _z80.IFF2 = regs.INTENABLED ? 1 : 0;
+    _iffKnown = false;
+    _imKnown = false;
+    _cycleCount = 0;
+    _isValid = true;
+}
+
+bool TargetShadowRegs::getRegs(Z80Registers& regs)
+{
+    if (!_isValid)
+        return false;
+    regs.PC = _z80.PC;
+    regs.SP = _z80.R1.wr.SP;
+    regs.AF = _z80.R1.wr.AF;
+    regs.BC = _z80.R1.wr.BC;
+    regs.DE = _z80.R1.wr.DE;
+    regs.HL = _z80.R1.wr.HL;
+    regs.IX = _z80.R1.wr.IX;
+    regs.IY = _z80.R1.wr.IY;
+    regs.AFDASH = _z80.R2.wr.AF;
+    regs.BCDASH = _z80.R2.wr.BC;
+    regs.DEDASH = _z80.R2.wr.DE;
+    regs.HLDASH = _z80.R2.wr.HL;
+    regs.I = _z80.I;
+    regs.R = _z80.R;
+    if (_imKnown)
+        regs.INTMODE = _z80.IM;
+    if (_iffKnown)
+        regs.INTENABLED = _z80.IFF1;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Handle bus cycles
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TargetShadowRegs::handleCycle(uint32_t addr, uint32_t data, uint32_t flags, bool firstByteOfInstr)
+{
+    if (!_isValid)
+        return;
+    if ((flags & (BR_CTRL_BUS_RD_MASK | BR_CTRL_BUS_WR_MASK)) == 0)
+        return;
+
+    // Start of an instruction completes the previous one
+    if (firstByteOfInstr)
+    {
+        bool instrOk = (_cycleCount == 0) ? ((addr & 0xffff) == _z80.PC) : executeInstr(addr & 0xffff);
+        if (!instrOk)
+        {
+            diverged();
+            return;
+        }
+        _cycleCount = 0;
+    }
+
+    // Collect
+    if (_cycleCount >= MAX_CYCLES_PER_INSTR)
+    {
+        diverged();
+        return;
+    }
+    _cycles[_cycleCount].addr = addr & 0xffff;
+    _cycles[_cycleCount].data = data & 0xff;
+    _cycles[_cycleCount].isWrite = (flags & BR_CTRL_BUS_WR_MASK) != 0;
+    _cycles[_cycleCount].isIO = (flags & BR_CTRL_BUS_IORQ_MASK) != 0;
+    _cycleCount++;
+}
+
+bool TargetShadowRegs::executeInstr(uint32_t nextInstrAddr)
+{
+    _cyclesUsed = 0;
+    _cycleMismatch = false;
+    if (_z80.halted)
+    {
+        // While halted the processor repeatedly fetches and ignores a byte - the address is the byte
+        // after the HALT on a real Z80 (some emulators use the HALT itself)
+        if (_cycles[0].isWrite || !isHaltFetchAddr(_cycles[0].addr))
+            return false;
+        _cyclesUsed = 1;
+        _z80.R = (_z80.R & 0x80) | ((_z80.R + 1) & 0x7f);
+    }
+    else
+    {
+        // Instructions which depend on an unknown interrupt state can't be followed
+        if (!_iffKnown || !_imKnown)
+            trackIntState();
+        if (!_isValid)
+            return false;
+        Z80Execute(&_z80);
+        _instrCount++;
+    }
+    if (_cycleMismatch)
+        return false;
+
+    // Cycles left over are an interrupt response
+    if (_cyclesUsed != ((1u << _cycleCount) - 1))
+        return handleIntResponse(nextInstrAddr);
+    if (_z80.halted)
+        return isHaltFetchAddr(nextInstrAddr);
+    return nextInstrAddr == _z80.PC;
+}
+
+bool TargetShadowRegs::handleIntResponse(uint32_t nextInstrAddr)
+{
+    // Return address pushed (the address after the HALT if halted)
+    uint16_t retAddr = _z80.halted ? _z80.PC + 1 : _z80.PC;
+    uint16_t sp = _z80.R1.wr.SP;
+    int hiIdx = findCycle(sp - 1, true, false);
+    if ((hiIdx < 0) || (_cycles[hiIdx].data != (retAddr >> 8)))
+        return false;
+    _cyclesUsed |= 1 << hiIdx;
+    int loIdx = findCycle(sp - 2, true, false);
+    if ((loIdx < 0) || (_cycles[loIdx].data != (retAddr & 0xff)))
+        return false;
+    _cyclesUsed |= 1 << loIdx;
+
+    // Anything else must be the IM2 vector read
+    int numVectorReads = 0;
+    for (int i = 0; i < _cycleCount; i++)
+    {
+        if (_cyclesUsed & (1 << i))
+            continue;
+        if (_cycles[i].isWrite || _cycles[i].isIO || (++numVectorReads > 2))
+            return false;
+    }
+
+    // Jump to the handler
+    _z80.halted = 0;
+    _z80.R1.wr.SP = sp - 2;
+    if (nextInstrAddr == 0x66)
+    {
+        // NMI
+        _z80.IFF2 = _z80.IFF1;
+        _z80.IFF1 = 0;
+    }
+    else
+    {
+        // The acknowledge cycle is an M1 cycle so R is incremented
+        _z80.IFF1 = _z80.IFF2 = 0;
+        _iffKnown = true;
+        _z80.R = (_z80.R & 0x80) | ((_z80.R + 1) & 0x7f);
+    }
+    _z80.PC = nextInstrAddr;
+    return true;
+}
+
+void TargetShadowRegs::trackIntState()
+{
+    // Opcode after any index prefixes
+    int opIdx = 0;
+    while ((opIdx < _cycleCount - 1) && ((_cycles[opIdx].data == 0xdd) || (_cycles[opIdx].data == 0xfd)))
+        opIdx++;
+    uint8_t opcode = _cycles[opIdx].data;
+
+    // DI and EI set both flip-flops
+    if ((opcode == 0xf3) || (opcode == 0xfb))
+    {
+        _iffKnown = true;
+        return;
+    }
+    if ((opcode != 0xed) || (opIdx + 1 >= _cycleCount))
+        return;
+    uint8_t edOpcode = _cycles[opIdx + 1].data;
+
+    // IM 0/1/2 (and their undocumented copies)
+    if ((edOpcode & 0xc7) == 0x46)
+        _imKnown = true;
+
+    // ld a,i and ld a,r put IFF2 into the P/V flag
+    if (!_iffKnown && ((edOpcode == 0x57) || (edOpcode == 0x5f)))
+        _isValid = false;
+}
+
+int TargetShadowRegs::findCycle(uint16_t addr, bool isWrite, bool isIO)
+{
+    // The first unused cycle of the right type at the address - order within the instruction isn't
+    // checked as the emulator doesn't always access memory in the same order as the processor
+    // IO is matched on the port (low byte) as the emulator doesn't always put the processor's value
+    // on the upper address lines (e.g. B during block IO)
+    uint16_t addrMask = isIO ? 0xff : 0xffff;
+    for (int i = 0; i < _cycleCount; i++)
+        if (((_cyclesUsed & (1 << i)) == 0) && (_cycles[i].isWrite == isWrite) && (_cycles[i].isIO == isIO) &&
+                        (((_cycles[i].addr ^ addr) & addrMask) == 0))
+            return i;
+    return -1;
+}
+
+void TargetShadowRegs::diverged()
+{
+    _isValid = false;
+    _divergeCount++;
+    _cycleCount = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Memory and IO for the emulator
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+byte TargetShadowRegs::memRead([[maybe_unused]] int param, ushort addr)
+{
+    int idx = _pThisInstance->findCycle(addr, false, false);
+    if (idx < 0)
+    {
+        _pThisInstance->_cycleMismatch = true;
+        return 0xff;
+    }
+    _pThisInstance->_cyclesUsed |= 1 << idx;
+    return _pThisInstance->_cycles[idx].data;
+}
+
+void TargetShadowRegs::memWrite([[maybe_unused]] int param, ushort addr, byte data)
+{
+    int idx = _pThisInstance->findCycle(addr, true, false);
+    if ((idx < 0) || (_pThisInstance->_cycles[idx].data != data))
+    {
+        _pThisInstance->_cycleMismatch = true;
+        return;
+    }
+    _pThisInstance->_cyclesUsed |= 1 << idx;
+}
+
+byte TargetShadowRegs::ioRead([[maybe_unused]] int param, ushort addr)
+{
+    // The value read is the one seen on the bus
+    int idx = _pThisInstance->findCycle(addr, false, true);
+    if (idx < 0)
+    {
+        _pThisInstance->_cycleMismatch = true;
+        return 0xff;
+    }
+    _pThisInstance->_cyclesUsed |= 1 << idx;
+    return _pThisInstance->_cycles[idx].data;
+}
+
+void TargetShadowRegs::ioWrite([[maybe_unused]] int param, ushort addr, byte data)
+{
+    int idx = _pThisInstance->findCycle(addr, true, true);
+    if ((idx < 0) || (_pThisInstance->_cycles[idx].data != data))
+    {
+        _pThisInstance->_cycleMismatch = true;
+        return;
+    }
+    _pThisInstance->_cyclesUsed |= 1 << idx;
+}
@@ -0,0 +1,107 @@
+// Bus Raider
+// Rob Dobson 2019
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "../System/lowlib.h"
+#include "TargetRegisters.h"
+#include "../StepTracer/libz80/z80.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shadow registers - an emulated Z80 run in lock-step with the bus cycles of the target so the target's
+// registers are known without injecting code
+//
+// The cycles of each instruction are collected and when the next instruction starts the emulator executes
+// the instruction with its memory reads served from the collected cycles - every emulated access must match
+// a real one (and the next instruction must start at the emulated PC) or the shadow becomes invalid
+// Interrupt responses (PC pushed with no instruction) and HALT are followed - IO cycles are collected too
+// and IO reads get the value seen on the bus
+// The shadow only becomes valid again when synced to registers from an injection
+//
+// The injected code doesn't get the interrupt flip-flops or mode so they are unknown after a sync until an
+// instruction (or interrupt response) sets them - until then they aren't reported and instructions whose
+// result depends on IFF2 (ld a,i and ld a,r) make the shadow invalid so registers are got by injection
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class TargetShadowRegs
+{
+public:
+    TargetShadowRegs();
+
+    // Sync to registers known to be in the processor at the start of the next instruction
+    void sync(const Z80Registers& regs);
+    void invalidate()
+    {
+        _isValid = false;
+    }
+    bool isValid()
+    {
+        return _isValid;
+    }
+
+    // Bus cycle (not injected) - firstByteOfInstr is set for the opcode fetch which starts an instruction
+    // and data is the value read or written
+    void handleCycle(uint32_t addr, uint32_t data, uint32_t flags, bool firstByteOfInstr);
+
+    // Registers at the start of the current instruction - returns false if not valid - the interrupt
+    // mode and enable are left unchanged if they aren't known
+    bool getRegs(Z80Registers& regs);
+
+    // Stats
+    uint32_t getInstrCount()
+    {
+        return _instrCount;
+    }
+    uint32_t getDivergeCount()
+    {
+        return _divergeCount;
+    }
+
+private:
+    // Emulated processor
+    Z80Context _z80;
+    volatile bool _isValid;
+
+    // Interrupt flip-flops and mode known
+    bool _iffKnown;
+    bool _imKnown;
+    void trackIntState();
+
+    // Cycles of the current instruction
+    static const int MAX_CYCLES_PER_INSTR = 16;
+    struct ShadowCycle
+    {
+        uint16_t addr;
+        uint8_t data;
+        bool isWrite;
+        bool isIO;
+    };
+    ShadowCycle _cycles[MAX_CYCLES_PER_INSTR];
+    int _cycleCount;
+    uint32_t _cyclesUsed;
+    bool _cycleMismatch;
+
+    // Stats
+    uint32_t _instrCount;
+    uint32_t _divergeCount;
+
+    // Execute the collected instruction - returns false if the emulator diverged from the real cycles
+    bool executeInstr(uint32_t nextInstrAddr);
+    bool handleIntResponse(uint32_t nextInstrAddr);
+    int findCycle(uint16_t addr, bool isWrite, bool isIO);
+    bool isHaltFetchAddr(uint32_t addr)
+    {
+        return (addr == _z80.PC) || (addr == (uint16_t)(_z80.PC + 1));
+    }
+    void diverged();
+
+    // Memory and IO for the emulator
+    static TargetShadowRegs* _pThisInstance;
+    static byte memRead(int param, ushort addr);
+    static void memWrite(int param, ushort addr, byte data);
+    static byte ioRead(int param, ushort addr);
+    static void ioWrite(int param, ushort addr, byte data);
+};
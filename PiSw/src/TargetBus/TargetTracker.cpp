@@ -6,9 +6,11 @@
 #include "../System/lowlib.h"
 #include "../System/ee_sprintf.h"
 #include "../System/logging.h"
+#include "../System/nmalloc.h"
 #include "../Hardware/HwManager.h"
 #include "../Machines/McManager.h"
 #include "../Disassembler/src/mdZ80.h"
+#include "TargetCPUZ80.h"
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Variables
@@ -50,7 +52,8 @@ BusSocketInfo TargetTracker::_busSocketInfo =
     0,
     .busMasterRequest=false,
     .busMasterReason=BR_BUS_ACTION_GENERAL,
-    .holdInWaitReq=false
+    .holdInWaitReq=false,
+    .busAccessCycles=BR_BUS_CYCLE_MREQ_MASK | BR_BUS_CYCLE_IORQ_RD_MASK | BR_BUS_CYCLE_IORQ_WR_MASK
 };
 
 // Code snippet
@@ -62,6 +65,14 @@ uint32_t TargetTracker::_snippetWriteIdx = 0;
 // Step over
 uint32_t TargetTracker::_stepOverPCValue = 0;
 
+// Step batches
+uint32_t TargetTracker::_stepBatchInstrsLeft = 0;
+uint32_t TargetTracker::_stepBatchRangeStart = 0;
+uint32_t TargetTracker::_stepBatchRangeEnd = 0;
+uint32_t TargetTracker::_stepOutSP = 0;
+uint32_t TargetTracker::_stepOutReturnCount = 0;
+uint32_t TargetTracker::_stepOutCallDepth = 0;
+
 // Injection type
 bool TargetTracker::_setRegs = false;
 
@@ -82,6 +93,8 @@ bool TargetTracker::_pageOutForInjectionActive = false;
 
 // Registers
 Z80Registers TargetTracker::_z80Registers;
+Z80Registers TargetTracker::_z80RegistersOnTarget;
+bool TargetTracker::_z80RegistersOnTargetValid = false;
 
 // Prefix tracking
 bool TargetTracker::_prefixTracker[2] = {false,false};
@@ -95,6 +108,15 @@ TargetTracker::STEP_MODE_TYPE TargetTracker::_stepMode = STEP_MODE_STEP_PAUSED;
 // Breakpoints
 TargetBreakpoints TargetTracker::_breakpoints;
 
+// Shadow registers
+TargetShadowRegs TargetTracker::_shadowRegs;
+
+// Instruction history
+TargetHistory TargetTracker::_history;
+
+// Shadow call stack
+TargetCallStack TargetTracker::_callStack;
+
 // Machine heartbeat
 uint32_t TargetTracker::_machineHeartbeatCounter = 0;
 
@@ -110,7 +132,11 @@ void TargetTracker::init()
 {
     // Connect to the bus socket
     if (_busSocketId < 0)
-        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo);
+        _busSocketId = BusAccess::busSocketAdd(_busSocketInfo, "TargetTracker");
+
+    // Breakpoint conditions use the shadow registers and read memory from the mirror (kept up to date
+    // with writes while tracking)
+    _breakpoints.setConditionSources(breakpointCondRegsGet, breakpointCondMemRead);
 }
 
 // Service
@@ -122,6 +148,8 @@ void TargetTracker::service()
 //Enable
 void TargetTracker::enable(bool en)
 {
+    _z80RegistersOnTargetValid = false;
+    _shadowRegs.invalidate();
     _stepMode = STEP_MODE_STEP_PAUSED;
     if (en)
     {
@@ -131,8 +159,13 @@ void TargetTracker::enable(bool en)
         // Set mirror mode so we record memory accesses
         HwManager::setMirrorMode(true);
         _postInjectMemoryMirror = true;
-        // Wait on memory and hold at each instruction
+        // History restarts from the mirror
+        _history.clear();
+        historySyncMemory();
+        _callStack.clear();
+        // Wait on memory (and IO for the shadow registers) and hold at each instruction
         BusAccess::waitOnMemory(_busSocketId, true);
+        BusAccess::waitOnIO(_busSocketId, true);
         BusAccess::waitHold(_busSocketId, false);
         BusAccess::waitRelease();
     }
@@ -146,6 +179,7 @@ void TargetTracker::enable(bool en)
         {
             // Disable
             BusAccess::waitOnMemory(_busSocketId, false);
+            BusAccess::waitOnIO(_busSocketId, false);
             BusAccess::busSocketEnable(_busSocketId, en);
             // Remove paging for injection
             BusAccess::targetPageForInjection(_busSocketId, false);
@@ -158,6 +192,24 @@ void TargetTracker::enable(bool en)
     }
 }
 
+// Register values for breakpoint condition
+bool TargetTracker::breakpointCondRegsGet(Z80Registers& regs)
+{
+    return _shadowRegs.getRegs(regs);
+}
+
+// Memory value for breakpoint condition
+bool TargetTracker::breakpointCondMemRead(uint32_t addr, uint8_t& val)
+{
+    if (addr > HwManager::getMaxAddress())
+        return false;
+    uint8_t* pMirrorMem = HwManager::getMirrorMemForAddr(addr);
+    if (!pMirrorMem)
+        return false;
+    val = *pMirrorMem;
+    return true;
+}
+
 // Check if bus can be accessed directly
 bool TargetTracker::busAccessAvailable()
 {
@@ -180,6 +232,7 @@ bool TargetTracker::isTrackingActive()
 
 void TargetTracker::targetReset()
 {
+    _z80RegistersOnTargetValid = false;
     _targetResetPending = true;
     McManager::targetReset();
 }
@@ -490,7 +543,12 @@ TargetTracker::OPCODE_INJECT_PROGRESS TargetTracker::handleRegisterSet(uint32_t&
     // Fill in the register values
     if (_snippetPos == 0)
     {
-        _snippetLen = getInstructionsToSetRegs(_z80Registers, _snippetBuf, MAX_REGISTER_SET_CODE_LEN);
+        // Only changed registers need setting if the processor's registers are known
+        if (_z80RegistersOnTargetValid)
+            _snippetLen = TargetCPUZ80::getInjectToSetChangedRegs(_z80Registers, _z80RegistersOnTarget, 
+                        _snippetBuf, MAX_REGISTER_SET_CODE_LEN);
+        else
+            _snippetLen = getInstructionsToSetRegs(_z80Registers, _snippetBuf, MAX_REGISTER_SET_CODE_LEN);
         if (_snippetLen == 0)
         {
             // Nothing to do
@@ -515,9 +573,15 @@ void TargetTracker::stepInto()
 {
     // LogWrite(FromTargetTracker, LOG_DEBUG, "stepInto");
 
+    // Registers change when the processor runs
+    _z80RegistersOnTargetValid = false;
+
     // Set flag to indicate mode
     _stepMode = STEP_MODE_STEP_INTO;
 
+    // Any watchpoint hit is for the previous break
+    _breakpoints.clearWatchpointHit();
+
     // Release bus hold if held
     if (BusAccess::waitIsHeld())
     {
@@ -543,9 +607,15 @@ void TargetTracker::stepOver()
     _stepOverPCValue = curAddr + instrLen;
     LogWrite(FromTargetTracker, LOG_DEBUG, "cpu-step-over PCnow %04x StepToPC %04x", _z80Registers.PC, _stepOverPCValue);
 
+    // Registers change when the processor runs
+    _z80RegistersOnTargetValid = false;
+
     // Set flag to indicate mode
     _stepMode = STEP_MODE_STEP_OVER;
 
+    // Any watchpoint hit is for the previous break
+    _breakpoints.clearWatchpointHit();
+
     // Release bus hold if held
     if (BusAccess::waitIsHeld())
     {
@@ -558,9 +628,15 @@ void TargetTracker::stepRun()
 {
     // LogWrite(FromTargetTracker, LOG_DEBUG, "stepRun");
 
+    // Registers change when the processor runs
+    _z80RegistersOnTargetValid = false;
+
     // Set flag to indicate mode
     _stepMode = STEP_MODE_RUN;
 
+    // Any watchpoint hit is for the previous break
+    _breakpoints.clearWatchpointHit();
+
     // Release bus hold if held
     if (BusAccess::waitIsHeld())
     {
@@ -569,10 +645,89 @@ void TargetTracker::stepRun()
     }
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Step batches
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TargetTracker::stepCount(uint32_t numInstrs)
+{
+    if (numInstrs == 0)
+        return;
+    _stepBatchInstrsLeft = numInstrs;
+    startStepMode(STEP_MODE_STEP_COUNT);
+}
+
+void TargetTracker::stepRunInRange(uint32_t startAddr, uint32_t endAddr)
+{
+    _stepBatchRangeStart = startAddr;
+    _stepBatchRangeEnd = endAddr;
+    startStepMode(STEP_MODE_RUN_IN_RANGE);
+}
+
+void TargetTracker::stepOut()
+{
+    // When the call stack is known the step is complete when the innermost frame is removed - otherwise
+    // the return address is on the stack at or above the current stack pointer
+    _stepOutCallDepth = _callStack.getDepth();
+    _stepOutSP = _z80Registers.SP;
+    _stepOutReturnCount = _callStack.getReturnCount();
+    LogWrite(FromTargetTracker, LOG_DEBUG, "cpu-step-out PCnow %04x SP %04x callDepth %u",
+                _z80Registers.PC, _stepOutSP, _stepOutCallDepth);
+    startStepMode(STEP_MODE_STEP_OUT);
+}
+
+void TargetTracker::startStepMode(STEP_MODE_TYPE stepMode)
+{
+    // Registers change when the processor runs
+    _z80RegistersOnTargetValid = false;
+
+    // Set flag to indicate mode
+    _stepMode = stepMode;
+
+    // Any watchpoint hit is for the previous break
+    _breakpoints.clearWatchpointHit();
+
+    // Release bus hold if held
+    if (BusAccess::waitIsHeld())
+    {
+        // Remove any hold to allow execution / injection
+        BusAccess::waitHold(_busSocketId, false);
+    }
+}
+
+bool TargetTracker::stepBatchComplete(uint32_t addr)
+{
+    // Called at the start of each instruction executed after the step started
+    switch (_stepMode)
+    {
+        case STEP_MODE_STEP_COUNT:
+            if (_stepBatchInstrsLeft > 0)
+                _stepBatchInstrsLeft--;
+            return _stepBatchInstrsLeft == 0;
+        case STEP_MODE_RUN_IN_RANGE:
+            return (addr < _stepBatchRangeStart) || (addr > _stepBatchRangeEnd);
+        case STEP_MODE_STEP_OUT:
+            if (_stepOutCallDepth > 0)
+                return _callStack.getDepth() < _stepOutCallDepth;
+
+            // Otherwise the first return (RET, RET cc, RETI or RETN taken) which pops from the stack
+            // at or above the stack pointer when stepping out started
+            if (_callStack.getReturnCount() == _stepOutReturnCount)
+                return false;
+            _stepOutReturnCount = _callStack.getReturnCount();
+            return ((_callStack.getLastReturnStackAddr() - _stepOutSP) & 0xffff) < 0x8000;
+        default:
+            return false;
+    }
+}
+
 void TargetTracker::completeTargetProgram()
 {
     // LogWrite(FromTargetTracker, LOG_DEBUG, "completeTargetProgram");
 
+    // Registers change when the processor runs
+    _z80RegistersOnTargetValid = false;
+
     // Set flag to indicate mode
     _stepMode = STEP_MODE_STEP_PAUSED;
 
@@ -646,6 +801,7 @@ bool TargetTracker::handlePendingDisable()
 
         // Disable
         BusAccess::waitOnMemory(_busSocketId, false);
+        BusAccess::waitOnIO(_busSocketId, false);
         BusAccess::busSocketEnable(_busSocketId, false);
 
         // Release bus hold
@@ -660,6 +816,60 @@ bool TargetTracker::handlePendingDisable()
     return false;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Instruction history
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TargetTracker::historyEnable(uint32_t sizeMB, uint32_t& allocatedMB)
+{
+    allocatedMB = 0;
+    if (sizeMB == 0)
+        return _history.enable(0, 0);
+    if (sizeMB > HISTORY_MAX_SIZE_MB)
+        sizeMB = HISTORY_MAX_SIZE_MB;
+    uint32_t memLen = HwManager::getMaxAddress() + 1;
+    if (memLen > HISTORY_MAX_MEM_LEN)
+        memLen = HISTORY_MAX_MEM_LEN;
+
+    // Halve the size until the ring can be allocated with the reserve still free
+    uint32_t tryMB = sizeMB;
+    while ((tryMB > 0) && !(_history.enable(tryMB * 1024 * 1024, memLen) && historyHeapHasReserve()))
+        tryMB /= 2;
+    if (tryMB == 0)
+    {
+        _history.enable(0, 0);
+        LogWrite(FromTargetTracker, LOG_WARNING, "History can't allocate %uMB", sizeMB);
+        return false;
+    }
+    allocatedMB = tryMB;
+    historySyncMemory();
+    LogWrite(FromTargetTracker, LOG_DEBUG, "History %uMB (%uMB requested)", allocatedMB, sizeMB);
+    return true;
+}
+
+bool TargetTracker::historyHeapHasReserve()
+{
+    return nmalloc_free_space() >= HISTORY_HEAP_RESERVE_MB * 1024 * 1024;
+}
+
+void TargetTracker::historySyncMemory()
+{
+    if (!_history.isEnabled())
+        return;
+    uint8_t* pMirrorMem = HwManager::getMirrorMemForAddr(0);
+    if (pMirrorMem)
+        _history.syncMemory(pMirrorMem, HwManager::getMaxAddress() + 1);
+}
+
+void TargetTracker::getHistoryStatusJson(char* pBuf, int maxLen)
+{
+    char tmpStr[200];
+    ee_sprintf(tmpStr, "\"err\":\"ok\",\"enabled\":%d,\"size\":%u,\"used\":%u,\"count\":%u,\"dropped\":%u,\"repeats\":%u",
+                _history.isEnabled(), _history.getRingSize(), _history.getUsedBytes(),
+                _history.getRecordCount(), _history.getDroppedCount(), _history.getRepeatCount());
+    strlcpy(pBuf, tmpStr, maxLen);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Handle bus actions
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -670,6 +880,10 @@ void TargetTracker::busActionCompleteStatic([[maybe_unused]]BR_BUS_ACTION action
     {
         // LogWrite(FromTargetTracker, LOG_DEBUG, "busActionComplete Reset");
         _prefixTracker[0] = _prefixTracker[1] = false;
+        _z80RegistersOnTargetValid = false;
+        _shadowRegs.invalidate();
+        _history.clear();
+        _callStack.clear();
 
         // Since we're receiving a reset we are at the start of the program so clear prefix-tracking
         _targetStateAcqMode = TARGET_STATE_ACQ_INJECT_IF_NEW_INSTR;
@@ -688,6 +902,11 @@ void TargetTracker::busActionCompleteStatic([[maybe_unused]]BR_BUS_ACTION action
     {
         // LogWrite(FromTargetTracker, LOG_DEBUG, "busActionComplete ResetEnd");
     }
+    else if ((actionType == BR_BUS_ACTION_BUSRQ) && (reason == BR_BUS_ACTION_MIRROR))
+    {
+        // The hardware has just refreshed the mirror (its socket is called first)
+        historySyncMemory();
+    }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -697,10 +916,6 @@ void TargetTracker::busActionCompleteStatic([[maybe_unused]]BR_BUS_ACTION action
 void TargetTracker::handleWaitInterruptStatic(uint32_t addr, uint32_t data, 
         uint32_t flags, uint32_t& retVal)
 {
-    // Only handle MREQs
-    if ((flags & BR_CTRL_BUS_MREQ_MASK) == 0)
-        return;
-
 //    LogWrite(FromTargetTracker, LOG_DEBUG, "WAITISRSTART %s %s A %04x D %02x M1 %d Pfx0 %d Pfx1 %d Flags %08x", 
 //                 (_stepMode == STEP_MODE_STEP_PAUSED) ? "PAUSED" : ((_stepMode == STEP_MODE_STEP_INTO) ? "INTO" : ((_stepMode == STEP_MODE_STEP_OVER) ? "OVER" : "RUN")),
 //                 (_targetStateAcqMode == TARGET_STATE_ACQ_NONE) ? "ACQNONE" : ((_targetStateAcqMode == TARGET_STATE_ACQ_INJECTING) ? "INJECTING" : ((_targetStateAcqMode == TARGET_STATE_ACQ_INJECT_IF_NEW_INSTR) ? "INJIFNEW" : "POSTINJ")),
@@ -709,6 +924,25 @@ void TargetTracker::handleWaitInterruptStatic(uint32_t addr, uint32_t data,
 //                 (flags & BR_CTRL_BUS_M1_MASK) != 0, _prefixTracker[0], _prefixTracker[1], 
 //                 flags);
 
+    // Keep the shadow registers in step with the target - injected cycles are excluded (the first
+    // cycle of an injection is seen before the state changes but the shadow is synced afterwards)
+    // IO cycles are only used by the shadow registers (for the values of IO reads)
+    if (_targetStateAcqMode != TARGET_STATE_ACQ_INJECTING)
+    {
+        uint32_t busVal = (flags & BR_CTRL_BUS_WR_MASK) || (retVal & BR_MEM_ACCESS_RSLT_NOT_DECODED) ? data : retVal;
+        bool firstByteOfInstr = (flags & BR_CTRL_BUS_M1_MASK) && !_prefixTracker[1];
+        _shadowRegs.handleCycle(addr, busVal, flags, firstByteOfInstr);
+        if (flags & BR_CTRL_BUS_MREQ_MASK)
+        {
+            _history.handleCycle(addr, busVal, flags, firstByteOfInstr);
+            _callStack.handleCycle(addr, busVal, flags, firstByteOfInstr);
+        }
+    }
+
+    // Only MREQs are tracked
+    if ((flags & BR_CTRL_BUS_MREQ_MASK) == 0)
+        return;
+
     // Handle state machine
     TARGET_STATE_ACQ startAcqMode = _targetStateAcqMode;
     switch (_targetStateAcqMode)
@@ -776,8 +1010,13 @@ void TargetTracker::handleWaitInterruptStatic(uint32_t addr, uint32_t data,
                 //         (flags & BR_CTRL_BUS_RD_MASK) ? "R" : "", 
                 //         (flags & BR_CTRL_BUS_WR_MASK) ? "W" : "",
                 //         _prefixTracker[0], _prefixTracker[1]);
-                // Bump state if in step mode or a grab is needed
-                if ((_stepMode == STEP_MODE_STEP_INTO) || _requestDisplayWhileStepping)
+                // Bump state if in step mode (or a step batch is complete) or a grab is needed
+                if ((_stepMode == STEP_MODE_STEP_INTO) || stepBatchComplete(addr))
+                {
+                    _stepMode = STEP_MODE_STEP_INTO;
+                    _targetStateAcqMode = TARGET_STATE_ACQ_INJECTING;
+                }
+                else if (_requestDisplayWhileStepping)
                 {
                     // TODO DEBUG
                     // ISR_ASSERT(ISR_ASSERT_CODE_DEBUG_A);
@@ -785,12 +1024,16 @@ void TargetTracker::handleWaitInterruptStatic(uint32_t addr, uint32_t data,
                 }
             }
 
-            // Check for move to injection state and start now
+            // Check for move to injection state and start now - unless the shadow registers
+            // mean the target can just be held at the start of this instruction
             if (_targetStateAcqMode == TARGET_STATE_ACQ_INJECTING)
             {
-                _setRegs = false;
-                _snippetPos = 0;
-                handleInjection(addr, data, flags, retVal);
+                if (!(firstByteOfInstr && pauseWithShadowRegs()))
+                {
+                    _setRegs = false;
+                    _snippetPos = 0;
+                    handleInjection(addr, data, flags, retVal);
+                }
             }
 
             break;
@@ -826,6 +1069,27 @@ void TargetTracker::handleWaitInterruptStatic(uint32_t addr, uint32_t data,
     }
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Pause using shadow registers
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TargetTracker::pauseWithShadowRegs()
+{
+    // Injection is still needed for a memory grab
+    if (_postInjectMemoryMirror || _requestDisplayWhileStepping)
+        return false;
+    if (!_shadowRegs.getRegs(_z80Registers))
+        return false;
+
+    // Hold at the start of this instruction as if registers had been got by injection
+    _targetStateAcqMode = TARGET_STATE_ACQ_INJECT_IF_NEW_INSTR;
+    _stepMode = STEP_MODE_STEP_PAUSED;
+    BusAccess::waitHold(_busSocketId, true);
+    _z80RegistersOnTarget = _z80Registers;
+    _z80RegistersOnTargetValid = true;
+    return true;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Handle stepping over a breakpoint
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -849,7 +1113,14 @@ void TargetTracker::handleStepOverBkpts([[maybe_unused]] uint32_t addr, [[maybe_
     {
         _targetStateAcqMode = TARGET_STATE_ACQ_INJECTING;
         _stepMode = STEP_MODE_STEP_PAUSED;
-        LogWrite(FromTargetTracker, LOG_DEBUG, "Hit Breakpoint %04x", addr);
+        TargetWatchpointHit watchpointHit;
+        if (_breakpoints.getWatchpointHit(watchpointHit))
+            LogWrite(FromTargetTracker, LOG_DEBUG, "Hit Watchpoint %d (%04x-%04x) %s %04x, break at %04x",
+                        watchpointHit.watchpointIdx, watchpointHit.startAddr, watchpointHit.endAddr,
+                        (watchpointHit.accessType == TARGET_WATCHPOINT_WRITE) ? "write" : "read",
+                        watchpointHit.dataAddr, addr);
+        else
+            LogWrite(FromTargetTracker, LOG_DEBUG, "Hit Breakpoint %04x", addr);
     }
 }
 
@@ -960,6 +1231,15 @@ void TargetTracker::handleInjection(uint32_t addr, uint32_t data,
         }
 #endif
 
+        // Registers in the processor are known while it is held
+        _z80RegistersOnTarget = _z80Registers;
+        _z80RegistersOnTargetValid = (_stepMode == STEP_MODE_STEP_PAUSED);
+        _shadowRegs.sync(_z80Registers);
+
+        // The instruction the injection interrupted is fetched again
+        _history.discardPending();
+        _callStack.discardPending();
+
         // LogWrite(FromTargetTracker, LOG_DEBUG, "INJECTING FINISHED 0x%04x 0x%02x %s%s",
         //             addr, ((flags & BR_CTRL_BUS_RD_MASK) & ((retVal & BR_MEM_ACCESS_RSLT_NOT_DECODED) == 0)) ? (retVal & 0xff) : data,  
         //             (flags & BR_CTRL_BUS_RD_MASK) ? "R" : "", (flags & BR_CTRL_BUS_WR_MASK) ? "W" : "");
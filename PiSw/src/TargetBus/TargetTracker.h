@@ -10,6 +10,9 @@
 #include "BusAccess.h"
 #include "TargetRegisters.h"
 #include "TargetBreakpoints.h"
+#include "TargetShadowRegs.h"
+#include "TargetHistory.h"
+#include "TargetCallStack.h"
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Defs
@@ -29,6 +32,11 @@ public:
     static void stepRun();
     static void stepOver();
 
+    // Step batches - counted in the wait handler and completed by pausing as for a single step
+    static void stepCount(uint32_t numInstrs);
+    static void stepRunInRange(uint32_t startAddr, uint32_t endAddr);
+    static void stepOut();
+
     // Regs
     static Z80Registers& getRegs()
     {
@@ -64,7 +72,10 @@ public:
         STEP_MODE_STEP_PAUSED,
         STEP_MODE_STEP_INTO,
         STEP_MODE_STEP_OVER,
-        STEP_MODE_RUN
+        STEP_MODE_RUN,
+        STEP_MODE_STEP_COUNT,
+        STEP_MODE_RUN_IN_RANGE,
+        STEP_MODE_STEP_OUT
     };
 
     // Step modes
@@ -83,9 +94,9 @@ public:
     {
         _breakpoints.enableBreakpoints(en);
     }
-    static void enableBreakpoint(int idx, bool enabled)
+    static bool enableBreakpoint(int idx, bool enabled)
     {
-        _breakpoints.enableBreakpoint(idx, enabled);
+        return _breakpoints.enableBreakpoint(idx, enabled);
     }
     static void setBreakpointMessage(int idx, const char* hitMessage)
     {
@@ -95,6 +106,14 @@ public:
     {
         _breakpoints.setBreakpointPCAddr(idx, pcVal);
     }
+    static bool setBreakpointCondition(int idx, const char* pCondition)
+    {
+        return _breakpoints.setBreakpointCondition(idx, pCondition);
+    }
+    static void setBreakpointPassCount(int idx, uint32_t passCount)
+    {
+        _breakpoints.setBreakpointPassCount(idx, passCount);
+    }
     static void setFastBreakpoint(uint32_t addr, bool en)
     {
         _breakpoints.setFastBreakpoint(addr, en);
@@ -103,6 +122,82 @@ public:
     {
         _breakpoints.clearFastBreakpoints();
     }
+    static void setWatchpoint(uint32_t addr, uint32_t len, TargetWatchpointType watchType)
+    {
+        _breakpoints.setWatchpoint(addr, len, watchType);
+    }
+    static void clearWatchpoints()
+    {
+        _breakpoints.clearWatchpoints();
+    }
+    static void requestBreak()
+    {
+        _breakpoints.requestBreak();
+    }
+    static bool getWatchpointHit(TargetWatchpointHit& hit)
+    {
+        return _breakpoints.getWatchpointHit(hit);
+    }
+
+    // Tracepoints
+    static bool setTracepoint(uint32_t addr, TargetTracepointRecordType recordType)
+    {
+        return _breakpoints.setTracepoint(addr, recordType);
+    }
+    static void clearTracepoint(uint32_t addr)
+    {
+        _breakpoints.clearTracepoint(addr);
+    }
+    static void clearTracepoints()
+    {
+        _breakpoints.clearTracepoints();
+    }
+    static void getTracepointsJson(char* pBuf, int maxLen)
+    {
+        _breakpoints.getTracepointsJson(pBuf, maxLen);
+    }
+    static uint32_t getTracepointLog(TargetTracepointLogEntry* pEntries, uint32_t maxEntries)
+    {
+        return _breakpoints.getTracepointLog(pEntries, maxEntries);
+    }
+    static uint32_t getTracepointLogDropped()
+    {
+        return _breakpoints.getTracepointLogDropped();
+    }
+
+    // Instruction history - ring size in MB (0 to disable) - the ring is made smaller if the heap
+    // can't give the size requested and the size allocated is returned in allocatedMB
+    static bool historyEnable(uint32_t sizeMB, uint32_t& allocatedMB);
+    static void historyClear()
+    {
+        _history.clear();
+    }
+    static void getHistoryStatusJson(char* pBuf, int maxLen);
+    static uint32_t getHistoryRecords(uint32_t startIdx, uint32_t maxRecords, uint8_t* pBuf, uint32_t maxLen,
+                uint32_t& numRecords, uint32_t& predictedPC)
+    {
+        return _history.getRecords(startIdx, maxRecords, pBuf, maxLen, numRecords, predictedPC);
+    }
+    static uint32_t getHistoryRecordCount()
+    {
+        return _history.getRecordCount();
+    }
+    static const uint32_t HISTORY_DEFAULT_SIZE_MB = 16;
+    static const uint32_t HISTORY_MAX_SIZE_MB = 32;
+
+    // Shadow call stack - frame 0 is the innermost
+    static uint32_t getCallStackDepth()
+    {
+        return _callStack.getDepth();
+    }
+    static bool getCallStackFrame(uint32_t idx, TargetCallFrame& frame)
+    {
+        return _callStack.getFrame(idx, frame);
+    }
+    static void getCallStackJson(char* pBuf, int maxLen)
+    {
+        _callStack.getJson(pBuf, maxLen);
+    }
 
 private:
 
@@ -121,6 +216,18 @@ private:
     // Step over
     static uint32_t _stepOverPCValue;
 
+    // Step batches - instructions left to step, address range to run in and stack pointer when
+    // stepping out (a return pops from at or above it) - or the call stack depth to return below
+    // when the call stack is known
+    static uint32_t _stepBatchInstrsLeft;
+    static uint32_t _stepBatchRangeStart;
+    static uint32_t _stepBatchRangeEnd;
+    static uint32_t _stepOutSP;
+    static uint32_t _stepOutReturnCount;
+    static uint32_t _stepOutCallDepth;
+    static void startStepMode(STEP_MODE_TYPE stepMode);
+    static bool stepBatchComplete(uint32_t addr);
+
     // Code snippet
     static uint32_t _snippetLen;
     static uint32_t _snippetPos;
@@ -139,6 +246,11 @@ private:
     // Registers
     static Z80Registers _z80Registers;
 
+    // Registers in the processor after the last injection - valid until the processor runs and
+    // used to inject only the registers that change when setting
+    static Z80Registers _z80RegistersOnTarget;
+    static bool _z80RegistersOnTargetValid;
+
     // Register get/set
     enum OPCODE_INJECT_PROGRESS
     {
@@ -185,6 +297,27 @@ private:
     // Breakpoints
     static TargetBreakpoints _breakpoints;
 
+    // Memory values for breakpoint conditions
+    static bool breakpointCondRegsGet(Z80Registers& regs);
+    static bool breakpointCondMemRead(uint32_t addr, uint8_t& val);
+
+    // Shadow registers - when valid the target can be paused without injecting
+    static TargetShadowRegs _shadowRegs;
+    static bool pauseWithShadowRegs();
+
+    // Instruction history - old values of writes come from a copy of memory up to the Z180 address space
+    static TargetHistory _history;
+    static const uint32_t HISTORY_MAX_MEM_LEN = 0x100000;
+    static void historySyncMemory();
+
+    // The heap is shared (mirror memory, bus capture, profiler and coverage) so the history ring must
+    // leave this much free
+    static const uint32_t HISTORY_HEAP_RESERVE_MB = 8;
+    static bool historyHeapHasReserve();
+
+    // Shadow call stack
+    static TargetCallStack _callStack;
+
     // Machine heartbeat cycle counter
     static uint32_t _machineHeartbeatCounter;
 
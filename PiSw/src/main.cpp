@@ -16,6 +16,9 @@
 #include "BusController/BusController.h"
 #include "DeZogInterface/DeZogInterface.h"
 #include "StepTracer/StepTracer.h"
+#include "BusCapture/BusCapture.h"
+#include "IOWatch/IOWatch.h"
+#include "Profiler/Profiler.h"
 #include "BusRaiderApp.h"
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -106,6 +109,15 @@ extern "C" int main()
     // Init machine manager
     mcManager.init(&display);
 
+    // Bus capture - after other bus sockets so it sees the data they return
+    BusCapture::init();
+
+    // IO watchpoints - also after other bus sockets so it sees data read from IO ports
+    IOWatch::init();
+
+    // Profiler - after other bus sockets so it sees opcodes they return
+    Profiler::init();
+
     // USB and status
     busRaiderApp.initUSB();
 
@@ -147,5 +159,11 @@ extern "C" int main()
         busController.service();
         stepTracer.service();
         _DeZogInterface.service();
+
+        // Bus capture
+        BusCapture::service();
+
+        // IO watchpoints and log
+        IOWatch::service();
     }
 }
@@ -0,0 +1,477 @@
+// Bus Raider
+// Rob Dobson 2019
+// Regression tests of the bus capture compact encoding (BusCaptureCodec) and record store (BusCaptureStore)
+// - records are encoded and decoded again and must match
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "BusCapture/BusCaptureCodec.h"
+#include "BusCapture/BusCaptureStore.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Test support
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int _checkCount = 0;
+static int _failCount = 0;
+
+static void check(bool ok, const char* pTestName, const char* pCheckName)
+{
+    _checkCount++;
+    if (ok)
+        return;
+    _failCount++;
+    printf("FAIL %s: %s\n", pTestName, pCheckName);
+}
+
+// Flags as seen in a wait
+static const uint8_t FLAGS_M1 = BR_CTRL_BUS_M1_MASK | BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_RD_MASK | BR_CTRL_BUS_WAIT_MASK;
+static const uint8_t FLAGS_MEM_RD = BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_RD_MASK | BR_CTRL_BUS_WAIT_MASK;
+static const uint8_t FLAGS_MEM_WR = BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_WR_MASK | BR_CTRL_BUS_WAIT_MASK;
+static const uint8_t FLAGS_IO_RD = BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_RD_MASK | BR_CTRL_BUS_WAIT_MASK;
+static const uint8_t FLAGS_IO_WR = BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_WR_MASK | BR_CTRL_BUS_WAIT_MASK;
+
+// Bus cycles of a program - mostly polling an IO port (as a program waiting for a key does) with block
+// copies, stack use and occasional odd cycles in between
+class TraceGen
+{
+public:
+    TraceGen(uint32_t seed, int pollPercent)
+    {
+        _seed = seed;
+        _pollPercent = pollPercent;
+        _cycles = 0xfff00000;
+        _num = 0;
+        _pos = 0;
+    }
+
+    BusCaptureRecord next()
+    {
+        if (_pos >= _num)
+            fill();
+        return _recs[_pos++];
+    }
+
+private:
+    uint32_t _seed;
+    int _pollPercent;
+    uint32_t _cycles;
+    static const int MAX_RECS = 4096;
+    BusCaptureRecord _recs[MAX_RECS];
+    int _num;
+    int _pos;
+
+    uint32_t rnd()
+    {
+        _seed = _seed * 1103515245 + 12345;
+        return (_seed >> 16) & 0x7fff;
+    }
+
+    void put(uint16_t addr, uint8_t data, uint8_t flags, uint32_t delta)
+    {
+        _cycles += delta;
+        _recs[_num].cycles = _cycles;
+        _recs[_num].addr = addr;
+        _recs[_num].data = data;
+        _recs[_num].flags = flags;
+        _num++;
+    }
+
+    // A section of the program
+    void fill()
+    {
+        _num = 0;
+        _pos = 0;
+        if ((int)(rnd() % 100) < _pollPercent)
+        {
+            // in a,(10h) ; and 1 ; jr z,loop - at a steady rate
+            int numPolls = 2 + rnd() % 20;
+            for (int i = 0; i < numPolls; i++)
+            {
+                put(0x0100, 0xdb, FLAGS_M1, 800);
+                put(0x0101, 0x10, FLAGS_MEM_RD, 800);
+                put(0x0010, 0x00, FLAGS_IO_RD, 800);
+                put(0x0102, 0xe6, FLAGS_M1, 800);
+                put(0x0103, 0x01, FLAGS_MEM_RD, 800);
+                put(0x0104, 0x28, FLAGS_M1, 800);
+                put(0x0105, 0xfa, FLAGS_MEM_RD, 800);
+            }
+            return;
+        }
+        switch (rnd() % 4)
+        {
+            case 0:
+            {
+                // ldir
+                uint16_t src = rnd();
+                uint16_t dst = rnd();
+                int len = 16 + rnd() % 64;
+                for (int i = 0; i < len; i++)
+                {
+                    uint8_t data = rnd();
+                    put(0x0200, 0xed, FLAGS_M1, 800 + rnd() % 300);
+                    put(0x0201, 0xb0, FLAGS_M1, 800);
+                    put(src + i, data, FLAGS_MEM_RD, 800);
+                    put(dst + i, data, FLAGS_MEM_WR, 900);
+                }
+                break;
+            }
+            case 1:
+            {
+                // call, push and out then ret
+                uint16_t sp = 0xf000 - (rnd() % 16) * 2;
+                put(0x0300, 0xcd, FLAGS_M1, 800);
+                put(0x0301, 0x00, FLAGS_MEM_RD, 800);
+                put(0x0302, 0x04, FLAGS_MEM_RD, 800);
+                put(sp - 1, 0x03, FLAGS_MEM_WR, 1000);
+                put(sp - 2, 0x03, FLAGS_MEM_WR, 800);
+                put(0x0400, 0xd3, FLAGS_M1, 800);
+                put(0x0401, 0x20, FLAGS_MEM_RD, 800);
+                put(0x0020 | (rnd() % 4), rnd(), FLAGS_IO_WR, 800);
+                put(0x0402, 0xc9, FLAGS_M1, 800);
+                put(sp - 2, 0x03, FLAGS_MEM_RD, 800);
+                put(sp - 1, 0x03, FLAGS_MEM_RD, 800);
+                break;
+            }
+            case 2:
+            {
+                // Straight line code
+                uint16_t pc = 0x1000 + rnd() % 0x1000;
+                int len = 10 + rnd() % 50;
+                for (int i = 0; i < len; i++)
+                    put(pc + i, rnd(), (rnd() % 3) ? FLAGS_M1 : FLAGS_MEM_RD, 700 + rnd() % 600);
+                break;
+            }
+            default:
+            {
+                // Odd cycles (raw flags) and a long gap
+                put(rnd(), rnd(), rnd(), 100000 + rnd());
+                put(rnd(), rnd(), FLAGS_MEM_RD | BR_CTRL_BUS_IRQ_MASK, 800);
+                break;
+            }
+        }
+    }
+};
+
+static bool recordsMatch(const BusCaptureRecord& rec, const BusCaptureRecord& expRec, uint8_t tsShift)
+{
+    if (!rec.sameCycle(expRec))
+        return false;
+    if (tsShift == BUS_CAPTURE_CODEC_NO_TIMESTAMPS)
+        return rec.cycles == 0;
+
+    // Timestamps are truncated to the shift and those of repeated records are interpolated
+    int64_t diff = (int32_t)(rec.cycles - expRec.cycles);
+    int64_t maxDiff = ((int64_t)2 << tsShift) + 400;
+    return (diff <= maxDiff) && (diff >= -maxDiff);
+}
+
+// Decoded records
+static std::vector<BusCaptureRecord> _decoded;
+static std::vector<uint32_t> _decodedIdx;
+
+static void decodedRecordCB(uint32_t idx, const BusCaptureRecord& rec, [[maybe_unused]] void* pArg)
+{
+    _decoded.push_back(rec);
+    _decodedIdx.push_back(idx);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Codec tests
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Encode a trace into one stream and decode it again - for each timestamp shift
+static void testRoundTrip()
+{
+    static const char* pTest = "roundTrip";
+    static const uint32_t NUM_RECORDS = 50000;
+    static const uint32_t BUF_LEN = NUM_RECORDS * 12;
+    static const uint8_t tsShifts[] = { 0, 8, 31, BUS_CAPTURE_CODEC_NO_TIMESTAMPS };
+    std::vector<uint8_t> buf(BUF_LEN);
+    for (uint8_t tsShift : tsShifts)
+    {
+        TraceGen traceGen(1, 50);
+        std::vector<BusCaptureRecord> trace;
+        for (uint32_t i = 0; i < NUM_RECORDS; i++)
+            trace.push_back(traceGen.next());
+        BusCaptureEncoder encoder;
+        uint32_t startCycles = trace[0].cycles - 800;
+        encoder.start(buf.data(), BUF_LEN, 1234, startCycles, tsShift);
+        bool allAdded = true;
+        for (const BusCaptureRecord& rec : trace)
+            allAdded = allAdded && encoder.add(rec);
+        check(allAdded, pTest, "all added");
+        uint32_t streamLen = encoder.finish();
+
+        // Decode
+        _decoded.clear();
+        _decodedIdx.clear();
+        uint32_t decodedLen = BusCaptureDecoder::decode(buf.data(), BUF_LEN, decodedRecordCB, NULL);
+        check(decodedLen == streamLen, pTest, "stream length");
+        check(_decoded.size() == NUM_RECORDS, pTest, "record count");
+        bool idxOk = true;
+        bool recsOk = true;
+        for (uint32_t i = 0; (i < _decoded.size()) && (i < NUM_RECORDS); i++)
+        {
+            idxOk = idxOk && (_decodedIdx[i] == 1234 + i);
+            recsOk = recsOk && recordsMatch(_decoded[i], trace[i], tsShift);
+        }
+        check(idxOk, pTest, "indices");
+        check(recsOk, pTest, "records");
+        printf("Round trip tsShift %d: %u records %u bytes %.2f bytes/record\n", tsShift, NUM_RECORDS, streamLen,
+                    (double)streamLen / NUM_RECORDS);
+    }
+}
+
+// Encode into buffers too small for all the records - those which fit must decode
+static void testBufferFull()
+{
+    static const char* pTest = "bufferFull";
+    TraceGen traceGen(2, 30);
+    std::vector<BusCaptureRecord> trace;
+    for (uint32_t i = 0; i < 2000; i++)
+        trace.push_back(traceGen.next());
+    bool allOk = true;
+    for (uint32_t maxLen = BUS_CAPTURE_CODEC_HEADER_LEN; maxLen < 600; maxLen += 7)
+    {
+        std::vector<uint8_t> buf(maxLen);
+        BusCaptureEncoder encoder;
+        encoder.start(buf.data(), maxLen, 0, 0, 8);
+        uint32_t numAdded = 0;
+        while ((numAdded < trace.size()) && encoder.add(trace[numAdded]))
+            numAdded++;
+        bool stillFull = !encoder.add(trace[numAdded]);
+        uint32_t streamLen = encoder.finish();
+        _decoded.clear();
+        _decodedIdx.clear();
+        uint32_t decodedLen = BusCaptureDecoder::decode(buf.data(), maxLen, decodedRecordCB, NULL);
+        bool ok = stillFull && (streamLen <= maxLen) && (decodedLen == streamLen) &&
+                    (encoder.getNumRecords() == numAdded) && (_decoded.size() == numAdded);
+        for (uint32_t i = 0; ok && (i < numAdded); i++)
+            ok = _decoded[i].sameCycle(trace[i]);
+        allOk = allOk && ok;
+    }
+    check(allOk, pTest, "records that fit decode");
+
+    // Too small for the header
+    uint8_t smallBuf[BUS_CAPTURE_CODEC_HEADER_LEN - 1];
+    BusCaptureEncoder encoder;
+    encoder.start(smallBuf, sizeof(smallBuf), 0, 0, 8);
+    check(!encoder.add(trace[0]) && (encoder.finish() == 0), pTest, "no space for header");
+}
+
+// Consecutive streams (as sent in successive frames) continue the indices and timestamps
+static void testStreams()
+{
+    static const char* pTest = "streams";
+    static const uint32_t STREAM_LEN = 500;
+    TraceGen traceGen(3, 50);
+    std::vector<BusCaptureRecord> trace;
+    for (uint32_t i = 0; i < 20000; i++)
+        trace.push_back(traceGen.next());
+    std::vector<uint8_t> data;
+    uint32_t numStreams = 0;
+    uint32_t idx = 0;
+    while (idx < trace.size())
+    {
+        uint8_t buf[STREAM_LEN];
+        BusCaptureEncoder encoder;
+        encoder.start(buf, STREAM_LEN, idx, (idx > 0) ? trace[idx - 1].cycles : 0, 0);
+        while ((idx < trace.size()) && encoder.add(trace[idx]))
+            idx++;
+        uint32_t streamLen = encoder.finish();
+        data.insert(data.end(), buf, buf + streamLen);
+        numStreams++;
+    }
+
+    // Decode all
+    _decoded.clear();
+    _decodedIdx.clear();
+    uint32_t pos = 0;
+    bool streamsOk = true;
+    while (streamsOk && (pos < data.size()))
+    {
+        uint32_t streamLen = BusCaptureDecoder::decode(data.data() + pos, data.size() - pos, decodedRecordCB, NULL);
+        streamsOk = streamLen != 0;
+        pos += streamLen;
+    }
+    check(streamsOk && (numStreams > 1), pTest, "streams decode");
+    bool recsOk = _decoded.size() == trace.size();
+    for (uint32_t i = 0; recsOk && (i < trace.size()); i++)
+        recsOk = (_decodedIdx[i] == i) && recordsMatch(_decoded[i], trace[i], 0);
+    check(recsOk, pTest, "records");
+}
+
+// Damaged streams are rejected
+static void testBadStreams()
+{
+    static const char* pTest = "badStreams";
+    TraceGen traceGen(4, 50);
+    uint8_t buf[2000];
+    BusCaptureEncoder encoder;
+    encoder.start(buf, sizeof(buf), 0, 0, 8);
+    while (encoder.add(traceGen.next()))
+        ;
+    uint32_t streamLen = encoder.finish();
+    _decoded.clear();
+    check(BusCaptureDecoder::decode(buf, streamLen, decodedRecordCB, NULL) == streamLen, pTest, "whole stream");
+    bool truncatedOk = true;
+    for (uint32_t len = 0; len < streamLen; len++)
+        truncatedOk = truncatedOk && (BusCaptureDecoder::decode(buf, len, decodedRecordCB, NULL) == 0);
+    check(truncatedOk, pTest, "truncated");
+    buf[0] = 'X';
+    check(BusCaptureDecoder::decode(buf, streamLen, decodedRecordCB, NULL) == 0, pTest, "bad magic");
+    buf[0] = 'B';
+    buf[2] = BUS_CAPTURE_CODEC_VERSION + 1;
+    check(BusCaptureDecoder::decode(buf, streamLen, decodedRecordCB, NULL) == 0, pTest, "bad version");
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Store tests
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Read the store from idx in chunks and compare with the trace (which starts at index 0)
+static bool storeMatches(BusCaptureStore& store, const std::vector<BusCaptureRecord>& trace, uint32_t idx,
+            uint32_t endIdx, uint8_t tsShift)
+{
+    static const uint32_t CHUNK_LEN = 333;
+    BusCaptureRecord recs[CHUNK_LEN];
+    while (idx < endIdx)
+    {
+        uint32_t numRead = store.getRecords(idx, recs, CHUNK_LEN);
+        uint32_t expRead = (endIdx - idx < CHUNK_LEN) ? endIdx - idx : CHUNK_LEN;
+        if (numRead != expRead)
+            return false;
+        for (uint32_t i = 0; i < numRead; i++)
+            if (!recordsMatch(recs[i], trace[idx + i], tsShift))
+                return false;
+        idx += numRead;
+    }
+    return true;
+}
+
+// Records wrap round the blocks dropping the oldest
+static void testStoreWrap()
+{
+    static const char* pTest = "storeWrap";
+    static const uint32_t NUM_BLOCKS = 4;
+    std::vector<uint8_t> buf(NUM_BLOCKS * BusCaptureStore::BLOCK_LEN + 100);
+    BusCaptureStore store;
+    store.init(buf.data(), buf.size());
+    check(store.getNumBlocks() == NUM_BLOCKS, pTest, "blocks");
+    TraceGen traceGen(5, 10);
+    std::vector<BusCaptureRecord> trace;
+    store.start(8, 0xfff00000);
+    bool allAdded = true;
+    for (uint32_t i = 0; i < 40000; i++)
+    {
+        trace.push_back(traceGen.next());
+        allAdded = allAdded && store.add(trace.back());
+    }
+    check(allAdded, pTest, "all added");
+    check(store.getNumAdded() == trace.size(), pTest, "num added");
+
+    // The block being written isn't readable until finished
+    check(store.getEndIdx() < trace.size(), pTest, "end before finish");
+    BusCaptureRecord rec;
+    check(store.getRecords(store.getEndIdx(), &rec, 1) == 0, pTest, "unfinished not read");
+    store.finish();
+    check(store.getEndIdx() == trace.size(), pTest, "end after finish");
+    check(store.getFirstIdx() > 0, pTest, "oldest dropped");
+    check(store.getFirstIdxOfNewest(NUM_BLOCKS) == store.getFirstIdx(), pTest, "newest all");
+    check(store.getFirstIdxOfNewest(1) > store.getFirstIdxOfNewest(2), pTest, "newest order");
+    check(store.getRecords(store.getFirstIdx() - 1, &rec, 1) == 0, pTest, "dropped not read");
+    check(storeMatches(store, trace, store.getFirstIdx(), store.getEndIdx(), 8), pTest, "records");
+    check(store.getUsedLen() <= store.getBufLen(), pTest, "used len");
+
+    // Adding after finish starts a new block
+    rec = traceGen.next();
+    trace.push_back(rec);
+    check(store.add(rec), pTest, "add after finish");
+    store.finish();
+    check(storeMatches(store, trace, store.getFirstIdx(), store.getEndIdx(), 8), pTest, "records after finish");
+}
+
+// Records from the keep index aren't dropped so the store fills
+static void testStoreKeep()
+{
+    static const char* pTest = "storeKeep";
+    static const uint32_t NUM_BLOCKS = 4;
+    std::vector<uint8_t> buf(NUM_BLOCKS * BusCaptureStore::BLOCK_LEN);
+    BusCaptureStore store;
+    store.init(buf.data(), buf.size());
+    TraceGen traceGen(6, 10);
+    std::vector<BusCaptureRecord> trace;
+    store.start(BUS_CAPTURE_CODEC_NO_TIMESTAMPS, 0);
+    for (uint32_t i = 0; i < 20000; i++)
+    {
+        trace.push_back(traceGen.next());
+        store.add(trace.back());
+    }
+    uint32_t keepFromIdx = store.getFirstIdxOfNewest(2) + 10;
+    store.setKeepFrom(keepFromIdx);
+    uint32_t numAdded = store.getNumAdded();
+    while (numAdded < 1000000)
+    {
+        trace.push_back(traceGen.next());
+        if (!store.add(trace.back()))
+            break;
+        numAdded++;
+    }
+    check(store.getNumAdded() == numAdded, pTest, "failed add not counted");
+    check(!store.add(trace.back()), pTest, "still full");
+    check(store.getFirstIdx() <= keepFromIdx, pTest, "kept");
+    check(store.getEndIdx() == numAdded, pTest, "all readable when full");
+    check(storeMatches(store, trace, keepFromIdx, store.getEndIdx(), BUS_CAPTURE_CODEC_NO_TIMESTAMPS), pTest, "records");
+
+    // No buffer
+    BusCaptureStore emptyStore;
+    emptyStore.start(8, 0);
+    check(!emptyStore.add(trace[0]) && (emptyStore.getEndIdx() == 0), pTest, "no buffer");
+}
+
+// Capture depth in the default capture buffer size compared to raw 8 byte records
+static void testStoreDepth()
+{
+    static const char* pTest = "storeDepth";
+    static const uint32_t BUF_LEN = 256 * BusCaptureStore::BLOCK_LEN;
+    static const uint32_t RAW_RECORD_LEN = 8;
+    static const int pollPercents[] = { 90, 50 };
+    static const uint32_t minDepthRatios[] = { 5, 2 };
+    std::vector<uint8_t> buf(BUF_LEN);
+    for (int i = 0; i < 2; i++)
+    {
+        BusCaptureStore store;
+        store.init(buf.data(), BUF_LEN);
+        store.start(8, 0);
+        store.setKeepFrom(0);
+        TraceGen traceGen(7, pollPercents[i]);
+        while (store.add(traceGen.next()))
+            ;
+        double depthRatio = (double)store.getNumAdded() / (BUF_LEN / RAW_RECORD_LEN);
+        printf("Depth %d%% polling: %u records in %u bytes - %.1f times raw\n", pollPercents[i],
+                    store.getNumAdded(), BUF_LEN, depthRatio);
+        check(depthRatio >= minDepthRatios[i], pTest, "depth");
+        check((store.getFirstIdx() == 0) && (store.getEndIdx() == store.getNumAdded()), pTest, "all kept");
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Main
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main()
+{
+    testRoundTrip();
+    testBufferFull();
+    testStreams();
+    testBadStreams();
+    testStoreWrap();
+    testStoreKeep();
+    testStoreDepth();
+
+    printf("%d checks, %d failed\n", _checkCount, _failCount);
+    return (_failCount == 0) ? 0 : 1;
+}
@@ -0,0 +1,236 @@
+// Bus Raider
+// Rob Dobson 2019
+// Regression tests of breakpoint conditions (TargetBreakpointCond)
+
+#include <stdio.h>
+#include <string.h>
+#include "TargetBus/TargetBreakpointCond.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Test support
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Logging isn't built for the host
+extern "C" void LogWrite([[maybe_unused]] const char* pSource, [[maybe_unused]] unsigned severity,
+            [[maybe_unused]] const char* pMessage, ...)
+{
+}
+
+static int _checkCount = 0;
+static int _failCount = 0;
+
+static void check(bool ok, const char* pTestName, const char* pCheckName)
+{
+    _checkCount++;
+    if (ok)
+        return;
+    _failCount++;
+    printf("FAIL %s: %s\n", pTestName, pCheckName);
+}
+
+// Target memory - reads above 64K fail as they would for memory that can't be got
+static const uint32_t MEM_LEN = 0x10000;
+static uint8_t _mem[MEM_LEN];
+
+static bool memRead(uint32_t addr, uint8_t& val)
+{
+    if (addr >= MEM_LEN)
+        return false;
+    val = _mem[addr];
+    return true;
+}
+
+static Z80Registers _regs;
+
+// Compile and evaluate with valid registers - returns -1 if the expression doesn't compile
+static int evalExpr(const char* pExpr)
+{
+    TargetBreakpointCond cond;
+    if (!cond.compile(pExpr))
+        return -1;
+    return cond.evaluate(_regs, true, memRead);
+}
+
+static void checkExpr(const char* pTest, const char* pExpr, int expResult)
+{
+    int result = evalExpr(pExpr);
+    if (result == expResult)
+    {
+        _checkCount++;
+        return;
+    }
+    char checkName[200];
+    snprintf(checkName, sizeof(checkName), "%s gave %d expected %d", pExpr, result, expResult);
+    check(false, pTest, checkName);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Tests
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Numbers in each format and registers
+static void testOperands()
+{
+    static const char* pTest = "operands";
+    checkExpr(pTest, "", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "A==0x3F", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "a==$3f", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "A==3fh", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "A==63", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "F==0x44 && AF==0x3f44", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "B==0x12 && C==0x34 && BC==0x1234", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "HL==8000h && H==80h && L==0", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "IX==0x9000 && IY==0xa000 && SP==0xf000", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "PC==256", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "AF'==0x1111 && BC'==0x2222", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "DE'==0x3333 && HL'==0x4444", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "I==0x12 && R==0x34", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "(HL)==0x81", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "(IX+5)==7", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "((HL)+0xff7e)==0x55", BREAKPOINT_COND_TRUE);
+}
+
+// Constants use all 32 bits and larger numbers are an error
+static void testLargeConstants()
+{
+    static const char* pTest = "largeConstants";
+    checkExpr(pTest, "0x12345678==0x12345678", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "0x1000000==0", BREAKPOINT_COND_FALSE);
+    checkExpr(pTest, "0x12345678-0x12000000==0x345678", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "0xffffffff==0-1", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "4294967295==$ffffffff", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "0ffffffffh==4294967295", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "0x100000000==0", -1);
+    checkExpr(pTest, "$100000000==0", -1);
+    checkExpr(pTest, "100000000h==0", -1);
+    checkExpr(pTest, "4294967296==0", -1);
+}
+
+// Operator precedence (lowest first) || && comparisons bitwise + - ! and left to right within a level
+static void testPrecedence()
+{
+    static const char* pTest = "precedence";
+    checkExpr(pTest, "1 || 0 && 0", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "0 && 0 || 1", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "(1 || 0) && 0", BREAKPOINT_COND_FALSE);
+    checkExpr(pTest, "1 or 0 and 0", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "BC & 0xff == 0x34", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "1 | 2 == 3", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "6 ^ 3 == 5", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "2 + 2 & 1 == 0", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "1 + 2 == 3", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "5 - 2 - 1 == 2", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "!0 == 1", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "!(A == 0x3f)", BREAKPOINT_COND_FALSE);
+    checkExpr(pTest, "!!A", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "A != 0x3f || A <> 0x40", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "A < 0x40 && A > 0x3e && A <= 0x3f && A >= 0x3f", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "A = 0x3f", BREAKPOINT_COND_TRUE);
+    checkExpr(pTest, "0 - 1 < 0", BREAKPOINT_COND_TRUE);
+}
+
+// Brackets and ! are limited to the evaluation stack depth
+static void testNesting()
+{
+    static const char* pTest = "nesting";
+    static const int MAX_NESTING = 16;
+    char expr[200];
+    for (int depth = MAX_NESTING; depth <= MAX_NESTING + 1; depth++)
+    {
+        // Brackets around a comparison
+        int pos = 0;
+        for (int i = 0; i < depth; i++)
+            expr[pos++] = '(';
+        strcpy(expr + pos, "A==0x3f");
+        pos += strlen("A==0x3f");
+        for (int i = 0; i < depth; i++)
+            expr[pos++] = ')';
+        expr[pos] = 0;
+        checkExpr(pTest, expr, (depth <= MAX_NESTING) ? BREAKPOINT_COND_TRUE : -1);
+
+        // Nots
+        memset(expr, '!', depth);
+        strcpy(expr + depth, "0");
+        checkExpr(pTest, expr, (depth > MAX_NESTING) ? -1 : (depth % 2) ? BREAKPOINT_COND_TRUE : BREAKPOINT_COND_FALSE);
+    }
+
+    // Nested memory reads - (((HL))) reads 0x8000 then 0x81 then 0x81 again
+    checkExpr(pTest, "(((HL)))==0x81", BREAKPOINT_COND_TRUE);
+}
+
+// Syntax errors and expressions too long for the code buffer
+static void testBadInput()
+{
+    static const char* pTest = "badInput";
+    static const char* badExprs[] = {
+        "A==", "==1", "((HL)", "(HL))", "A==1)", "A==0x3F && && B", "Q==1", "AX==1", "0x", "$", "12g",
+        "1 2", "A===1", "A==1 ||", "()", "!", "0x3fh",
+        "A==1 || A==2 || A==3 || A==4 || A==5 || A==6 || A==7 || A==8 || A==9"
+    };
+    for (const char* pExpr : badExprs)
+        checkExpr(pTest, pExpr, -1);
+
+    // A failed compile leaves the condition empty
+    TargetBreakpointCond cond;
+    check(cond.compile("A==1"), pTest, "compile");
+    check(!cond.compile("A=="), pTest, "bad compile");
+    check(cond.isEmpty(), pTest, "empty after bad compile");
+    check(cond.compile(NULL) && cond.isEmpty(), pTest, "NULL is empty");
+    check(cond.compile(" \t\r\n") && cond.isEmpty(), pTest, "blank is empty");
+}
+
+// Results that can't be known - registers not valid or memory that can't be read
+static void testUnknown()
+{
+    static const char* pTest = "unknown";
+    TargetBreakpointCond cond;
+    check(cond.compile("A==0x3f") && cond.usesRegisters(), pTest, "uses registers");
+    check(cond.evaluate(_regs, false, memRead) == BREAKPOINT_COND_UNKNOWN, pTest, "registers not valid");
+    check(cond.compile("PC==256") && !cond.usesRegisters(), pTest, "PC only");
+    check(cond.evaluate(_regs, false, memRead) == BREAKPOINT_COND_TRUE, pTest, "PC with registers not valid");
+    check(cond.compile("(0x10000)==0"), pTest, "compile read");
+    check(cond.evaluate(_regs, true, memRead) == BREAKPOINT_COND_UNKNOWN, pTest, "memory read fails");
+    check(cond.compile("(0x8000)==0x81"), pTest, "compile read ok");
+    check(cond.evaluate(_regs, false, memRead) == BREAKPOINT_COND_TRUE, pTest, "memory read");
+    check(cond.evaluate(_regs, false, NULL) == BREAKPOINT_COND_UNKNOWN, pTest, "no memory read");
+
+    // An unknown result isn't short-circuited
+    check(cond.compile("1 || (0x10000)"), pTest, "compile or");
+    check(cond.evaluate(_regs, true, memRead) == BREAKPOINT_COND_UNKNOWN, pTest, "or with failed read");
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Main
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main()
+{
+    _regs.AF = 0x3f44;
+    _regs.BC = 0x1234;
+    _regs.DE = 0x5678;
+    _regs.HL = 0x8000;
+    _regs.IX = 0x9000;
+    _regs.IY = 0xa000;
+    _regs.SP = 0xf000;
+    _regs.PC = 0x100;
+    _regs.AFDASH = 0x1111;
+    _regs.BCDASH = 0x2222;
+    _regs.DEDASH = 0x3333;
+    _regs.HLDASH = 0x4444;
+    _regs.I = 0x12;
+    _regs.R = 0x34;
+    _mem[0x8000] = 0x81;
+    _mem[0x0081] = 0x81;
+    _mem[0x9005] = 7;
+    _mem[0xffff] = 0x55;
+
+    testOperands();
+    testLargeConstants();
+    testPrecedence();
+    testNesting();
+    testBadInput();
+    testUnknown();
+
+    printf("%d checks, %d failed\n", _checkCount, _failCount);
+    return (_failCount == 0) ? 0 : 1;
+}
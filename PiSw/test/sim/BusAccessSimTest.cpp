@@ -0,0 +1,256 @@
+// Bus Raider
+// Rob Dobson 2019
+// Regression tests and timing of BusAccess running on the simulated bus (BusAccessSim)
+
+#include <stdio.h>
+#include <string.h>
+#include "TargetBus/BusAccess.h"
+#include "TargetBus/BusAccessSim.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Test support
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Logging isn't built for the host
+extern "C" void LogWrite([[maybe_unused]] const char* pSource, [[maybe_unused]] unsigned severity,
+            [[maybe_unused]] const char* pMessage, ...)
+{
+}
+
+static int _checkCount = 0;
+static int _failCount = 0;
+
+static void check(bool ok, const char* pTestName, const char* pCheckName)
+{
+    _checkCount++;
+    if (ok)
+        return;
+    _failCount++;
+    printf("FAIL %s: %s\n", pTestName, pCheckName);
+}
+
+// Cycles seen by the target
+static const int MAX_SEEN_CYCLES = 32;
+static uint32_t _seenBusData[MAX_SEEN_CYCLES];
+static bool _seenPiDriven[MAX_SEEN_CYCLES];
+static int _seenCount = 0;
+
+static void cycleCompleteCB([[maybe_unused]] const BusAccessSimCycle& cycle, uint32_t busData, bool piDriven)
+{
+    if (_seenCount < MAX_SEEN_CYCLES)
+    {
+        _seenBusData[_seenCount] = busData;
+        _seenPiDriven[_seenCount] = piDriven;
+    }
+    _seenCount++;
+}
+
+// Cycles seen by the socket callback
+static const uint32_t DECODED_IO_PORT = 0x13;
+static const uint32_t DECODED_IO_DATA = 0x5a;
+static uint32_t _accessAddr[MAX_SEEN_CYCLES];
+static uint32_t _accessData[MAX_SEEN_CYCLES];
+static uint32_t _accessFlags[MAX_SEEN_CYCLES];
+static int _accessCount = 0;
+
+static void busAccessCB(uint32_t addr, uint32_t data, uint32_t flags, uint32_t& retVal)
+{
+    if (_accessCount < MAX_SEEN_CYCLES)
+    {
+        _accessAddr[_accessCount] = addr;
+        _accessData[_accessCount] = data;
+        _accessFlags[_accessCount] = flags;
+    }
+    _accessCount++;
+
+    // Decode a single IO port
+    if ((flags & BR_CTRL_BUS_IORQ_MASK) && (flags & BR_CTRL_BUS_RD_MASK) && ((addr & 0xff) == DECODED_IO_PORT))
+        retVal = DECODED_IO_DATA;
+}
+
+static BusSocketInfo _testSocket =
+{
+    true,
+    busAccessCB,
+    NULL,
+    true,
+    true,
+    // Reset
+    false,
+    0,
+    // NMI
+    false,
+    0,
+    // IRQ
+    false,
+    0,
+    false,
+    BR_BUS_ACTION_GENERAL,
+    false,
+    // Bus cycles
+    BR_BUS_CYCLE_ALL_MASK
+};
+static int _testSocketId = -1;
+
+static void clearSeen()
+{
+    _seenCount = 0;
+    _accessCount = 0;
+}
+
+static void runScript(const BusAccessSimCycle* pCycles, int numCycles)
+{
+    clearSeen();
+    BusAccessSim::clearStats();
+    BusAccessSim::setScript(pCycles, numCycles, false);
+    BusAccessSim::runScript(100000);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Tests
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Each class of bus cycle is waited, passed to the socket and completed with the right data on the bus
+static void testBusCycles()
+{
+    static const char* pTest = "busCycles";
+    static const BusAccessSimCycle script[] = {
+        { BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_RD_MASK | BR_CTRL_BUS_M1_MASK, 0x0000, 0 },
+        { BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_WR_MASK, 0x4000, 0x12 },
+        { BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_RD_MASK, 0x1200 | DECODED_IO_PORT, 0 },
+        { BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_WR_MASK, 0xa5fe, 0x77 },
+    };
+    static const int numCycles = sizeof(script) / sizeof(script[0]);
+    BusAccessSim::getTargetMemory()[0] = 0x3e;
+    BusAccess::clearStatus();
+    runScript(script, numCycles);
+    BusAccessSimStats stats;
+    BusAccessSim::getStats(stats);
+    BusAccessStatusInfo statusInfo;
+    BusAccess::getStatus(statusInfo);
+
+    check(BusAccessSim::isScriptComplete(), pTest, "script complete");
+    check(stats.cyclesCompleted == numCycles, pTest, "all cycles completed");
+    check(stats.waitCount == numCycles, pTest, "every cycle waited");
+    check(_accessCount == numCycles, pTest, "socket called for every cycle");
+    for (int i = 0; (i < numCycles) && (i < _accessCount); i++)
+    {
+        check(_accessAddr[i] == script[i].addr, pTest, "socket address");
+        check((_accessFlags[i] & ~BR_CTRL_BUS_WAIT_MASK) == script[i].flags, pTest, "socket flags");
+    }
+    check(_accessData[1] == 0x12, pTest, "memory write data to socket");
+    check(_accessData[3] == 0x77, pTest, "IO write data to socket");
+
+    // Undecoded read comes from the target, decoded read is driven by the Pi
+    check((_seenBusData[0] == 0x3e) && !_seenPiDriven[0], pTest, "undecoded memory read");
+    check((_seenBusData[2] == DECODED_IO_DATA) && _seenPiDriven[2], pTest, "decoded IO read");
+    check(BusAccessSim::getTargetMemory()[0x4000] == 0x12, pTest, "memory write reached target");
+
+    // Every ISR is in the latency histogram for its class of cycle
+    uint32_t histCount = 0;
+    for (int i = 0; i < BR_BUS_CYCLE_NUM_CLASSES; i++)
+        for (int j = 0; j < BusAccessLatencyHist::NUM_BUCKETS; j++)
+            histCount += statusInfo.isrLatencyHist[i].buckets[j];
+    check(histCount == (uint32_t)numCycles, pTest, "ISR latency histogram");
+    printf("%s: %s\n", pTest, stats.getJson());
+}
+
+// IORQ cycles on ports no socket handles are released without calling the socket
+static void testIOPortFilter()
+{
+    static const char* pTest = "ioPortFilter";
+    static const BusAccessSimCycle script[] = {
+        { BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_RD_MASK, 0x1200 | DECODED_IO_PORT, 0 },
+        { BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_RD_MASK, 0x0014, 0 },
+        { BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_WR_MASK, 0x00fe, 0x55 },
+    };
+    static const int numCycles = sizeof(script) / sizeof(script[0]);
+    uint32_t portFilter[BR_BUS_FILTER_BITMAP_WORDS];
+    BusSocketInfo::filterClear(portFilter);
+    BusSocketInfo::filterSetRange(portFilter, DECODED_IO_PORT, DECODED_IO_PORT);
+    BusAccess::busSocketSetIOPortFilter(_testSocketId, portFilter);
+    BusAccess::clearStatus();
+    runScript(script, numCycles);
+    BusAccess::busSocketSetIOPortFilter(_testSocketId, NULL);
+    BusAccessSimStats stats;
+    BusAccessSim::getStats(stats);
+    BusAccessStatusInfo statusInfo;
+    BusAccess::getStatus(statusInfo);
+
+    check(stats.cyclesCompleted == numCycles, pTest, "all cycles completed");
+    check(_accessCount == 1, pTest, "socket only called for the filtered port");
+    check((_seenBusData[0] == DECODED_IO_DATA) && _seenPiDriven[0], pTest, "decoded IO read");
+    check(!_seenPiDriven[1], pTest, "unhandled port not driven");
+    check(BusAccessSim::getTargetIO()[0xfe] == 0x55, pTest, "IO write reached target");
+    check(statusInfo.isrIORQFastRelease == 2, pTest, "unhandled ports fast released");
+}
+
+// Block write and read through BUSRQ
+static void testBlockAccess()
+{
+    static const char* pTest = "blockAccess";
+    static const uint32_t BLOCK_ADDR = 0x12f0;
+    static const uint32_t BLOCK_LEN = 300;
+    uint8_t writeBuf[BLOCK_LEN];
+    uint8_t readBuf[BLOCK_LEN];
+    for (uint32_t i = 0; i < BLOCK_LEN; i++)
+        writeBuf[i] = i * 7;
+    memset(readBuf, 0, sizeof(readBuf));
+    BusAccessSim::clearStats();
+
+    uint64_t startNs = BusAccessSim::getTimeNs();
+    BR_RETURN_TYPE writeRslt = BusAccess::blockWrite(BLOCK_ADDR, writeBuf, BLOCK_LEN, true, false);
+    uint64_t writeNs = BusAccessSim::getTimeNs() - startNs;
+    startNs = BusAccessSim::getTimeNs();
+    BR_RETURN_TYPE readRslt = BusAccess::blockRead(BLOCK_ADDR, readBuf, BLOCK_LEN, true, false);
+    uint64_t readNs = BusAccessSim::getTimeNs() - startNs;
+
+    check(writeRslt == BR_OK, pTest, "write ok");
+    check(readRslt == BR_OK, pTest, "read ok");
+    check(memcmp(BusAccessSim::getTargetMemory() + BLOCK_ADDR, writeBuf, BLOCK_LEN) == 0, pTest, "target memory written");
+    check(memcmp(readBuf, writeBuf, BLOCK_LEN) == 0, pTest, "read back matches");
+    BusAccessSimStats stats;
+    BusAccessSim::getStats(stats);
+    check(stats.busAckCount == 2, pTest, "one bus grant per block");
+    printf("%s: write %u bytes %lluns read %lluns\n", pTest, BLOCK_LEN,
+                (unsigned long long)writeNs, (unsigned long long)readNs);
+}
+
+// Hardware version selection - each version's functions are used (the paging pin polarity differs) and
+// going back to the default version restores all of them (the simulated bus is V2.0 hardware)
+static void testHwVersionSelect()
+{
+    static const char* pTest = "hwVersionSelect";
+    static const int hwVersions[] = { 17, 20 };
+    for (int hwVersion : hwVersions)
+    {
+        BusAccess::setHwVersion(hwVersion);
+        BusAccess::busPagePinSetActive(true);
+        bool pinHigh = (BusAccessSim::rd32(ARM_GPIO_GPLEV0) & (1 << BR_PAGING_RAM_PIN)) != 0;
+        check(pinHigh == (hwVersion == 17), pTest, "paging pin active level");
+        BusAccess::busPagePinSetActive(false);
+        pinHigh = (BusAccessSim::rd32(ARM_GPIO_GPLEV0) & (1 << BR_PAGING_RAM_PIN)) != 0;
+        check(pinHigh == (hwVersion != 17), pTest, "paging pin inactive level");
+    }
+    testBusCycles();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Main
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main()
+{
+    BusAccessSim::reset();
+    BusAccess::init();
+    BusAccessSim::setCycleCallback(cycleCompleteCB);
+    _testSocketId = BusAccess::busSocketAdd(_testSocket, "Test");
+
+    testBusCycles();
+    testIOPortFilter();
+    testBlockAccess();
+    testHwVersionSelect();
+
+    printf("%d checks, %d failed\n", _checkCount, _failCount);
+    return (_failCount == 0) ? 0 : 1;
+}
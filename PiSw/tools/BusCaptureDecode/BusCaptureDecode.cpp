@@ -0,0 +1,66 @@
+// Bus Raider
+// Rob Dobson 2019
+// Host-side decoder for compact bus capture data - reads the binary payloads of captureGetBinData
+// frames (concatenated in a file) and prints the records as CSV
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "BusCaptureCodec.h"
+
+static void printRecord(uint32_t idx, const BusCaptureRecord& rec, void* pArg)
+{
+    bool showCycles = *(bool*)pArg;
+    if (showCycles)
+        printf("%u,%u,0x%04x,0x%02x,0x%02x\n", idx, rec.cycles, rec.addr, rec.data, rec.flags);
+    else
+        printf("%u,,0x%04x,0x%02x,0x%02x\n", idx, rec.addr, rec.data, rec.flags);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: BusCaptureDecode <capture.bin>\n");
+        return 1;
+    }
+
+    // Read file
+    FILE* pFile = fopen(argv[1], "rb");
+    if (!pFile)
+    {
+        fprintf(stderr, "Can't open %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t readLen = 0;
+    while ((readLen = fread(buf, 1, sizeof(buf), pFile)) > 0)
+        data.insert(data.end(), buf, buf + readLen);
+    fclose(pFile);
+
+    // Decode each stream
+    printf("idx,cycles,addr,data,flags\n");
+    uint32_t pos = 0;
+    uint32_t numStreams = 0;
+    uint32_t numRecords = 0;
+    while (pos < data.size())
+    {
+        uint32_t remaining = data.size() - pos;
+        bool showCycles = (remaining > 3) && (data[pos + 3] != BUS_CAPTURE_CODEC_NO_TIMESTAMPS);
+        uint32_t streamLen = BusCaptureDecoder::decode(data.data() + pos, remaining, printRecord, &showCycles);
+        if (streamLen == 0)
+        {
+            fprintf(stderr, "Invalid stream at offset %u\n", pos);
+            return 1;
+        }
+        numRecords += BusCaptureDecoder::getU32(data.data() + pos + 8);
+        numStreams++;
+        pos += streamLen;
+    }
+
+    // Summary
+    fprintf(stderr, "%u streams, %u records, %u bytes, %.2f bytes/record (raw 8.00)\n",
+                numStreams, numRecords, pos, numRecords ? (double)pos / numRecords : 0.0);
+    return 0;
+}
@@ -0,0 +1,476 @@
+// Bus Raider
+// Rob Dobson 2019
+// Host-side check of the Z80 bus cycle generator (StepTracer/Z80BusCycleGen) against libz80
+//
+// 1. Every instruction in libz80's opcode tables (codegen/opcodes_table.h - read through Z80Debug) is
+//    generated and the bytes fetched and the number of M1 cycles must match the instruction length
+// 2. Runs of DD / FD prefixes are generated one prefix at a time with only the last one used
+// 3. Random code is run on both cores from the same random registers and memory and the registers after
+//    each instruction and the set of bus cycles (and their order) must match
+//
+// Known libz80 differences which aren't counted as errors
+// - LD (IX+d),n and LD (IY+d),n have one operand in the tables so Z80Debug gives them a byte too few
+// - the opcode of DD CB / FD CB instructions is read before the displacement (the Z80 reads it after)
+// - EX (SP),HL writes the low byte first (the Z80 writes the high byte first)
+// - IN F,(C) (ED 70) loads F with the value read (the Z80 sets S, Z and P from it and leaves C)
+// - the H flag and undocumented flags (bits 3 and 5) aren't compared
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "StepTracer/Z80BusCycleGen.h"
+#include "StepTracer/libz80/z80.h"
+#include "TargetBus/TargetCPU.h"
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Memory and IO
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Logging isn't built for the host
+extern "C" void LogWrite([[maybe_unused]] const char* pSource, [[maybe_unused]] unsigned severity,
+            [[maybe_unused]] const char* pMessage, ...)
+{
+}
+
+static const uint32_t MEM_LEN = 0x10000;
+static const uint32_t MEM_READ_FLAGS = BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_RD_MASK;
+static const uint32_t MEM_WRITE_FLAGS = BR_CTRL_BUS_MREQ_MASK | BR_CTRL_BUS_WR_MASK;
+static const uint32_t IO_READ_FLAGS = BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_RD_MASK;
+static const uint32_t IO_WRITE_FLAGS = BR_CTRL_BUS_IORQ_MASK | BR_CTRL_BUS_WR_MASK;
+
+// Memory for the generator and for libz80
+static uint8_t _genMem[MEM_LEN];
+static uint8_t _refMem[MEM_LEN];
+
+// IO reads return a value made from the port
+static uint8_t ioValue(uint32_t port)
+{
+    return ((port & 0xff) * 37 + ((port >> 8) & 0xff) * 11) & 0xff;
+}
+
+// Generator access
+static uint8_t genMemRead(uint32_t addr)
+{
+    return _genMem[addr % MEM_LEN];
+}
+
+static void genMemWrite(uint32_t addr, uint8_t data)
+{
+    _genMem[addr % MEM_LEN] = data;
+}
+
+static uint8_t genIORead(uint32_t addr)
+{
+    return ioValue(addr);
+}
+
+static void genIOWrite([[maybe_unused]] uint32_t addr, [[maybe_unused]] uint8_t data)
+{
+}
+
+// libz80 access - the cycles are recorded
+static std::vector<Z80BusCycle> _refCycles;
+
+static byte refMemRead([[maybe_unused]] int param, ushort addr)
+{
+    _refCycles.push_back({ addr, _refMem[addr], MEM_READ_FLAGS });
+    return _refMem[addr];
+}
+
+static void refMemWrite([[maybe_unused]] int param, ushort addr, byte data)
+{
+    _refMem[addr] = data;
+    _refCycles.push_back({ addr, data, MEM_WRITE_FLAGS });
+}
+
+static byte refIORead([[maybe_unused]] int param, ushort addr)
+{
+    _refCycles.push_back({ addr, ioValue(addr), IO_READ_FLAGS });
+    return ioValue(addr);
+}
+
+static void refIOWrite([[maybe_unused]] int param, ushort addr, byte data)
+{
+    _refCycles.push_back({ addr, data, IO_WRITE_FLAGS });
+}
+
+static bool cycleLess(const Z80BusCycle& c1, const Z80BusCycle& c2)
+{
+    if (c1.addr != c2.addr)
+        return c1.addr < c2.addr;
+    if (c1.data != c2.data)
+        return c1.data < c2.data;
+    return c1.flags < c2.flags;
+}
+
+static bool cyclesEqual(const std::vector<Z80BusCycle>& c1, const std::vector<Z80BusCycle>& c2)
+{
+    if (c1.size() != c2.size())
+        return false;
+    for (uint32_t i = 0; i < c1.size(); i++)
+        if ((c1[i].addr != c2[i].addr) || (c1[i].data != c2[i].data) || (c1[i].flags != c2[i].flags))
+            return false;
+    return true;
+}
+
+static void printCycles(const char* pName, const std::vector<Z80BusCycle>& cycles)
+{
+    printf("   %-4s:", pName);
+    for (const Z80BusCycle& cycle : cycles)
+        printf(" %04x=%02x/%x", cycle.addr, cycle.data, cycle.flags);
+    printf("\n");
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// libz80 opcode tables
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Prefix groups - DD CB and FD CB instructions have a displacement before the opcode
+struct PrefixGroup
+{
+    const char* pName;
+    uint8_t prefix[2];
+    int prefixLen;
+    bool indexedCB;
+};
+static const PrefixGroup PREFIX_GROUPS[] = {
+    { "main", { 0, 0 }, 0, false },
+    { "DD", { 0xdd, 0 }, 1, false },
+    { "FD", { 0xfd, 0 }, 1, false },
+    { "ED", { 0xed, 0 }, 1, false },
+    { "CB", { 0xcb, 0 }, 1, false },
+    { "DDCB", { 0xdd, 0xcb }, 2, true },
+    { "FDCB", { 0xfd, 0xcb }, 2, true },
+};
+static const int NUM_PREFIX_GROUPS = sizeof(PREFIX_GROUPS) / sizeof(PREFIX_GROUPS[0]);
+static const uint8_t INDEXED_CB_DISPLACEMENT = 0x05;
+
+// Opcodes libz80 executes after a DD or FD prefix
+static bool _indexOpcodeDefined[256];
+
+static bool isPrefix(uint8_t opcode)
+{
+    return (opcode == 0xcb) || (opcode == 0xdd) || (opcode == 0xed) || (opcode == 0xfd);
+}
+
+// Instruction bytes for an opcode in a prefix group - returns the number of bytes
+static int instrBytes(const PrefixGroup& group, uint8_t opcode, uint8_t* pBytes)
+{
+    int len = 0;
+    for (int i = 0; i < group.prefixLen; i++)
+        pBytes[len++] = group.prefix[i];
+    if (group.indexedCB)
+        pBytes[len++] = INDEXED_CB_DISPLACEMENT;
+    pBytes[len++] = opcode;
+    return len;
+}
+
+// Instruction length from libz80's tables - returns 0 if the opcode isn't in the tables
+static const uint8_t* _pDebugBytes = NULL;
+static byte debugMemRead([[maybe_unused]] int param, ushort addr)
+{
+    return (addr < 4) ? _pDebugBytes[addr] : 0;
+}
+
+static int libz80InstrLen(const uint8_t* pBytes)
+{
+    Z80Context ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.memRead = debugMemRead;
+    _pDebugBytes = pBytes;
+    char dump[40];
+    char decode[40];
+    Z80Debug(&ctx, dump, decode);
+    if (strcmp(decode, "NOP (ignored)") == 0)
+        return 0;
+    return strlen(dump) / 2;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checks
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static Z80BusCycleGen _gen;
+
+// Generate each instruction in libz80's tables - the bytes fetched in sequence from the instruction address
+// must be the instruction length and each prefix and the opcode (other than for DD CB / FD CB) fetched with M1
+static int checkInstrLengths()
+{
+    static const uint32_t INSTR_ADDR = 0x1000;
+    static const uint32_t OPERAND_ADDR = 0x8000;
+    int numInstrs = 0;
+    int numErrors = 0;
+    for (int groupIdx = 0; groupIdx < NUM_PREFIX_GROUPS; groupIdx++)
+    {
+        const PrefixGroup& group = PREFIX_GROUPS[groupIdx];
+        for (int opcode = 0; opcode < 256; opcode++)
+        {
+            // Prefixes are handled by their own groups
+            if ((groupIdx <= 2) && isPrefix(opcode))
+                continue;
+            uint8_t bytes[4];
+            int numBytes = instrBytes(group, opcode, bytes);
+            int expLen = libz80InstrLen(bytes);
+            if (expLen == 0)
+                continue;
+            if ((groupIdx == 1 || groupIdx == 2) && (opcode == 0x36))
+                expLen++;
+            if ((group.prefixLen == 1) && (bytes[0] != 0xed) && (bytes[0] != 0xcb))
+                _indexOpcodeDefined[opcode] = true;
+            numInstrs++;
+
+            // Generate from memory filled with NOPs
+            memset(_genMem, 0, sizeof(_genMem));
+            memcpy(_genMem + INSTR_ADDR, bytes, numBytes);
+            Z80Registers regs;
+            regs.PC = INSTR_ADDR;
+            regs.HL = regs.IX = regs.IY = regs.SP = regs.BC = regs.DE = OPERAND_ADDR;
+            _gen.setRegs(regs);
+            int numCycles = _gen.genInstr();
+            uint32_t nextAddr = INSTR_ADDR;
+            int numFetched = 0;
+            int numM1 = 0;
+            for (int i = 0; i < numCycles; i++)
+            {
+                const Z80BusCycle& cycle = _gen.getCycle(i);
+                if (cycle.flags & BR_CTRL_BUS_M1_MASK)
+                    numM1++;
+                if (((cycle.flags & MEM_READ_FLAGS) == MEM_READ_FLAGS) && (cycle.addr == nextAddr))
+                {
+                    numFetched++;
+                    nextAddr++;
+                }
+            }
+            int expM1 = group.indexedCB ? 2 : group.prefixLen + 1;
+            if ((numFetched != expLen) || (numM1 != expM1) || (numCycles >= Z80BusCycleGen::MAX_CYCLES_PER_INSTR))
+            {
+                numErrors++;
+                printf("LEN %s %02x: length %d fetched %d M1 %d expected %d cycles %d\n",
+                            group.pName, opcode, expLen, numFetched, numM1, expM1, numCycles);
+            }
+        }
+    }
+    printf("Instruction lengths: %d instructions, %d errors\n", numInstrs, numErrors);
+    return numErrors;
+}
+
+// Run random code on the generator and libz80 - registers are resynced after each instruction so a
+// difference doesn't cascade
+static int checkAgainstLibz80(int numRuns, int instrsPerRun)
+{
+    static const uint8_t FLAGS_COMPARED = F_S | F_Z | F_PV | F_N | F_C;
+    static const int MAX_ERRORS_SHOWN = 20;
+    int numSteps = 0;
+    int regErrors = 0;
+    int cycleErrors = 0;
+    int orderErrors = 0;
+    srand(1234);
+    for (int run = 0; run < numRuns; run++)
+    {
+        // Random memory (without HALT as libz80 doesn't generate the halted fetches)
+        for (uint32_t i = 0; i < MEM_LEN; i++)
+        {
+            uint8_t val = rand();
+            _genMem[i] = _refMem[i] = (val == 0x76) ? 0 : val;
+        }
+
+        // Random registers
+        Z80Context ref;
+        memset(&ref, 0, sizeof(ref));
+        ref.memRead = refMemRead;
+        ref.memWrite = refMemWrite;
+        ref.ioRead = refIORead;
+        ref.ioWrite = refIOWrite;
+        ref.R1.wr.AF = rand();
+        ref.R1.wr.BC = rand();
+        ref.R1.wr.DE = rand();
+        ref.R1.wr.HL = rand();
+        ref.R1.wr.IX = rand();
+        ref.R1.wr.IY = rand();
+        ref.R1.wr.SP = rand();
+        ref.R2.wr.AF = rand();
+        ref.R2.wr.BC = rand();
+        ref.R2.wr.DE = rand();
+        ref.R2.wr.HL = rand();
+        ref.PC = rand();
+        ref.I = rand();
+        ref.R = rand() & 0x7f;
+
+        for (int step = 0; step < instrsPerRun; step++)
+        {
+            // Sync generator to libz80
+            Z80Registers regs;
+            regs.AF = ref.R1.wr.AF;
+            regs.BC = ref.R1.wr.BC;
+            regs.DE = ref.R1.wr.DE;
+            regs.HL = ref.R1.wr.HL;
+            regs.IX = ref.R1.wr.IX;
+            regs.IY = ref.R1.wr.IY;
+            regs.SP = ref.R1.wr.SP;
+            regs.AFDASH = ref.R2.wr.AF;
+            regs.BCDASH = ref.R2.wr.BC;
+            regs.DEDASH = ref.R2.wr.DE;
+            regs.HLDASH = ref.R2.wr.HL;
+            regs.PC = ref.PC;
+            regs.I = ref.I;
+            regs.R = ref.R;
+            regs.INTENABLED = ref.IFF1;
+            regs.INTMODE = ref.IM;
+            _gen.setRegs(regs);
+
+            // libz80 doesn't execute DD/FD opcodes it has no entry for (or chains of prefixes)
+            uint16_t pc = ref.PC;
+            uint8_t ops[4];
+            for (int i = 0; i < 4; i++)
+                ops[i] = _refMem[(pc + i) % MEM_LEN];
+            if (((ops[0] == 0xdd) || (ops[0] == 0xfd)) && (!_indexOpcodeDefined[ops[1]] || isPrefix(ops[1])))
+            {
+                if (ops[1] != 0xcb)
+                {
+                    _genMem[pc] = _refMem[pc] = ops[0] = 0;
+                }
+            }
+            bool indexed = (ops[0] == 0xdd) || (ops[0] == 0xfd);
+            bool orderDiffers = (indexed && (ops[1] == 0xcb)) || (ops[indexed ? 1 : 0] == 0xe3);
+            bool inFC = (ops[0] == 0xed) && (ops[1] == 0x70);
+
+            // Execute on both
+            numSteps++;
+            _refCycles.clear();
+            Z80Execute(&ref);
+            int numCycles = _gen.genInstr();
+            std::vector<Z80BusCycle> genCycles;
+            for (int i = 0; i < numCycles; i++)
+            {
+                Z80BusCycle cycle = _gen.getCycle(i);
+                cycle.flags &= ~BR_CTRL_BUS_M1_MASK;
+                genCycles.push_back(cycle);
+            }
+
+            // Compare registers
+            _gen.getRegs(regs);
+            uint8_t flagsCompared = inFC ? 0 : FLAGS_COMPARED;
+            bool regsOk = (regs.PC == ref.PC) && (regs.SP == ref.R1.wr.SP) && (regs.BC == ref.R1.wr.BC) &&
+                    (regs.DE == ref.R1.wr.DE) && (regs.HL == ref.R1.wr.HL) && (regs.IX == ref.R1.wr.IX) &&
+                    (regs.IY == ref.R1.wr.IY) && ((regs.AF >> 8) == ref.R1.br.A) &&
+                    ((regs.AF & flagsCompared) == (ref.R1.br.F & flagsCompared)) &&
+                    (regs.AFDASH == ref.R2.wr.AF) && (regs.BCDASH == ref.R2.wr.BC) &&
+                    (regs.DEDASH == ref.R2.wr.DE) && (regs.HLDASH == ref.R2.wr.HL) &&
+                    (regs.INTENABLED == ref.IFF1) && (regs.INTMODE == ref.IM) && (regs.I == ref.I);
+
+            // Compare cycles - as a set and in order
+            std::vector<Z80BusCycle> genSorted = genCycles;
+            std::vector<Z80BusCycle> refSorted = _refCycles;
+            std::sort(genSorted.begin(), genSorted.end(), cycleLess);
+            std::sort(refSorted.begin(), refSorted.end(), cycleLess);
+            bool cyclesOk = cyclesEqual(genSorted, refSorted);
+            bool orderOk = !cyclesOk || orderDiffers || cyclesEqual(genCycles, _refCycles);
+            if (!cyclesOk)
+                memcpy(_genMem, _refMem, sizeof(_genMem));
+            if (!regsOk)
+                regErrors++;
+            if (!cyclesOk)
+                cycleErrors++;
+            if (!orderOk)
+                orderErrors++;
+            if ((!regsOk || !cyclesOk || !orderOk) && (regErrors + cycleErrors + orderErrors <= MAX_ERRORS_SHOWN))
+            {
+                printf("%s%s%sPC %04x ops %02x %02x %02x %02x: AF %04x/%04x PC %04x/%04x HL %04x/%04x BC %04x/%04x SP %04x/%04x\n",
+                        regsOk ? "" : "REG ", cyclesOk ? "" : "CYCLES ", orderOk ? "" : "ORDER ",
+                        pc, ops[0], ops[1], ops[2], ops[3], regs.AF, ref.R1.wr.AF, regs.PC, ref.PC,
+                        regs.HL, ref.R1.wr.HL, regs.BC, ref.R1.wr.BC, regs.SP, ref.R1.wr.SP);
+                if (!cyclesOk || !orderOk)
+                {
+                    printCycles("gen", genCycles);
+                    printCycles("ref", _refCycles);
+                }
+            }
+        }
+    }
+    printf("Against libz80: %d instructions, %d register errors, %d cycle errors, %d order errors\n",
+                numSteps, regErrors, cycleErrors, orderErrors);
+    return regErrors + cycleErrors + orderErrors;
+}
+
+// A run of index prefixes - each prefix followed by another is a one cycle instruction and only the last
+// one applies to the instruction (memory filled with DD or FD must not run on)
+static int checkPrefixRuns()
+{
+    static const uint32_t INSTR_ADDR = 0x1000;
+    static const int RUN_LEN = 40;
+    int numErrors = 0;
+    for (int lastIdx = 0; lastIdx < 2; lastIdx++)
+    {
+        // DD FD DD FD ... then LD HL,nn with the last prefix
+        memset(_genMem, 0, sizeof(_genMem));
+        for (int i = 0; i < RUN_LEN; i++)
+            _genMem[INSTR_ADDR + i] = (i % 2 == lastIdx) ? 0xfd : 0xdd;
+        uint8_t lastPrefix = _genMem[INSTR_ADDR + RUN_LEN - 1];
+        _genMem[INSTR_ADDR + RUN_LEN] = 0x21;
+        _genMem[INSTR_ADDR + RUN_LEN + 1] = 0x34;
+        _genMem[INSTR_ADDR + RUN_LEN + 2] = 0x12;
+        Z80Registers regs;
+        regs.PC = INSTR_ADDR;
+        regs.HL = regs.IX = regs.IY = 0;
+        regs.R = 0;
+        _gen.setRegs(regs);
+        for (int i = 0; i < RUN_LEN - 1; i++)
+        {
+            int numCycles = _gen.genInstr();
+            const Z80BusCycle& cycle = _gen.getCycle(0);
+            if ((numCycles != 1) || (cycle.addr != INSTR_ADDR + i) || (cycle.flags != (MEM_READ_FLAGS | BR_CTRL_BUS_M1_MASK)))
+            {
+                numErrors++;
+                printf("PREFIX run %d: cycles %d addr %04x flags %x\n", i, numCycles, cycle.addr, cycle.flags);
+                break;
+            }
+        }
+        int numCycles = _gen.genInstr();
+        _gen.getRegs(regs);
+        uint16_t expIX = (lastPrefix == 0xdd) ? 0x1234 : 0;
+        uint16_t expIY = (lastPrefix == 0xfd) ? 0x1234 : 0;
+        if ((numCycles != 4) || _gen.cyclesOverflowed() || (regs.IX != expIX) || (regs.IY != expIY) || (regs.HL != 0) ||
+                    (regs.PC != INSTR_ADDR + RUN_LEN + 3) || (regs.R != RUN_LEN + 1))
+        {
+            numErrors++;
+            printf("PREFIX last %02x: cycles %d IX %04x IY %04x HL %04x PC %04x R %02x\n",
+                        lastPrefix, numCycles, regs.IX, regs.IY, regs.HL, regs.PC, regs.R);
+        }
+    }
+
+    // Memory filled with FD
+    memset(_genMem, 0xfd, sizeof(_genMem));
+    Z80Registers regs;
+    regs.PC = 0;
+    _gen.setRegs(regs);
+    for (int i = 0; i < 1000; i++)
+    {
+        if ((_gen.genInstr() != 1) || _gen.cyclesOverflowed())
+        {
+            numErrors++;
+            printf("PREFIX fill: instruction %d\n", i);
+            break;
+        }
+    }
+    printf("Prefix runs: %d errors\n", numErrors);
+    return numErrors;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Main
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[])
+{
+    int numRuns = (argc > 1) ? atoi(argv[1]) : 4000;
+    static const int INSTRS_PER_RUN = 50;
+    _gen.setAccessFns(genMemRead, genMemWrite, genIORead, genIOWrite);
+
+    // The length check also finds the DD/FD opcodes libz80 executes
+    int numErrors = checkInstrLengths();
+    numErrors += checkPrefixRuns();
+    numErrors += checkAgainstLibz80(numRuns, INSTRS_PER_RUN);
+    return (numErrors == 0) ? 0 : 1;
+}